@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "aggregates.h"
+#include <string.h>
+
+// Smallest absolute value that is not counted as 0 by QuantileSketch
+static const double min_sketch_value = 1e-9;
+
+RunningStats::RunningStats() {
+	clear();
+}
+
+/*! \fn void RunningStats::clear()
+ *
+ * Remove all the values.
+ */
+void RunningStats::clear() {
+	count_ = 0;
+	sum_ = compensation_ = 0.;
+	mean_ = m2_ = 0.;
+	min_ = max_ = 0.;
+}
+
+/*! \fn void RunningStats::merge(const RunningStats &other)
+ *
+ * Add the values of \p other to the statistics. The mean and variance are
+ * combined with the pairwise formula of Chan et al.
+ */
+void RunningStats::merge(const RunningStats &other) {
+	if (other.count_ == 0)
+		return;
+	if (count_ == 0) {
+		*this = other;
+		return;
+	}
+	double n1 = count_, n2 = other.count_, n = n1 + n2;
+	double delta = other.mean_ - mean_;
+	mean_ += delta * n2 / n;
+	m2_ += other.m2_ + delta * delta * n1 * n2 / n;
+	double t = sum_ + other.sum_;
+	if (fabs(sum_) >= fabs(other.sum_))
+		compensation_ += (sum_ - t) + other.sum_;
+	else
+		compensation_ += (other.sum_ - t) + sum_;
+	sum_ = t;
+	compensation_ += other.compensation_;
+	if (other.min_ < min_)
+		min_ = other.min_;
+	if (other.max_ > max_)
+		max_ = other.max_;
+	count_ += other.count_;
+}
+
+/*! \fn QuantileSketch::QuantileSketch(double relative_accuracy)
+ *
+ * Create an empty sketch. The quantiles are returned with a relative error
+ * smaller than \p relative_accuracy (which should be between 0 and 1).
+ */
+QuantileSketch::QuantileSketch(double relative_accuracy) :
+	buckets_(NULL), first_index_(0), nb_buckets_(0), count_(0),
+	cursor_index_(0), cursor_below_(0)
+{
+	gamma_ = (1. + relative_accuracy) / (1. - relative_accuracy);
+	inv_log_gamma_ = 1. / log(gamma_);
+}
+
+QuantileSketch::QuantileSketch(const QuantileSketch &other) :
+	buckets_(NULL), nb_buckets_(0)
+{
+	*this = other;
+}
+
+QuantileSketch::~QuantileSketch() {
+	delete [] buckets_;
+}
+
+QuantileSketch &QuantileSketch::operator=(const QuantileSketch &other) {
+	if (this == &other)
+		return *this;
+	delete [] buckets_;
+	buckets_ = NULL;
+	if (other.nb_buckets_ > 0) {
+		buckets_ = new long long[other.nb_buckets_];
+		memcpy(buckets_, other.buckets_, other.nb_buckets_ * sizeof(long long));
+	}
+	gamma_ = other.gamma_;
+	inv_log_gamma_ = other.inv_log_gamma_;
+	first_index_ = other.first_index_;
+	nb_buckets_ = other.nb_buckets_;
+	count_ = other.count_;
+	cursor_index_ = other.cursor_index_;
+	cursor_below_ = other.cursor_below_;
+	return *this;
+}
+
+/*! \fn void QuantileSketch::clear()
+ *
+ * Remove all the values. The buckets are kept for the next values.
+ */
+void QuantileSketch::clear() {
+	if (nb_buckets_ > 0)
+		memset(buckets_, 0, nb_buckets_ * sizeof(long long));
+	count_ = 0;
+	cursor_index_ = 0;
+	cursor_below_ = 0;
+}
+
+/*! \fn void QuantileSketch::merge(const QuantileSketch &other)
+ *
+ * Add the values counted in \p other to this sketch. Both sketches must
+ * have been created with the same accuracy.
+ */
+void QuantileSketch::merge(const QuantileSketch &other) {
+	if (other.count_ == 0)
+		return;
+	for (int i = 0 ; i < other.nb_buckets_ ; ++i) {
+		if (other.buckets_[i] != 0)
+			addToBucket(other.first_index_ + i, other.buckets_[i]);
+	}
+	count_ += other.count_;
+	// Restart the search of the quantiles from the first bucket
+	cursor_index_ = first_index_;
+	cursor_below_ = 0;
+}
+
+/*! \fn double QuantileSketch::quantile(double q)
+ *
+ * Return the approximate value below which there is a fraction \p q of the
+ * values (0 for the minimum, 0.5 for the median and 1 for the maximum), or
+ * NaN if the sketch is empty.
+ */
+double QuantileSketch::quantile(double q) {
+	if (count_ == 0 || q != q)
+		return NAN;
+	long long rank = 0;
+	if (q >= 1.)
+		rank = count_ - 1;
+	else if (q > 0.)
+		rank = (long long)(q * (count_ - 1));
+	// Move the cursor to the bucket that contains the value of that rank
+	while (rank < cursor_below_) {
+		--cursor_index_;
+		cursor_below_ -= bucketCount(cursor_index_);
+	}
+	while (rank >= cursor_below_ + bucketCount(cursor_index_)) {
+		cursor_below_ += bucketCount(cursor_index_);
+		++cursor_index_;
+	}
+	return bucketValue(cursor_index_);
+}
+
+// Bucket 0 holds the values close to 0, bucket i > 0 the values in
+// ]min * gamma^(i-1), min * gamma^i] and bucket -i the opposite values.
+int QuantileSketch::bucketIndex(double value) const {
+	double magnitude = fabs(value);
+	if (magnitude <= min_sketch_value)
+		return 0;
+	int index = (int)ceil(log(magnitude / min_sketch_value) * inv_log_gamma_);
+	if (index < 1)
+		index = 1;
+	return value > 0. ? index : -index;
+}
+
+// Value in the middle of the bucket (in relative terms), which is within the
+// relative accuracy of all the values in the bucket.
+double QuantileSketch::bucketValue(int index) const {
+	if (index == 0)
+		return 0.;
+	double value = min_sketch_value * 2. * pow(gamma_, index > 0 ? index : -index) / (gamma_ + 1.);
+	return index > 0 ? value : -value;
+}
+
+// Extend the bucket array so that it includes the given index. The array at
+// least doubles in size to keep the cost of growing it small.
+void QuantileSketch::grow(int index) {
+	if (nb_buckets_ == 0) {
+		const int initial_size = 64;
+		buckets_ = new long long[initial_size];
+		memset(buckets_, 0, initial_size * sizeof(long long));
+		first_index_ = index - initial_size / 2;
+		nb_buckets_ = initial_size;
+		return;
+	}
+	int first = first_index_, last = first_index_ + nb_buckets_ - 1;
+	if (index < first)
+		first = index < last - 2 * nb_buckets_ + 1 ? index : last - 2 * nb_buckets_ + 1;
+	else
+		last = index > first + 2 * nb_buckets_ - 1 ? index : first + 2 * nb_buckets_ - 1;
+	int size = last - first + 1;
+	long long *buckets = new long long[size];
+	memset(buckets, 0, size * sizeof(long long));
+	memcpy(buckets + (first_index_ - first), buckets_, nb_buckets_ * sizeof(long long));
+	delete [] buckets_;
+	buckets_ = buckets;
+	first_index_ = first;
+	nb_buckets_ = size;
+}
+
+/*! \fn GroupTable::GroupTable(int nb_values, int nb_stats, int nb_sketches)
+ *
+ * Create an empty table whose groups have \p nb_values variable values,
+ * \p nb_stats RunningStats and \p nb_sketches QuantileSketch each.
+ */
+GroupTable::GroupTable(int nb_values, int nb_stats, int nb_sketches) :
+	nb_values_(nb_values), nb_stats_(nb_stats), nb_sketches_(nb_sketches),
+	slots_(NULL), nb_slots_(0), keys_(NULL), values_(NULL), stats_(NULL), sketches_(NULL),
+	size_(0), capacity_(0), last_key_(0.), last_group_(-1)
+{
+}
+
+GroupTable::~GroupTable() {
+	clear();
+}
+
+/*! \fn void GroupTable::clear()
+ *
+ * Remove all the groups.
+ */
+void GroupTable::clear() {
+	for (int g = 0 ; g < size_ ; ++g)
+		delete [] sketches_[g];
+	delete [] slots_;
+	delete [] keys_;
+	delete [] values_;
+	delete [] stats_;
+	delete [] sketches_;
+	slots_ = NULL;
+	keys_ = NULL;
+	values_ = NULL;
+	stats_ = NULL;
+	sketches_ = NULL;
+	nb_slots_ = 0;
+	size_ = 0;
+	capacity_ = 0;
+	last_group_ = -1;
+}
+
+// Create the group for a key that is not in the table. The slot is the empty
+// slot found for the key by find(), or -1 if there are no slots yet.
+int GroupTable::insert(double key, unsigned int hash, int slot) {
+	// Keep the table at most half full so that the probe sequences stay short
+	if (2 * (size_ + 1) > nb_slots_) {
+		growSlots();
+		int mask = nb_slots_ - 1;
+		slot = hash & mask;
+		while (slots_[slot].group_ != -1)
+			slot = (slot + 1) & mask;
+	}
+	if (size_ == capacity_)
+		growGroups();
+	int group = size_++;
+	slots_[slot].key_ = key;
+	slots_[slot].group_ = group;
+	keys_[group] = key;
+	for (int i = 0 ; i < nb_values_ ; ++i)
+		values_[group * nb_values_ + i] = 0.;
+	for (int i = 0 ; i < nb_stats_ ; ++i)
+		stats_[group * nb_stats_ + i].clear();
+	sketches_[group] = nb_sketches_ > 0 ? new QuantileSketch[nb_sketches_] : NULL;
+	return group;
+}
+
+void GroupTable::growSlots() {
+	Slot *old_slots = slots_;
+	int old_nb_slots = nb_slots_;
+	nb_slots_ = nb_slots_ == 0 ? 16 : 2 * nb_slots_;
+	slots_ = new Slot[nb_slots_];
+	for (int i = 0 ; i < nb_slots_ ; ++i)
+		slots_[i].group_ = -1;
+	int mask = nb_slots_ - 1;
+	for (int i = 0 ; i < old_nb_slots ; ++i) {
+		if (old_slots[i].group_ == -1)
+			continue;
+		int slot = hash(old_slots[i].key_) & mask;
+		while (slots_[slot].group_ != -1)
+			slot = (slot + 1) & mask;
+		slots_[slot] = old_slots[i];
+	}
+	delete [] old_slots;
+}
+
+void GroupTable::growGroups() {
+	int capacity = capacity_ == 0 ? 16 : 2 * capacity_;
+	double *keys = new double[capacity];
+	double *values = new double[capacity * nb_values_];
+	RunningStats *stats = new RunningStats[capacity * nb_stats_];
+	QuantileSketch **sketches = new QuantileSketch*[capacity];
+	if (size_ > 0) {
+		memcpy(keys, keys_, size_ * sizeof(double));
+		memcpy(values, values_, size_ * nb_values_ * sizeof(double));
+		for (int i = 0 ; i < size_ * nb_stats_ ; ++i)
+			stats[i] = stats_[i];
+		memcpy(sketches, sketches_, size_ * sizeof(QuantileSketch*));
+	}
+	delete [] keys_;
+	delete [] values_;
+	delete [] stats_;
+	delete [] sketches_;
+	keys_ = keys;
+	values_ = values;
+	stats_ = stats;
+	sketches_ = sketches;
+	capacity_ = capacity;
+}
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef aggregates_h
+#define aggregates_h
+
+#include <math.h>
+#include <string.h>
+
+/*! \class RunningStats
+ *
+ * Streaming statistics of a sequence of values: count, sum, mean, variance,
+ * minimum and maximum. The sum uses Neumaier's compensated summation and the
+ * mean and variance use Welford's algorithm, so that neither loses precision
+ * over long sequences or values with a large offset. NaN values are ignored.
+ *
+ * Two sets of statistics computed on different parts of the data can be
+ * combined with merge(), which gives the same result (up to rounding) as if
+ * all the values had been added to a single set.
+ */
+class RunningStats {
+public:
+	RunningStats();
+
+	void add(double);
+	void merge(const RunningStats&);
+	void clear();
+
+	long long count() const;
+	double sum() const;
+	double mean() const;
+	double variance() const;
+	double stddev() const;
+	double minimum() const;
+	double maximum() const;
+
+private:
+	long long count_;
+	double sum_;
+	double compensation_;
+	double mean_;
+	double m2_;     // Sum of the squared differences to the mean
+	double min_;
+	double max_;
+};
+
+/*! \fn void RunningStats::add(double value)
+ *
+ * Add a value to the statistics. NaN values are ignored.
+ */
+inline void RunningStats::add(double value) {
+	if (value != value)
+		return;
+	++count_;
+	// Neumaier summation
+	double t = sum_ + value;
+	if (fabs(sum_) >= fabs(value))
+		compensation_ += (sum_ - t) + value;
+	else
+		compensation_ += (value - t) + sum_;
+	sum_ = t;
+	// Welford
+	double delta = value - mean_;
+	mean_ += delta / count_;
+	m2_ += delta * (value - mean_);
+	if (count_ == 1 || value < min_)
+		min_ = value;
+	if (count_ == 1 || value > max_)
+		max_ = value;
+}
+
+inline long long RunningStats::count() const {
+	return count_;
+}
+
+inline double RunningStats::sum() const {
+	return sum_ + compensation_;
+}
+
+/*! \fn double RunningStats::mean() const
+ *
+ * Return the mean of the values, or NaN if there are none.
+ */
+inline double RunningStats::mean() const {
+	return count_ == 0 ? NAN : mean_;
+}
+
+/*! \fn double RunningStats::variance() const
+ *
+ * Return the sample variance of the values (with n - 1 degrees of freedom),
+ * or 0 if there are less than two values.
+ */
+inline double RunningStats::variance() const {
+	return count_ < 2 ? 0. : m2_ / (count_ - 1);
+}
+
+inline double RunningStats::stddev() const {
+	return sqrt(variance());
+}
+
+/*! \fn double RunningStats::minimum() const
+ *
+ * Return the smallest value, or NaN if there are none.
+ */
+inline double RunningStats::minimum() const {
+	return count_ == 0 ? NAN : min_;
+}
+
+/*! \fn double RunningStats::maximum() const
+ *
+ * Return the largest value, or NaN if there are none.
+ */
+inline double RunningStats::maximum() const {
+	return count_ == 0 ? NAN : max_;
+}
+
+/*! \class QuantileSketch
+ *
+ * Approximate quantiles of a sequence of values in a fixed amount of memory.
+ * The values are counted in buckets whose bounds grow geometrically (as in
+ * DDSketch), so that any quantile is returned with a relative error smaller
+ * than the accuracy given to the constructor, whatever the distribution of
+ * the values. The buckets are stored in a single array covering the range of
+ * bucket indices seen so far: with the default 1% accuracy, values between
+ * 1e-3 and 1e6 need less than 1000 buckets. Values smaller than 1e-9 in
+ * absolute value are counted as 0 and NaN and infinite values are ignored.
+ *
+ * The sketch keeps the position of the last quantile that was asked for, so
+ * that asking for the same quantile after each add() only costs a few steps.
+ * Two sketches with the same accuracy can be combined with merge().
+ */
+class QuantileSketch {
+public:
+	QuantileSketch(double relative_accuracy = 0.01);
+	QuantileSketch(const QuantileSketch&);
+	~QuantileSketch();
+
+	QuantileSketch &operator=(const QuantileSketch&);
+
+	void add(double);
+	void merge(const QuantileSketch&);
+	void clear();
+
+	long long count() const;
+	double quantile(double q);
+
+private:
+	int bucketIndex(double) const;
+	double bucketValue(int index) const;
+	void addToBucket(int index, long long n);
+	long long bucketCount(int index) const;
+	void grow(int index);
+
+	double gamma_;
+	double inv_log_gamma_;
+	long long *buckets_;
+	int first_index_;   // Bucket index of buckets_[0]
+	int nb_buckets_;
+	long long count_;
+	// Position of the last quantile: index of its bucket and number of values
+	// in the buckets before it.
+	int cursor_index_;
+	long long cursor_below_;
+};
+
+/*! \fn void QuantileSketch::add(double value)
+ *
+ * Add a value to the sketch. NaN and infinite values are ignored.
+ */
+inline void QuantileSketch::add(double value) {
+	if (value != value || fabs(value) > 1.7976931348623157e308)
+		return;
+	int index = bucketIndex(value);
+	addToBucket(index, 1);
+	if (count_ == 0) {
+		cursor_index_ = index;
+		cursor_below_ = 0;
+	} else if (index < cursor_index_)
+		++cursor_below_;
+	++count_;
+}
+
+inline long long QuantileSketch::count() const {
+	return count_;
+}
+
+inline void QuantileSketch::addToBucket(int index, long long n) {
+	if (index < first_index_ || index >= first_index_ + nb_buckets_)
+		grow(index);
+	buckets_[index - first_index_] += n;
+}
+
+inline long long QuantileSketch::bucketCount(int index) const {
+	index -= first_index_;
+	return index >= 0 && index < nb_buckets_ ? buckets_[index] : 0;
+}
+
+/*! \class GroupTable
+ *
+ * State of the groups of a 'group' statement of a script: for each distinct
+ * value of the key, a set of variable values, RunningStats and QuantileSketch
+ * objects. The groups are numbered in the order in which their keys were first
+ * found and their states are stored in contiguous arrays indexed by that
+ * number, while the keys are found with an open addressing hash table (linear
+ * probing on a power of two number of slots) that only holds the keys and the
+ * group numbers. The last key is remembered, so that consecutive rows of the
+ * same group do not need a lookup.
+ *
+ * Keys are compared by value, except that all the NaN keys are in the same
+ * group and that 0 and -0 are the same key.
+ *
+ * Example:
+ * \code
+	GroupTable table(1, 1, 0);
+	int group = table.find(key);
+	table.values(group)[0] += 1.;
+	table.stats(group)[0].add(value);
+ * \endcode
+ */
+class GroupTable {
+public:
+	GroupTable(int nb_values, int nb_stats, int nb_sketches);
+	~GroupTable();
+
+	void clear();
+	int find(double key);
+
+	int size() const;
+	double key(int group) const;
+	double *values(int group);
+	RunningStats *stats(int group);
+	QuantileSketch *sketches(int group);
+
+private:
+	// Not copyable: the sketches are owned by the table.
+	GroupTable(const GroupTable&);
+	GroupTable &operator=(const GroupTable&);
+
+	struct Slot {
+		double key_;
+		int group_;    // -1 for an empty slot
+	};
+
+	static double normalizedKey(double);
+	static unsigned int hash(double);
+	static bool sameKey(double, double);
+	int insert(double key, unsigned int hash, int slot);
+	void growSlots();
+	void growGroups();
+
+	int nb_values_;
+	int nb_stats_;
+	int nb_sketches_;
+	Slot *slots_;
+	int nb_slots_;        // Always a power of two (or 0)
+	double *keys_;
+	double *values_;
+	RunningStats *stats_;
+	QuantileSketch **sketches_;
+	int size_;
+	int capacity_;        // Number of groups the state arrays can hold
+	double last_key_;
+	int last_group_;      // -1 if there is no last key
+};
+
+/*! \fn int GroupTable::find(double key)
+ *
+ * Return the number of the group of the given key, creating the group if
+ * needed. The variable values of a new group are 0.
+ */
+inline int GroupTable::find(double key) {
+	key = normalizedKey(key);
+	if (last_group_ != -1 && sameKey(key, last_key_))
+		return last_group_;
+	unsigned int h = hash(key);
+	int slot = -1;
+	if (nb_slots_ > 0) {
+		int mask = nb_slots_ - 1;
+		slot = h & mask;
+		while (slots_[slot].group_ != -1 && !sameKey(slots_[slot].key_, key))
+			slot = (slot + 1) & mask;
+	}
+	int group = slot != -1 && slots_[slot].group_ != -1 ? slots_[slot].group_ : insert(key, h, slot);
+	last_key_ = key;
+	last_group_ = group;
+	return group;
+}
+
+inline int GroupTable::size() const {
+	return size_;
+}
+
+inline double GroupTable::key(int group) const {
+	return keys_[group];
+}
+
+inline double *GroupTable::values(int group) {
+	return values_ + group * nb_values_;
+}
+
+inline RunningStats *GroupTable::stats(int group) {
+	return stats_ + group * nb_stats_;
+}
+
+inline QuantileSketch *GroupTable::sketches(int group) {
+	return sketches_[group];
+}
+
+inline double GroupTable::normalizedKey(double key) {
+	if (key != key)
+		return NAN;
+	return key == 0. ? 0. : key;
+}
+
+// The keys are normalized, so comparing their bits is enough (and also
+// works for NaN).
+inline bool GroupTable::sameKey(double key1, double key2) {
+	return memcmp(&key1, &key2, sizeof(double)) == 0;
+}
+
+// Finalizer of splitmix64 on the bits of the key.
+inline unsigned int GroupTable::hash(double key) {
+	unsigned long long z;
+	memcpy(&z, &key, sizeof(double));
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (unsigned int)(z ^ (z >> 31));
+}
+
+#endif
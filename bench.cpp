@@ -0,0 +1,539 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+// Benchmark suite built by 'make bench'. Run 'script_bench --help' for the options.
+
+#include "equation_parser.h"
+#include "script_parser.h"
+#include "parser_operators.h"
+#include "data_file_reader.h"
+#include "random_generator.h"
+#include "redirect_output.h"
+#include "eval_kernels.h"
+#include "timer.h"
+#include "list.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+static const char *compute_script =
+	"if (Vp <= 0 || Vs <= 0 || Rho <= 0) {\n"
+	"    invalid = invalid + 1;\n"
+	"} else {\n"
+	"    Ip = Vp * Rho;\n"
+	"    Is = Vs * Rho;\n"
+	"    VpVs = Vp / Vs;\n"
+	"    Poisson = 0.5 * (1 - Vs * Vs / (Vp * Vp - Vs * Vs));\n"
+	"    RhoMu = Ip * Ip - 2 * Is * Is;\n"
+	"    LambdaMu = (Ip * Ip - 2 * Is * Is) / (Is * Is);\n"
+	"    k = 0;\n"
+	"    while (k < 4) {\n"
+	"        LambdaMu = LambdaMu + sqrt(k * Poisson);\n"
+	"        k = k + 1;\n"
+	"    }\n"
+	"}\n"
+	"n = n + 1;\n";
+
+static const char *print_script = "print(Vp, Vs, Rho);\n";
+
+static const char *parse_equation = "(Ip * Ip - 2 * Is * Is) / (Is * Is) + if(Vp > Vs, sqrt(Vp - Vs), pow(Vs, 0.5))";
+
+/***********************************************************************************
+ * Benchmarks
+ ***********************************************************************************/
+
+/*! \class Benchmark
+ *
+ * Base class of the benchmarks. run() is timed and returns the number of
+ * operations done (or of rows processed for the benchmarks in rows).
+ */
+class Benchmark {
+public:
+	Benchmark(const String &name, const char *unit) : name_(name), unit_(unit) {}
+	virtual ~Benchmark() {}
+
+	const String &name() const { return name_; }
+	const char *unit() const { return unit_; }
+
+	virtual bool setup() { return true; }
+	virtual long long run() = 0;
+	// Number of bytes of input processed by the last run(), if relevant.
+	virtual long long bytes() const { return 0; }
+
+private:
+	String name_;
+	const char *unit_;
+};
+
+class EquationParseBenchmark : public Benchmark {
+public:
+	EquationParseBenchmark(int iterations) : Benchmark("parse/equation", "op"), iterations_(iterations) {}
+
+	virtual long long run() {
+		StringList variables;
+		variables << "Ip" << "Is" << "Vp" << "Vs";
+		EquationParser parser;
+		for (int i = 0 ; i < iterations_ ; ++i)
+			parser.parse(parse_equation, variables);
+		return iterations_;
+	}
+
+private:
+	int iterations_;
+};
+
+class ScriptParseBenchmark : public Benchmark {
+public:
+	ScriptParseBenchmark(int iterations) : Benchmark("parse/script", "op"), iterations_(iterations) {}
+
+	virtual bool setup() {
+		ScriptParser parser;
+		variables_ = parser.getVariablesList(compute_script);
+		return true;
+	}
+
+	virtual long long run() {
+		ScriptParser parser;
+		for (int i = 0 ; i < iterations_ ; ++i)
+			parser.parse(compute_script, variables_);
+		return iterations_;
+	}
+
+private:
+	int iterations_;
+	StringList variables_;
+};
+
+class BreakBlockBenchmark : public Benchmark {
+public:
+	BreakBlockBenchmark(int iterations) : Benchmark("parse/breakBlock", "op"), iterations_(iterations) {}
+
+	virtual bool setup() {
+		ScriptParser parser;
+		variables_ = parser.getVariablesList(compute_script);
+		return true;
+	}
+
+	virtual long long run() {
+		double *values = new double[variables_.size()];
+		EquationParser equation_parser;
+		equation_parser.setVariables(variables_, false, values);
+		for (int i = 0 ; i < iterations_ ; ++i) {
+			List<ScriptParserExpression*> expressions;
+			StringList errors;
+			ScriptParser::breakBlock(compute_script, expressions, equation_parser, errors);
+			for (List<ScriptParserExpression*>::iterator it = expressions.begin() ; it != expressions.end() ; ++it)
+				delete (*it);
+		}
+		delete [] values;
+		return iterations_;
+	}
+
+private:
+	int iterations_;
+	StringList variables_;
+};
+
+// Script similar to the ones emitted by code generators: nb_statements statements
+// (one in 20 is an if/else) on nb_variables variables.
+static String generateScript(int nb_statements, int nb_variables) {
+	RandomGenerator random(nb_statements);
+	String script;
+	for (int i = 0 ; i < nb_statements ; ++i) {
+		int a = (int)(random.uniform() * nb_variables);
+		int b = (int)(random.uniform() * nb_variables);
+		int c = (int)(random.uniform() * nb_variables);
+		if (i % 20 == 0)
+			script += String::format("if (v%d > v%d) {\n    v%d = v%d * 0.5 + 1;\n} else {\n    v%d = v%d - 0.25;\n}\n", a, b, c, a, c, b);
+		else
+			script += String::format("v%d = v%d * 0.999 + v%d * 0.001 + %d;\n", a, b, c, i % 7);
+	}
+	return script;
+}
+
+// Parsing (or evaluation) of a large generated script. The time per statement
+// should not depend on the number of statements.
+class ScriptScaleBenchmark : public Benchmark {
+public:
+	ScriptScaleBenchmark(int nb_statements, bool evaluate) :
+		Benchmark(String::format("scale/%s_%dk", evaluate ? "eval" : "parse", nb_statements / 1000), "statement"),
+		nb_statements_(nb_statements), evaluate_(evaluate) {}
+
+	virtual bool setup() {
+		script_ = generateScript(nb_statements_, 400);
+		if (!evaluate_)
+			return true;
+		StringList variables = parser_.getVariablesList(script_);
+		return parser_.nbErrors() == 0 && parser_.parse(script_, variables);
+	}
+
+	virtual long long run() {
+		if (evaluate_)
+			parser_.evaluate();
+		else {
+			ScriptParser parser;
+			StringList variables = parser.getVariablesList(script_);
+			parser.parse(script_, variables);
+		}
+		return nb_statements_;
+	}
+
+private:
+	int nb_statements_;
+	bool evaluate_;
+	String script_;
+	ScriptParser parser_;
+};
+
+// Evaluation of a single expression, to measure the latency of one operator class.
+class ExpressionBenchmark : public Benchmark {
+public:
+	ExpressionBenchmark(const char *name, const char *expression, bool fast_math, int iterations) :
+		Benchmark(String::format("eval/%s", name), "op"), expression_(expression),
+		fast_math_(fast_math), iterations_(iterations) {}
+
+	virtual bool setup() {
+		StringList variables;
+		variables << "x" << "y" << "z";
+		bool fast_math = EquationParser::fastMath();
+		EquationParser::setFastMath(fast_math_);
+		bool ok = parser_.parse(expression_, variables);
+		EquationParser::setFastMath(fast_math);
+		if (!ok)
+			return false;
+		parser_.variablesValue()[0] = 1.7;
+		parser_.variablesValue()[1] = 0.3;
+		parser_.variablesValue()[2] = 0.;
+		return true;
+	}
+
+	virtual long long run() {
+		double sum = 0.;
+		for (int i = 0 ; i < iterations_ ; ++i)
+			sum += parser_.evaluate();
+		sink_ = sum;
+		return iterations_;
+	}
+
+	static volatile double sink_;
+
+private:
+	const char *expression_;
+	bool fast_math_;
+	int iterations_;
+	EquationParser parser_;
+};
+
+volatile double ExpressionBenchmark::sink_ = 0.;
+
+// Benchmarks reading the generated data file.
+class DataFileBenchmark : public Benchmark {
+public:
+	DataFileBenchmark(const char *name, const String &data_file, const char *script) :
+		Benchmark(name, "row"), data_file_(data_file), script_(script), bytes_(0) {}
+
+	virtual bool setup() {
+		if (script_ == NULL) {
+			StringList names;
+			names << "Vp" << "Vs" << "Rho";
+			variables_.setNames(names);
+			return true;
+		}
+		variables_.setNames(parser_.getVariablesList(script_));
+		return parser_.parse(script_, variables_);
+	}
+
+	virtual long long run() {
+		DataFileReader reader;
+		if (!reader.open(data_file_, variables_.names(), false))
+			return 0;
+		if (script_ == NULL) {
+			while (reader.readRow(variables_.values())) {}
+		} else {
+			while (reader.readRow(variables_.values()))
+				parser_.evaluate();
+		}
+		bytes_ = reader.nbBytes();
+		return reader.nbRows();
+	}
+
+	virtual long long bytes() const { return bytes_; }
+
+private:
+	String data_file_;
+	const char *script_;
+	VariableStorage variables_;
+	ScriptParser parser_;
+	long long bytes_;
+};
+
+// Same as DataFileBenchmark but with the output redirected to /dev/null.
+class PrintBenchmark : public DataFileBenchmark {
+public:
+	PrintBenchmark(const String &data_file) : DataFileBenchmark("output/print", data_file, print_script) {}
+
+	virtual long long run() {
+		if (!redirect_output("/dev/null"))
+			return 0;
+		long long rows = DataFileBenchmark::run();
+		close_redirect_output();
+		return rows;
+	}
+};
+
+/***********************************************************************************
+ * Measurements
+ ***********************************************************************************/
+
+struct BenchResult {
+	String name_;
+	const char *unit_;
+	long long operations_;
+	double mean_ns_;
+	double stddev_ns_;
+	double min_ns_;
+	double cpu_ns_;
+	double bytes_per_second_;
+};
+
+static BenchResult measure(Benchmark *bench, int warmup, int repetitions) {
+	BenchResult result;
+	result.name_ = bench->name();
+	result.unit_ = bench->unit();
+	result.operations_ = 0;
+	for (int i = 0 ; i < warmup ; ++i)
+		bench->run();
+
+	double *ns_per_op = new double[repetitions];
+	double sum = 0., cpu_sum = 0., bytes_per_second = 0.;
+	for (int i = 0 ; i < repetitions ; ++i) {
+		long long wall_start = Timer::wallNs(), cpu_start = Timer::cpuNs();
+		long long operations = bench->run();
+		long long wall = Timer::wallNs() - wall_start, cpu = Timer::cpuNs() - cpu_start;
+		if (operations <= 0)
+			operations = 1;
+		result.operations_ = operations;
+		ns_per_op[i] = (double)wall / operations;
+		sum += ns_per_op[i];
+		cpu_sum += (double)cpu / operations;
+		if (wall > 0)
+			bytes_per_second += bench->bytes() * 1e9 / wall;
+	}
+	result.mean_ns_ = sum / repetitions;
+	result.cpu_ns_ = cpu_sum / repetitions;
+	result.bytes_per_second_ = bytes_per_second / repetitions;
+	result.min_ns_ = ns_per_op[0];
+	double variance = 0.;
+	for (int i = 0 ; i < repetitions ; ++i) {
+		if (ns_per_op[i] < result.min_ns_)
+			result.min_ns_ = ns_per_op[i];
+		variance += (ns_per_op[i] - result.mean_ns_) * (ns_per_op[i] - result.mean_ns_);
+	}
+	result.stddev_ns_ = repetitions > 1 ? sqrt(variance / (repetitions - 1)) : 0.;
+	delete [] ns_per_op;
+	return result;
+}
+
+/***********************************************************************************
+ * Data generation and reports
+ ***********************************************************************************/
+
+static bool generateDataFile(const String &file_name, int nb_rows) {
+	FILE *file = fopen(file_name.c_str(), "w");
+	if (file == NULL)
+		return false;
+	fprintf(file, "  Vp      Vs    Rho\n");
+	const int block = 1024;
+	double vp[block], vs[block], rho[block];
+	RandomGenerator random(12345);
+	for (int row = 0 ; row < nb_rows ; row += block) {
+		int n = nb_rows - row < block ? nb_rows - row : block;
+		random.fillUniform(vp, n, 1500., 4500.);
+		random.fillUniform(vs, n, 700., 2500.);
+		random.fillUniform(rho, n, 1.8, 2.8);
+		for (int i = 0 ; i < n ; ++i)
+			fprintf(file, "%.1f  %.1f  %.2f\n", vp[i], vs[i], rho[i]);
+	}
+	fclose(file);
+	return true;
+}
+
+static void printText(const List<BenchResult> &results) {
+	printf("%-28s %12s %8s %12s %12s %14s\n", "Benchmark", "ns/unit", "+/-", "min", "cpu", "rate");
+	for (int i = 0 ; i < results.size() ; ++i) {
+		const BenchResult &r = results[i];
+		double relative = r.mean_ns_ > 0. ? 100. * r.stddev_ns_ / r.mean_ns_ : 0.;
+		double rate = r.mean_ns_ > 0. ? 1e9 / r.mean_ns_ : 0.;
+		printf(
+			"%-28s %12.1f %7.1f%% %12.1f %12.1f %10.0f %s/s",
+			r.name_.c_str(), r.mean_ns_, relative, r.min_ns_, r.cpu_ns_, rate, r.unit_
+		);
+		if (r.bytes_per_second_ > 0.)
+			printf("  %.1f MB/s", r.bytes_per_second_ / 1e6);
+		printf("\n");
+	}
+}
+
+static void printJson(const List<BenchResult> &results, int warmup, int repetitions, int rows) {
+	printf("{\n");
+	printf("  \"cpu_level\": \"%s\",\n", EvalKernels::cpuLevelName(EvalKernels::cpuLevel()));
+	printf("  \"warmup\": %d,\n", warmup);
+	printf("  \"repetitions\": %d,\n", repetitions);
+	printf("  \"rows\": %d,\n", rows);
+	printf("  \"benchmarks\": [\n");
+	for (int i = 0 ; i < results.size() ; ++i) {
+		const BenchResult &r = results[i];
+		printf("    {\n");
+		printf("      \"name\": \"%s\",\n", r.name_.c_str());
+		printf("      \"unit\": \"%s\",\n", r.unit_);
+		printf("      \"operations\": %lld,\n", r.operations_);
+		printf("      \"mean_ns\": %.3f,\n", r.mean_ns_);
+		printf("      \"stddev_ns\": %.3f,\n", r.stddev_ns_);
+		printf("      \"min_ns\": %.3f,\n", r.min_ns_);
+		printf("      \"cpu_ns\": %.3f,\n", r.cpu_ns_);
+		printf("      \"per_second\": %.3f,\n", r.mean_ns_ > 0. ? 1e9 / r.mean_ns_ : 0.);
+		printf("      \"bytes_per_second\": %.3f\n", r.bytes_per_second_);
+		printf("    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	printf("  ]\n");
+	printf("}\n");
+}
+
+static void printHelp(const char *cmd_name) {
+	printf("Usage: %s [options]\n", cmd_name);
+	printf("\n");
+	printf("Options can be:\n");
+	printf("  --help              Print this help.\n");
+	printf("  --json              Print the results in JSON.\n");
+	printf("  --repetitions=N     Number of timed runs of each benchmark (default 5).\n");
+	printf("  --warmup=N          Number of untimed runs before the timed ones (default 1).\n");
+	printf("  --iterations=N      Number of operations in one run of the parse and\n");
+	printf("                      evaluation benchmarks (default 200000).\n");
+	printf("  --rows=N            Number of rows in the generated data file (default 100000).\n");
+	printf("  --filter=text       Only run the benchmarks whose name contains text.\n");
+	printf("\n");
+	printf("The times are given per operation or per row, with the standard deviation\n");
+	printf("between the repetitions (relative to the mean) and the fastest repetition.\n");
+}
+
+int main(int argc, char* argv[]) {
+	EvalKernels::init();
+
+	bool json = false;
+	int repetitions = 5, warmup = 1, iterations = 200000, rows = 100000;
+	String filter;
+	for (int i = 1 ; i < argc ; ++i) {
+		String arg(argv[i]);
+		if (arg == "--help") {
+			printHelp(argv[0]);
+			return 0;
+		} else if (arg == "--json")
+			json = true;
+		else if (arg.startsWith("--repetitions="))
+			repetitions = arg.right(14).toInt();
+		else if (arg.startsWith("--warmup="))
+			warmup = arg.right(9).toInt();
+		else if (arg.startsWith("--iterations="))
+			iterations = arg.right(13).toInt();
+		else if (arg.startsWith("--rows="))
+			rows = arg.right(7).toInt();
+		else if (arg.startsWith("--filter="))
+			filter = arg.right(9);
+		else {
+			printf("Unrecognized option '%s'.\n", argv[i]);
+			printHelp(argv[0]);
+			return 1;
+		}
+	}
+	if (repetitions < 1 || warmup < 0 || iterations < 1 || rows < 1) {
+		printf("Invalid option value.\n");
+		return 1;
+	}
+
+	const char *tmp_dir = getenv("TMPDIR");
+	String data_file = String::format("%s/script_bench_%d.txt", tmp_dir != NULL && *tmp_dir != 0 ? tmp_dir : "/tmp", (int)getpid());
+	if (!generateDataFile(data_file, rows)) {
+		printf("Cannot create the data file '%s'.\n", data_file.c_str());
+		return 1;
+	}
+
+	List<Benchmark*> benchmarks;
+	benchmarks << new EquationParseBenchmark(iterations / 10);
+	benchmarks << new ScriptParseBenchmark(iterations / 100);
+	benchmarks << new BreakBlockBenchmark(iterations / 100);
+	for (int n = 1000 ; n <= 100000 ; n *= 10) {
+		benchmarks << new ScriptScaleBenchmark(n, false);
+		benchmarks << new ScriptScaleBenchmark(n, true);
+	}
+	benchmarks << new ExpressionBenchmark("constant", "1.5", false, iterations);
+	benchmarks << new ExpressionBenchmark("variable", "x", false, iterations);
+	benchmarks << new ExpressionBenchmark("add", "x + y", false, iterations);
+	benchmarks << new ExpressionBenchmark("multiply", "x * y", false, iterations);
+	benchmarks << new ExpressionBenchmark("divide", "x / y", false, iterations);
+	benchmarks << new ExpressionBenchmark("compare", "x < y", false, iterations);
+	benchmarks << new ExpressionBenchmark("logical", "x > 0 && y > 0", false, iterations);
+	benchmarks << new ExpressionBenchmark("if", "if(x > y, x, y)", false, iterations);
+	benchmarks << new ExpressionBenchmark("assign", "z = x", false, iterations);
+	benchmarks << new ExpressionBenchmark("sqrt", "sqrt(x)", false, iterations);
+	benchmarks << new ExpressionBenchmark("pow", "pow(x, y)", false, iterations);
+	benchmarks << new ExpressionBenchmark("exp", "exp(y)", false, iterations);
+	benchmarks << new ExpressionBenchmark("exp_fast", "exp(y)", true, iterations);
+	benchmarks << new ExpressionBenchmark("log", "log(x)", false, iterations);
+	benchmarks << new ExpressionBenchmark("log_fast", "log(x)", true, iterations);
+	benchmarks << new ExpressionBenchmark("sin", "sin(x)", false, iterations);
+	benchmarks << new ExpressionBenchmark("sin_fast", "sin(x)", true, iterations);
+	benchmarks << new ExpressionBenchmark("cos", "cos(x)", false, iterations);
+	benchmarks << new ExpressionBenchmark("cos_fast", "cos(x)", true, iterations);
+	benchmarks << new ExpressionBenchmark("urand", "urand(0, 1)", false, iterations);
+	benchmarks << new ExpressionBenchmark("nrand", "nrand(0, 1)", false, iterations);
+	benchmarks << new DataFileBenchmark("ingest/data_file", data_file, NULL);
+	benchmarks << new DataFileBenchmark("script/data_file", data_file, compute_script);
+	benchmarks << new PrintBenchmark(data_file);
+
+	List<BenchResult> results;
+	for (int i = 0 ; i < benchmarks.size() ; ++i) {
+		Benchmark *bench = benchmarks[i];
+		if (!filter.isEmpty() && !bench->name().contains(filter))
+			continue;
+		if (!bench->setup()) {
+			fprintf(stderr, "Benchmark %s failed to initialize.\n", bench->name().c_str());
+			continue;
+		}
+		if (!json)
+			fprintf(stderr, "Running %s...\n", bench->name().c_str());
+		results << measure(bench, warmup, repetitions);
+	}
+
+	if (json)
+		printJson(results, warmup, repetitions, rows);
+	else {
+		printf(
+			"CPU level: %s, %d warmup run(s), %d repetition(s), %d rows\n\n",
+			EvalKernels::cpuLevelName(EvalKernels::cpuLevel()), warmup, repetitions, rows
+		);
+		printText(results);
+	}
+
+	for (int i = 0 ; i < benchmarks.size() ; ++i)
+		delete benchmarks[i];
+	remove(data_file.c_str());
+	return 0;
+}
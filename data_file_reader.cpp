@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "data_file_reader.h"
+#include "eval_kernels.h"
+#include "modules.h"
+
+// Number of rejected rows kept by readRow() before their values are restored
+static const int MaxSkippedLines = 256;
+
+/*! \fn DataFileReader::DataFileReader()
+ *
+ * Create a reader. Call open() to start reading a file.
+ */
+DataFileReader::DataFileReader() :
+	file_(NULL), row_values_(NULL), row_parsed_(NULL),
+	filter_(NULL), nb_filter_columns_(0), nb_other_columns_(0),
+	skipped_lines_(NULL), skipped_offsets_(NULL), nb_skipped_lines_(0), restored_(NULL),
+	nb_rows_(0), nb_skipped_rows_(0), nb_bytes_(0)
+{
+}
+
+/*! \fn DataFileReader::~DataFileReader()
+ *
+ * Destructor of the DataFileReader class. It closes the file.
+ */
+DataFileReader::~DataFileReader() {
+	close();
+}
+
+/*! \fn bool DataFileReader::open(const String &file_name, const StringList &variables, bool warn_unused)
+ *
+ * Open the given data file and read its header. The columns are mapped to the
+ * variables with the same name in \p variables. If \p warn_unused is true a
+ * warning is printed for each column that does not correspond to any variable
+ * (that column is then ignored).
+ * Return false if the file cannot be opened.
+ */
+bool DataFileReader::open(const String &file_name, const StringList &variables, bool warn_unused) {
+	close();
+	file_ = fopen(file_name.c_str(), "r");
+	if (file_ == NULL)
+		return false;
+
+	String line = readLine(false, file_);
+	nb_bytes_ = line.length();
+	line = line.trimmed();
+	while (!line.isEmpty()) {
+		int space_i = line.findSpace();
+		String var;
+		if (space_i == -1) {
+			var = line;
+			line.clear();
+		} else {
+			var = line.left(space_i - 1);
+			line = line.right(space_i + 1).trimmed();
+		}
+		column_names_ << var;
+		column_mapping_ << variables.indexOf(var);
+		if (column_mapping_.last() == -1 && warn_unused)
+			printf("Warning: variable %s ignored as it is not used in any script.\n", var.c_str());
+	}
+	int nb_columns = column_mapping_.size();
+	row_values_ = new double[nb_columns > 0 ? nb_columns : 1];
+	row_parsed_ = new bool[nb_columns > 0 ? nb_columns : 1];
+	restored_ = new bool[nb_columns > 0 ? nb_columns : 1];
+	skipped_lines_ = new String[MaxSkippedLines];
+	skipped_offsets_ = new int[MaxSkippedLines];
+	return true;
+}
+
+/*! \fn void DataFileReader::close()
+ *
+ * Close the file. This is done automatically by open() and the destructor.
+ */
+void DataFileReader::close() {
+	if (file_ != NULL)
+		fclose(file_);
+	file_ = NULL;
+	column_names_.clear();
+	column_mapping_.clear();
+	delete [] row_values_;
+	delete [] row_parsed_;
+	delete [] restored_;
+	delete [] skipped_lines_;
+	delete [] skipped_offsets_;
+	row_values_ = NULL;
+	row_parsed_ = NULL;
+	restored_ = NULL;
+	skipped_lines_ = NULL;
+	skipped_offsets_ = NULL;
+	nb_skipped_lines_ = 0;
+	line_.clear();
+	filter_ = NULL;
+	nb_filter_columns_ = 0;
+	nb_other_columns_ = 0;
+	nb_rows_ = 0;
+	nb_skipped_rows_ = 0;
+	nb_bytes_ = 0;
+}
+
+/*! \fn void DataFileReader::setFilter(RowFilter *filter, const StringList &columns)
+ *
+ * Make readRow() skip the rows rejected by \p filter, which only depends on
+ * the given columns. For each row, the fields up to the last of those columns
+ * are parsed and copied into the variables first, and the rest of the row is
+ * only parsed if the filter accepts it. The rest of the rejected rows is kept
+ * and only the fields needed to give the other variables their value after
+ * the last rejected row are parsed, when the next row is accepted or the end
+ * of the file is reached. The variables then have the same values as if all
+ * the rows had been read. Call it after open(), and with a NULL filter to read
+ * all the rows again. The filter is not owned by the reader.
+ */
+void DataFileReader::setFilter(RowFilter *filter, const StringList &columns) {
+	filter_ = filter;
+	nb_filter_columns_ = 0;
+	nb_other_columns_ = 0;
+	nb_skipped_lines_ = 0;
+	for (int c = 0 ; c < column_names_.size() ; ++c) {
+		if (columns.contains(column_names_[c]))
+			nb_filter_columns_ = c + 1;
+	}
+	for (int c = nb_filter_columns_ ; c < column_mapping_.size() ; ++c) {
+		if (column_mapping_[c] != -1)
+			++nb_other_columns_;
+	}
+}
+
+/*! \fn bool DataFileReader::readRow(double *var_values)
+ *
+ * Read the next row and copy the values of the mapped columns into
+ * \p var_values. Fields that are missing or are not numbers leave the
+ * corresponding variable unchanged.
+ * Return false when the end of the file has been reached.
+ */
+bool DataFileReader::readRow(double *var_values) {
+	if (filter_ == NULL) {
+		const double *values;
+		const bool *parsed;
+		int nb_values;
+		if (!readFields(values, parsed, nb_values))
+			return false;
+		copyFields(0, nb_values, var_values);
+		return true;
+	}
+	int nb_columns = column_mapping_.size();
+	while (nextLine()) {
+		int consumed;
+		int nb_values = EvalKernels::parseRow(line_.c_str(), line_.length(), row_values_, row_parsed_, nb_filter_columns_, &consumed);
+		copyFields(0, nb_values, var_values);
+		if (!filter_->accept()) {
+			++nb_skipped_rows_;
+			// Keep the rest of the line if it has fields for other variables
+			if (nb_other_columns_ > 0 && nb_values == nb_filter_columns_) {
+				if (nb_skipped_lines_ == MaxSkippedLines)
+					restoreSkippedRows(var_values);
+				skipped_lines_[nb_skipped_lines_] = line_;
+				skipped_offsets_[nb_skipped_lines_] = consumed;
+				++nb_skipped_lines_;
+			}
+			continue;
+		}
+		restoreSkippedRows(var_values);
+		int nb_other_values = EvalKernels::parseRow(
+			line_.c_str() + consumed, line_.length() - consumed,
+			row_values_ + nb_values, row_parsed_ + nb_values, nb_columns - nb_values
+		);
+		copyFields(nb_values, nb_values + nb_other_values, var_values);
+		return true;
+	}
+	restoreSkippedRows(var_values);
+	return false;
+}
+
+// Copy into the variables the fields after the filter columns of the rows
+// kept by readRow(), each from the last of those rows in which it is a number.
+// The rows are parsed from the last one until all those fields are found.
+void DataFileReader::restoreSkippedRows(double *var_values) {
+	if (nb_skipped_lines_ == 0)
+		return;
+	int nb_columns = column_mapping_.size();
+	for (int c = nb_filter_columns_ ; c < nb_columns ; ++c)
+		restored_[c] = column_mapping_[c] == -1;
+	int nb_missing = nb_other_columns_;
+	for (int i = nb_skipped_lines_ - 1 ; i >= 0 && nb_missing > 0 ; --i) {
+		const String &line = skipped_lines_[i];
+		int offset = skipped_offsets_[i];
+		int nb_values = EvalKernels::parseRow(
+			line.c_str() + offset, line.length() - offset,
+			row_values_ + nb_filter_columns_, row_parsed_ + nb_filter_columns_, nb_columns - nb_filter_columns_
+		);
+		for (int c = nb_filter_columns_ ; c < nb_filter_columns_ + nb_values ; ++c) {
+			if (!restored_[c] && row_parsed_[c]) {
+				var_values[column_mapping_[c]] = row_values_[c];
+				restored_[c] = true;
+				--nb_missing;
+			}
+		}
+	}
+	nb_skipped_lines_ = 0;
+}
+
+// Copy the parsed fields of the columns first to last - 1 into the variables.
+void DataFileReader::copyFields(int first, int last, double *var_values) const {
+	for (int var_i = first ; var_i < last ; ++var_i) {
+		if (row_parsed_[var_i] && column_mapping_[var_i] != -1)
+			var_values[column_mapping_[var_i]] = row_values_[var_i];
+	}
+}
+
+/*! \fn bool DataFileReader::readFields(const double *&values, const bool *&parsed, int &nb_values)
+ *
+ * Read the next row without mapping it to the variables. On return \p values
+ * and \p parsed point to the value of each of the first \p nb_values columns
+ * and tell if that field was a number. They stay valid until the next read.
+ * Return false when the end of the file has been reached.
+ */
+bool DataFileReader::readFields(const double *&values, const bool *&parsed, int &nb_values) {
+	if (!nextLine())
+		return false;
+	nb_values = EvalKernels::parseRow(line_.c_str(), line_.length(), row_values_, row_parsed_, column_mapping_.size());
+	values = row_values_;
+	parsed = row_parsed_;
+	return true;
+}
+
+// Read the next row into line_. Return false at the end of the file.
+bool DataFileReader::nextLine() {
+	if (file_ == NULL || feof(file_))
+		return false;
+	line_ = readLine(false, file_);
+	// An empty read means the previous line was the last one
+	if (line_.isEmpty() && feof(file_))
+		return false;
+	nb_bytes_ += line_.length();
+	// The last line may not end with a new line character
+	if (line_[line_.length() - 1] == '\n')
+		line_ = line_.left(-2);
+	++nb_rows_;
+	return true;
+}
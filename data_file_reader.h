@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef data_file_reader_h
+#define data_file_reader_h
+
+#include <stdio.h>
+#include "str.h"
+#include "strlist.h"
+#include "list.h"
+
+/*! \class RowFilter
+ *
+ * Condition given to DataFileReader::setFilter() to skip rows while they are
+ * read. accept() is called once the columns used by the condition have been
+ * copied into the variables, and before the other columns are parsed.
+ */
+class RowFilter {
+public:
+	virtual ~RowFilter() {}
+
+	virtual bool accept() = 0;
+};
+
+/*! \class DataFileReader
+ *
+ * Read a data file with the variable names on the first line and one row of
+ * values per following line. Each row is copied into the variable value
+ * array of the scripts, using the variable names to map the columns.
+ *
+ * Example:
+ * \code
+	DataFileReader reader;
+	if (reader.open("data.txt", variables.names())) {
+		while (reader.readRow(variables.values())) {
+			parser.nextRow();
+			parser.evaluate();
+		}
+	}
+ * \endcode
+ */
+class DataFileReader {
+public:
+	DataFileReader();
+	~DataFileReader();
+
+	bool open(const String &file_name, const StringList &variables, bool warn_unused = true);
+	void close();
+
+	bool readRow(double *var_values);
+	bool readFields(const double *&values, const bool *&parsed, int &nb_values);
+
+	void setFilter(RowFilter*, const StringList &columns);
+
+	const StringList &columnNames() const;
+	int nbColumns() const;
+	long long nbRows() const;
+	long long nbSkippedRows() const;
+	long long nbBytes() const;
+
+private:
+	bool nextLine();
+	void copyFields(int first, int last, double *var_values) const;
+	void restoreSkippedRows(double *var_values);
+
+	FILE *file_;
+	String line_;
+	StringList column_names_;
+	List<int> column_mapping_;
+	double *row_values_;
+	bool *row_parsed_;
+	RowFilter *filter_;
+	int nb_filter_columns_;  // The columns up to the last one used by the filter
+	int nb_other_columns_;   // The mapped columns after those
+	// End of the lines of the rows rejected by the filter, not parsed yet
+	String *skipped_lines_;
+	int *skipped_offsets_;
+	int nb_skipped_lines_;
+	bool *restored_;
+	long long nb_rows_;
+	long long nb_skipped_rows_;
+	long long nb_bytes_;
+};
+
+/*! \fn const StringList &DataFileReader::columnNames() const
+ *
+ * Return the names of the columns in the header of the file.
+ */
+inline const StringList &DataFileReader::columnNames() const {
+	return column_names_;
+}
+
+/*! \fn int DataFileReader::nbColumns() const
+ *
+ * Return the number of columns in the header of the file.
+ */
+inline int DataFileReader::nbColumns() const {
+	return column_mapping_.size();
+}
+
+/*! \fn long long DataFileReader::nbRows() const
+ *
+ * Return the number of rows read since the file was opened.
+ */
+inline long long DataFileReader::nbRows() const {
+	return nb_rows_;
+}
+
+/*! \fn long long DataFileReader::nbSkippedRows() const
+ *
+ * Return the number of rows rejected by the filter since the file was opened
+ * (they are included in nbRows()).
+ */
+inline long long DataFileReader::nbSkippedRows() const {
+	return nb_skipped_rows_;
+}
+
+/*! \fn long long DataFileReader::nbBytes() const
+ *
+ * Return the number of bytes read since the file was opened, header included.
+ */
+inline long long DataFileReader::nbBytes() const {
+	return nb_bytes_;
+}
+
+#endif
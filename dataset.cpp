@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "dataset.h"
+#include "data_file_reader.h"
+#include "eval_kernels.h"
+#include <stdio.h>
+#include <string.h>
+
+Dataset::Dataset() :
+	nb_rows_(0), capacity_(0), nb_bytes_(0)
+{
+}
+
+Dataset::~Dataset() {
+	clear();
+}
+
+/*! \fn bool Dataset::load(const String &file_name)
+ *
+ * Replace the content of the dataset by the content of the given data file.
+ * Return false if the file cannot be opened.
+ */
+bool Dataset::load(const String &file_name) {
+	clear();
+	DataFileReader reader;
+	if (!reader.open(file_name, StringList(), false))
+		return false;
+	column_names_ = reader.columnNames();
+	int nb_columns = column_names_.size();
+	for (int c = 0 ; c < nb_columns ; ++c) {
+		columns_ << (double*)NULL;
+		missing_ << (unsigned char*)NULL;
+	}
+
+	const double *values;
+	const bool *parsed;
+	int nb_values;
+	while (reader.readFields(values, parsed, nb_values)) {
+		if (nb_rows_ == capacity_)
+			reserve(capacity_ == 0 ? 1024 : 2 * capacity_);
+		for (int c = 0 ; c < nb_columns ; ++c) {
+			if (c < nb_values && parsed[c])
+				columns_[c][nb_rows_] = values[c];
+			else {
+				if (missing_[c] == NULL) {
+					missing_[c] = new unsigned char[capacity_];
+					memset(missing_[c], 0, capacity_);
+				}
+				columns_[c][nb_rows_] = 0.;
+				missing_[c][nb_rows_] = 1;
+			}
+		}
+		++nb_rows_;
+	}
+	// Release the unused capacity
+	if (nb_rows_ > 0 && nb_rows_ < capacity_)
+		reserve(nb_rows_);
+	computeBlockStats();
+	nb_bytes_ = reader.nbBytes();
+	return true;
+}
+
+/*! \fn void Dataset::clear()
+ *
+ * Remove all the columns and rows.
+ */
+void Dataset::clear() {
+	for (int c = 0 ; c < columns_.size() ; ++c) {
+		delete [] columns_[c];
+		delete [] missing_[c];
+		delete [] block_stats_[c];
+	}
+	columns_.clear();
+	missing_.clear();
+	block_stats_.clear();
+	column_names_.clear();
+	nb_rows_ = 0;
+	capacity_ = 0;
+	nb_bytes_ = 0;
+}
+
+/*! \fn long long Dataset::memoryUsage() const
+ *
+ * Return the number of bytes allocated for the values of the dataset.
+ */
+long long Dataset::memoryUsage() const {
+	long long bytes = 0;
+	for (int c = 0 ; c < columns_.size() ; ++c) {
+		bytes += capacity_ * sizeof(double);
+		if (missing_[c] != NULL)
+			bytes += capacity_;
+		bytes += nbBlocks() * sizeof(BlockStats);
+	}
+	return bytes;
+}
+
+/*! \fn List<int> Dataset::mapColumns(const StringList &variables, bool warn_unused) const
+ *
+ * Return for each column the index of the variable with the same name in
+ * \p variables, or -1 if there is none. If \p warn_unused is true a warning
+ * is printed for each column that does not correspond to any variable.
+ */
+List<int> Dataset::mapColumns(const StringList &variables, bool warn_unused) const {
+	List<int> mapping;
+	for (int c = 0 ; c < column_names_.size() ; ++c) {
+		mapping << variables.indexOf(column_names_[c]);
+		if (mapping.last() == -1 && warn_unused)
+			printf("Warning: variable %s ignored as it is not used in any script.\n", column_names_[c].c_str());
+	}
+	return mapping;
+}
+
+/*! \fn void Dataset::copyLastValues(long long first_row, long long end_row, const List<int> &column_mapping, double *var_values) const
+ *
+ * Set the variables to the values they would have after calling copyRow()
+ * for each row from \p first_row to \p end_row (excluded), without copying
+ * all these rows.
+ */
+void Dataset::copyLastValues(long long first_row, long long end_row, const List<int> &column_mapping, double *var_values) const {
+	for (int c = 0 ; c < column_mapping.size() ; ++c) {
+		int var_i = column_mapping[c];
+		if (var_i == -1)
+			continue;
+		for (long long row = end_row - 1 ; row >= first_row ; --row) {
+			if (!isMissing(c, row)) {
+				var_values[var_i] = columns_[c][row];
+				break;
+			}
+		}
+	}
+}
+
+// Grow the columns so that they can hold the given number of rows.
+void Dataset::reserve(long long nb_rows) {
+	for (int c = 0 ; c < columns_.size() ; ++c) {
+		double *column = new double[nb_rows];
+		if (nb_rows_ > 0)
+			memcpy(column, columns_[c], nb_rows_ * sizeof(double));
+		delete [] columns_[c];
+		columns_[c] = column;
+		if (missing_[c] != NULL) {
+			unsigned char *missing = new unsigned char[nb_rows];
+			memcpy(missing, missing_[c], nb_rows_);
+			memset(missing + nb_rows_, 0, nb_rows - nb_rows_);
+			delete [] missing_[c];
+			missing_[c] = missing;
+		}
+	}
+	capacity_ = nb_rows;
+}
+
+// Compute the range of the values of each column in each block of rows.
+// The columns without missing fields use the vectorized minMax() kernel.
+void Dataset::computeBlockStats() {
+	int nb_blocks = nbBlocks();
+	for (int c = 0 ; c < columns_.size() ; ++c) {
+		BlockStats *stats = new BlockStats[nb_blocks];
+		const double *values = columns_[c];
+		for (int b = 0 ; b < nb_blocks ; ++b) {
+			long long start = (long long)b * BlockSize, end = start + blockSize(b);
+			double min = 0., max = 0.;
+			int count = 0;
+			if (missing_[c] == NULL) {
+				// NaN is the only value not equal to itself
+				for (long long row = start ; row < end ; ++row)
+					count += values[row] == values[row];
+				if (count > 0)
+					EvalKernels::minMax(values + start, blockSize(b), min, max);
+				stats[b].min_ = min;
+				stats[b].max_ = max;
+				stats[b].count_ = count;
+				continue;
+			}
+			for (long long row = start ; row < end ; ++row) {
+				double value = values[row];
+				// Skip the missing fields and NaN (the only value not equal to itself)
+				if (isMissing(c, row) || !(value == value))
+					continue;
+				if (count == 0 || value < min)
+					min = value;
+				if (count == 0 || value > max)
+					max = value;
+				++count;
+			}
+			stats[b].min_ = min;
+			stats[b].max_ = max;
+			stats[b].count_ = count;
+		}
+		block_stats_ << stats;
+	}
+}
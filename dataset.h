@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef dataset_h
+#define dataset_h
+
+#include "str.h"
+#include "strlist.h"
+#include "list.h"
+
+/*! \class Dataset
+ *
+ * Content of a data file (see DataFileReader) kept in memory, with the
+ * values of each column stored in a contiguous array. The file is read and
+ * parsed once by load() and can then be used by any number of runs: a row is
+ * copied into the variables of the scripts without any text parsing.
+ *
+ * The rows are also split in blocks of BlockSize rows for which load()
+ * computes the range of the values of each column (see blockStats()). A run
+ * can use them to skip the blocks in which no row can pass a filter without
+ * looking at the rows.
+ *
+ * Example:
+ * \code
+	Dataset dataset;
+	if (dataset.load("data.txt")) {
+		List<int> mapping = dataset.mapColumns(variables.names());
+		for (long long row = 0 ; row < dataset.nbRows() ; ++row) {
+			dataset.copyRow(row, mapping, variables.values());
+			parser.nextRow();
+			parser.evaluate();
+		}
+	}
+ * \endcode
+ */
+class Dataset {
+public:
+	/*! \struct Dataset::BlockStats
+	 *
+	 * Values of one column in one block of rows. The missing fields and the
+	 * values that are NaN are not counted in count_, min_ and max_.
+	 */
+	struct BlockStats {
+		double min_;
+		double max_;
+		int count_;
+	};
+
+	enum { BlockSize = 1024 };
+
+	Dataset();
+	~Dataset();
+
+	bool load(const String &file_name);
+	void clear();
+
+	const StringList &columnNames() const;
+	int nbColumns() const;
+	long long nbRows() const;
+	long long nbBytes() const;
+	long long memoryUsage() const;
+
+	const double *column(int) const;
+	bool isMissing(int column, long long row) const;
+	bool hasMissing(int column) const;
+
+	int nbBlocks() const;
+	int blockSize(int block) const;
+	const BlockStats &blockStats(int column, int block) const;
+
+	List<int> mapColumns(const StringList &variables, bool warn_unused = true) const;
+	void copyRow(long long row, const List<int> &column_mapping, double *var_values) const;
+	void copyLastValues(long long first_row, long long end_row, const List<int> &column_mapping, double *var_values) const;
+
+private:
+	// Not copyable: the columns are owned by the dataset.
+	Dataset(const Dataset&);
+	Dataset &operator=(const Dataset&);
+
+	void reserve(long long nb_rows);
+	void computeBlockStats();
+
+	StringList column_names_;
+	List<double*> columns_;
+	// For each column, NULL if all its fields are numbers or else one flag
+	// per row set for the fields that are missing or are not numbers.
+	List<unsigned char*> missing_;
+	// For each column, the statistics of each block of rows
+	List<BlockStats*> block_stats_;
+	long long nb_rows_;
+	long long capacity_;
+	long long nb_bytes_;
+};
+
+/*! \fn const StringList &Dataset::columnNames() const
+ *
+ * Return the names of the columns, as given in the header of the file.
+ */
+inline const StringList &Dataset::columnNames() const {
+	return column_names_;
+}
+
+inline int Dataset::nbColumns() const {
+	return column_names_.size();
+}
+
+inline long long Dataset::nbRows() const {
+	return nb_rows_;
+}
+
+/*! \fn long long Dataset::nbBytes() const
+ *
+ * Return the size of the file the dataset was loaded from.
+ */
+inline long long Dataset::nbBytes() const {
+	return nb_bytes_;
+}
+
+/*! \fn const double *Dataset::column(int column) const
+ *
+ * Return the values of the given column, one per row. The value of a
+ * missing field is 0 (see isMissing()).
+ */
+inline const double *Dataset::column(int column) const {
+	return columns_[column];
+}
+
+/*! \fn bool Dataset::isMissing(int column, long long row) const
+ *
+ * Return true if the field of the given row and column was missing or was
+ * not a number in the file.
+ */
+inline bool Dataset::isMissing(int column, long long row) const {
+	return missing_[column] != NULL && missing_[column][row];
+}
+
+/*! \fn bool Dataset::hasMissing(int column) const
+ *
+ * Return true if at least one field of the given column was missing or was
+ * not a number in the file.
+ */
+inline bool Dataset::hasMissing(int column) const {
+	return missing_[column] != NULL;
+}
+
+inline int Dataset::nbBlocks() const {
+	return (int)((nb_rows_ + BlockSize - 1) / BlockSize);
+}
+
+/*! \fn int Dataset::blockSize(int block) const
+ *
+ * Return the number of rows in the given block: BlockSize for all the blocks
+ * but the last one.
+ */
+inline int Dataset::blockSize(int block) const {
+	long long start = (long long)block * BlockSize;
+	return nb_rows_ - start < BlockSize ? (int)(nb_rows_ - start) : (int)BlockSize;
+}
+
+/*! \fn const Dataset::BlockStats &Dataset::blockStats(int column, int block) const
+ *
+ * Return the range of the values of the given column in the given block. All
+ * the rows of the block have a value in that range if count_ is equal to
+ * blockSize().
+ */
+inline const Dataset::BlockStats &Dataset::blockStats(int column, int block) const {
+	return block_stats_[column][block];
+}
+
+/*! \fn void Dataset::copyRow(long long row, const List<int> &column_mapping, double *var_values) const
+ *
+ * Copy the values of the given row into \p var_values, using the mapping
+ * returned by mapColumns(). As with DataFileReader::readRow(), the missing
+ * fields leave the corresponding variable unchanged.
+ */
+inline void Dataset::copyRow(long long row, const List<int> &column_mapping, double *var_values) const {
+	for (int c = 0 ; c < column_mapping.size() ; ++c) {
+		int var_i = column_mapping[c];
+		if (var_i != -1 && !isMissing(c, row))
+			var_values[var_i] = columns_[c][row];
+	}
+}
+
+#endif
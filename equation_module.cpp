@@ -19,6 +19,7 @@
 
 #include "equation_parser.h"
 #include "modules.h"
+#include "fast_math.h"
 #include <math.h>
 #include <ctype.h>
 #include <stdio.h>
@@ -69,8 +70,30 @@ void printEquationModuleHelp(int mode) {
 		printf("  - urand(min, max)  A random number between min and max (uniform distribution).\n");
 		printf("  - nrand(mean, sigma) A random number with a normal (Gaussian) distribution.\n");
 		printf("  - rands(s)  Set a seed for the urand() and nrand() functions and return the seed.\n");
+		printf("  - rands(s, n) Same as rands(s) but use the independent stream n (n >= 0) for that seed.\n");
+		printf("              An invalid seed or stream returns NaN and does not change the seed.\n");
 		printf("  - if (x, y, z) If x is true (not equal to zero) return y, otherwise return z.\n");
 		printf("  - print(x [, y, \"text\", z...])  Print the passed values and strings.\n");
+		printf("  - memo(f(x, y)) Same as f(x, y) but keep the results for the last values of x and y.\n");
+		printf("The following aggregate functions add x to the values seen by that call in the\n");
+		printf("script and return the result for all those values. They are meant for scripts\n");
+		printf("run on a data file (see 'help script' in script mode):\n");
+		printf("  - count(x)  The number of values.\n");
+		printf("  - sum(x)    The sum of the values.\n");
+		printf("  - mean(x)   The mean of the values.\n");
+		printf("  - variance(x) The variance of the values (sample variance, n - 1).\n");
+		printf("  - stddev(x) The standard deviation of the values (square root of the variance).\n");
+		printf("  - minimum(x) The smallest value.\n");
+		printf("  - maximum(x) The largest value.\n");
+		printf("  - quantile(x, q) The value below which there is the fraction q of the values (within 1%%).\n");
+		printf("  - median(x) Same as quantile(x, 0.5).\n");
+		printf("The following window functions work on the last values of x seen by that call\n");
+		printf("(the last rows of the data). n must be an integer number:\n");
+		printf("  - lag(x, n)  The value of x n calls earlier (NaN for the first n calls).\n");
+		printf("  - rolling_mean(x, n) The mean of the last n values.\n");
+		printf("  - rolling_min(x, n) The smallest of the last n values.\n");
+		printf("  - rolling_max(x, n) The largest of the last n values.\n");
+		printf("  - ema(x, a) Exponential moving average: a * x + (1 - a) * previous average.\n");
 		break;
 	case 3:
 		printf("The recognized operators are:\n");
@@ -100,6 +123,10 @@ void printEquationModuleHelp(int mode) {
 	case 4:
 		printf("The recognized debug commands are:\n");
 		printf("  - tree <equation>  Prints the parser tree for the given equation.\n");
+		printf("  - fastmath [on|off] Enable or disable the fast approximations of exp(), log(), sin() and cos().\n");
+		printf("  - mathcheck        Print the maximum error observed for the fast math approximations.\n");
+		printf("  - compare [exact|tolerant] Select how ==, !=, <= and >= compare values: exactly (the default)\n");
+		printf("                     or ignoring differences of up to 100 ULP.\n");
 		break;
 	case 5:
 		printf("You can define or undefine variables that can then be used in equations:\n");
@@ -192,6 +219,39 @@ void runEquationModule() {
 			continue;
 		}
 		
+		if (line == "fastmath" || line.startsWith("fastmath ")) {
+			String mode = line.right(8).trimmed();
+			if (mode == "on")
+				EquationParser::setFastMath(true);
+			else if (mode == "off")
+				EquationParser::setFastMath(false);
+			else if (!mode.isEmpty()) {
+				printf("Unknown fast math mode '%s' (use 'on' or 'off').\n", mode.c_str());
+				continue;
+			}
+			printf("Fast math is %s.\n", EquationParser::fastMath() ? "on" : "off");
+			continue;
+		}
+
+		if (line == "mathcheck") {
+			FastMath::selfCheck();
+			continue;
+		}
+
+		if (line == "compare" || line.startsWith("compare ")) {
+			String mode = line.right(7).trimmed();
+			if (mode == "exact")
+				EquationParser::setTolerantComparisons(false);
+			else if (mode == "tolerant")
+				EquationParser::setTolerantComparisons(true);
+			else if (!mode.isEmpty()) {
+				printf("Unknown comparison mode '%s' (use 'exact' or 'tolerant').\n", mode.c_str());
+				continue;
+			}
+			printf("Comparisons are %s.\n", EquationParser::tolerantComparisons() ? "tolerant" : "exact");
+			continue;
+		}
+
 		if (line == "variables") {
 			int nb = variables.size();
 			switch (nb) {
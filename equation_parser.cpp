@@ -20,12 +20,17 @@
 #include "equation_parser.h"
 #include "parser_operators.h"
 #include "redirect_output.h"
+#include "script_cache.h"
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <iostream>
+#include <typeinfo>
 
 String EquationParser::nullStr_;
+bool EquationParser::fast_math_ = false;
+bool EquationParser::tolerant_comparisons_ = false;
+EvaluationContext *EquationParser::context_ = NULL;
 
 /*! \fn EquationParser::EquationParser()
  *
@@ -33,7 +38,8 @@ String EquationParser::nullStr_;
  */
 EquationParser::EquationParser() :
 	expression_(NULL), auto_add_args_(false), max_nb_args_(0),
-	args_double_(NULL), own_args_double_(true), start_point_(NULL)
+	args_double_(NULL), own_args_double_(true), start_point_(NULL),
+	scope_(NULL), bindings_(NULL), recursive_(false)
 {
 }
 
@@ -45,6 +51,8 @@ EquationParser::~EquationParser() {
 	if (start_point_)
 		delete start_point_;
 	clearArguments();
+	for (int i = 0 ; i < functions_.size() ; ++i)
+		functions_[i]->release();
 	errors_.clear();
 	equation_.clear();
 }
@@ -57,6 +65,8 @@ void EquationParser::clearArguments() {
 		own_args_double_ = true;
 	}
 	args_names_.clear();
+	args_index_.clear();
+	auto_variables_.clear();
 	max_nb_args_ = 0;
 }
 
@@ -77,6 +87,14 @@ double EquationParser::evaluate(double *arg) {
 	return result;
 }
 
+/*! \fn EvaluationContext *EquationParser::context()
+ *
+ * Return the context used by the equations parsed afterward.
+ */
+EvaluationContext *EquationParser::context() {
+	return context_ != NULL ? context_ : EvaluationContext::defaultContext();
+}
+
 // Parser
 
 /*! \fn bool EquationParser::parse(const String& equation, const StringList& variables_names, bool auto_add_variables = false, double* variable_array = NULL)
@@ -111,45 +129,439 @@ bool EquationParser::parse(
 		delete start_point_;
 		start_point_ = NULL;
 	}
-	clearArguments();
-	errors_.clear();
-	expression_ = NULL;
-	equation_ = equation;
-	if (equation_.isEmpty()) {
-		equation_ = NULL;
-		return false;
-	}
+	setVariables(variables_names, auto_add_variables, variable_array);
+	start_point_ = compile(equation);
+	return (start_point_ != NULL);
+}
 
-	max_nb_args_ = variables_names.size();
+/*! \fn void EquationParser::setVariables(const StringList& variables_names, bool auto_add_variables = false, double* variable_array = NULL)
+ *
+ * Set the variables used by the equations compiled afterward with compile().
+ * The arguments are the same as for parse(). This is used to parse several
+ * equations that share the same variables with a single EquationParser (e.g.
+ * what the ScriptParser does).
+ *
+ * In the auto-add mode the value array grows as variables are found, and the
+ * variables of the equations compiled so far are moved to the new array. The
+ * compiled equations must therefore not be deleted before the last call to
+ * compile() or setVariables().
+ */
+void EquationParser::setVariables(
+	const StringList& variables_names,
+	bool auto_add_variables,
+	double* variable_array
+) {
+	clearArguments();
 	auto_add_args_ = auto_add_variables;
-	if (auto_add_args_)
-		max_nb_args_ += 50;
+	max_nb_args_ = variables_names.size();
 	if (max_nb_args_ > 0) {
 		if (auto_add_variables || variable_array == NULL) {
 			args_double_ = new double[max_nb_args_];
+			memset(args_double_, 0, max_nb_args_ * sizeof(double));
 			own_args_double_ = true;
 		} else {
 			args_double_ = variable_array;
 			own_args_double_ = false;
 		}
 	}
-
 	args_names_ = variables_names;
+	args_index_.build(args_names_);
+}
+
+/*! \fn ParserOperator *EquationParser::compile(const String& equation)
+ *
+ * Parse an equation with the variables given to setVariables() and return
+ * its operator tree, or NULL if the equation cannot be parsed (the errors
+ * are then available with nbErrors() and getError()). The caller owns the
+ * returned tree, which can be evaluated directly.
+ */
+ParserOperator *EquationParser::compile(const String& equation) {
+	errors_.clear();
+	expression_ = NULL;
+	equation_ = equation;
+	if (equation_.isEmpty()) {
+		equation_ = NULL;
+		return NULL;
+	}
 
+	int nb_auto_variables = auto_variables_.size();
 	expression_ = equation_.c_str();
 
+	ParserOperator *result = NULL;
 	getToken();
-	if (!*token_) {
+	if (!*token_)
 		syntaxError(2);
+	else {
+		result = eval_exp();
+		if (*token_ != 0 && result) {
+			delete result;
+			result = NULL;
+			syntaxError(0);
+		}
+	}
+	if (result == NULL) {
+		// Forget the variables of the deleted tree
+		while (auto_variables_.size() > nb_auto_variables)
+			auto_variables_.removeAt(auto_variables_.size() - 1);
+	}
+#ifdef PARSER_INSTRUMENTATION
+	instrument(result);
+#endif
+	return result;
+}
+
+// Add a variable in the auto-add mode and return its index.
+int EquationParser::addVariable(const String& name) {
+	if (args_names_.size() == max_nb_args_) {
+		int capacity = max_nb_args_ < 16 ? 16 : 2 * max_nb_args_;
+		double *values = new double[capacity];
+		if (args_double_ != NULL)
+			memcpy(values, args_double_, args_names_.size() * sizeof(double));
+		// Move the variables of the equations compiled so far to the new array
+		for (int i = 0 ; i < auto_variables_.size() ; ++i) {
+			VariableOperator *variable = auto_variables_[i];
+			variable->setValuePointer(values + (variable->valuePointer() - args_double_));
+		}
+		if (own_args_double_)
+			delete [] args_double_;
+		args_double_ = values;
+		own_args_double_ = true;
+		max_nb_args_ = capacity;
+	}
+	int arg = args_names_.size();
+	args_double_[arg] = 0.;
+	args_names_ << name;
+	args_index_.insert(name, arg);
+	return arg;
+}
+
+// Names of the functions recognized by eval_exp10(), which cannot be
+// redefined.
+static const char *const built_in_functions[] = {
+	"print", "sign", "cos", "sin", "tan", "sqrt", "cbrt", "exp", "pow", "round",
+	"ceil", "floor", "fabs", "abs", "log10", "log", "ln", "asin", "acos", "atan",
+	"atan2", "sinh", "cosh", "tanh", "asinh", "acosh", "atanh", "degToRad",
+	"radToDeg", "min", "max", "urand", "nrand", "rands", "count", "sum", "mean",
+	"variance", "stddev", "minimum", "maximum", "median", "quantile", "lag",
+	"rolling_mean", "rolling_min", "rolling_max", "ema", "if", "memo", NULL
+};
+
+static bool isIdentifier(const String &name) {
+	if (name.isEmpty() || !isalpha(name[0]))
 		return false;
+	for (int i = 1 ; i < name.length() ; ++i) {
+		if (!isalnum(name[i]) && name[i] != '_')
+			return false;
 	}
-	start_point_ = eval_exp();
-	if (*token_ != 0 && start_point_) {
-		delete start_point_;
-		start_point_ = NULL;
-		syntaxError(0);
+	return true;
+}
+
+// Return true if the given equation uses an aggregate or a window function.
+static bool hasStatefulFunction(const ParserOperator *op) {
+	if (op == NULL)
+		return false;
+	if (
+		dynamic_cast<const AggregateOperator*>(op) != NULL ||
+		dynamic_cast<const QuantileAggregateOperator*>(op) != NULL ||
+		dynamic_cast<const WindowOperator*>(op) != NULL
+	)
+		return true;
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		if (hasStatefulFunction(op->child(i)))
+			return true;
 	}
-	return (start_point_ != NULL);
+	return false;
+}
+
+// Return true if the given equation or one of its operands has side effects.
+static bool hasSideEffects(const ParserOperator *op) {
+	if (op == NULL)
+		return false;
+	if (op->hasSideEffects())
+		return true;
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		if (hasSideEffects(op->child(i)))
+			return true;
+	}
+	return false;
+}
+
+/*! \fn bool EquationParser::defineFunction(const String& name, const StringList& parameters, const String& body, bool memoized = false)
+ *
+ * Define a function that can be used by the equations compiled afterward
+ * with this parser. The \p body is an equation that can only use the
+ * \p parameters and the functions defined before, including this function
+ * itself. Return false if the function cannot be defined (the errors are
+ * then available with nbErrors() and getError()).
+ *
+ * Small functions that do not call themselves are inlined in the equations
+ * that use them. The others are evaluated with a call (see UserFunction).
+ * Aggregate and window functions cannot be used in the body, since all the
+ * calls would share their state.
+ *
+ * If \p memoized is true each call keeps the results for the last arguments
+ * it was given (see MemoOperator). The body must then have no side effects.
+ */
+bool EquationParser::defineFunction(const String& name, const StringList& parameters, const String& body, bool memoized) {
+	errors_.clear();
+	for (int i = 0 ; built_in_functions[i] != NULL ; ++i) {
+		if (name == built_in_functions[i]) {
+			errors_ << String::format("%s() is a built-in function", name.c_str());
+			return false;
+		}
+	}
+	if (!isIdentifier(name))
+		errors_ << String::format("Invalid function name: %s", name.c_str());
+	else if (findFunction(name) != NULL)
+		errors_ << String::format("Function %s() is already defined", name.c_str());
+	else if (parameters.size() > UserFunction::MaxParameters)
+		errors_ << String::format("A function cannot have more than %d parameters", (int)UserFunction::MaxParameters);
+	for (int i = 0 ; i < parameters.size() && errors_.isEmpty() ; ++i) {
+		if (!isIdentifier(parameters[i]) || parameters[i] == "PI")
+			errors_ << String::format("Invalid parameter name: %s", parameters[i].c_str());
+		else if (parameters.indexOf(parameters[i]) != i)
+			errors_ << String::format("Duplicate parameter: %s", parameters[i].c_str());
+	}
+	if (!errors_.isEmpty())
+		return false;
+
+	// The function is visible in its own body
+	UserFunction *function = new UserFunction(name, parameters, memoized);
+	unsigned int first_call_site = context()->nextCallSite();
+	functions_ << function;
+	scope_ = function;
+	bindings_ = NULL;
+	recursive_ = false;
+	ParserOperator *tree = compileBody(body);
+	scope_ = NULL;
+	if (tree != NULL && hasStatefulFunction(tree)) {
+		errors_ << "Aggregate and window functions cannot be used in a function";
+		delete tree;
+		tree = NULL;
+	} else if (tree != NULL && memoized && hasSideEffects(tree)) {
+		errors_ << "A memo function cannot have side effects";
+		delete tree;
+		tree = NULL;
+	}
+	if (tree == NULL) {
+		functions_.removeAt(functions_.size() - 1);
+		function->release();
+		context()->resetCallSites(first_call_site);
+		return false;
+	}
+	function->setBody(body, tree, recursive_);
+	// The body of an inlined function is compiled again for each call, and
+	// only these copies are evaluated and saved in the ScriptCache. They get
+	// the ids of the random call sites, as when the script is loaded from the
+	// cache.
+	if (function->isInlined())
+		context()->resetCallSites(first_call_site);
+	return true;
+}
+
+// Compile the body of a function in the middle of the current equation,
+// without clearing the errors.
+ParserOperator *EquationParser::compileBody(const String& body) {
+	String equation = equation_;
+	int position = expression_ != NULL ? (int)(expression_ - equation_.c_str()) : -1;
+	char token[sizeof(token_)];
+	memcpy(token, token_, sizeof(token_));
+	TokenType token_type = token_type_;
+
+	equation_ = body;
+	expression_ = equation_.c_str();
+	ParserOperator *result = NULL;
+	getToken();
+	if (!*token_)
+		syntaxError(2);
+	else {
+		result = eval_exp();
+		if (*token_ != 0 && result) {
+			delete result;
+			result = NULL;
+			syntaxError(0);
+		}
+	}
+
+	equation_ = equation;
+	expression_ = position != -1 ? equation_.c_str() + position : NULL;
+	memcpy(token_, token, sizeof(token_));
+	token_type_ = token_type;
+	return result;
+}
+
+UserFunction *EquationParser::findFunction(const String& name) const {
+	for (int i = 0 ; i < functions_.size() ; ++i) {
+		if (functions_[i]->name() == name)
+			return functions_[i];
+	}
+	return NULL;
+}
+
+// Return the operator for a parameter used in the body of a function.
+ParserOperator *EquationParser::parameter(const String& name) {
+	int index = scope_->parameters().indexOf(name);
+	if (index == -1) {
+		syntaxError(6);
+		return NULL;
+	}
+	if (bindings_ == NULL)
+		return new FrameParameterOperator(scope_->framePointer(), index, name);
+	const ParameterBinding &binding = (*bindings_)[index];
+	if (binding.variable_ != NULL) {
+		VariableOperator *variable = new VariableOperator(binding.variable_, binding.name_);
+		if (auto_add_args_)
+			auto_variables_ << variable;
+		return variable;
+	}
+	if (binding.slot_ != NULL)
+		return new ParameterOperator(binding.slot_, name);
+	return new ConstantOperator(binding.constant_, binding.name_);
+}
+
+// Parse the arguments of a call to a user function, from the '(' to the ')'.
+ParserOperator *EquationParser::parseCall(UserFunction *function) {
+	getToken(); // skip (
+	getToken();
+	List<ParserOperator*> arguments;
+	bool ok = true;
+	if (*token_ != ')') {
+		do {
+			ParserOperator *pop = eval_exp();
+			if (pop == NULL) {
+				ok = false;
+				break;
+			}
+			arguments << pop;
+			if (*token_ != ',')
+				break;
+			getToken();
+		} while (1);
+	}
+	if (ok && arguments.size() != function->nbParameters()) {
+		errors_ << String::format(
+			"%s() takes %d argument(s) but %d were given",
+			function->name().c_str(), function->nbParameters(), arguments.size()
+		);
+		ok = false;
+	}
+	if (!ok) {
+		for (int i = 0 ; i < arguments.size() ; ++i)
+			delete arguments[i];
+		return NULL;
+	}
+	if (!function->isMemoized())
+		return callOperator(function, arguments);
+
+	// The call reads the arguments from the MemoOperator
+	double *values = new double[arguments.size()];
+	List<ParserOperator*> parameters;
+	for (int i = 0 ; i < arguments.size() ; ++i)
+		parameters << new ParameterOperator(values + i, function->parameters()[i]);
+	ParserOperator *call = callOperator(function, parameters);
+	if (call == NULL) {
+		for (int i = 0 ; i < arguments.size() ; ++i)
+			delete arguments[i];
+		delete [] values;
+		return NULL;
+	}
+	return new MemoOperator(arguments, values, call);
+}
+
+// Return the operator for a call of a user function with the given arguments.
+ParserOperator *EquationParser::callOperator(UserFunction *function, const List<ParserOperator*>& arguments) {
+	if (function == scope_ && bindings_ == NULL) {
+		// Recursive call: the function owns the operator
+		recursive_ = true;
+		return new FunctionCallOperator(function, arguments, false);
+	}
+	if (!function->isInlined())
+		return new FunctionCallOperator(function, arguments);
+	return inlineCall(function, arguments);
+}
+
+// Compile the body of an inlined function for the given arguments. The
+// variables and constants are used in place of the parameters, unless another
+// argument has side effects (they must be read before it is evaluated). The
+// other arguments are evaluated by an InlineCallOperator.
+ParserOperator *EquationParser::inlineCall(UserFunction *function, const List<ParserOperator*>& arguments) {
+	bool side_effects = false;
+	for (int i = 0 ; i < arguments.size() ; ++i)
+		side_effects = side_effects || hasSideEffects(arguments[i]);
+	double *slots = new double[function->nbParameters()];
+	List<ParserOperator*> evaluated;
+	List<ParameterBinding> bindings;
+	for (int i = 0 ; i < arguments.size() ; ++i) {
+		ParameterBinding binding;
+		binding.variable_ = NULL;
+		binding.slot_ = NULL;
+		binding.constant_ = 0.;
+		VariableOperator *variable = dynamic_cast<VariableOperator*>(arguments[i]);
+		ConstantOperator *constant = dynamic_cast<ConstantOperator*>(arguments[i]);
+		ParameterOperator *parameter = dynamic_cast<ParameterOperator*>(arguments[i]);
+		if (parameter != NULL) {
+			// Parameter of the enclosing call, whose slot is set before the body
+			// of this one is evaluated
+			binding.slot_ = parameter->slot();
+			delete parameter;
+		} else if (variable != NULL && !side_effects) {
+			binding.variable_ = variable->valuePointer();
+			binding.name_ = variable->name();
+			int index = auto_variables_.indexOf(variable);
+			if (index != -1)
+				auto_variables_.removeAt(index);
+			delete variable;
+		} else if (constant != NULL) {
+			binding.constant_ = constant->value();
+			binding.name_ = constant->name();
+			delete constant;
+		} else {
+			binding.slot_ = slots + evaluated.size();
+			evaluated << arguments[i];
+		}
+		bindings << binding;
+	}
+
+	UserFunction *scope = scope_;
+	const List<ParameterBinding> *scope_bindings = bindings_;
+	scope_ = function;
+	bindings_ = &bindings;
+	ParserOperator *body = compileBody(function->bodyText());
+	scope_ = scope;
+	bindings_ = scope_bindings;
+
+	if (body == NULL || evaluated.isEmpty()) {
+		for (int i = 0 ; i < evaluated.size() ; ++i)
+			delete evaluated[i];
+		delete [] slots;
+		return body;
+	}
+	return new InlineCallOperator(function->name(), evaluated, slots, body);
+}
+
+// Keep the results of the given call for the last values of its operands
+// (see MemoOperator). The operands are replaced by ParameterOperator.
+ParserOperator *EquationParser::memoize(ParserOperator *call) {
+	int nb_arguments = call->nbChildren();
+	const char *error = NULL;
+	if (nb_arguments == 0 || nb_arguments > MemoCache::MaxArguments)
+		error = "memo() must be given a function call";
+	else if (hasSideEffects(call))
+		error = "memo() cannot be used on a function with side effects";
+	else if (dynamic_cast<InlineCallOperator*>(call) != NULL || dynamic_cast<MemoOperator*>(call) != NULL)
+		error = "memo() cannot be used on a function of the script (use 'memo function' instead)";
+	if (error != NULL) {
+		errors_ << error;
+		delete call;
+		return NULL;
+	}
+	double *values = new double[nb_arguments];
+	List<ParserOperator*> arguments;
+	for (int i = 0 ; i < nb_arguments ; ++i) {
+		arguments << call->child(i);
+		*call->childSlot(i) = new ParameterOperator(values + i, String::format("argument %d", i + 1));
+	}
+	return new MemoOperator(arguments, values, call);
 }
 
 void EquationParser::getToken() {
@@ -392,10 +804,16 @@ ParserOperator *EquationParser::eval_exp3() {
 		}
 		switch (op1) {
 			case '!':
-				lop = new NotEqualOperator(lop, rop);
+				if (tolerant_comparisons_)
+					lop = new TolerantNotEqualOperator(lop, rop);
+				else
+					lop = new NotEqualOperator(lop, rop);
 				break;
 			case '=':
-				lop = new EqualOperator(lop, rop);
+				if (tolerant_comparisons_)
+					lop = new TolerantEqualOperator(lop, rop);
+				else
+					lop = new EqualOperator(lop, rop);
 				break;
 		}
 		// Make sure op1 and op2 are initialized for the next while test
@@ -423,16 +841,20 @@ ParserOperator *EquationParser::eval_exp4() {
 		}
 		switch (op1) {
 			case '<':
-				if (op2 == '=')
-					lop = new EqualOrSmallerOperator(lop, rop);
-				else
+				if (op2 != '=')
 					lop = new SmallerOperator(lop, rop);
+				else if (tolerant_comparisons_)
+					lop = new TolerantEqualOrSmallerOperator(lop, rop);
+				else
+					lop = new EqualOrSmallerOperator(lop, rop);
 				break;
 			case '>':
-				if (op2 == '=')
-					lop = new EqualOrGreaterOperator(lop, rop);
-				else
+				if (op2 != '=')
 					lop = new GreaterOperator(lop, rop);
+				else if (tolerant_comparisons_)
+					lop = new TolerantEqualOrGreaterOperator(lop, rop);
+				else
+					lop = new EqualOrGreaterOperator(lop, rop);
 				break;
 		}
 		// Make sure op1 and op2 are initialized for the next while test
@@ -631,24 +1053,26 @@ ParserOperator *EquationParser::eval_exp10() {
 					result = new ConstantOperator(M_PI, "PI");
 					break;
 				}
+				// Only the parameters are visible in the body of a function
+				if (scope_ != NULL) {
+					result = parameter(token_);
+					break;
+				}
 				// look if variable exists
 				String var_name(token_);
-				int arg = args_names_.indexOf(var_name);
+				int arg = args_index_.indexOf(var_name);
 				if (arg == -1) {
-					if (auto_add_args_) {
-						if (args_names_.size() < max_nb_args_) {
-							arg = args_names_.size();
-							args_double_[arg] = 0.;
-							args_names_ << var_name;
-						} else {
-							syntaxError(7);
-						}
-					} else {
+					if (auto_add_args_)
+						arg = addVariable(var_name);
+					else
 						syntaxError(6);
-					}
 				}
-				if (arg != -1)
-					result = new VariableOperator(args_double_ + arg, var_name);
+				if (arg != -1) {
+					VariableOperator *variable = new VariableOperator(args_double_ + arg, var_name);
+					if (auto_add_args_)
+						auto_variables_ << variable;
+					result = variable;
+				}
 			}
 			break;
 		case EquationParser::FUNCTION: {
@@ -685,14 +1109,22 @@ ParserOperator *EquationParser::eval_exp10() {
 					getToken(); // skip (
 					getToken();
 					ParserOperator *pop = eval_exp();
-					if (pop != NULL)
-						result = new CosOperator(pop);
+					if (pop != NULL) {
+						if (fast_math_)
+							result = new FastCosOperator(pop);
+						else
+							result = new CosOperator(pop);
+					}
 				} else if (strcmp(token_, "sin") == 0) {
 					getToken(); // skip (
 					getToken();
 					ParserOperator *pop = eval_exp();
-					if (pop != NULL)
-						result = new SinOperator(pop);
+					if (pop != NULL) {
+						if (fast_math_)
+							result = new FastSinOperator(pop);
+						else
+							result = new SinOperator(pop);
+					}
 				} else if (strcmp(token_, "tan") == 0) {
 					getToken(); // skip (
 					getToken();
@@ -715,8 +1147,12 @@ ParserOperator *EquationParser::eval_exp10() {
 					getToken(); // skip (
 					getToken();
 					ParserOperator *pop = eval_exp();
-					if (pop != NULL)
-						result = new ExpOperator(pop);
+					if (pop != NULL) {
+						if (fast_math_)
+							result = new FastExpOperator(pop);
+						else
+							result = new ExpOperator(pop);
+					}
 				} else if (strcmp(token_, "pow") == 0) {
 					getToken(); // skip (
 					getToken();
@@ -764,8 +1200,12 @@ ParserOperator *EquationParser::eval_exp10() {
 					getToken(); // skip (
 					getToken();
 					ParserOperator *pop = eval_exp();
-					if (pop != NULL)
-						result = new LogOperator(pop);
+					if (pop != NULL) {
+						if (fast_math_)
+							result = new FastLogOperator(pop);
+						else
+							result = new LogOperator(pop);
+					}
 				} else if (strcmp(token_, "asin") == 0) {
 					getToken(); // skip (
 					getToken();
@@ -881,7 +1321,7 @@ ParserOperator *EquationParser::eval_exp10() {
 							getToken();
 							ParserOperator *rop = eval_exp();
 							if (!rop) delete lop;
-							else result = new URandOperator(lop,rop);
+							else result = new URandOperator(lop, rop, context());
 						}
 					}
 				} else if (strcmp(token_, "nrand") == 0) {
@@ -894,15 +1334,134 @@ ParserOperator *EquationParser::eval_exp10() {
 							getToken();
 							ParserOperator *rop = eval_exp();
 							if (!rop) delete lop;
-							else result = new NRandOperator(lop,rop);
+							else result = new NRandOperator(lop, rop, context());
 						}
 					}
 				} else if (strcmp(token_, "rands") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *lop = eval_exp();
+					if (lop) {
+						if (*token_ != ',')
+							result = new RandSeedOperator(lop, NULL, context());
+						else {
+							getToken();
+							ParserOperator *rop = eval_exp();
+							if (!rop) delete lop;
+							else result = new RandSeedOperator(lop, rop, context());
+						}
+					}
+				} else if (strcmp(token_, "count") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *pop = eval_exp();
+					if (pop != NULL)
+						result = new CountAggregateOperator(pop);
+				} else if (strcmp(token_, "sum") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *pop = eval_exp();
+					if (pop != NULL)
+						result = new SumAggregateOperator(pop);
+				} else if (strcmp(token_, "mean") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *pop = eval_exp();
+					if (pop != NULL)
+						result = new MeanAggregateOperator(pop);
+				} else if (strcmp(token_, "variance") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *pop = eval_exp();
+					if (pop != NULL)
+						result = new VarianceAggregateOperator(pop);
+				} else if (strcmp(token_, "stddev") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *pop = eval_exp();
+					if (pop != NULL)
+						result = new StdDevAggregateOperator(pop);
+				} else if (strcmp(token_, "minimum") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *pop = eval_exp();
+					if (pop != NULL)
+						result = new MinimumAggregateOperator(pop);
+				} else if (strcmp(token_, "maximum") == 0) {
 					getToken(); // skip (
 					getToken();
 					ParserOperator *pop = eval_exp();
 					if (pop != NULL)
-						result = new RandSeedOperator(pop);
+						result = new MaximumAggregateOperator(pop);
+				} else if (strcmp(token_, "median") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *pop = eval_exp();
+					if (pop != NULL)
+						result = new QuantileAggregateOperator(pop, new ConstantOperator(0.5));
+				} else if (strcmp(token_, "quantile") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *lop = eval_exp();
+					if (lop) {
+						if (*token_ != ',') delete lop;
+						else {
+							getToken();
+							ParserOperator *rop = eval_exp();
+							if (!rop) delete lop;
+							else result = new QuantileAggregateOperator(lop, rop);
+						}
+					}
+				} else if (
+					strcmp(token_, "lag") == 0 || strcmp(token_, "rolling_mean") == 0 ||
+					strcmp(token_, "rolling_min") == 0 || strcmp(token_, "rolling_max") == 0
+				) {
+					String function = token_;
+					getToken(); // skip (
+					getToken();
+					ParserOperator *lop = eval_exp();
+					if (lop) {
+						if (*token_ != ',') delete lop;
+						else {
+							getToken();
+							ParserOperator *rop = eval_exp();
+							if (!rop) delete lop;
+							else if (!WindowOperator::isValidSize(rop)) {
+								errors_ << String::format(
+									"The window size of %s() must be an integer number between 1 and %d",
+									function.c_str(), (int)WindowOperator::MaxSize
+								);
+								delete lop;
+								delete rop;
+							} else if (function == "lag")
+								result = new LagOperator(lop, rop);
+							else if (function == "rolling_mean")
+								result = new RollingMeanOperator(lop, rop);
+							else if (function == "rolling_min")
+								result = new RollingMinimumOperator(lop, rop);
+							else
+								result = new RollingMaximumOperator(lop, rop);
+						}
+					}
+				} else if (strcmp(token_, "ema") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *lop = eval_exp();
+					if (lop) {
+						if (*token_ != ',') delete lop;
+						else {
+							getToken();
+							ParserOperator *rop = eval_exp();
+							if (!rop) delete lop;
+							else result = new EmaOperator(lop, rop);
+						}
+					}
+				} else if (strcmp(token_, "memo") == 0) {
+					getToken(); // skip (
+					getToken();
+					ParserOperator *pop = eval_exp();
+					if (pop != NULL)
+						result = memoize(pop);
 				} else if (strcmp(token_, "if") == 0) {
 					getToken(); // skip (
 					getToken();
@@ -928,9 +1487,13 @@ ParserOperator *EquationParser::eval_exp10() {
 						}
 					}
 				} else {
-					syntaxError(5);
-					getToken(); // skip (
-					break;
+					UserFunction *function = findFunction(token_);
+					if (function == NULL) {
+						syntaxError(5);
+						getToken(); // skip (
+						break;
+					}
+					result = parseCall(function);
 				}
 				if (*token_ != ')') {
 					syntaxError(1);
@@ -990,9 +1553,6 @@ void EquationParser::syntaxError(int type) {
 		case 6:
 			error = String::format("Unkown variable: %s", token_);
 			break;
-		case 7:
-			error = String::format("Detected variable %s but maximum number of unknown variables has been reached", token_);
-			break;
 		case 8:
 			error = "Unbalanced quotes";
 			break;
@@ -1008,18 +1568,296 @@ void EquationParser::syntaxError(int type) {
 		errors_ << error;
 }
 
+// Compiled equations
+
+typedef ParserOperator *(*OperatorFactory)(ParserOperator **args, EvaluationContext *context);
+
+template <class T> static ParserOperator *createOperator1(ParserOperator **args, EvaluationContext*) {
+	return new T(args[0]);
+}
+template <class T> static ParserOperator *createOperator2(ParserOperator **args, EvaluationContext*) {
+	return new T(args[0], args[1]);
+}
+template <class T> static ParserOperator *createRandomOperator(ParserOperator **args, EvaluationContext *context) {
+	return new T(args[0], args[1], context);
+}
+static ParserOperator *createIfOperator(ParserOperator **args, EvaluationContext*) {
+	return new IfOperator(args[0], args[1], args[2]);
+}
+
+struct OperatorCodec {
+	const std::type_info *type_;
+	int nb_args_;
+	OperatorFactory create_;
+};
+
+// Operators with a fixed number of operands. In a compiled equation they are
+// identified by their index in this table (plus first_codec_id), so any change
+// to the table requires a new ScriptCache::formatVersion.
+static const OperatorCodec operator_codecs[] = {
+	{ &typeid(OrOperator), 2, createOperator2<OrOperator> },
+	{ &typeid(AndOperator), 2, createOperator2<AndOperator> },
+	{ &typeid(EqualOperator), 2, createOperator2<EqualOperator> },
+	{ &typeid(GreaterOperator), 2, createOperator2<GreaterOperator> },
+	{ &typeid(SmallerOperator), 2, createOperator2<SmallerOperator> },
+	{ &typeid(EqualOrGreaterOperator), 2, createOperator2<EqualOrGreaterOperator> },
+	{ &typeid(EqualOrSmallerOperator), 2, createOperator2<EqualOrSmallerOperator> },
+	{ &typeid(NotEqualOperator), 2, createOperator2<NotEqualOperator> },
+	{ &typeid(AssignmentOperator), 2, createOperator2<AssignmentOperator> },
+	{ &typeid(IncrementOperator), 2, createOperator2<IncrementOperator> },
+	{ &typeid(SignOperator), 1, createOperator1<SignOperator> },
+	{ &typeid(NSignOperator), 1, createOperator1<NSignOperator> },
+	{ &typeid(PlusOperator), 2, createOperator2<PlusOperator> },
+	{ &typeid(MinusOperator), 2, createOperator2<MinusOperator> },
+	{ &typeid(MultiplyOperator), 2, createOperator2<MultiplyOperator> },
+	{ &typeid(MultiplyAndAssignOperator), 2, createOperator2<MultiplyAndAssignOperator> },
+	{ &typeid(DivideOperator), 2, createOperator2<DivideOperator> },
+	{ &typeid(DivideAndAssignOperator), 2, createOperator2<DivideAndAssignOperator> },
+	{ &typeid(ModuloOperator), 2, createOperator2<ModuloOperator> },
+	{ &typeid(SqrtOperator), 1, createOperator1<SqrtOperator> },
+	{ &typeid(CbrtOperator), 1, createOperator1<CbrtOperator> },
+	{ &typeid(CosOperator), 1, createOperator1<CosOperator> },
+	{ &typeid(SinOperator), 1, createOperator1<SinOperator> },
+	{ &typeid(TanOperator), 1, createOperator1<TanOperator> },
+	{ &typeid(ExpOperator), 1, createOperator1<ExpOperator> },
+	{ &typeid(LogOperator), 1, createOperator1<LogOperator> },
+	{ &typeid(Log10Operator), 1, createOperator1<Log10Operator> },
+	{ &typeid(FastCosOperator), 1, createOperator1<FastCosOperator> },
+	{ &typeid(FastSinOperator), 1, createOperator1<FastSinOperator> },
+	{ &typeid(FastExpOperator), 1, createOperator1<FastExpOperator> },
+	{ &typeid(FastLogOperator), 1, createOperator1<FastLogOperator> },
+	{ &typeid(ASinOperator), 1, createOperator1<ASinOperator> },
+	{ &typeid(ACosOperator), 1, createOperator1<ACosOperator> },
+	{ &typeid(ATanOperator), 1, createOperator1<ATanOperator> },
+	{ &typeid(ATan2Operator), 2, createOperator2<ATan2Operator> },
+	{ &typeid(SinHOperator), 1, createOperator1<SinHOperator> },
+	{ &typeid(CosHOperator), 1, createOperator1<CosHOperator> },
+	{ &typeid(TanHOperator), 1, createOperator1<TanHOperator> },
+	{ &typeid(ASinHOperator), 1, createOperator1<ASinHOperator> },
+	{ &typeid(ACosHOperator), 1, createOperator1<ACosHOperator> },
+	{ &typeid(ATanHOperator), 1, createOperator1<ATanHOperator> },
+	{ &typeid(RoundOperator), 1, createOperator1<RoundOperator> },
+	{ &typeid(CeilOperator), 1, createOperator1<CeilOperator> },
+	{ &typeid(FloorOperator), 1, createOperator1<FloorOperator> },
+	{ &typeid(FAbsOperator), 1, createOperator1<FAbsOperator> },
+	{ &typeid(PowOperator), 2, createOperator2<PowOperator> },
+	{ &typeid(Deg2RadOperator), 1, createOperator1<Deg2RadOperator> },
+	{ &typeid(Rad2DegOperator), 1, createOperator1<Rad2DegOperator> },
+	{ &typeid(MinimumOperator), 2, createOperator2<MinimumOperator> },
+	{ &typeid(MaximumOperator), 2, createOperator2<MaximumOperator> },
+	{ &typeid(URandOperator), 2, createRandomOperator<URandOperator> },
+	{ &typeid(NRandOperator), 2, createRandomOperator<NRandOperator> },
+	{ &typeid(RandSeedOperator), 2, createRandomOperator<RandSeedOperator> },
+	{ &typeid(IfOperator), 3, createIfOperator },
+	{ &typeid(TolerantEqualOperator), 2, createOperator2<TolerantEqualOperator> },
+	{ &typeid(TolerantNotEqualOperator), 2, createOperator2<TolerantNotEqualOperator> },
+	{ &typeid(TolerantEqualOrGreaterOperator), 2, createOperator2<TolerantEqualOrGreaterOperator> },
+	{ &typeid(TolerantEqualOrSmallerOperator), 2, createOperator2<TolerantEqualOrSmallerOperator> },
+	{ &typeid(CountAggregateOperator), 1, createOperator1<CountAggregateOperator> },
+	{ &typeid(SumAggregateOperator), 1, createOperator1<SumAggregateOperator> },
+	{ &typeid(MeanAggregateOperator), 1, createOperator1<MeanAggregateOperator> },
+	{ &typeid(VarianceAggregateOperator), 1, createOperator1<VarianceAggregateOperator> },
+	{ &typeid(StdDevAggregateOperator), 1, createOperator1<StdDevAggregateOperator> },
+	{ &typeid(MinimumAggregateOperator), 1, createOperator1<MinimumAggregateOperator> },
+	{ &typeid(MaximumAggregateOperator), 1, createOperator1<MaximumAggregateOperator> },
+	{ &typeid(QuantileAggregateOperator), 2, createOperator2<QuantileAggregateOperator> },
+	{ &typeid(LagOperator), 2, createOperator2<LagOperator> },
+	{ &typeid(RollingMeanOperator), 2, createOperator2<RollingMeanOperator> },
+	{ &typeid(RollingMinimumOperator), 2, createOperator2<RollingMinimumOperator> },
+	{ &typeid(RollingMaximumOperator), 2, createOperator2<RollingMaximumOperator> },
+	{ &typeid(EmaOperator), 2, createOperator2<EmaOperator> }
+};
+static const int nb_operator_codecs = sizeof(operator_codecs) / sizeof(OperatorCodec);
+
+// Ids of the operators that need special handling in compiled equations
+enum { NULL_OPERATOR_ID, CONSTANT_ID, VARIABLE_ID, PRINT_ID, first_codec_id };
+
+bool EquationParser::saveOperator(const ParserOperator *op, CacheWriter &writer) const {
+	if (op == NULL) {
+		writer.writeInt(NULL_OPERATOR_ID);
+		return true;
+	}
+	const std::type_info &type = typeid(*op);
+	if (type == typeid(ConstantOperator)) {
+		const ConstantOperator *constant = static_cast<const ConstantOperator*>(op);
+		writer.writeInt(CONSTANT_ID);
+		writer.writeDouble(constant->value());
+		writer.writeString(constant->name());
+		return true;
+	}
+	if (type == typeid(VariableOperator)) {
+		// Variables are saved as their index in the variables names
+		int index = static_cast<const VariableOperator*>(op)->valuePointer() - args_double_;
+		if (args_double_ == NULL || index < 0 || index >= args_names_.size())
+			return false;
+		writer.writeInt(VARIABLE_ID);
+		writer.writeInt(index);
+		return true;
+	}
+	if (type == typeid(PrintOperator)) {
+		const PrintOperator *print = static_cast<const PrintOperator*>(op);
+		writer.writeInt(PRINT_ID);
+		writer.writeInt(print->values().size());
+		for (int i = 0 ; i < print->values().size() ; ++i) {
+			if (!saveOperator(print->values().at(i), writer))
+				return false;
+		}
+		writer.writeStringList(print->strings());
+		return true;
+	}
+	for (int id = 0 ; id < nb_operator_codecs ; ++id) {
+		if (type == *operator_codecs[id].type_) {
+			writer.writeInt(first_codec_id + id);
+			for (int i = 0 ; i < operator_codecs[id].nb_args_ ; ++i) {
+				if (!saveOperator(op->child(i), writer))
+					return false;
+			}
+			return true;
+		}
+	}
+	// Unknown operator (e.g. InstrumentedOperator)
+	return false;
+}
+
+ParserOperator *EquationParser::loadOperator(CacheReader &reader, const List<int> &variable_map, bool &ok) {
+	int id = reader.readInt();
+	if (!reader.isValid()) {
+		ok = false;
+		return NULL;
+	}
+	if (id == NULL_OPERATOR_ID)
+		return NULL;
+	if (id == CONSTANT_ID) {
+		double value = reader.readDouble();
+		String name = reader.readString();
+		return new ConstantOperator(value, name);
+	}
+	if (id == VARIABLE_ID) {
+		int index = reader.readInt();
+		if (index < 0 || index >= variable_map.size() || variable_map.at(index) < 0) {
+			ok = false;
+			return NULL;
+		}
+		index = variable_map.at(index);
+		return new VariableOperator(args_double_ + index, args_names_[index]);
+	}
+	if (id == PRINT_ID) {
+		List<ParserOperator*> values;
+		int nb_values = reader.readInt();
+		for (int i = 0 ; i < nb_values && ok && reader.isValid() ; ++i)
+			values << loadOperator(reader, variable_map, ok);
+		StringList strings = reader.readStringList();
+		if (!ok || !reader.isValid()) {
+			ok = false;
+			for (int i = 0 ; i < values.size() ; ++i)
+				delete values[i];
+			return NULL;
+		}
+		return new PrintOperator(values, strings);
+	}
+	id -= first_codec_id;
+	if (id < 0 || id >= nb_operator_codecs) {
+		ok = false;
+		return NULL;
+	}
+	ParserOperator *args[3] = { NULL, NULL, NULL };
+	for (int i = 0 ; i < operator_codecs[id].nb_args_ && ok ; ++i)
+		args[i] = loadOperator(reader, variable_map, ok);
+	if (!ok) {
+		for (int i = 0 ; i < 3 ; ++i)
+			delete args[i];
+		return NULL;
+	}
+	return operator_codecs[id].create_(args, context());
+}
+
+/*! \fn bool EquationParser::save(CacheWriter &writer) const
+ *
+ * Write the parsed equation to \p writer so that it can be loaded with
+ * load() without parsing the equation again. The variables are saved as
+ * their index in the variables names given to parse(). Return false if
+ * the equation cannot be saved.
+ */
+bool EquationParser::save(CacheWriter &writer) const {
+	return saveOperator(start_point_, writer);
+}
+
+/*! \fn bool EquationParser::saveTree(const ParserOperator *tree, CacheWriter &writer) const
+ *
+ * Same as save() for an operator tree returned by compile() or loadTree().
+ */
+bool EquationParser::saveTree(const ParserOperator *tree, CacheWriter &writer) const {
+	return saveOperator(tree, writer);
+}
+
+/*! \fn bool EquationParser::load(CacheReader &reader, const List<int>& variable_map, const StringList& variables_names, double* variable_array = NULL)
+ *
+ * Load an equation saved with save(). This replaces parse(): the equation
+ * is ready to be evaluated if it returns true. The \p variables_names and
+ * \p variable_array are used as for parse(), and \p variable_map gives for
+ * each variable index in the saved equation its index in \p variables_names
+ * (or -1 if it is not in the list, in which case loading fails if the
+ * equation uses it).
+ */
+bool EquationParser::load(
+	CacheReader &reader,
+	const List<int> &variable_map,
+	const StringList &variables_names,
+	double *variable_array
+) {
+	if (start_point_) {
+		delete start_point_;
+		start_point_ = NULL;
+	}
+	errors_.clear();
+	expression_ = NULL;
+	equation_.clear();
+	setVariables(variables_names, false, variable_array);
+	start_point_ = loadTree(reader, variable_map);
+	return start_point_ != NULL;
+}
+
+/*! \fn ParserOperator *EquationParser::loadTree(CacheReader &reader, const List<int>& variable_map)
+ *
+ * Load an equation saved with save() or saveTree() with the variables given
+ * to setVariables(), and return its operator tree (owned by the caller), or
+ * NULL if the data is not valid. See load() for \p variable_map.
+ */
+ParserOperator *EquationParser::loadTree(CacheReader &reader, const List<int> &variable_map) {
+	bool ok = true;
+	ParserOperator *tree = loadOperator(reader, variable_map, ok);
+	if (!ok || !reader.isValid()) {
+		delete tree;
+		return NULL;
+	}
+#ifdef PARSER_INSTRUMENTATION
+	instrument(tree);
+#endif
+	return tree;
+}
+
 #ifdef PARSER_TREE_DEBUG
 EquationParser::ParserTreeNode EquationParser::getParserTreeDescription() const {
 	return buildNode(start_point_);
 }
  
-EquationParser::ParserTreeNode EquationParser::buildNode(const ParserOperator* op) const {
+EquationParser::ParserTreeNode EquationParser::buildNode(const ParserOperator* op) {
 	EquationParser::ParserTreeNode node;
 	if (op == NULL) {
 		node.description_ = "(Empty)";
 		return node;
 	}
  
+#ifdef PARSER_INSTRUMENTATION
+	const InstrumentedOperator *instrumented = dynamic_cast<const InstrumentedOperator*>(op);
+	if (instrumented != NULL) {
+		node = buildNode(instrumented->wrappedOperator());
+		node.count_ = instrumented->count();
+		node.time_ns_ = instrumented->timeNs();
+		return node;
+	}
+#endif
+
 	node.description_ = op->operatorName();
 	int nb_children = op->nbChildren();
 	for (int i = 0 ; i < nb_children ; ++i)
@@ -1048,9 +1886,57 @@ EquationParser::ParserTreeNode EquationParser::buildNode(const ParserOperator* o
 }
  
 void EquationParser::debugPrint(const ParserTreeNode& node, const String& prefix) {
+#ifdef PARSER_INSTRUMENTATION
+	long long total_ns = instrumentedTime(node);
+	if (total_ns > 0) {
+		debugPrint(node, prefix, total_ns);
+		return;
+	}
+#endif
 	rprintf("%s%s\n", prefix.c_str(), node.description_.c_str());
 	for (int i = 0 ; i < node.children_.size() ; ++i)
 		debugPrint(node.children_.at(i), prefix + "  ");
 }
 #endif
 
+#ifdef PARSER_INSTRUMENTATION
+// Wrap the operator and all the operators below it that have children
+// in an InstrumentedOperator.
+void EquationParser::instrument(ParserOperator *&op) {
+	if (op == NULL || op->nbChildren() == 0)
+		return;
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		ParserOperator **slot = op->childSlot(i);
+		if (slot != NULL)
+			instrument(*slot);
+	}
+	op = new InstrumentedOperator(op);
+}
+
+// Return the total time spent in the tree, i.e. the sum of the time of
+// the instrumented nodes that have no instrumented ancestor.
+long long EquationParser::instrumentedTime(const ParserTreeNode& node) {
+	if (node.count_ >= 0)
+		return node.time_ns_;
+	long long total_ns = 0;
+	for (int i = 0 ; i < node.children_.size() ; ++i)
+		total_ns += instrumentedTime(node.children_.at(i));
+	return total_ns;
+}
+
+// Print the tree with the number of evaluations of each instrumented node
+// and the percentage of the total time spent in its subtree.
+void EquationParser::debugPrint(const ParserTreeNode& node, const String& prefix, long long total_ns) {
+	if (node.count_ >= 0)
+		rprintf(
+			"%s%s  [%lld evaluations, %.3f ms, %.1f%%]\n",
+			prefix.c_str(), node.description_.c_str(), node.count_,
+			node.time_ns_ * 1e-6, 100. * node.time_ns_ / total_ns
+		);
+	else
+		rprintf("%s%s\n", prefix.c_str(), node.description_.c_str());
+	for (int i = 0 ; i < node.children_.size() ; ++i)
+		debugPrint(node.children_.at(i), prefix + "  ", total_ns);
+}
+#endif
+
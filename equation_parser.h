@@ -23,8 +23,19 @@
 #include <stdlib.h>
 #include "str.h"
 #include "strlist.h"
+#include "string_index.h"
+
+// The instrumentation build also needs the parser tree description.
+#if defined(PARSER_INSTRUMENTATION) && !defined(PARSER_TREE_DEBUG)
+#define PARSER_TREE_DEBUG
+#endif
 
 class ParserOperator;
+class VariableOperator;
+class UserFunction;
+class EvaluationContext;
+class CacheWriter;
+class CacheReader;
 
 /*! \class EquationParser
  *
@@ -72,8 +83,12 @@ class ParserOperator;
  *   - urand(min, max), a random number between min and max (uniform distribution).
  *   - nrand(mean, sigma), a random number with a normal (Gaussian) distribution.
  *   - rands(s), set a seed for the urand() and nrand() functions and return the seed.
+ *   - rands(s, n), same as rands(s) but select the independent stream n for that seed.
  *   - if (x, y, z), if x is true (not equal to zero) return y, otherwise return z.
  *   - print(x), print the value of x and return that value.
+ *   - memo(f(x, y)), same as f(x, y) but keep the results for the last values of x and y (see MemoOperator).
+ *
+ * Other functions can be added with defineFunction().
  *
  * The recognized operators are:
  *   - x + y, add y to x.
@@ -99,6 +114,16 @@ class ParserOperator;
  *   - ++x, prefix increment operator (add 1 to x).
  *   - --x, prefix decrement operator (remove 1 from x).
  *
+ * When the fast math mode is enabled (see setFastMath()), exp(), log(), sin()
+ * and cos() use the fast approximations from the FastMath namespace.
+ *
+ * The comparisons are exact. When the tolerant comparisons are enabled (see
+ * setTolerantComparisons()), ==, !=, <= and >= consider two values within
+ * 100 ULP of each other as equal.
+ *
+ * The random number functions use the generator of the EvaluationContext that
+ * is current when the equation is parsed (see setContext()).
+ *
  * And you can of course use parenthesis to make sure the expressions are evaluated in the
  * order than you want them to be. The priority of the operators is the same than in C.
  *
@@ -141,6 +166,14 @@ public:
 
 	double evaluate(double *var = NULL);
 
+	void setVariables(
+		const StringList& variables_names,
+		bool auto_add_variables = false,
+		double* variable_array = NULL
+	);
+	ParserOperator *compile(const String& equation);
+	bool defineFunction(const String& name, const StringList& parameters, const String& body, bool memoized = false);
+
 	double *variablesValue();
 	int nbVariables() const;
 	const StringList& variablesName() const;
@@ -148,14 +181,41 @@ public:
 	int nbErrors() const;
 	const String& getError(int) const;
 	const String& getLastError() const;
+
+	static void setFastMath(bool);
+	static bool fastMath();
+	static void setTolerantComparisons(bool);
+	static bool tolerantComparisons();
+
+	static void setContext(EvaluationContext*);
+	static EvaluationContext *context();
+
+	bool save(CacheWriter&) const;
+	bool load(
+		CacheReader&,
+		const List<int>& variable_map,
+		const StringList& variables_names,
+		double* variable_array = NULL
+	);
+	bool saveTree(const ParserOperator*, CacheWriter&) const;
+	ParserOperator *loadTree(CacheReader&, const List<int>& variable_map);
 	
 #ifdef PARSER_TREE_DEBUG
 	struct ParserTreeNode {
+#ifdef PARSER_INSTRUMENTATION
+		ParserTreeNode() : count_(-1), time_ns_(0) {}
+#endif
         String description_;
         List<ParserTreeNode> children_;
+#ifdef PARSER_INSTRUMENTATION
+		// Number of evaluations (-1 if the node is not instrumented)
+		// and time spent in the subtree.
+		long long count_;
+		long long time_ns_;
+#endif
     };
     ParserTreeNode getParserTreeDescription() const;
-	ParserTreeNode buildNode(const ParserOperator*) const;
+	static ParserTreeNode buildNode(const ParserOperator*);
     static void debugPrint(const ParserTreeNode&, const String& prefix = String());
 #endif
 
@@ -172,9 +232,24 @@ private:
 	ParserOperator *eval_exp8(); // Unary + or - and prefix ++ or --
 	ParserOperator *eval_exp9(); // Parenthesized expression
 	ParserOperator *eval_exp10(); // Functions, constant number and variable
+	ParserOperator *compileBody(const String&);
+	UserFunction *findFunction(const String&) const;
+	ParserOperator *parameter(const String&);
+	ParserOperator *parseCall(UserFunction*);
+	ParserOperator *callOperator(UserFunction*, const List<ParserOperator*>& arguments);
+	ParserOperator *inlineCall(UserFunction*, const List<ParserOperator*>& arguments);
+	ParserOperator *memoize(ParserOperator*);
 	bool isdelim(char c);
 	void syntaxError(int type);
 	void clearArguments();
+	int addVariable(const String&);
+	bool saveOperator(const ParserOperator*, CacheWriter&) const;
+	ParserOperator *loadOperator(CacheReader&, const List<int>& variable_map, bool &ok);
+#ifdef PARSER_INSTRUMENTATION
+	static void instrument(ParserOperator *&);
+	static long long instrumentedTime(const ParserTreeNode&);
+	static void debugPrint(const ParserTreeNode&, const String& prefix, long long total_ns);
+#endif
 
 private:
 	// Equation parsing
@@ -188,10 +263,29 @@ private:
 	double *args_double_;
 	bool own_args_double_;
 	StringList args_names_;
+	StringIndex args_index_;
+	// Variables created in the auto-add mode, moved when the array grows
+	List<VariableOperator*> auto_variables_;
 	ParserOperator *start_point_;
 	StringList errors_;
+	// User functions (see defineFunction())
+	struct ParameterBinding {
+		double *variable_;     // Variable given as argument, or NULL
+		const double *slot_;   // Otherwise slot of the argument, or NULL for a constant
+		double constant_;
+		String name_;
+	};
+	List<UserFunction*> functions_;
+	// Function whose body is being compiled, and the arguments of the call
+	// when it is inlined (NULL when it is compiled for UserFunction::call())
+	UserFunction *scope_;
+	const List<ParameterBinding> *bindings_;
+	bool recursive_;  // Set when the body being defined calls its function
 
 	static String nullStr_;
+	static bool fast_math_;
+	static bool tolerant_comparisons_;
+	static EvaluationContext *context_;
 };
 
 /*! \fn double *EquationParser::variablesValue()
@@ -227,6 +321,55 @@ inline const StringList& EquationParser::variablesName() const {
 	return args_names_;
 }
 
+/*! \fn void EquationParser::setFastMath(bool enable)
+ *
+ * Enable or disable the fast math mode for the equations parsed afterward.
+ * In this mode exp(), log(), sin() and cos() are evaluated using fast
+ * approximations (see FastMath::selfCheck() for the accuracy).
+ * This does not change equations that have already been parsed.
+ */
+inline void EquationParser::setFastMath(bool enable) {
+	fast_math_ = enable;
+}
+
+/*! \fn bool EquationParser::fastMath()
+ *
+ * Return true if the fast math mode is enabled.
+ */
+inline bool EquationParser::fastMath() {
+	return fast_math_;
+}
+
+/*! \fn void EquationParser::setTolerantComparisons(bool enable)
+ *
+ * Enable or disable the tolerant comparisons for the equations parsed
+ * afterward. When they are enabled, ==, !=, <= and >= use a ULP comparison
+ * (see MathUtils::isEqual()) instead of the exact comparison, so that small
+ * rounding errors are ignored. This is slower and is disabled by default.
+ * This does not change equations that have already been parsed.
+ */
+inline void EquationParser::setTolerantComparisons(bool enable) {
+	tolerant_comparisons_ = enable;
+}
+
+/*! \fn bool EquationParser::tolerantComparisons()
+ *
+ * Return true if the tolerant comparisons are enabled.
+ */
+inline bool EquationParser::tolerantComparisons() {
+	return tolerant_comparisons_;
+}
+
+/*! \fn void EquationParser::setContext(EvaluationContext *context)
+ *
+ * Set the context used by the equations parsed afterward. Passing NULL
+ * selects the default context (EvaluationContext::defaultContext()).
+ * This does not change equations that have already been parsed.
+ */
+inline void EquationParser::setContext(EvaluationContext *context) {
+	context_ = context;
+}
+
 /*! \fn int EquationParser::nbErrors() const
  *
  * Get the number of error messages since the last call to parse.
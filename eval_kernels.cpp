@@ -0,0 +1,735 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "eval_kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EVAL_KERNELS_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace EvalKernels {
+
+/***********************************************************************************
+ * Shared scalar helpers
+ ***********************************************************************************/
+
+// Same set of characters as isspace() in the C locale.
+static inline bool isBlank(char c) {
+	return c == ' ' || (unsigned char)(c - 9) <= 4;
+}
+
+static const double powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+	1e21, 1e22
+};
+
+// Convert the number in [begin, end[. The common case of a decimal number with
+// at most 15 significant digits and a small exponent is converted exactly
+// (both the mantissa and the power of ten are exact doubles so there is only
+// one rounding). Everything else is handed to strtod(), which gives the same
+// result as the sscanf("%lf") used before.
+static bool parseNumber(const char *begin, const char *end, double &value) {
+	const char *p = begin;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = (*p++ == '-');
+	unsigned long long mantissa = 0;
+	int nb_digits = 0, exponent = 0;
+	bool has_digits = false;
+	while (p < end && *p >= '0' && *p <= '9') {
+		has_digits = true;
+		if (nb_digits > 0 || *p != '0') {
+			mantissa = mantissa * 10 + (*p - '0');
+			++nb_digits;
+		}
+		++p;
+	}
+	if (p < end && *p == '.') {
+		++p;
+		while (p < end && *p >= '0' && *p <= '9') {
+			has_digits = true;
+			if (nb_digits > 0 || *p != '0') {
+				mantissa = mantissa * 10 + (*p - '0');
+				++nb_digits;
+			}
+			--exponent;
+			++p;
+		}
+	}
+	if (has_digits && p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool negative_exp = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			negative_exp = (*q++ == '-');
+		if (q < end && *q >= '0' && *q <= '9') {
+			int e = 0;
+			while (q < end && *q >= '0' && *q <= '9' && e < 10000)
+				e = e * 10 + (*q++ - '0');
+			exponent += negative_exp ? -e : e;
+			p = q;
+		}
+	}
+	if (has_digits && p == end && nb_digits <= 15 && exponent >= -22 && exponent <= 22) {
+		double v = (double)mantissa;
+		if (exponent < 0)
+			v /= powers_of_ten[-exponent];
+		else
+			v *= powers_of_ten[exponent];
+		value = negative ? -v : v;
+		return true;
+	}
+
+	// Slow path. The token is followed by a blank or the end of the line,
+	// so strtod() stops at the end of the token.
+	char *stop = NULL;
+	double v = strtod(begin, &stop);
+	if (stop == begin)
+		return false;
+	value = v;
+	return true;
+}
+
+/***********************************************************************************
+ * Blank scanners
+ *
+ * Each scanner provides skipBlanks() (return the first non blank character)
+ * and findBlank() (return the first blank character). Both return end if no
+ * such character is found. The SIMD versions only load full vectors inside
+ * [p, end[ and finish with the scalar loop.
+ ***********************************************************************************/
+
+struct GenericScanner {
+	static const char *skipBlanks(const char *p, const char *end) {
+		while (p < end && isBlank(*p))
+			++p;
+		return p;
+	}
+	static const char *findBlank(const char *p, const char *end) {
+		while (p < end && !isBlank(*p))
+			++p;
+		return p;
+	}
+};
+
+#ifdef EVAL_KERNELS_X86
+
+TARGET("sse2") static inline unsigned int blankMask16(const char *p) {
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	__m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(9));
+	__m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+	__m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	return (unsigned int)_mm_movemask_epi8(_mm_or_si128(ctrl, space));
+}
+
+struct Sse2Scanner {
+	TARGET("sse2") static const char *skipBlanks(const char *p, const char *end) {
+		while (end - p >= 16) {
+			unsigned int mask = ~blankMask16(p) & 0xFFFF;
+			if (mask != 0)
+				return p + __builtin_ctz(mask);
+			p += 16;
+		}
+		return GenericScanner::skipBlanks(p, end);
+	}
+	TARGET("sse2") static const char *findBlank(const char *p, const char *end) {
+		while (end - p >= 16) {
+			unsigned int mask = blankMask16(p);
+			if (mask != 0)
+				return p + __builtin_ctz(mask);
+			p += 16;
+		}
+		return GenericScanner::findBlank(p, end);
+	}
+};
+
+TARGET("avx2") static inline unsigned int blankMask32(const char *p) {
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	__m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8(9));
+	__m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+	__m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+	return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(ctrl, space));
+}
+
+struct Avx2Scanner {
+	TARGET("avx2") static const char *skipBlanks(const char *p, const char *end) {
+		while (end - p >= 32) {
+			unsigned int mask = ~blankMask32(p);
+			if (mask != 0)
+				return p + __builtin_ctz(mask);
+			p += 32;
+		}
+		return Sse2Scanner::skipBlanks(p, end);
+	}
+	TARGET("avx2") static const char *findBlank(const char *p, const char *end) {
+		while (end - p >= 32) {
+			unsigned int mask = blankMask32(p);
+			if (mask != 0)
+				return p + __builtin_ctz(mask);
+			p += 32;
+		}
+		return Sse2Scanner::findBlank(p, end);
+	}
+};
+
+TARGET("avx512f,avx512bw") static inline unsigned long long blankMask64(const char *p) {
+	__m512i v = _mm512_loadu_si512((const void*)p);
+	__mmask64 ctrl = _mm512_cmple_epu8_mask(_mm512_sub_epi8(v, _mm512_set1_epi8(9)), _mm512_set1_epi8(4));
+	__mmask64 space = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' '));
+	return (unsigned long long)(ctrl | space);
+}
+
+struct Avx512Scanner {
+	TARGET("avx512f,avx512bw") static const char *skipBlanks(const char *p, const char *end) {
+		while (end - p >= 64) {
+			unsigned long long mask = ~blankMask64(p);
+			if (mask != 0)
+				return p + __builtin_ctzll(mask);
+			p += 64;
+		}
+		return Avx2Scanner::skipBlanks(p, end);
+	}
+	TARGET("avx512f,avx512bw") static const char *findBlank(const char *p, const char *end) {
+		while (end - p >= 64) {
+			unsigned long long mask = blankMask64(p);
+			if (mask != 0)
+				return p + __builtin_ctzll(mask);
+			p += 64;
+		}
+		return Avx2Scanner::findBlank(p, end);
+	}
+};
+
+#endif // EVAL_KERNELS_X86
+
+/***********************************************************************************
+ * Row parsing
+ ***********************************************************************************/
+
+template <class Scanner> static int parseRowImpl(
+	const char *line, int length,
+	double *values, bool *parsed, int max_values, int *consumed
+) {
+	const char *p = line, *end = line + length;
+	int nb = 0;
+	while (nb < max_values) {
+		p = Scanner::skipBlanks(p, end);
+		if (p == end)
+			break;
+		const char *token_end = Scanner::findBlank(p, end);
+		parsed[nb] = parseNumber(p, token_end, values[nb]);
+		++nb;
+		p = token_end;
+	}
+	if (consumed != NULL)
+		*consumed = (int)(p - line);
+	return nb;
+}
+
+static int parseRowGeneric(const char *line, int length, double *values, bool *parsed, int max_values, int *consumed) {
+	return parseRowImpl<GenericScanner>(line, length, values, parsed, max_values, consumed);
+}
+
+/***********************************************************************************
+ * Min / max
+ *
+ * NaN values are ignored. If there is no value (or only NaN values) the
+ * minimum is +infinity and the maximum -infinity.
+ ***********************************************************************************/
+
+static void minMaxGeneric(const double *values, int n, double &minimum, double &maximum) {
+	double mn = HUGE_VAL, mx = -HUGE_VAL;
+	for (int i = 0 ; i < n ; ++i) {
+		if (values[i] < mn)
+			mn = values[i];
+		if (values[i] > mx)
+			mx = values[i];
+	}
+	minimum = mn;
+	maximum = mx;
+}
+
+/***********************************************************************************
+ * Compare with a constant
+ *
+ * Set mask[i] to 1 if the comparison is true for values[i] and to 0 otherwise.
+ * Comparisons with NaN are false. Return the number of true comparisons.
+ ***********************************************************************************/
+
+static inline bool compareValue(double v, CompareOp op, double c) {
+	switch (op) {
+	case COMPARE_SMALLER:
+		return v < c;
+	case COMPARE_SMALLER_OR_EQUAL:
+		return v <= c;
+	case COMPARE_GREATER:
+		return v > c;
+	case COMPARE_GREATER_OR_EQUAL:
+		return v >= c;
+	}
+	return false;
+}
+
+static int compareGeneric(const double *values, int n, CompareOp op, double constant, unsigned char *mask) {
+	int count = 0;
+	for (int i = 0 ; i < n ; ++i) {
+		mask[i] = compareValue(values[i], op, constant) ? 1 : 0;
+		count += mask[i];
+	}
+	return count;
+}
+
+/***********************************************************************************
+ * Uniform random numbers
+ *
+ * Advance four interleaved xoshiro256++ generators and produce 4 * nb_blocks
+ * numbers in [0, 1[, values[4 * k + j] coming from generator j. The state is
+ * stored word by word: state[4 * w + j] is the word w of generator j. Each
+ * number uses the 52 high bits of the 64-bit output so that the conversion
+ * is the same in all the variants.
+ ***********************************************************************************/
+
+static inline unsigned long long rotl64(unsigned long long x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline double toUnitInterval(unsigned long long x) {
+	union { unsigned long long u_; double d_; } bits;
+	bits.u_ = (x >> 12) | 0x3FF0000000000000ULL;
+	return bits.d_ - 1.;
+}
+
+static void uniformBlocksGeneric(unsigned long long *state, double *values, int nb_blocks) {
+	unsigned long long *s0 = state, *s1 = state + 4, *s2 = state + 8, *s3 = state + 12;
+	for (int k = 0 ; k < nb_blocks ; ++k) {
+		for (int j = 0 ; j < 4 ; ++j) {
+			unsigned long long result = rotl64(s0[j] + s3[j], 23) + s0[j];
+			unsigned long long t = s1[j] << 17;
+			s2[j] ^= s0[j];
+			s3[j] ^= s1[j];
+			s1[j] ^= s2[j];
+			s0[j] ^= s3[j];
+			s2[j] ^= t;
+			s3[j] = rotl64(s3[j], 45);
+			values[4 * k + j] = toUnitInterval(result);
+		}
+	}
+}
+
+#ifdef EVAL_KERNELS_X86
+
+static int parseRowSse2(const char *line, int length, double *values, bool *parsed, int max_values, int *consumed) {
+	return parseRowImpl<Sse2Scanner>(line, length, values, parsed, max_values, consumed);
+}
+
+static int parseRowAvx2(const char *line, int length, double *values, bool *parsed, int max_values, int *consumed) {
+	return parseRowImpl<Avx2Scanner>(line, length, values, parsed, max_values, consumed);
+}
+
+static int parseRowAvx512(const char *line, int length, double *values, bool *parsed, int max_values, int *consumed) {
+	return parseRowImpl<Avx512Scanner>(line, length, values, parsed, max_values, consumed);
+}
+
+// The min and max instructions return their second operand when the first one
+// is NaN, which is what we want to ignore NaN values.
+
+TARGET("sse2") static void minMaxSse2(const double *values, int n, double &minimum, double &maximum) {
+	__m128d vmin = _mm_set1_pd(HUGE_VAL), vmax = _mm_set1_pd(-HUGE_VAL);
+	int i = 0;
+	for ( ; i + 2 <= n ; i += 2) {
+		__m128d v = _mm_loadu_pd(values + i);
+		vmin = _mm_min_pd(v, vmin);
+		vmax = _mm_max_pd(v, vmax);
+	}
+	double mn[2], mx[2];
+	_mm_storeu_pd(mn, vmin);
+	_mm_storeu_pd(mx, vmax);
+	minMaxGeneric(values + i, n - i, minimum, maximum);
+	for (int j = 0 ; j < 2 ; ++j) {
+		if (mn[j] < minimum)
+			minimum = mn[j];
+		if (mx[j] > maximum)
+			maximum = mx[j];
+	}
+}
+
+TARGET("avx2") static void minMaxAvx2(const double *values, int n, double &minimum, double &maximum) {
+	__m256d vmin = _mm256_set1_pd(HUGE_VAL), vmax = _mm256_set1_pd(-HUGE_VAL);
+	int i = 0;
+	for ( ; i + 4 <= n ; i += 4) {
+		__m256d v = _mm256_loadu_pd(values + i);
+		vmin = _mm256_min_pd(v, vmin);
+		vmax = _mm256_max_pd(v, vmax);
+	}
+	double mn[4], mx[4];
+	_mm256_storeu_pd(mn, vmin);
+	_mm256_storeu_pd(mx, vmax);
+	minMaxGeneric(values + i, n - i, minimum, maximum);
+	for (int j = 0 ; j < 4 ; ++j) {
+		if (mn[j] < minimum)
+			minimum = mn[j];
+		if (mx[j] > maximum)
+			maximum = mx[j];
+	}
+}
+
+TARGET("avx512f") static void minMaxAvx512(const double *values, int n, double &minimum, double &maximum) {
+	__m512d vmin = _mm512_set1_pd(HUGE_VAL), vmax = _mm512_set1_pd(-HUGE_VAL);
+	int i = 0;
+	for ( ; i + 8 <= n ; i += 8) {
+		__m512d v = _mm512_loadu_pd(values + i);
+		vmin = _mm512_min_pd(v, vmin);
+		vmax = _mm512_max_pd(v, vmax);
+	}
+	double mn[8], mx[8];
+	_mm512_storeu_pd(mn, vmin);
+	_mm512_storeu_pd(mx, vmax);
+	minMaxGeneric(values + i, n - i, minimum, maximum);
+	for (int j = 0 ; j < 8 ; ++j) {
+		if (mn[j] < minimum)
+			minimum = mn[j];
+		if (mx[j] > maximum)
+			maximum = mx[j];
+	}
+}
+
+TARGET("sse2") static inline __m128d compare2(__m128d v, __m128d c, CompareOp op) {
+	switch (op) {
+	case COMPARE_SMALLER:
+		return _mm_cmplt_pd(v, c);
+	case COMPARE_SMALLER_OR_EQUAL:
+		return _mm_cmple_pd(v, c);
+	case COMPARE_GREATER:
+		return _mm_cmpgt_pd(v, c);
+	case COMPARE_GREATER_OR_EQUAL:
+		return _mm_cmpge_pd(v, c);
+	}
+	return _mm_setzero_pd();
+}
+
+TARGET("sse2") static int compareSse2(const double *values, int n, CompareOp op, double constant, unsigned char *mask) {
+	__m128d c = _mm_set1_pd(constant);
+	int count = 0, i = 0;
+	for ( ; i + 2 <= n ; i += 2) {
+		int bits = _mm_movemask_pd(compare2(_mm_loadu_pd(values + i), c, op));
+		mask[i] = bits & 1;
+		mask[i + 1] = (bits >> 1) & 1;
+		count += __builtin_popcount(bits);
+	}
+	return count + compareGeneric(values + i, n - i, op, constant, mask + i);
+}
+
+TARGET("avx2") static inline int compare4(__m256d v, __m256d c, CompareOp op) {
+	switch (op) {
+	case COMPARE_SMALLER:
+		return _mm256_movemask_pd(_mm256_cmp_pd(v, c, _CMP_LT_OQ));
+	case COMPARE_SMALLER_OR_EQUAL:
+		return _mm256_movemask_pd(_mm256_cmp_pd(v, c, _CMP_LE_OQ));
+	case COMPARE_GREATER:
+		return _mm256_movemask_pd(_mm256_cmp_pd(v, c, _CMP_GT_OQ));
+	case COMPARE_GREATER_OR_EQUAL:
+		return _mm256_movemask_pd(_mm256_cmp_pd(v, c, _CMP_GE_OQ));
+	}
+	return 0;
+}
+
+TARGET("avx2") static int compareAvx2(const double *values, int n, CompareOp op, double constant, unsigned char *mask) {
+	__m256d c = _mm256_set1_pd(constant);
+	int count = 0, i = 0;
+	for ( ; i + 4 <= n ; i += 4) {
+		int bits = compare4(_mm256_loadu_pd(values + i), c, op);
+		for (int j = 0 ; j < 4 ; ++j)
+			mask[i + j] = (bits >> j) & 1;
+		count += __builtin_popcount(bits);
+	}
+	return count + compareGeneric(values + i, n - i, op, constant, mask + i);
+}
+
+TARGET("avx512f") static inline int compare8(__m512d v, __m512d c, CompareOp op) {
+	switch (op) {
+	case COMPARE_SMALLER:
+		return _mm512_cmp_pd_mask(v, c, _CMP_LT_OQ);
+	case COMPARE_SMALLER_OR_EQUAL:
+		return _mm512_cmp_pd_mask(v, c, _CMP_LE_OQ);
+	case COMPARE_GREATER:
+		return _mm512_cmp_pd_mask(v, c, _CMP_GT_OQ);
+	case COMPARE_GREATER_OR_EQUAL:
+		return _mm512_cmp_pd_mask(v, c, _CMP_GE_OQ);
+	}
+	return 0;
+}
+
+TARGET("avx512f") static int compareAvx512(const double *values, int n, CompareOp op, double constant, unsigned char *mask) {
+	__m512d c = _mm512_set1_pd(constant);
+	int count = 0, i = 0;
+	for ( ; i + 8 <= n ; i += 8) {
+		int bits = compare8(_mm512_loadu_pd(values + i), c, op);
+		for (int j = 0 ; j < 8 ; ++j)
+			mask[i + j] = (bits >> j) & 1;
+		count += __builtin_popcount(bits);
+	}
+	return count + compareGeneric(values + i, n - i, op, constant, mask + i);
+}
+
+// SSE2 only has two 64-bit lanes, so the four generators are split in two halves.
+TARGET("sse2") static void uniformBlocksSse2(unsigned long long *state, double *values, int nb_blocks) {
+	const __m128i exponent = _mm_set1_epi64x(0x3FF0000000000000LL);
+	const __m128d one = _mm_set1_pd(1.);
+	for (int h = 0 ; h < 4 ; h += 2) {
+		__m128i s0 = _mm_loadu_si128((const __m128i*)(state + h));
+		__m128i s1 = _mm_loadu_si128((const __m128i*)(state + 4 + h));
+		__m128i s2 = _mm_loadu_si128((const __m128i*)(state + 8 + h));
+		__m128i s3 = _mm_loadu_si128((const __m128i*)(state + 12 + h));
+		for (int k = 0 ; k < nb_blocks ; ++k) {
+			__m128i sum = _mm_add_epi64(s0, s3);
+			__m128i result = _mm_add_epi64(_mm_or_si128(_mm_slli_epi64(sum, 23), _mm_srli_epi64(sum, 41)), s0);
+			__m128i t = _mm_slli_epi64(s1, 17);
+			s2 = _mm_xor_si128(s2, s0);
+			s3 = _mm_xor_si128(s3, s1);
+			s1 = _mm_xor_si128(s1, s2);
+			s0 = _mm_xor_si128(s0, s3);
+			s2 = _mm_xor_si128(s2, t);
+			s3 = _mm_or_si128(_mm_slli_epi64(s3, 45), _mm_srli_epi64(s3, 19));
+			__m128d unit = _mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(result, 12), exponent));
+			_mm_storeu_pd(values + 4 * k + h, _mm_sub_pd(unit, one));
+		}
+		_mm_storeu_si128((__m128i*)(state + h), s0);
+		_mm_storeu_si128((__m128i*)(state + 4 + h), s1);
+		_mm_storeu_si128((__m128i*)(state + 8 + h), s2);
+		_mm_storeu_si128((__m128i*)(state + 12 + h), s3);
+	}
+}
+
+TARGET("avx2") static void uniformBlocksAvx2(unsigned long long *state, double *values, int nb_blocks) {
+	const __m256i exponent = _mm256_set1_epi64x(0x3FF0000000000000LL);
+	const __m256d one = _mm256_set1_pd(1.);
+	__m256i s0 = _mm256_loadu_si256((const __m256i*)state);
+	__m256i s1 = _mm256_loadu_si256((const __m256i*)(state + 4));
+	__m256i s2 = _mm256_loadu_si256((const __m256i*)(state + 8));
+	__m256i s3 = _mm256_loadu_si256((const __m256i*)(state + 12));
+	for (int k = 0 ; k < nb_blocks ; ++k) {
+		__m256i sum = _mm256_add_epi64(s0, s3);
+		__m256i result = _mm256_add_epi64(_mm256_or_si256(_mm256_slli_epi64(sum, 23), _mm256_srli_epi64(sum, 41)), s0);
+		__m256i t = _mm256_slli_epi64(s1, 17);
+		s2 = _mm256_xor_si256(s2, s0);
+		s3 = _mm256_xor_si256(s3, s1);
+		s1 = _mm256_xor_si256(s1, s2);
+		s0 = _mm256_xor_si256(s0, s3);
+		s2 = _mm256_xor_si256(s2, t);
+		s3 = _mm256_or_si256(_mm256_slli_epi64(s3, 45), _mm256_srli_epi64(s3, 19));
+		__m256d unit = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(result, 12), exponent));
+		_mm256_storeu_pd(values + 4 * k, _mm256_sub_pd(unit, one));
+	}
+	_mm256_storeu_si256((__m256i*)state, s0);
+	_mm256_storeu_si256((__m256i*)(state + 4), s1);
+	_mm256_storeu_si256((__m256i*)(state + 8), s2);
+	_mm256_storeu_si256((__m256i*)(state + 12), s3);
+}
+
+#endif // EVAL_KERNELS_X86
+
+/***********************************************************************************
+ * Dispatch
+ ***********************************************************************************/
+
+struct KernelTable {
+	int (*parseRow_)(const char*, int, double*, bool*, int, int*);
+	void (*minMax_)(const double*, int, double&, double&);
+	int (*compare_)(const double*, int, CompareOp, double, unsigned char*);
+	void (*uniformBlocks_)(unsigned long long*, double*, int);
+};
+
+static const KernelTable kernel_tables[] = {
+	{ parseRowGeneric, minMaxGeneric, compareGeneric, uniformBlocksGeneric },
+#ifdef EVAL_KERNELS_X86
+	{ parseRowSse2, minMaxSse2, compareSse2, uniformBlocksSse2 },
+	{ parseRowAvx2, minMaxAvx2, compareAvx2, uniformBlocksAvx2 },
+	// Four generators fill an AVX2 register, there is no gain in using AVX-512
+	{ parseRowAvx512, minMaxAvx512, compareAvx512, uniformBlocksAvx2 }
+#endif
+};
+
+static const char *const level_names[] = { "generic", "sse2", "avx2", "avx512" };
+
+static const KernelTable *kernels = NULL;
+static CpuLevel detected_level = CPU_GENERIC;
+static CpuLevel active_level = CPU_GENERIC;
+
+static CpuLevel detectLevel() {
+#ifdef EVAL_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return CPU_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return CPU_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return CPU_SSE2;
+#endif
+	return CPU_GENERIC;
+}
+
+/*! \fn void EvalKernels::init()
+ *
+ * Detect the CPU features and select the kernel variants. This is called
+ * at startup, but the kernels also call it on first use if needed.
+ * The SCRIPT_CMD_CPU_LEVEL environment variable can be used to force a
+ * lower level (e.g. for benchmarking or to reproduce a bug).
+ */
+void init() {
+	detected_level = detectLevel();
+	active_level = detected_level;
+	kernels = &kernel_tables[active_level];
+
+	const char *forced = getenv("SCRIPT_CMD_CPU_LEVEL");
+	if (forced != NULL && *forced != 0) {
+		CpuLevel level;
+		if (!cpuLevelFromName(forced, level))
+			printf("Warning: unknown CPU level '%s' in SCRIPT_CMD_CPU_LEVEL (ignored).\n", forced);
+		else if (!setCpuLevel(level))
+			printf("Warning: CPU level '%s' is not supported by this CPU, using '%s'.\n", forced, cpuLevelName(active_level));
+	}
+}
+
+/*! \fn EvalKernels::CpuLevel EvalKernels::detectedCpuLevel()
+ *
+ * Return the best level supported by the CPU.
+ */
+CpuLevel detectedCpuLevel() {
+	if (kernels == NULL)
+		init();
+	return detected_level;
+}
+
+/*! \fn EvalKernels::CpuLevel EvalKernels::cpuLevel()
+ *
+ * Return the level of the kernel variants currently in use.
+ */
+CpuLevel cpuLevel() {
+	if (kernels == NULL)
+		init();
+	return active_level;
+}
+
+/*! \fn bool EvalKernels::setCpuLevel(CpuLevel level)
+ *
+ * Select the kernel variants for the given level. Return false (and leave
+ * the selection unchanged) if the CPU does not support that level.
+ */
+bool setCpuLevel(CpuLevel level) {
+	if (kernels == NULL)
+		init();
+	if (level < CPU_GENERIC || level > detected_level)
+		return false;
+	active_level = level;
+	kernels = &kernel_tables[level];
+	return true;
+}
+
+/*! \fn const char *EvalKernels::cpuLevelName(CpuLevel level)
+ *
+ * Return the name of the level as used in SCRIPT_CMD_CPU_LEVEL.
+ */
+const char *cpuLevelName(CpuLevel level) {
+	if (level < CPU_GENERIC || level > CPU_AVX512)
+		return "unknown";
+	return level_names[level];
+}
+
+/*! \fn bool EvalKernels::cpuLevelFromName(const char *name, CpuLevel &level)
+ *
+ * Get the level with the given name. Return false if the name is not recognized.
+ */
+bool cpuLevelFromName(const char *name, CpuLevel &level) {
+	for (int i = CPU_GENERIC ; i <= CPU_AVX512 ; ++i) {
+		if (strcmp(name, level_names[i]) == 0) {
+			level = (CpuLevel)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*! \fn int EvalKernels::parseRow(const char *line, int length, double *values, bool *parsed, int max_values, int *consumed)
+ *
+ * Split a line of a data file into blank separated fields and convert them
+ * to numbers. At most \p max_values fields are read. For each field,
+ * parsed[i] is set to true if values[i] contains the converted value, and
+ * to false if the field is not a number (values[i] is then unchanged).
+ * Return the number of fields read.
+ *
+ * If \p consumed is not NULL it is set to the number of characters read, so
+ * that the following fields can be parsed later from line + *consumed.
+ *
+ * The character at line[length] must be a blank or the terminating 0 (this
+ * is the case for the String returned by readLine()).
+ */
+int parseRow(const char *line, int length, double *values, bool *parsed, int max_values, int *consumed) {
+	if (kernels == NULL)
+		init();
+	return kernels->parseRow_(line, length, values, parsed, max_values, consumed);
+}
+
+/*! \fn void EvalKernels::minMax(const double *values, int n, double &minimum, double &maximum)
+ *
+ * Compute the minimum and maximum of the given values. NaN values are ignored.
+ */
+void minMax(const double *values, int n, double &minimum, double &maximum) {
+	if (kernels == NULL)
+		init();
+	kernels->minMax_(values, n, minimum, maximum);
+}
+
+/*! \fn int EvalKernels::compare(const double *values, int n, CompareOp op, double constant, unsigned char *mask)
+ *
+ * Compare each value with the given constant and store the result (0 or 1)
+ * in \p mask. Return the number of values for which the comparison is true.
+ */
+int compare(const double *values, int n, CompareOp op, double constant, unsigned char *mask) {
+	if (kernels == NULL)
+		init();
+	return kernels->compare_(values, n, op, constant, mask);
+}
+
+/*! \fn void EvalKernels::uniformFill(unsigned long long *state, double *values, int n)
+ *
+ * Fill \p values with \p n uniform random numbers in [0, 1[ using four
+ * interleaved xoshiro256++ generators. \p state contains the 16 words of
+ * the generators (state[4 * w + j] is the word w of generator j) and is
+ * updated. When \p n is not a multiple of 4 the numbers of the last block
+ * that are not needed are discarded.
+ */
+void uniformFill(unsigned long long *state, double *values, int n) {
+	if (kernels == NULL)
+		init();
+	int nb_blocks = n / 4;
+	kernels->uniformBlocks_(state, values, nb_blocks);
+	if (n % 4 != 0) {
+		double last[4];
+		kernels->uniformBlocks_(state, last, 1);
+		memcpy(values + 4 * nb_blocks, last, (n % 4) * sizeof(double));
+	}
+}
+
+} // namespace EvalKernels
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef eval_kernels_h
+#define eval_kernels_h
+
+#include <stddef.h>
+
+/*! \namespace EvalKernels
+ *
+ * Hot kernels used when ingesting and scanning data or when generating random
+ * numbers in bulk. Each kernel is compiled in several instruction set variants
+ * in the same executable and the best variant supported by the CPU is selected
+ * at startup (see init()).
+ *
+ * The selection can be forced with the SCRIPT_CMD_CPU_LEVEL environment
+ * variable (generic, sse2, avx2 or avx512). A level higher than the one
+ * supported by the CPU is ignored with a warning.
+ *
+ * All the variants of a kernel give exactly the same results.
+ *
+ * minMax() computes the statistics of the blocks of rows of a Dataset, and
+ * compare() finds the rows of a block that pass a row guard (see
+ * ScriptParser::rowGuardMask()).
+ */
+namespace EvalKernels {
+
+enum CpuLevel {
+	CPU_GENERIC = 0,
+	CPU_SSE2,
+	CPU_AVX2,
+	CPU_AVX512
+};
+
+enum CompareOp {
+	COMPARE_SMALLER = 0,
+	COMPARE_SMALLER_OR_EQUAL,
+	COMPARE_GREATER,
+	COMPARE_GREATER_OR_EQUAL
+};
+
+void init();
+
+CpuLevel detectedCpuLevel();
+CpuLevel cpuLevel();
+bool setCpuLevel(CpuLevel);
+const char *cpuLevelName(CpuLevel);
+bool cpuLevelFromName(const char *name, CpuLevel &level);
+
+int parseRow(const char *line, int length, double *values, bool *parsed, int max_values, int *consumed = NULL);
+void minMax(const double *values, int n, double &minimum, double &maximum);
+int compare(const double *values, int n, CompareOp op, double constant, unsigned char *mask);
+void uniformFill(unsigned long long *state, double *values, int n);
+
+} // namespace EvalKernels
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "evaluation_context.h"
+
+/*! \fn EvaluationContext::EvaluationContext()
+ *
+ * Create a context. The random number generator starts with seed 1
+ * (as rand() does when srand() has not been called).
+ */
+EvaluationContext::EvaluationContext() :
+	random_(1), random_mode_(RANDOM_SEQUENTIAL),
+	row_(0), next_row_(0), epoch_(0), nb_call_sites_(0)
+{
+}
+
+/*! \fn EvaluationContext::~EvaluationContext()
+ *
+ * Destructor of the EvaluationContext class.
+ */
+EvaluationContext::~EvaluationContext() {
+}
+
+/*! \fn void EvaluationContext::seed(unsigned long long seed, unsigned long long stream)
+ *
+ * Seed the random number generator (see RandomGenerator::seed()). The rows
+ * are counted again from 0: the rest of the row being evaluated and the next
+ * row both use row index 0 (so that both calling rands() at the start of a
+ * script and calling it before running a script are reproducible), and the
+ * call counts are reset.
+ */
+void EvaluationContext::seed(unsigned long long seed, unsigned long long stream) {
+	random_.seed(seed, stream);
+	row_ = 0;
+	next_row_ = 0;
+	++epoch_;
+}
+
+/*! \fn EvaluationContext *EvaluationContext::defaultContext()
+ *
+ * Return the context used when no other context has been set.
+ */
+EvaluationContext *EvaluationContext::defaultContext() {
+	static EvaluationContext context;
+	return &context;
+}
+
+/*! \fn RandomCallSite::RandomCallSite(EvaluationContext *context)
+ *
+ * Create a call site with a new id from the given context.
+ */
+RandomCallSite::RandomCallSite(EvaluationContext *context) :
+	context_(context), id_(context->newCallSite()), calls_(0), epoch_(context->epoch())
+{
+}
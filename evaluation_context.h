@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef evaluation_context_h
+#define evaluation_context_h
+
+#include "random_generator.h"
+
+/*! \class EvaluationContext
+ *
+ * State shared by the operators of the equations evaluated together, such as
+ * the random number generator used by urand(), nrand() and rands().
+ *
+ * The operators keep a pointer to the context that was current when their
+ * equation was parsed (see EquationParser::setContext()), so the context must
+ * outlive the parsers that use it. Equations using different contexts do not
+ * interfere with each other.
+ *
+ * Random numbers can be generated in two modes:
+ *   - RANDOM_SEQUENTIAL (the default): each call takes the next number of the
+ *     generator sequence, so the result depends on the order of the calls.
+ *   - RANDOM_COUNTER: each number is a pure function of the seed, the row
+ *     index, the call site and the number of calls of that site in the row
+ *     (see RandomCallSite). The rows can then be evaluated in any order and
+ *     still give the same numbers.
+ *
+ * A row is one evaluation of a script (e.g. one line of a data file). Rows
+ * are numbered from 0 after each call to seed().
+ */
+class EvaluationContext {
+public:
+	enum RandomMode {
+		RANDOM_SEQUENTIAL,
+		RANDOM_COUNTER
+	};
+
+	EvaluationContext();
+	~EvaluationContext();
+
+	RandomGenerator &random();
+	void seed(unsigned long long seed, unsigned long long stream = 0);
+
+	RandomMode randomMode() const;
+	void setRandomMode(RandomMode);
+
+	void nextRow();
+	unsigned long long row() const;
+	unsigned long long epoch() const;
+
+	unsigned int newCallSite();
+	unsigned int nextCallSite() const;
+	void resetCallSites(unsigned int first = 0);
+
+	static EvaluationContext *defaultContext();
+
+private:
+	RandomGenerator random_;
+	RandomMode random_mode_;
+	unsigned long long row_;
+	unsigned long long next_row_;
+	unsigned long long epoch_;
+	unsigned int nb_call_sites_;
+};
+
+/*! \class RandomCallSite
+ *
+ * Random number source for one urand() or nrand() call in an equation. In
+ * counter mode it assigns the call site id and counts the calls made in the
+ * current row.
+ */
+class RandomCallSite {
+public:
+	RandomCallSite(EvaluationContext *context);
+
+	double uniform();
+	double normal();
+
+private:
+	unsigned int nextCall();
+
+	EvaluationContext *context_;
+	unsigned int id_;
+	unsigned int calls_;
+	unsigned long long epoch_;
+};
+
+/*! \fn RandomGenerator &EvaluationContext::random()
+ *
+ * Return the random number generator of this context.
+ */
+inline RandomGenerator &EvaluationContext::random() {
+	return random_;
+}
+
+/*! \fn EvaluationContext::RandomMode EvaluationContext::randomMode() const
+ *
+ * Return the mode used to generate random numbers.
+ */
+inline EvaluationContext::RandomMode EvaluationContext::randomMode() const {
+	return random_mode_;
+}
+
+/*! \fn void EvaluationContext::setRandomMode(RandomMode mode)
+ *
+ * Set the mode used to generate random numbers.
+ */
+inline void EvaluationContext::setRandomMode(RandomMode mode) {
+	random_mode_ = mode;
+}
+
+/*! \fn void EvaluationContext::nextRow()
+ *
+ * Start the evaluation of a new row.
+ */
+inline void EvaluationContext::nextRow() {
+	row_ = next_row_++;
+	++epoch_;
+}
+
+/*! \fn unsigned long long EvaluationContext::row() const
+ *
+ * Return the index of the row being evaluated.
+ */
+inline unsigned long long EvaluationContext::row() const {
+	return row_;
+}
+
+/*! \fn unsigned long long EvaluationContext::epoch() const
+ *
+ * Return a number that changes each time a row starts or the generator is
+ * seeded. It is used by RandomCallSite to reset its call count.
+ */
+inline unsigned long long EvaluationContext::epoch() const {
+	return epoch_;
+}
+
+/*! \fn unsigned int EvaluationContext::newCallSite()
+ *
+ * Return the id for a new call site. The ids are given in parsing order.
+ */
+inline unsigned int EvaluationContext::newCallSite() {
+	return nb_call_sites_++;
+}
+
+/*! \fn unsigned int EvaluationContext::nextCallSite() const
+ *
+ * Return the id that the next call to newCallSite() will give.
+ */
+inline unsigned int EvaluationContext::nextCallSite() const {
+	return nb_call_sites_;
+}
+
+/*! \fn void EvaluationContext::resetCallSites(unsigned int first)
+ *
+ * Restart the call site ids from \p first. This is done when a script is
+ * parsed so that a call site keeps the same id when the script is parsed
+ * again.
+ */
+inline void EvaluationContext::resetCallSites(unsigned int first) {
+	nb_call_sites_ = first;
+}
+
+inline unsigned int RandomCallSite::nextCall() {
+	if (epoch_ != context_->epoch()) {
+		epoch_ = context_->epoch();
+		calls_ = 0;
+	}
+	return calls_++;
+}
+
+/*! \fn double RandomCallSite::uniform()
+ *
+ * Return a random number in [0, 1[ with a uniform distribution.
+ */
+inline double RandomCallSite::uniform() {
+	if (context_->randomMode() == EvaluationContext::RANDOM_COUNTER)
+		return context_->random().counterUniform(context_->row(), id_, nextCall());
+	return context_->random().uniform();
+}
+
+/*! \fn double RandomCallSite::normal()
+ *
+ * Return a random number with a normal distribution (mean = 0 and sigma = 1).
+ */
+inline double RandomCallSite::normal() {
+	if (context_->randomMode() == EvaluationContext::RANDOM_COUNTER)
+		return context_->random().counterNormal(context_->row(), id_, nextCall());
+	return context_->random().normal();
+}
+
+#endif
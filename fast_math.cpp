@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "fast_math.h"
+#include <stdio.h>
+
+namespace FastMath {
+
+// Small generator used to get the samples. We do not use rand() so that
+// running the self-check does not change the sequence of urand() and nrand().
+static double nextSample(unsigned long long &state) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return (state >> 11) * (1. / 9007199254740992.);
+}
+
+static void checkFunction(
+	const char *name, const char *range,
+	double (*fast)(double), double (*reference)(double),
+	double min_x, double max_x, bool log_scale,
+	int nb_samples
+) {
+	unsigned long long state = 0x9E3779B97F4A7C15ULL;
+	double max_abs = 0., max_rel = 0., worst_x = min_x;
+	for (int i = 0 ; i < nb_samples ; ++i) {
+		double u = nextSample(state);
+		double x = log_scale ?
+			::exp(::log(min_x) + u * (::log(max_x) - ::log(min_x))) :
+			min_x + u * (max_x - min_x);
+		double ref = reference(x), val = fast(x);
+		double abs_error = fabs(val - ref);
+		double rel_error = ref == 0. ? abs_error : abs_error / fabs(ref);
+		if (abs_error > max_abs)
+			max_abs = abs_error;
+		if (rel_error > max_rel) {
+			max_rel = rel_error;
+			worst_x = x;
+		}
+	}
+	printf("  %-7s %-22s %-12.3g %-12.3g %.17g\n", name, range, max_rel, max_abs, worst_x);
+}
+
+static double libExp(double x) { return ::exp(x); }
+static double libLog(double x) { return ::log(x); }
+static double libSin(double x) { return ::sin(x); }
+static double libCos(double x) { return ::cos(x); }
+static double fastExp(double x) { return FastMath::exp(x); }
+static double fastLog(double x) { return FastMath::log(x); }
+static double fastSin(double x) { return FastMath::sin(x); }
+static double fastCos(double x) { return FastMath::cos(x); }
+
+/*! \fn void FastMath::selfCheck(int nb_samples)
+ *
+ * Compare the fast approximations with the standard library functions on
+ * \p nb_samples samples for each function and print the maximum relative and
+ * absolute errors observed, as well as the sample with the worst relative error.
+ */
+void selfCheck(int nb_samples) {
+	printf("Fast math self-check (%d samples per function):\n", nb_samples);
+	printf("  %-7s %-22s %-12s %-12s %s\n", "", "Range", "Max rel err", "Max abs err", "Worst x");
+	checkFunction("exp(x)", "[-700, 700]", fastExp, libExp, -700., 700., false, nb_samples);
+	checkFunction("exp(x)", "[-1, 1]", fastExp, libExp, -1., 1., false, nb_samples);
+	checkFunction("log(x)", "[1e-300, 1e300]", fastLog, libLog, 1e-300, 1e300, true, nb_samples);
+	checkFunction("log(x)", "[0.5, 2]", fastLog, libLog, 0.5, 2., false, nb_samples);
+	checkFunction("sin(x)", "[-2PI, 2PI]", fastSin, libSin, -2. * M_PI, 2. * M_PI, false, nb_samples);
+	checkFunction("sin(x)", "[-1e4, 1e4]", fastSin, libSin, -1e4, 1e4, false, nb_samples);
+	checkFunction("cos(x)", "[-2PI, 2PI]", fastCos, libCos, -2. * M_PI, 2. * M_PI, false, nb_samples);
+	checkFunction("cos(x)", "[-1e4, 1e4]", fastCos, libCos, -1e4, 1e4, false, nb_samples);
+}
+
+} // namespace FastMath
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef fast_math_h
+#define fast_math_h
+
+#include <math.h>
+
+/*! \namespace FastMath
+ *
+ * Fast polynomial approximations of exp(), log(), sin() and cos() used by the
+ * EquationParser when the fast math mode is enabled. They are accurate to a
+ * relative error of about 1e-8 in their normal range and fall back to the
+ * standard library functions outside of it (and for special values such as
+ * NaN, infinities or negative numbers for log()). Use selfCheck() to get the
+ * error actually observed.
+ */
+namespace FastMath {
+
+// Avoid breaking strict-aliasing rules when manipulating the bits of a double
+typedef union { long long l_; double d_; } DoubleBits;
+
+const double LN2_HI = 6.93147180369123816490e-01;
+const double LN2_LO = 1.90821492927058770002e-10;
+const double LOG2_E = 1.44269504088896338700e+00;
+const double PIO2_HI = 1.57079632673412561417e+00;
+const double PIO2_LO = 6.07710050650619224932e-11;
+const double TWO_OVER_PI = 6.36619772367581382433e-01;
+const double SQRT2 = 1.41421356237309514547e+00;
+
+/*! \fn double exp(double x)
+ *
+ * Return an approximation of e raised to the power of x.
+ */
+inline double exp(double x) {
+	if (!(x > -708. && x < 709.))
+		return ::exp(x);
+	// x = k * ln(2) + r with |r| <= ln(2) / 2
+	double kd = x * LOG2_E;
+	int k = (int)(kd < 0. ? kd - 0.5 : kd + 0.5);
+	double r = (x - k * LN2_HI) - k * LN2_LO;
+	double p = 1. + r * (1. + r * (1. / 2. + r * (1. / 6. + r * (1. / 24. + r * (1. / 120. + r * (1. / 720. + r * (1. / 5040.)))))));
+	DoubleBits scale;
+	scale.l_ = (long long)(k + 1023) << 52;
+	return p * scale.d_;
+}
+
+/*! \fn double log(double x)
+ *
+ * Return an approximation of the natural logarithm of x.
+ */
+inline double log(double x) {
+	if (!(x > 0. && x < HUGE_VAL))
+		return ::log(x);
+	DoubleBits bits;
+	bits.d_ = x;
+	int e = (int)((bits.l_ >> 52) & 0x7FF) - 1023;
+	if (e == -1023)
+		return ::log(x); // denormal number
+	// x = m * 2^e with m in [sqrt(2)/2, sqrt(2)[
+	bits.l_ = (bits.l_ & 0x000FFFFFFFFFFFFFLL) | 0x3FF0000000000000LL;
+	double m = bits.d_;
+	if (m > SQRT2) {
+		m *= 0.5;
+		++e;
+	}
+	// log(m) = 2 atanh(s) with s = (m - 1) / (m + 1)
+	double s = (m - 1.) / (m + 1.), s2 = s * s;
+	double l = 2. * s * (1. + s2 * (1. / 3. + s2 * (1. / 5. + s2 * (1. / 7. + s2 * (1. / 9.)))));
+	return e * LN2_HI + (l + e * LN2_LO);
+}
+
+inline double sinPolynomial(double r) {
+	double r2 = r * r;
+	return r * (1. - r2 * (1. / 6. - r2 * (1. / 120. - r2 * (1. / 5040. - r2 * (1. / 362880.)))));
+}
+
+inline double cosPolynomial(double r) {
+	double r2 = r * r;
+	return 1. - r2 * (1. / 2. - r2 * (1. / 24. - r2 * (1. / 720. - r2 * (1. / 40320. - r2 * (1. / 3628800.)))));
+}
+
+/*! \fn double sinCos(double x, int quadrant_shift)
+ *
+ * Reduce x to [-PI/4, PI/4] and evaluate the sine (quadrant_shift = 0)
+ * or the cosine (quadrant_shift = 1) of x.
+ */
+inline double sinCos(double x, int quadrant_shift) {
+	double kd = x * TWO_OVER_PI;
+	int k = (int)(kd < 0. ? kd - 0.5 : kd + 0.5);
+	double r = (x - k * PIO2_HI) - k * PIO2_LO;
+	switch ((k + quadrant_shift) & 3) {
+	case 0:
+		return sinPolynomial(r);
+	case 1:
+		return cosPolynomial(r);
+	case 2:
+		return -sinPolynomial(r);
+	default:
+		return -cosPolynomial(r);
+	}
+}
+
+/*! \fn double sin(double x)
+ *
+ * Return an approximation of the sine of x.
+ */
+inline double sin(double x) {
+	// The range reduction is only accurate enough for moderate values
+	if (!(x > -1e5 && x < 1e5))
+		return ::sin(x);
+	return sinCos(x, 0);
+}
+
+/*! \fn double cos(double x)
+ *
+ * Return an approximation of the cosine of x.
+ */
+inline double cos(double x) {
+	if (!(x > -1e5 && x < 1e5))
+		return ::cos(x);
+	return sinCos(x, 1);
+}
+
+void selfCheck(int nb_samples = 1000000);
+
+} // namespace FastMath
+
+#endif
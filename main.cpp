@@ -19,7 +19,11 @@
 
 #include "modules.h"
 #include "str.h"
+#include "eval_kernels.h"
+#include "equation_parser.h"
+#include "script_cache.h"
 #include <stdio.h>
+#include <string.h>
 
 void printHelp(const char* cmd_name) {
 	printf("Usage: %s [options]\n", cmd_name);
@@ -34,6 +38,20 @@ void printHelp(const char* cmd_name) {
 	printf("  -s 'command'        Same as --script='command'\n");
 	printf("  --file=path         Start in script mode and load the script from the given file.\n");
 	printf("  -f path             Same as --file=path\n");
+	printf("  --fast-math         Use fast approximations of exp(), log(), sin() and cos().\n");
+	printf("                      This can be combined with the other options.\n");
+	printf("  --tolerant-compare  Compare values with a tolerance of 100 ULP in ==, !=, <= and >=.\n");
+	printf("                      This can also be combined with the other options.\n");
+	printf("  --no-cache          Do not use the cache of compiled scripts. This can also be\n");
+	printf("                      combined with the other options.\n");
+	printf("  --cpu-info          Print the CPU level used for the evaluation kernels.\n");
+	printf("\n");
+	printf("The SCRIPT_CMD_CPU_LEVEL environment variable can be set to generic, sse2, avx2\n");
+	printf("or avx512 to force the CPU level used for the evaluation kernels.\n");
+	printf("\n");
+	printf("Compiled scripts are cached in the directory given by the SCRIPT_CMD_CACHE_DIR\n");
+	printf("environment variable, or by default in ~/.cache/script_cmd, so that they do not\n");
+	printf("need to be parsed again the next time the program is started.\n");
 	printf("\n");
 	printf("This program interprets C-like mathematical expressions and prints the result.\n");
 	printf("In Script mode, you can specify a multi-line script that contains variables,\n");
@@ -46,6 +64,24 @@ void printHelp(const char* cmd_name) {
 }
 
 int main(int argc, char* argv[])  {
+	// Select the evaluation kernels for this CPU
+	EvalKernels::init();
+
+	// The --fast-math, --tolerant-compare and --no-cache options can be combined with the other
+	// ones. Remove them from the arguments before parsing them.
+	int nb_args = 1;
+	for (int i = 1 ; i < argc ; ++i) {
+		if (strcmp(argv[i], "--fast-math") == 0)
+			EquationParser::setFastMath(true);
+		else if (strcmp(argv[i], "--tolerant-compare") == 0)
+			EquationParser::setTolerantComparisons(true);
+		else if (strcmp(argv[i], "--no-cache") == 0)
+			ScriptCache::setEnabled(false);
+		else
+			argv[nb_args++] = argv[i];
+	}
+	argc = nb_args;
+
 	// When invoqued with no arguments, start interactive script mode
 	if (argc == 1) {
 		runScriptModule();
@@ -87,6 +123,13 @@ int main(int argc, char* argv[])  {
 		return 0;
 	}
 
+	// CPU info
+	if (first_arg == "--cpu-info" && second_arg.isEmpty()) {
+		printf("Detected CPU level: %s\n", EvalKernels::cpuLevelName(EvalKernels::detectedCpuLevel()));
+		printf("Selected CPU level: %s\n", EvalKernels::cpuLevelName(EvalKernels::cpuLevel()));
+		return 0;
+	}
+
 	// Simple mode
 	if ((first_arg == "-e" || first_arg == "--simple-mode") && second_arg.isEmpty()) {
 		runEquationModule();
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "memo_cache.h"
+
+/*! \fn MemoCache::MemoCache(int nb_arguments)
+ *
+ * Create an empty cache for a function with the given number of arguments
+ * (at most MaxArguments).
+ */
+MemoCache::MemoCache(int nb_arguments) :
+	nb_arguments_(nb_arguments), keys_(NULL), hits_(0), misses_(0)
+{
+	if (nb_arguments_ > 0)
+		keys_ = new unsigned long long[NbSets * NbWays * nb_arguments_];
+	clear();
+}
+
+MemoCache::~MemoCache() {
+	delete [] keys_;
+}
+
+/*! \fn void MemoCache::insert(const double *arguments, double value)
+ *
+ * Store the result for the given arguments, which are not in the cache,
+ * in place of the least recently used entry of their set.
+ */
+void MemoCache::insert(const double *arguments, double value) {
+	unsigned long long key[MaxArguments];
+	memcpy(key, arguments, nb_arguments_ * sizeof(double));
+	int set = setIndex(key);
+	int way = oldest_[set];
+	int entry = set * NbWays + way;
+	memcpy(keys_ + entry * nb_arguments_, key, nb_arguments_ * sizeof(double));
+	values_[entry] = value;
+	valid_[entry] = true;
+	oldest_[set] = (unsigned char)(1 - way);
+}
+
+/*! \fn void MemoCache::clear()
+ *
+ * Remove all the entries and reset the counters.
+ */
+void MemoCache::clear() {
+	memset(valid_, 0, sizeof(valid_));
+	memset(oldest_, 0, sizeof(oldest_));
+	hits_ = 0;
+	misses_ = 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef memo_cache_h
+#define memo_cache_h
+
+#include <string.h>
+
+/*! \class MemoCache
+ *
+ * Small fixed-size cache of the results of a function for the last
+ * arguments it was called with, as used by the memo functions of the
+ * scripts. The arguments are compared by their bit patterns (so 0 and -0
+ * are different arguments, and a NaN argument can be found again). The cache
+ * is two-way set associative: the arguments select a set of two entries and
+ * the least recently used one is replaced on insertion.
+ *
+ * The cache counts the hits and misses of find().
+ *
+ * Example:
+ * \code
+	MemoCache cache(2);
+	double args[2] = { x, y }, result;
+	if (!cache.find(args, result)) {
+		result = pow(x, y);
+		cache.insert(args, result);
+	}
+ * \endcode
+ */
+class MemoCache {
+public:
+	MemoCache(int nb_arguments);
+	~MemoCache();
+
+	bool find(const double *arguments, double &value);
+	void insert(const double *arguments, double value);
+	void clear();
+
+	long long hits() const;
+	long long misses() const;
+
+	enum { SetBits = 8, NbSets = 1 << SetBits, NbWays = 2, MaxArguments = 16 };
+
+private:
+	// Not copyable: the entries are owned by the cache.
+	MemoCache(const MemoCache&);
+	MemoCache &operator=(const MemoCache&);
+
+	int setIndex(const unsigned long long *key) const;
+	bool matches(int entry, const unsigned long long *key) const;
+
+	int nb_arguments_;
+	unsigned long long *keys_;  // nb_arguments_ per entry
+	double values_[NbSets * NbWays];
+	bool valid_[NbSets * NbWays];
+	unsigned char oldest_[NbSets];  // Way to replace in each set
+	long long hits_;
+	long long misses_;
+};
+
+inline long long MemoCache::hits() const {
+	return hits_;
+}
+
+inline long long MemoCache::misses() const {
+	return misses_;
+}
+
+// Select a set from the bits of all the arguments. The low bits of the
+// values that are small integers are all 0, so the set is taken from the
+// high bits of the mixed key.
+inline int MemoCache::setIndex(const unsigned long long *key) const {
+	unsigned long long hash = 0;
+	for (int i = 0 ; i < nb_arguments_ ; ++i)
+		hash = (hash ^ key[i]) * 0x9E3779B97F4A7C15ULL;
+	hash ^= hash >> 32;
+	hash *= 0xD6E8FEB86659FD93ULL;
+	return (int)(hash >> (64 - SetBits));
+}
+
+inline bool MemoCache::matches(int entry, const unsigned long long *key) const {
+	if (!valid_[entry])
+		return false;
+	const unsigned long long *entry_key = keys_ + entry * nb_arguments_;
+	for (int i = 0 ; i < nb_arguments_ ; ++i) {
+		if (entry_key[i] != key[i])
+			return false;
+	}
+	return true;
+}
+
+/*! \fn bool MemoCache::find(const double *arguments, double &value)
+ *
+ * Set \p value to the result stored for the given arguments and return
+ * true, or return false if they are not in the cache.
+ */
+inline bool MemoCache::find(const double *arguments, double &value) {
+	unsigned long long key[MaxArguments];
+	memcpy(key, arguments, nb_arguments_ * sizeof(double));
+	int set = setIndex(key);
+	for (int way = 0 ; way < NbWays ; ++way) {
+		int entry = set * NbWays + way;
+		if (matches(entry, key)) {
+			value = values_[entry];
+			oldest_[set] = (unsigned char)(1 - way);
+			++hits_;
+			return true;
+		}
+	}
+	++misses_;
+	return false;
+}
+
+#endif
@@ -25,6 +25,22 @@
 ParserOperator::ParserOperator() {}
 ParserOperator::~ParserOperator() {}
 
+int ParserOperator::cost() const {
+	int total = 1;
+	for (int i = 0 ; i < nbChildren() ; ++i) {
+		if (child(i) != NULL)
+			total += child(i)->cost();
+	}
+	return total;
+}
+
+#ifdef PARSER_INSTRUMENTATION
+InstrumentedOperator::InstrumentedOperator(ParserOperator *op) : ParserOperator(), op_(op), count_(0), time_ns_(0) {}
+InstrumentedOperator::~InstrumentedOperator() {
+	delete op_;
+}
+#endif
+
 
 ConstantOperator::ConstantOperator(double c, const String& name) : ParserOperator(), var_dbl(c), name_(name) {}
 ConstantOperator::~ConstantOperator() {}
@@ -121,6 +137,28 @@ EqualOrSmallerOperator::~EqualOrSmallerOperator() {}
 NotEqualOperator::NotEqualOperator(ParserOperator *left, ParserOperator *right) : ParserOperator2(left, right) {}
 NotEqualOperator::~NotEqualOperator() {}
 
+TolerantEqualOperator::TolerantEqualOperator(ParserOperator *left, ParserOperator *right) : ParserOperator2(left, right) {}
+TolerantEqualOperator::~TolerantEqualOperator() {}
+
+TolerantNotEqualOperator::TolerantNotEqualOperator(ParserOperator *left, ParserOperator *right) : ParserOperator2(left, right) {}
+TolerantNotEqualOperator::~TolerantNotEqualOperator() {}
+
+TolerantEqualOrGreaterOperator::TolerantEqualOrGreaterOperator(ParserOperator *left, ParserOperator *right) : ParserOperator2(left, right) {}
+TolerantEqualOrGreaterOperator::~TolerantEqualOrGreaterOperator() {}
+
+TolerantEqualOrSmallerOperator::TolerantEqualOrSmallerOperator(ParserOperator *left, ParserOperator *right) : ParserOperator2(left, right) {}
+TolerantEqualOrSmallerOperator::~TolerantEqualOrSmallerOperator() {}
+
+BranchFreeAndOperator::BranchFreeAndOperator(ParserOperator *left, ParserOperator *right) : AndOperator(left, right) {}
+BranchFreeAndOperator::~BranchFreeAndOperator() {}
+
+BranchFreeOrOperator::BranchFreeOrOperator(ParserOperator *left, ParserOperator *right) : OrOperator(left, right) {}
+BranchFreeOrOperator::~BranchFreeOrOperator() {}
+
+BranchFreeIfOperator::BranchFreeIfOperator(ParserOperator *test_exp, ParserOperator *left, ParserOperator *right) :
+	IfOperator(test_exp, left, right) {}
+BranchFreeIfOperator::~BranchFreeIfOperator() {}
+
 AssignmentOperator::AssignmentOperator(ParserOperator *left, ParserOperator *right) : ParserOperator2(left, right) {}
 AssignmentOperator::~AssignmentOperator() {}
 
@@ -172,6 +210,18 @@ LogOperator::~LogOperator() {}
 Log10Operator::Log10Operator(ParserOperator *argument) : ParserOperator1(argument) {}
 Log10Operator::~Log10Operator() {}
 
+FastCosOperator::FastCosOperator(ParserOperator *argument) : ParserOperator1(argument) {}
+FastCosOperator::~FastCosOperator() {}
+
+FastSinOperator::FastSinOperator(ParserOperator *argument) : ParserOperator1(argument) {}
+FastSinOperator::~FastSinOperator() {}
+
+FastExpOperator::FastExpOperator(ParserOperator *argument) : ParserOperator1(argument) {}
+FastExpOperator::~FastExpOperator() {}
+
+FastLogOperator::FastLogOperator(ParserOperator *argument) : ParserOperator1(argument) {}
+FastLogOperator::~FastLogOperator() {}
+
 ASinOperator::ASinOperator(ParserOperator *argument) : ParserOperator1(argument) {}
 ASinOperator::~ASinOperator() {}
 
@@ -230,28 +280,252 @@ MinimumOperator::~MinimumOperator() {}
 MaximumOperator::MaximumOperator(ParserOperator *left, ParserOperator *right) : ParserOperator2(left, right) {}
 MaximumOperator::~MaximumOperator() {}
 
-URandOperator::URandOperator(ParserOperator *minimum, ParserOperator *maximum) : ParserOperator2(minimum, maximum) {}
+URandOperator::URandOperator(ParserOperator *minimum, ParserOperator *maximum, EvaluationContext *context) :
+	ParserOperator2(minimum, maximum), site_(context) {}
 URandOperator::~URandOperator() {}
 
-NRandOperator::NRandOperator(ParserOperator *mean, ParserOperator *sigma) : ParserOperator2(mean, sigma) {}
+NRandOperator::NRandOperator(ParserOperator *mean, ParserOperator *sigma, EvaluationContext *context) :
+	ParserOperator2(mean, sigma), site_(context) {}
 NRandOperator::~NRandOperator() {}
 
-double NRandOperator::generateValue() {
-	// Generate a random number using a normal distribution with mean = 0 and sigma = 1.
-	// Method described by Abramowitz and Stegun
-	static double U, V;
-	static int phase = 0;
-	double Z;
-	if (phase == 0) {
-		U = (rand() + 1.) / (RAND_MAX + 2.);
-		V = rand() / (RAND_MAX + 1.);
-		Z = sqrt(-2 * log(U)) * sin(2. * M_PI * V);
-	} else
-		Z = sqrt(-2 * log(U)) * cos(2. * M_PI * V);
-	phase = 1 - phase;
-	return Z;
+RandSeedOperator::RandSeedOperator(ParserOperator *seed, ParserOperator *stream, EvaluationContext *context) :
+	ParserOperator2(seed, stream), context_(context) {}
+RandSeedOperator::~RandSeedOperator() {}
+
+AggregateOperator::AggregateOperator(ParserOperator *argument) : ParserOperator1(argument), stats_(&own_stats_) {}
+AggregateOperator::~AggregateOperator() {}
+
+/*! \fn void AggregateOperator::merge(const AggregateOperator &other)
+ *
+ * Add the values seen by \p other to the statistics of this operator.
+ */
+void AggregateOperator::merge(const AggregateOperator &other) {
+	stats_->merge(*other.stats_);
 }
 
-RandSeedOperator::RandSeedOperator(ParserOperator *seed) : ParserOperator1(seed) {}
-RandSeedOperator::~RandSeedOperator() {}
+CountAggregateOperator::CountAggregateOperator(ParserOperator *argument) : AggregateOperator(argument) {}
+CountAggregateOperator::~CountAggregateOperator() {}
+
+SumAggregateOperator::SumAggregateOperator(ParserOperator *argument) : AggregateOperator(argument) {}
+SumAggregateOperator::~SumAggregateOperator() {}
+
+MeanAggregateOperator::MeanAggregateOperator(ParserOperator *argument) : AggregateOperator(argument) {}
+MeanAggregateOperator::~MeanAggregateOperator() {}
+
+VarianceAggregateOperator::VarianceAggregateOperator(ParserOperator *argument) : AggregateOperator(argument) {}
+VarianceAggregateOperator::~VarianceAggregateOperator() {}
+
+StdDevAggregateOperator::StdDevAggregateOperator(ParserOperator *argument) : AggregateOperator(argument) {}
+StdDevAggregateOperator::~StdDevAggregateOperator() {}
+
+MinimumAggregateOperator::MinimumAggregateOperator(ParserOperator *argument) : AggregateOperator(argument) {}
+MinimumAggregateOperator::~MinimumAggregateOperator() {}
+
+MaximumAggregateOperator::MaximumAggregateOperator(ParserOperator *argument) : AggregateOperator(argument) {}
+MaximumAggregateOperator::~MaximumAggregateOperator() {}
+
+QuantileAggregateOperator::QuantileAggregateOperator(ParserOperator *value, ParserOperator *fraction) :
+	ParserOperator2(value, fraction), sketch_(&own_sketch_) {}
+QuantileAggregateOperator::~QuantileAggregateOperator() {}
+
+/*! \fn void QuantileAggregateOperator::merge(const QuantileAggregateOperator &other)
+ *
+ * Add the values seen by \p other to the sketch of this operator.
+ */
+void QuantileAggregateOperator::merge(const QuantileAggregateOperator &other) {
+	sketch_->merge(*other.sketch_);
+}
+
+WindowOperator::WindowOperator(ParserOperator *value, ParserOperator *argument) :
+	ParserOperator2(value, argument) {}
+WindowOperator::~WindowOperator() {}
+
+/*! \fn bool WindowOperator::isValidSize(const ParserOperator *size)
+ *
+ * Return true if the given operand can be used as the size of a window: a
+ * constant integer between 1 and MaxSize.
+ */
+bool WindowOperator::isValidSize(const ParserOperator *size) {
+	const ConstantOperator *constant = dynamic_cast<const ConstantOperator*>(size);
+	if (constant == NULL)
+		return false;
+	double value = constant->value();
+	return value >= 1. && value <= MaxSize && value == floor(value);
+}
+
+LagOperator::LagOperator(ParserOperator *value, ParserOperator *lag) :
+	WindowOperator(value, lag), buffer_(size()) {}
+LagOperator::~LagOperator() {}
+
+RollingMeanOperator::RollingMeanOperator(ParserOperator *value, ParserOperator *size) :
+	WindowOperator(value, size), window_(this->size()) {}
+RollingMeanOperator::~RollingMeanOperator() {}
+
+RollingMinimumOperator::RollingMinimumOperator(ParserOperator *value, ParserOperator *size) :
+	WindowOperator(value, size), window_(this->size(), false) {}
+RollingMinimumOperator::~RollingMinimumOperator() {}
+
+RollingMaximumOperator::RollingMaximumOperator(ParserOperator *value, ParserOperator *size) :
+	WindowOperator(value, size), window_(this->size(), true) {}
+RollingMaximumOperator::~RollingMaximumOperator() {}
+
+EmaOperator::EmaOperator(ParserOperator *value, ParserOperator *alpha) :
+	WindowOperator(value, alpha), average_(NAN) {}
+EmaOperator::~EmaOperator() {}
+
+double UserFunction::stack_[UserFunction::MaxDepth * UserFunction::MaxParameters];
+int UserFunction::depth_ = 0;
+
+UserFunction::UserFunction(const String &name, const StringList &parameters, bool memoized) :
+	name_(name), parameters_(parameters), memoized_(memoized), body_(NULL), inlined_(false),
+	side_effects_(false), cost_(CallCost), references_(1), frame_(NULL) {}
+UserFunction::~UserFunction() {
+	delete body_;
+}
+
+void UserFunction::addReference() {
+	++references_;
+}
+
+/*! \fn void UserFunction::release()
+ *
+ * Release a reference to the function, and delete it if it was the last one.
+ * The function starts with one reference, for the EquationParser that creates
+ * it.
+ */
+void UserFunction::release() {
+	if (--references_ == 0)
+		delete this;
+}
+
+// Return true if the given operator or one of its operands has side effects.
+static bool treeHasSideEffects(const ParserOperator *op) {
+	if (op == NULL)
+		return false;
+	if (op->hasSideEffects())
+		return true;
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		if (treeHasSideEffects(op->child(i)))
+			return true;
+	}
+	return false;
+}
+
+/*! \fn void UserFunction::setBody(const String &text, ParserOperator *body, bool recursive)
+ *
+ * Set the source and the compiled body of the function, and decide if it is
+ * inlined: only if it does not call itself (\p recursive) and its cost is at
+ * most InlineMaxCost.
+ */
+void UserFunction::setBody(const String &text, ParserOperator *body, bool recursive) {
+	body_text_ = text;
+	delete body_;
+	body_ = body;
+	side_effects_ = treeHasSideEffects(body);
+	int body_cost = body->cost();
+	inlined_ = !recursive && body_cost <= InlineMaxCost;
+	cost_ = body_cost + CallCost;
+}
+
+/*! \fn double UserFunction::call(const double *arguments) const
+ *
+ * Evaluate the body of the function with one value per parameter in
+ * \p arguments. Return NaN if the calls are nested deeper than MaxDepth.
+ */
+double UserFunction::call(const double *arguments) const {
+	if (depth_ == MaxDepth)
+		return NAN;
+	double *frame = stack_ + depth_ * MaxParameters;
+	for (int i = 0 ; i < parameters_.size() ; ++i)
+		frame[i] = arguments[i];
+	double *caller_frame = frame_;
+	frame_ = frame;
+	++depth_;
+	double result = body_->evaluate();
+	--depth_;
+	frame_ = caller_frame;
+	return result;
+}
+
+FrameParameterOperator::FrameParameterOperator(double *const *frame, int index, const String &name) :
+	ParserOperator(), frame_(frame), index_(index), name_(name) {}
+FrameParameterOperator::~FrameParameterOperator() {}
+
+ParameterOperator::ParameterOperator(const double *slot, const String &name) :
+	ParserOperator(), slot_(slot), name_(name) {}
+ParameterOperator::~ParameterOperator() {}
+
+InlineCallOperator::InlineCallOperator(const String &name, const List<ParserOperator*> &arguments, double *slots, ParserOperator *body) :
+	ParserOperator(), name_(name), arguments_(arguments), slots_(slots), body_(body) {}
+InlineCallOperator::~InlineCallOperator() {
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		delete arguments_[i];
+	delete [] slots_;
+	delete body_;
+}
+
+double InlineCallOperator::evaluate() const {
+	// An argument may evaluate this call again (from the body of a recursive
+	// function), so the slots are only set once all the arguments are known.
+	double values[UserFunction::MaxParameters];
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		values[i] = arguments_[i]->evaluate();
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		slots_[i] = values[i];
+	return body_->evaluate();
+}
+
+FunctionCallOperator::FunctionCallOperator(UserFunction *function, const List<ParserOperator*> &arguments, bool keep_reference) :
+	ParserOperator(), function_(function), keep_reference_(keep_reference), arguments_(arguments)
+{
+	if (keep_reference_)
+		function_->addReference();
+}
+FunctionCallOperator::~FunctionCallOperator() {
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		delete arguments_[i];
+	if (keep_reference_)
+		function_->release();
+}
+
+double FunctionCallOperator::evaluate() const {
+	double values[UserFunction::MaxParameters];
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		values[i] = arguments_[i]->evaluate();
+	return function_->call(values);
+}
+
+int FunctionCallOperator::cost() const {
+	int total = function_->cost();
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		total += arguments_[i]->cost();
+	return total;
+}
+
+MemoOperator::MemoOperator(const List<ParserOperator*> &arguments, double *values, ParserOperator *call) :
+	ParserOperator(), arguments_(arguments), values_(values), call_(call), cache_(arguments.size()) {}
+MemoOperator::~MemoOperator() {
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		delete arguments_[i];
+	delete call_;
+	delete [] values_;
+}
+
+double MemoOperator::evaluate() const {
+	// As for InlineCallOperator, the values read by the call are only set
+	// once all the arguments are known.
+	double arguments[MemoCache::MaxArguments];
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		arguments[i] = arguments_[i]->evaluate();
+	double result;
+	if (cache_.find(arguments, result))
+		return result;
+	for (int i = 0 ; i < arguments_.size() ; ++i)
+		values_[i] = arguments[i];
+	result = call_->evaluate();
+	cache_.insert(arguments, result);
+	return result;
+}
 
+LoopInvariantOperator::LoopInvariantOperator(ParserOperator *argument) : ParserOperator1(argument), value_(0.) {}
+LoopInvariantOperator::~LoopInvariantOperator() {}
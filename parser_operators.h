@@ -26,11 +26,25 @@
 #include "list.h"
 #include "strlist.h"
 #include "math_utils.h"
+#include "fast_math.h"
+#include "evaluation_context.h"
+#include "aggregates.h"
+#include "rolling_window.h"
+#include "memo_cache.h"
+
+// The instrumentation build also needs the parser tree description.
+#if defined(PARSER_INSTRUMENTATION) && !defined(PARSER_TREE_DEBUG)
+#define PARSER_TREE_DEBUG
+#endif
 
 #ifdef PARSER_TREE_DEBUG
 #include <typeinfo>
 #endif
 
+#ifdef PARSER_INSTRUMENTATION
+#include "timer.h"
+#endif
+
 /*! \class ParserOperator
  *
  * This is an internal class for the EquationParser. It is the base
@@ -41,22 +55,80 @@ public:
 	virtual ~ParserOperator();
 
 	virtual double evaluate() const = 0;
+	// Truth value of the operator, for conditions. Reimplement in operators
+	// that compute a boolean, so that it is not converted to a double and back.
+	virtual bool evaluateBool() const;
 
 	// Use by operator =
 	// Reimplement in classes that can change the argument value.
 	virtual bool canBeModified() const;
 	virtual double setValue(double value);
 
-#ifdef PARSER_TREE_DEBUG
-	virtual String operatorName() const { return typeid(*this).name(); }
+	// Operands (used to save compiled scripts and by the debug code)
 	virtual int nbChildren() const { return 0; }
 	virtual ParserOperator* child(int) const { return NULL; }
+	// Return the address of the pointer to the child, so that it can be
+	// replaced (by an InstrumentedOperator or by the script optimizations).
+	virtual ParserOperator** childSlot(int) { return NULL; }
+
+	// Used by the script optimizations.
+	// Reimplement in classes that change a variable, print something or use
+	// the random number generator: they cannot be moved or evaluated less often.
+	virtual bool hasSideEffects() const { return false; }
+	// Reimplement in classes that assign a value to their first operand.
+	virtual bool isAssignment() const { return false; }
+	// Estimated cost of the evaluation of the operator and of its operands, in
+	// number of simple operations such as an addition. The default is one
+	// operation plus the cost of the operands.
+	virtual int cost() const;
+	enum { DivisionCost = 4, FastMathCost = 6, MathFunctionCost = 20 };
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return typeid(*this).name(); }
 #endif
 
 protected:
 	ParserOperator();
 };
 
+#ifdef PARSER_INSTRUMENTATION
+/*! \class InstrumentedOperator
+ *
+ * Only used when compiling with PARSER_INSTRUMENTATION. The EquationParser
+ * wraps each operator that has children in an InstrumentedOperator, which
+ * counts how many times the operator is evaluated and the time spent in
+ * its subtree.
+ */
+class InstrumentedOperator : public ParserOperator {
+public:
+	InstrumentedOperator(ParserOperator *op);
+	virtual ~InstrumentedOperator();
+
+	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
+
+	virtual bool canBeModified() const;
+	virtual double setValue(double value);
+
+	virtual String operatorName() const { return op_->operatorName(); }
+	virtual int nbChildren() const { return op_->nbChildren(); }
+	virtual ParserOperator* child(int i) const { return op_->child(i); }
+	virtual ParserOperator** childSlot(int i) { return op_->childSlot(i); }
+	virtual bool hasSideEffects() const { return op_->hasSideEffects(); }
+	virtual bool isAssignment() const { return op_->isAssignment(); }
+	virtual int cost() const { return op_->cost(); }
+
+	const ParserOperator *wrappedOperator() const;
+	long long count() const;
+	long long timeNs() const;
+
+private:
+	ParserOperator *op_;
+	mutable long long count_;
+	mutable long long time_ns_;
+};
+#endif
+
 class ConstantOperator : public ParserOperator {
 public:
 	ConstantOperator(double c, const String& name = String());
@@ -64,6 +136,9 @@ public:
 
 	virtual double evaluate() const;
 
+	double value() const;
+	const String& name() const;
+
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const {
 		if (name_.isEmpty())
@@ -87,6 +162,8 @@ public:
 	virtual bool canBeModified() const;
 	virtual double setValue(double value);
 	const String& name() const;
+	double *valuePointer() const;
+	void setValuePointer(double*);
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const {
@@ -106,8 +183,13 @@ public:
 
 	virtual double evaluate() const;
 
+	// The values are NULL for the strings
+	const List<ParserOperator*>& values() const;
+	const StringList& strings() const;
+
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Print"; }
+#endif
 	virtual int nbChildren() const {
 		int cpt = 0;
 		for (int i = 0 ; i < values_.size() ; ++i)
@@ -129,7 +211,15 @@ public:
 		}
 		return NULL;
 	}
-#endif
+	virtual ParserOperator** childSlot(int idx) {
+		int cpt = 0;
+		for (int i = 0 ; i < values_.size() ; ++i) {
+			if (values_[i] != NULL && cpt++ == idx)
+				return &values_[i];
+		}
+		return NULL;
+	}
+	virtual bool hasSideEffects() const { return true; }
 
 private:
 	List<ParserOperator*> values_;
@@ -142,14 +232,16 @@ public:
 	virtual ~IfOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "If"; }
+#endif
 	virtual int nbChildren() const { return 3; }
 	virtual ParserOperator* child(int i) const { return i == 0 ? test : (i == 1 ? larg : (i == 2 ? rarg : NULL)); }
-#endif
+	virtual ParserOperator** childSlot(int i) { return i == 0 ? &test : (i == 1 ? &larg : (i == 2 ? &rarg : NULL)); }
 
-private:
+protected:
 	ParserOperator *test;
 	ParserOperator *larg;
 	ParserOperator *rarg;
@@ -159,10 +251,9 @@ class ParserOperator1 : public ParserOperator {
 public:
 	virtual ~ParserOperator1();
 
-#ifdef PARSER_TREE_DEBUG
 	virtual int nbChildren() const { return 1; }
 	virtual ParserOperator* child(int i) const { return i == 0 ? arg : NULL; }
-#endif
+	virtual ParserOperator** childSlot(int i) { return i == 0 ? &arg : NULL; }
 
 protected:
 	ParserOperator1(ParserOperator *argument);
@@ -174,10 +265,9 @@ class ParserOperator2 : public ParserOperator {
 public:
 	virtual ~ParserOperator2();
 
-#ifdef PARSER_TREE_DEBUG
 	virtual int nbChildren() const { return 2; }
 	virtual ParserOperator* child(int i) const { return i == 0 ? larg : (i == 1 ? rarg : NULL); }
-#endif
+	virtual ParserOperator** childSlot(int i) { return i == 0 ? &larg : (i == 1 ? &rarg : NULL); }
 
 protected:
 	ParserOperator2(ParserOperator *left, ParserOperator *right);
@@ -192,6 +282,7 @@ public:
 	virtual ~OrOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Or"; }
@@ -204,6 +295,7 @@ public:
 	virtual ~AndOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "And"; }
@@ -216,6 +308,7 @@ public:
 	virtual ~EqualOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Is equal"; }
@@ -228,6 +321,7 @@ public:
 	virtual ~GreaterOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Is greater"; }
@@ -240,6 +334,7 @@ public:
 	virtual ~SmallerOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Is smaller"; }
@@ -252,6 +347,7 @@ public:
 	virtual ~EqualOrGreaterOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Is equal or greater"; }
@@ -264,6 +360,7 @@ public:
 	virtual ~EqualOrSmallerOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Is equal or smaller"; }
@@ -276,12 +373,119 @@ public:
 	virtual ~NotEqualOperator();
 
 	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Is not equal"; }
 #endif
 };
 
+/*! \class TolerantEqualOperator
+ *
+ * Used instead of the EqualOperator when the tolerant comparisons are enabled
+ * (see EquationParser::setTolerantComparisons()): the two values are equal if
+ * they are within 100 ULP of each other (see MathUtils::isEqual()). The same
+ * applies to the other Tolerant operators below.
+ */
+class TolerantEqualOperator : public ParserOperator2 {
+public:
+	TolerantEqualOperator(ParserOperator *left, ParserOperator *right);
+	virtual ~TolerantEqualOperator();
+
+	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Is equal (tolerant)"; }
+#endif
+};
+
+class TolerantNotEqualOperator : public ParserOperator2 {
+public:
+	TolerantNotEqualOperator(ParserOperator *left, ParserOperator *right);
+	virtual ~TolerantNotEqualOperator();
+
+	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Is not equal (tolerant)"; }
+#endif
+};
+
+class TolerantEqualOrGreaterOperator : public ParserOperator2 {
+public:
+	TolerantEqualOrGreaterOperator(ParserOperator *left, ParserOperator *right);
+	virtual ~TolerantEqualOrGreaterOperator();
+
+	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Is equal or greater (tolerant)"; }
+#endif
+};
+
+class TolerantEqualOrSmallerOperator : public ParserOperator2 {
+public:
+	TolerantEqualOrSmallerOperator(ParserOperator *left, ParserOperator *right);
+	virtual ~TolerantEqualOrSmallerOperator();
+
+	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Is equal or smaller (tolerant)"; }
+#endif
+};
+
+/*! \class BranchFreeAndOperator
+ *
+ * Created by the ScriptParser in place of an AndOperator when its right
+ * operand is cheap and has no side effects. Both operands are always
+ * evaluated and combined without a branch, which is faster than the short
+ * circuit when the result is hard to predict. The BranchFreeOrOperator and
+ * BranchFreeIfOperator do the same for || and if().
+ */
+class BranchFreeAndOperator : public AndOperator {
+public:
+	BranchFreeAndOperator(ParserOperator *left, ParserOperator *right);
+	virtual ~BranchFreeAndOperator();
+
+	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "And (branch-free)"; }
+#endif
+};
+
+class BranchFreeOrOperator : public OrOperator {
+public:
+	BranchFreeOrOperator(ParserOperator *left, ParserOperator *right);
+	virtual ~BranchFreeOrOperator();
+
+	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Or (branch-free)"; }
+#endif
+};
+
+class BranchFreeIfOperator : public IfOperator {
+public:
+	BranchFreeIfOperator(ParserOperator *test, ParserOperator *left, ParserOperator *right);
+	virtual ~BranchFreeIfOperator();
+
+	virtual double evaluate() const;
+	virtual bool evaluateBool() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "If (branch-free)"; }
+#endif
+};
+
 class AssignmentOperator : public ParserOperator2 {
 public:
 	AssignmentOperator(ParserOperator *left, ParserOperator *right);
@@ -295,6 +499,8 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Assign"; }
 #endif
+	virtual bool hasSideEffects() const { return true; }
+	virtual bool isAssignment() const { return true; }
 };
 
 class IncrementOperator : public ParserOperator2 {
@@ -307,6 +513,8 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Increment"; }
 #endif
+	virtual bool hasSideEffects() const { return true; }
+	virtual bool isAssignment() const { return true; }
 };
 
 class SignOperator : public ParserOperator1 {
@@ -379,6 +587,8 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Multiply and assign"; }
 #endif
+	virtual bool hasSideEffects() const { return true; }
+	virtual bool isAssignment() const { return true; }
 };
 
 class DivideOperator : public ParserOperator2 {
@@ -391,6 +601,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Divide"; }
 #endif
+	virtual int cost() const { return DivisionCost + ParserOperator::cost(); }
 };
 
 class DivideAndAssignOperator : public ParserOperator2 {
@@ -403,6 +614,9 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Divide and assign"; }
 #endif
+	virtual int cost() const { return DivisionCost + ParserOperator::cost(); }
+	virtual bool hasSideEffects() const { return true; }
+	virtual bool isAssignment() const { return true; }
 };
 
 class ModuloOperator : public ParserOperator2 {
@@ -415,6 +629,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Modulo"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 
@@ -428,6 +643,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Square root"; }
 #endif
+	virtual int cost() const { return DivisionCost + ParserOperator::cost(); }
 };
 
 class CbrtOperator : public ParserOperator1 {
@@ -440,6 +656,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Cubic root"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class CosOperator : public ParserOperator1 {
@@ -452,6 +669,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Cosine"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class SinOperator : public ParserOperator1 {
@@ -464,6 +682,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Sine"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class TanOperator : public ParserOperator1 {
@@ -476,6 +695,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Tangent"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class ExpOperator : public ParserOperator1 {
@@ -488,6 +708,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Exponential"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class LogOperator : public ParserOperator1 {
@@ -500,6 +721,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Natural logarithm"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class Log10Operator : public ParserOperator1 {
@@ -512,6 +734,59 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Base 10 logarithm"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
+};
+
+class FastCosOperator : public ParserOperator1 {
+public:
+	FastCosOperator(ParserOperator *argument);
+	virtual ~FastCosOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Cosine (fast)"; }
+#endif
+	virtual int cost() const { return FastMathCost + ParserOperator::cost(); }
+};
+
+class FastSinOperator : public ParserOperator1 {
+public:
+	FastSinOperator(ParserOperator *argument);
+	virtual ~FastSinOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Sine (fast)"; }
+#endif
+	virtual int cost() const { return FastMathCost + ParserOperator::cost(); }
+};
+
+class FastExpOperator : public ParserOperator1 {
+public:
+	FastExpOperator(ParserOperator *argument);
+	virtual ~FastExpOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Exponential (fast)"; }
+#endif
+	virtual int cost() const { return FastMathCost + ParserOperator::cost(); }
+};
+
+class FastLogOperator : public ParserOperator1 {
+public:
+	FastLogOperator(ParserOperator *argument);
+	virtual ~FastLogOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Natural logarithm (fast)"; }
+#endif
+	virtual int cost() const { return FastMathCost + ParserOperator::cost(); }
 };
 
 class ASinOperator : public ParserOperator1 {
@@ -524,6 +799,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Arc sine"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class ACosOperator : public ParserOperator1 {
@@ -536,6 +812,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Arc cosine"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 
@@ -549,6 +826,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Arc tangent"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class ATan2Operator : public ParserOperator2 {
@@ -561,6 +839,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Arc tangent of two arguments"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class SinHOperator : public ParserOperator1 {
@@ -573,6 +852,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Hyperbolic sine"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class CosHOperator : public ParserOperator1 {
@@ -585,6 +865,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Hyperbolic cosine"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class TanHOperator : public ParserOperator1 {
@@ -597,6 +878,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Hyperbolic tangent"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class ASinHOperator : public ParserOperator1 {
@@ -609,6 +891,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Inverse hyperbolic sine"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class ACosHOperator : public ParserOperator1 {
@@ -621,6 +904,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Inverse hyperbolic cosine"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class ATanHOperator : public ParserOperator1 {
@@ -633,6 +917,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Inverse hyperbolic tangent"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class RoundOperator : public ParserOperator1 {
@@ -693,6 +978,7 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Pow"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
 };
 
 class Deg2RadOperator : public ParserOperator1 {
@@ -745,7 +1031,7 @@ public:
 
 class URandOperator : public ParserOperator2 {
 public:
-	URandOperator(ParserOperator *min, ParserOperator *max);
+	URandOperator(ParserOperator *min, ParserOperator *max, EvaluationContext *context);
 	virtual ~URandOperator();
 
 	virtual double evaluate() const;
@@ -753,25 +1039,34 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Uniform distribution random number"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
+	virtual bool hasSideEffects() const { return true; }
+
+private:
+	mutable RandomCallSite site_;
 };
 
 class NRandOperator : public ParserOperator2 {
 public:
-	NRandOperator(ParserOperator *mean, ParserOperator *sigma);
+	NRandOperator(ParserOperator *mean, ParserOperator *sigma, EvaluationContext *context);
 	virtual ~NRandOperator();
 
 	virtual double evaluate() const;
-	
-	static double generateValue();
 
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Normal distribution random number"; }
 #endif
+	virtual int cost() const { return MathFunctionCost + ParserOperator::cost(); }
+	virtual bool hasSideEffects() const { return true; }
+
+private:
+	mutable RandomCallSite site_;
 };
 
-class RandSeedOperator : public ParserOperator1 {
+// The stream argument is optional (right argument may be NULL).
+class RandSeedOperator : public ParserOperator2 {
 public:
-	RandSeedOperator(ParserOperator *seed);
+	RandSeedOperator(ParserOperator *seed, ParserOperator *stream, EvaluationContext *context);
 	virtual ~RandSeedOperator();
 
 	virtual double evaluate() const;
@@ -779,39 +1074,624 @@ public:
 #ifdef PARSER_TREE_DEBUG
 	virtual String operatorName() const { return "Set seed for random numbers"; }
 #endif
+	virtual bool hasSideEffects() const { return true; }
+	virtual int nbChildren() const { return rarg == NULL ? 1 : 2; }
+
+private:
+	EvaluationContext *context_;
+};
+
+/*! \class AggregateOperator
+ *
+ * Base class of the aggregate functions (count(), sum(), mean(), ...). Each
+ * call in a script keeps its own statistics, outside of the variables, and
+ * adds the value of its operand to them every time it is evaluated. It then
+ * returns the aggregate of all the values seen so far, so that the result for
+ * the whole data is the value of the last row (which can be printed in the
+ * end section of the script).
+ *
+ * The aggregates have side effects: they are never evaluated before the loop
+ * or the run, or replaced by a constant. The statistics of two operators
+ * evaluated on different parts of the data can be combined with merge().
+ *
+ * The statistics can also be kept outside of the operator with bind(), which
+ * is how a 'group' statement of a script gives each group its own statistics.
+ */
+class AggregateOperator : public ParserOperator1 {
+public:
+	virtual ~AggregateOperator();
+
+	virtual bool hasSideEffects() const { return true; }
+
+	const RunningStats &stats() const;
+	void bind(RunningStats*);
+	void merge(const AggregateOperator&);
+
+protected:
+	AggregateOperator(ParserOperator *argument);
+
+	RunningStats *stats_;  // own_stats_ unless bound to other statistics
+
+private:
+	RunningStats own_stats_;
+};
+
+class CountAggregateOperator : public AggregateOperator {
+public:
+	CountAggregateOperator(ParserOperator *argument);
+	virtual ~CountAggregateOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Count aggregate"; }
+#endif
+};
+
+class SumAggregateOperator : public AggregateOperator {
+public:
+	SumAggregateOperator(ParserOperator *argument);
+	virtual ~SumAggregateOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Sum aggregate"; }
+#endif
+};
+
+class MeanAggregateOperator : public AggregateOperator {
+public:
+	MeanAggregateOperator(ParserOperator *argument);
+	virtual ~MeanAggregateOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Mean aggregate"; }
+#endif
+};
+
+class VarianceAggregateOperator : public AggregateOperator {
+public:
+	VarianceAggregateOperator(ParserOperator *argument);
+	virtual ~VarianceAggregateOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Variance aggregate"; }
+#endif
+};
+
+class StdDevAggregateOperator : public AggregateOperator {
+public:
+	StdDevAggregateOperator(ParserOperator *argument);
+	virtual ~StdDevAggregateOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Standard deviation aggregate"; }
+#endif
+};
+
+class MinimumAggregateOperator : public AggregateOperator {
+public:
+	MinimumAggregateOperator(ParserOperator *argument);
+	virtual ~MinimumAggregateOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Minimum aggregate"; }
+#endif
+};
+
+class MaximumAggregateOperator : public AggregateOperator {
+public:
+	MaximumAggregateOperator(ParserOperator *argument);
+	virtual ~MaximumAggregateOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Maximum aggregate"; }
+#endif
+};
+
+/*! \class QuantileAggregateOperator
+ *
+ * Aggregate function quantile(x, q) (and median(x), which is quantile(x, 0.5)).
+ * The values of x are counted in a QuantileSketch and the result is within 1%
+ * of the exact quantile.
+ */
+class QuantileAggregateOperator : public ParserOperator2 {
+public:
+	QuantileAggregateOperator(ParserOperator *value, ParserOperator *fraction);
+	virtual ~QuantileAggregateOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Quantile aggregate"; }
+#endif
+	virtual bool hasSideEffects() const { return true; }
+
+	void bind(QuantileSketch*);
+	void merge(const QuantileAggregateOperator&);
+
+private:
+	QuantileSketch *sketch_;  // own_sketch_ unless bound to another sketch
+	QuantileSketch own_sketch_;
+};
+
+/*! \class WindowOperator
+ *
+ * Base class of the window functions lag(), rolling_mean(), rolling_min(),
+ * rolling_max() and ema(). Like the aggregates, each call in a script keeps
+ * its own state and updates it every time it is evaluated, so the window is
+ * made of the last values seen by that call (the last rows if it is not in an
+ * 'if' or a loop). The second operand of lag() and of the rolling functions
+ * is the size of the window, which must be a constant (see isValidSize()).
+ */
+class WindowOperator : public ParserOperator2 {
+public:
+	virtual ~WindowOperator();
+
+	virtual bool hasSideEffects() const { return true; }
+
+	static bool isValidSize(const ParserOperator*);
+
+	enum { MaxSize = 10000000 };
+
+protected:
+	WindowOperator(ParserOperator *value, ParserOperator *argument);
+
+	int size() const;
+};
+
+class LagOperator : public WindowOperator {
+public:
+	LagOperator(ParserOperator *value, ParserOperator *lag);
+	virtual ~LagOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Lag"; }
+#endif
+
+private:
+	mutable LagBuffer buffer_;
+};
+
+class RollingMeanOperator : public WindowOperator {
+public:
+	RollingMeanOperator(ParserOperator *value, ParserOperator *size);
+	virtual ~RollingMeanOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Rolling mean"; }
+#endif
+
+private:
+	mutable RollingMean window_;
+};
+
+class RollingMinimumOperator : public WindowOperator {
+public:
+	RollingMinimumOperator(ParserOperator *value, ParserOperator *size);
+	virtual ~RollingMinimumOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Rolling minimum"; }
+#endif
+
+private:
+	mutable RollingExtremum window_;
+};
+
+class RollingMaximumOperator : public WindowOperator {
+public:
+	RollingMaximumOperator(ParserOperator *value, ParserOperator *size);
+	virtual ~RollingMaximumOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Rolling maximum"; }
+#endif
+
+private:
+	mutable RollingExtremum window_;
+};
+
+/*! \class EmaOperator
+ *
+ * Exponential moving average ema(x, alpha): alpha * x + (1 - alpha) times the
+ * previous result. The first value of x is returned as is and NaN values are
+ * ignored. The smoothing factor can be any expression.
+ */
+class EmaOperator : public WindowOperator {
+public:
+	EmaOperator(ParserOperator *value, ParserOperator *alpha);
+	virtual ~EmaOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Exponential moving average"; }
+#endif
+
+private:
+	mutable double average_;  // NaN until the first value
+};
+
+/*! \class UserFunction
+ *
+ * Function defined in a script with 'function name(a, b) { return expr; }'.
+ * The EquationParser compiles its body once when it is defined (see
+ * EquationParser::defineFunction()) with FrameParameterOperator for the
+ * parameters, and then uses it in one of two ways:
+ *   - A small function that does not call itself is inlined: its body is
+ *     compiled again at each call with the arguments in place of the
+ *     parameters (see InlineCallOperator), so a call costs nothing more than
+ *     the expression it stands for.
+ *   - The other functions are evaluated by a FunctionCallOperator through
+ *     call(), which stores the arguments in a new frame of a stack allocated
+ *     once for all the functions.
+ *
+ * The calls of a memo function are wrapped in a MemoOperator, so that each
+ * call site keeps the results for the last arguments it was given.
+ *
+ * The function is shared by the EquationParser that defined it and by the
+ * FunctionCallOperator that use it, and is deleted with the last of them
+ * (see addReference() and release()).
+ */
+class UserFunction {
+public:
+	UserFunction(const String &name, const StringList &parameters, bool memoized = false);
+
+	void addReference();
+	void release();
+
+	const String &name() const;
+	const StringList &parameters() const;
+	int nbParameters() const;
+	bool isMemoized() const;
+
+	void setBody(const String &text, ParserOperator *body, bool recursive);
+	const String &bodyText() const;
+	bool isInlined() const;
+	bool hasSideEffects() const;
+	int cost() const;
+
+	double call(const double *arguments) const;
+	double *const *framePointer() const;
+
+	enum {
+		MaxParameters = 16,
+		// Calls deeper than this return NaN instead of overflowing the stack
+		MaxDepth = 2000,
+		// Bodies up to this cost (see ParserOperator::cost()) are inlined
+		InlineMaxCost = 40,
+		// Cost of a call through the stack, in addition to the body
+		CallCost = 10
+	};
+
+private:
+	~UserFunction();
+	// Not copyable: the operators keep a pointer to the function.
+	UserFunction(const UserFunction&);
+	UserFunction &operator=(const UserFunction&);
+
+	String name_;
+	StringList parameters_;
+	bool memoized_;
+	String body_text_;
+	ParserOperator *body_;
+	bool inlined_;
+	bool side_effects_;
+	int cost_;
+	int references_;
+	// Arguments of the call being evaluated, in stack_
+	mutable double *frame_;
+
+	static double stack_[MaxDepth * MaxParameters];
+	static int depth_;
+};
+
+/*! \class FrameParameterOperator
+ *
+ * Parameter of a UserFunction in the body evaluated by UserFunction::call():
+ * the value in the frame of the current call.
+ */
+class FrameParameterOperator : public ParserOperator {
+public:
+	FrameParameterOperator(double *const *frame, int index, const String &name);
+	virtual ~FrameParameterOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const {
+		return String::format("Parameter: %s", name_.c_str());
+	}
+#endif
+
+private:
+	double *const *frame_;
+	int index_;
+	String name_;
+};
+
+/*! \class ParameterOperator
+ *
+ * Parameter of an inlined UserFunction whose argument is an expression: the
+ * value stored in its slot by the enclosing InlineCallOperator. Unlike a
+ * variable it cannot be assigned, and its value is only known while the
+ * call is evaluated.
+ */
+class ParameterOperator : public ParserOperator {
+public:
+	ParameterOperator(const double *slot, const String &name);
+	virtual ~ParameterOperator();
+
+	virtual double evaluate() const;
+	const double *slot() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const {
+		return String::format("Parameter: %s", name_.c_str());
+	}
+#endif
+
+private:
+	const double *slot_;
+	String name_;
+};
+
+/*! \class InlineCallOperator
+ *
+ * Inlined call of a UserFunction. The arguments that are expressions are
+ * evaluated into the slots read by the ParameterOperator of the body, then
+ * the body is evaluated. The arguments that are variables or constants are
+ * used directly by the body and are not operands of the call.
+ */
+class InlineCallOperator : public ParserOperator {
+public:
+	InlineCallOperator(const String &name, const List<ParserOperator*> &arguments, double *slots, ParserOperator *body);
+	virtual ~InlineCallOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const {
+		return String::format("Inline call: %s", name_.c_str());
+	}
+#endif
+	// The arguments, then the body
+	virtual int nbChildren() const { return arguments_.size() + 1; }
+	virtual ParserOperator* child(int idx) const {
+		if (idx >= 0 && idx < arguments_.size())
+			return arguments_[idx];
+		return idx == arguments_.size() ? body_ : NULL;
+	}
+	virtual ParserOperator** childSlot(int idx) {
+		if (idx >= 0 && idx < arguments_.size())
+			return &arguments_[idx];
+		return idx == arguments_.size() ? &body_ : NULL;
+	}
+
+private:
+	String name_;
+	List<ParserOperator*> arguments_;
+	double *slots_;  // One per argument
+	ParserOperator *body_;
+};
+
+/*! \class FunctionCallOperator
+ *
+ * Call of a UserFunction that is not inlined (see UserFunction::call()). Its
+ * operands are the arguments: the body belongs to the function.
+ */
+class FunctionCallOperator : public ParserOperator {
+public:
+	FunctionCallOperator(UserFunction *function, const List<ParserOperator*> &arguments, bool keep_reference = true);
+	virtual ~FunctionCallOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const {
+		return String::format("Call: %s", function_->name().c_str());
+	}
+#endif
+	virtual int nbChildren() const { return arguments_.size(); }
+	virtual ParserOperator* child(int idx) const {
+		return idx >= 0 && idx < arguments_.size() ? arguments_[idx] : NULL;
+	}
+	virtual ParserOperator** childSlot(int idx) {
+		return idx >= 0 && idx < arguments_.size() ? &arguments_[idx] : NULL;
+	}
+	virtual bool hasSideEffects() const { return function_->hasSideEffects(); }
+	virtual int cost() const;
+
+private:
+	UserFunction *function_;
+	// False for the recursive calls in the body of the function itself
+	bool keep_reference_;
+	List<ParserOperator*> arguments_;
+};
+
+/*! \class MemoOperator
+ *
+ * Call of a function without side effects whose results are kept in a
+ * MemoCache, created for the calls of a 'memo' function and by the memo()
+ * function. The arguments are evaluated first and the call, whose operands
+ * are ParameterOperator reading them, is only evaluated if they are not in
+ * the cache. Each call site has its own cache.
+ */
+class MemoOperator : public ParserOperator {
+public:
+	MemoOperator(const List<ParserOperator*> &arguments, double *values, ParserOperator *call);
+	virtual ~MemoOperator();
+
+	virtual double evaluate() const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const {
+		return String::format("Memo (%lld hits, %lld misses)", cache_.hits(), cache_.misses());
+	}
+#endif
+	// The arguments, then the call
+	virtual int nbChildren() const { return arguments_.size() + 1; }
+	virtual ParserOperator* child(int idx) const {
+		if (idx >= 0 && idx < arguments_.size())
+			return arguments_[idx];
+		return idx == arguments_.size() ? call_ : NULL;
+	}
+	virtual ParserOperator** childSlot(int idx) {
+		if (idx >= 0 && idx < arguments_.size())
+			return &arguments_[idx];
+		return idx == arguments_.size() ? &call_ : NULL;
+	}
+
+private:
+	List<ParserOperator*> arguments_;
+	double *values_;  // Read by the call, one per argument
+	ParserOperator *call_;
+	mutable MemoCache cache_;
+};
+
+/*! \class LoopInvariantOperator
+ *
+ * Created by the ScriptParser in place of a subexpression of a while loop
+ * that does not depend on the variables modified in the loop. The value
+ * of the subexpression is computed once by update() before the loop starts,
+ * and evaluate() returns that value.
+ */
+class LoopInvariantOperator : public ParserOperator1 {
+public:
+	LoopInvariantOperator(ParserOperator *argument);
+	virtual ~LoopInvariantOperator();
+
+	virtual double evaluate() const;
+	void update();
+
+#ifdef PARSER_TREE_DEBUG
+	virtual String operatorName() const { return "Loop invariant"; }
+#endif
+	virtual int cost() const { return 1; }
+
+private:
+	double value_;
 };
 
 /***********************************************************
  * Inline Functions implementation
  ***********************************************************/
 
+inline bool ParserOperator::evaluateBool() const { return evaluate() != 0.;}
 inline bool ParserOperator::canBeModified() const { return false;}
 inline double ParserOperator::setValue(double value) {return value;}
 
+#ifdef PARSER_INSTRUMENTATION
+inline double InstrumentedOperator::evaluate() const {
+	++count_;
+	long long start = Timer::wallNs();
+	double result = op_->evaluate();
+	time_ns_ += Timer::wallNs() - start;
+	return result;
+}
+inline bool InstrumentedOperator::evaluateBool() const {
+	++count_;
+	long long start = Timer::wallNs();
+	bool result = op_->evaluateBool();
+	time_ns_ += Timer::wallNs() - start;
+	return result;
+}
+inline bool InstrumentedOperator::canBeModified() const {return op_->canBeModified();}
+inline double InstrumentedOperator::setValue(double value) {return op_->setValue(value);}
+inline const ParserOperator *InstrumentedOperator::wrappedOperator() const {return op_;}
+inline long long InstrumentedOperator::count() const {return count_;}
+inline long long InstrumentedOperator::timeNs() const {return time_ns_;}
+#endif
+
 inline double ConstantOperator::evaluate() const {return var_dbl;}
+inline double ConstantOperator::value() const {return var_dbl;}
+inline const String& ConstantOperator::name() const {return name_;}
 
 inline double VariableOperator::evaluate() const {return *var_dbl;}
 inline bool VariableOperator::canBeModified() const { return true;}
 inline double VariableOperator::setValue(double value) {return (*var_dbl = value);}
 inline const String& VariableOperator::name() const {return name_;}
+inline double *VariableOperator::valuePointer() const {return var_dbl;}
+inline void VariableOperator::setValuePointer(double *vardbl) {var_dbl = vardbl;}
+
+inline const List<ParserOperator*>& PrintOperator::values() const {return values_;}
+inline const StringList& PrintOperator::strings() const {return strings_;}
+
+inline double IfOperator::evaluate() const {return (test->evaluateBool() ? larg->evaluate() : rarg->evaluate());}
+inline bool IfOperator::evaluateBool() const {return (test->evaluateBool() ? larg->evaluateBool() : rarg->evaluateBool());}
+
+inline double OrOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool OrOperator::evaluateBool() const {return larg->evaluateBool() || rarg->evaluateBool();}
 
-inline double IfOperator::evaluate() const {return (!MathUtils::isEqual(test->evaluate(), 0.) ? larg->evaluate() : rarg->evaluate());}
+inline double AndOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool AndOperator::evaluateBool() const {return larg->evaluateBool() && rarg->evaluateBool();}
 
-inline double OrOperator::evaluate() const {return (!MathUtils::isEqual(larg->evaluate(), 0.) || !MathUtils::isEqual(rarg->evaluate(), 0.) ? 1. : 0.);}
+inline double EqualOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool EqualOperator::evaluateBool() const {return larg->evaluate() == rarg->evaluate();}
 
-inline double AndOperator::evaluate() const {return (!MathUtils::isEqual(larg->evaluate(), 0.) && !MathUtils::isEqual(rarg->evaluate(), 0.) ? 1. : 0.);}
+inline double GreaterOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool GreaterOperator::evaluateBool() const {return larg->evaluate() > rarg->evaluate();}
 
-inline double EqualOperator::evaluate() const {return (MathUtils::isEqual(larg->evaluate(), rarg->evaluate()) ? 1. : 0.);}
+inline double SmallerOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool SmallerOperator::evaluateBool() const {return larg->evaluate() < rarg->evaluate();}
 
-inline double GreaterOperator::evaluate() const {return (larg->evaluate() > rarg->evaluate() ? 1. : 0.);}
+inline double EqualOrGreaterOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool EqualOrGreaterOperator::evaluateBool() const {return larg->evaluate() >= rarg->evaluate();}
 
-inline double SmallerOperator::evaluate() const {return (larg->evaluate() < rarg->evaluate() ? 1. : 0.);}
+inline double EqualOrSmallerOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool EqualOrSmallerOperator::evaluateBool() const {return larg->evaluate() <= rarg->evaluate();}
 
-inline double EqualOrGreaterOperator::evaluate() const {return (MathUtils::isSupOrEqual(larg->evaluate(), rarg->evaluate()) ? 1. : 0.);}
+inline double NotEqualOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool NotEqualOperator::evaluateBool() const {return larg->evaluate() != rarg->evaluate();}
 
-inline double EqualOrSmallerOperator::evaluate() const {return (MathUtils::isInfOrEqual(larg->evaluate(), rarg->evaluate()) ? 1. : 0.);}
+inline double TolerantEqualOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool TolerantEqualOperator::evaluateBool() const {return MathUtils::isEqual(larg->evaluate(), rarg->evaluate());}
 
-inline double NotEqualOperator::evaluate() const {return (!MathUtils::isEqual(larg->evaluate(), rarg->evaluate()) ? 1. : 0.);}
+inline double TolerantNotEqualOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool TolerantNotEqualOperator::evaluateBool() const {return !MathUtils::isEqual(larg->evaluate(), rarg->evaluate());}
+
+inline double TolerantEqualOrGreaterOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool TolerantEqualOrGreaterOperator::evaluateBool() const {return MathUtils::isSupOrEqual(larg->evaluate(), rarg->evaluate());}
+
+inline double TolerantEqualOrSmallerOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool TolerantEqualOrSmallerOperator::evaluateBool() const {return MathUtils::isInfOrEqual(larg->evaluate(), rarg->evaluate());}
+
+inline double BranchFreeAndOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool BranchFreeAndOperator::evaluateBool() const {return larg->evaluateBool() & rarg->evaluateBool();}
+
+inline double BranchFreeOrOperator::evaluate() const {return evaluateBool() ? 1. : 0.;}
+inline bool BranchFreeOrOperator::evaluateBool() const {return larg->evaluateBool() | rarg->evaluateBool();}
+
+inline double BranchFreeIfOperator::evaluate() const {
+	bool condition = test->evaluateBool();
+	double left = larg->evaluate(), right = rarg->evaluate();
+	return condition ? left : right;
+}
+inline bool BranchFreeIfOperator::evaluateBool() const {
+	bool condition = test->evaluateBool();
+	bool left = larg->evaluateBool(), right = rarg->evaluateBool();
+	return (condition & left) | (!condition & right);
+}
 
 inline double AssignmentOperator::evaluate() const {return larg->setValue(rarg->evaluate());}
 // Assignment operator can be modified if right operand can be modified.
@@ -856,6 +1736,14 @@ inline double LogOperator::evaluate() const {return log(arg->evaluate());}
 
 inline double Log10Operator::evaluate() const {return log10(arg->evaluate());}
 
+inline double FastCosOperator::evaluate() const {return FastMath::cos(arg->evaluate());}
+
+inline double FastSinOperator::evaluate() const {return FastMath::sin(arg->evaluate());}
+
+inline double FastExpOperator::evaluate() const {return FastMath::exp(arg->evaluate());}
+
+inline double FastLogOperator::evaluate() const {return FastMath::log(arg->evaluate());}
+
 inline double ASinOperator::evaluate() const {return asin(arg->evaluate());}
 
 inline double ACosOperator::evaluate() const {return acos(arg->evaluate());}
@@ -905,19 +1793,117 @@ inline double MaximumOperator::evaluate() const {
 
 inline double URandOperator::evaluate() const {
 	double minimum = larg->evaluate(), maximum = rarg->evaluate();
-	return minimum + rand() * (maximum - minimum) / RAND_MAX;
+	return minimum + site_.uniform() * (maximum - minimum);
 }
 
 inline double NRandOperator::evaluate() const {
-	return larg->evaluate() + rarg->evaluate() * generateValue();
+	return larg->evaluate() + rarg->evaluate() * site_.normal();
 }
 
 inline double RandSeedOperator::evaluate() const {
-	unsigned int s = (unsigned int)arg->evaluate();
-	srand(s);
-	return (double)s;
+	double seed = larg->evaluate();
+	double stream = rarg == NULL ? 0. : rarg->evaluate();
+	// Seeds and streams that cannot be converted to an integer (NaN, infinite
+	// or out of range) and negative streams leave the generator unchanged.
+	const double limit = 9223372036854775808.;  // 2^63
+	if (!(seed >= -limit && seed < limit) || !(stream >= 0. && stream < limit))
+		return NAN;
+	unsigned long long s = (unsigned long long)(long long)seed;
+	context_->seed(s, (unsigned long long)stream);
+	return (double)(long long)s;
+}
+
+inline const RunningStats &AggregateOperator::stats() const {return *stats_;}
+inline void AggregateOperator::bind(RunningStats *stats) {stats_ = stats != NULL ? stats : &own_stats_;}
+
+inline double CountAggregateOperator::evaluate() const {
+	stats_->add(arg->evaluate());
+	return (double)stats_->count();
+}
+
+inline double SumAggregateOperator::evaluate() const {
+	stats_->add(arg->evaluate());
+	return stats_->sum();
+}
+
+inline double MeanAggregateOperator::evaluate() const {
+	stats_->add(arg->evaluate());
+	return stats_->mean();
+}
+
+inline double VarianceAggregateOperator::evaluate() const {
+	stats_->add(arg->evaluate());
+	return stats_->variance();
+}
+
+inline double StdDevAggregateOperator::evaluate() const {
+	stats_->add(arg->evaluate());
+	return stats_->stddev();
+}
+
+inline double MinimumAggregateOperator::evaluate() const {
+	stats_->add(arg->evaluate());
+	return stats_->minimum();
+}
+
+inline double MaximumAggregateOperator::evaluate() const {
+	stats_->add(arg->evaluate());
+	return stats_->maximum();
+}
+
+inline double QuantileAggregateOperator::evaluate() const {
+	sketch_->add(larg->evaluate());
+	return sketch_->quantile(rarg->evaluate());
+}
+
+inline void QuantileAggregateOperator::bind(QuantileSketch *sketch) {sketch_ = sketch != NULL ? sketch : &own_sketch_;}
+
+inline int WindowOperator::size() const {return (int)rarg->evaluate();}
+
+inline double LagOperator::evaluate() const {return buffer_.push(larg->evaluate());}
+
+inline double RollingMeanOperator::evaluate() const {
+	window_.add(larg->evaluate());
+	return window_.mean();
+}
+
+inline double RollingMinimumOperator::evaluate() const {
+	window_.add(larg->evaluate());
+	return window_.value();
+}
+
+inline double RollingMaximumOperator::evaluate() const {
+	window_.add(larg->evaluate());
+	return window_.value();
+}
+
+inline double EmaOperator::evaluate() const {
+	double value = larg->evaluate();
+	if (value == value) {
+		if (average_ != average_)
+			average_ = value;
+		else
+			average_ += rarg->evaluate() * (value - average_);
+	}
+	return average_;
 }
 
+inline const String &UserFunction::name() const {return name_;}
+inline const StringList &UserFunction::parameters() const {return parameters_;}
+inline int UserFunction::nbParameters() const {return parameters_.size();}
+inline bool UserFunction::isMemoized() const {return memoized_;}
+inline const String &UserFunction::bodyText() const {return body_text_;}
+inline bool UserFunction::isInlined() const {return inlined_;}
+inline bool UserFunction::hasSideEffects() const {return side_effects_;}
+inline int UserFunction::cost() const {return cost_;}
+inline double *const *UserFunction::framePointer() const {return &frame_;}
+
+inline double FrameParameterOperator::evaluate() const {return (*frame_)[index_];}
+inline double ParameterOperator::evaluate() const {return *slot_;}
+inline const double *ParameterOperator::slot() const {return slot_;}
+
+inline double LoopInvariantOperator::evaluate() const {return value_;}
+inline void LoopInvariantOperator::update() {value_ = arg->evaluate();}
 
 
 #endif
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "random_generator.h"
+#include "eval_kernels.h"
+
+// Jump polynomials of xoshiro256 (equivalent to 2^128 and 2^192 calls to next())
+static const unsigned long long jump_128[] = {
+	0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+};
+static const unsigned long long jump_192[] = {
+	0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL
+};
+
+static unsigned long long splitMix64(unsigned long long &x) {
+	unsigned long long z = (x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*! \fn RandomGenerator::RandomGenerator(unsigned long long seed)
+ *
+ * Create a generator for stream 0 of the given seed.
+ */
+RandomGenerator::RandomGenerator(unsigned long long seed) {
+	this->seed(seed);
+}
+
+/*! \fn void RandomGenerator::seed(unsigned long long seed, unsigned long long stream)
+ *
+ * Reset the generator to the beginning of the given stream for the given seed.
+ * The same seed and stream always give the same sequence of numbers. The
+ * time needed to reach a stream grows with the logarithm of its number.
+ */
+void RandomGenerator::seed(unsigned long long seed, unsigned long long stream) {
+	seed_ = seed;
+	stream_ = stream;
+	unsigned long long x = seed;
+	for (int i = 0 ; i < 4 ; ++i)
+		state_[i] = splitMix64(x);
+	// The Philox key depends on both the seed and the stream
+	x = seed ^ (stream * 0xd1342543de82ef95ULL);
+	unsigned long long key = splitMix64(x);
+	philox_key_[0] = (unsigned int)key;
+	philox_key_[1] = (unsigned int)(key >> 32);
+	jumpStreams(state_, stream);
+	for (int i = 0 ; i < 4 ; ++i)
+		stream_start_[i] = state_[i];
+	has_spare_normal_ = false;
+	spare_normal_ = 0.;
+	bulk_state_ready_ = false;
+}
+
+// Advance the state by the jump corresponding to the given polynomial.
+void RandomGenerator::jump(unsigned long long *state, const unsigned long long *polynomial) {
+	unsigned long long s[4] = { state[0], state[1], state[2], state[3] };
+	unsigned long long j[4] = { 0, 0, 0, 0 };
+	for (int i = 0 ; i < 4 ; ++i) {
+		for (int b = 0 ; b < 64 ; ++b) {
+			if (polynomial[i] & (1ULL << b)) {
+				for (int w = 0 ; w < 4 ; ++w)
+					j[w] ^= s[w];
+			}
+			unsigned long long t = s[1] << 17;
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = rotl(s[3], 45);
+		}
+	}
+	for (int w = 0 ; w < 4 ; ++w)
+		state[w] = j[w];
+}
+
+// Apply the linear map of the 256-bit state given by the images of the 256
+// basis vectors (columns[k] is the image of bit k) to the given state.
+static void applyLinearMap(const unsigned long long (*columns)[4], unsigned long long *state) {
+	unsigned long long result[4] = { 0, 0, 0, 0 };
+	for (int k = 0 ; k < 256 ; ++k) {
+		if (state[k / 64] & (1ULL << (k % 64))) {
+			for (int w = 0 ; w < 4 ; ++w)
+				result[w] ^= columns[k][w];
+		}
+	}
+	for (int w = 0 ; w < 4 ; ++w)
+		state[w] = result[w];
+}
+
+// Advance the state by the given number of 2^192 jumps. The jump is a linear
+// map of the state, so the n-th jump is computed by repeated squaring of its
+// matrix in O(log n) matrix products.
+void RandomGenerator::jumpStreams(unsigned long long *state, unsigned long long nb_streams) {
+	if (nb_streams == 0)
+		return;
+	if (nb_streams == 1) {
+		jump(state, jump_192);
+		return;
+	}
+	unsigned long long columns[256][4], squared[256][4];
+	for (int k = 0 ; k < 256 ; ++k) {
+		for (int w = 0 ; w < 4 ; ++w)
+			columns[k][w] = w == k / 64 ? 1ULL << (k % 64) : 0;
+		jump(columns[k], jump_192);
+	}
+	while (true) {
+		if (nb_streams & 1)
+			applyLinearMap(columns, state);
+		nb_streams >>= 1;
+		if (nb_streams == 0)
+			break;
+		for (int k = 0 ; k < 256 ; ++k) {
+			for (int w = 0 ; w < 4 ; ++w)
+				squared[k][w] = columns[k][w];
+			applyLinearMap(columns, squared[k]);
+		}
+		for (int k = 0 ; k < 256 ; ++k) {
+			for (int w = 0 ; w < 4 ; ++w)
+				columns[k][w] = squared[k][w];
+		}
+	}
+}
+
+// The bulk generator j (0 to 3) starts j + 1 jumps of 2^128 after the
+// beginning of the current stream.
+void RandomGenerator::initBulkState() {
+	unsigned long long s[4] = { stream_start_[0], stream_start_[1], stream_start_[2], stream_start_[3] };
+	for (int j = 0 ; j < 4 ; ++j) {
+		jump(s, jump_128);
+		for (int w = 0 ; w < 4 ; ++w)
+			bulk_state_[4 * w + j] = s[w];
+	}
+	bulk_state_ready_ = true;
+}
+
+/*! \fn void RandomGenerator::fillUniform(double *values, int n, double minimum, double maximum)
+ *
+ * Fill \p values with \p n random numbers between \p minimum and \p maximum
+ * with a uniform distribution. This uses the vectorized kernel from
+ * EvalKernels and is much faster than calling uniform() in a loop, but the
+ * numbers only have 52 random bits.
+ */
+void RandomGenerator::fillUniform(double *values, int n, double minimum, double maximum) {
+	if (n <= 0)
+		return;
+	if (!bulk_state_ready_)
+		initBulkState();
+	EvalKernels::uniformFill(bulk_state_, values, n);
+	if (minimum != 0. || maximum != 1.) {
+		double range = maximum - minimum;
+		for (int i = 0 ; i < n ; ++i)
+			values[i] = minimum + values[i] * range;
+	}
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef random_generator_h
+#define random_generator_h
+
+#include <math.h>
+
+/*! \class RandomGenerator
+ *
+ * Pseudo-random number generator used by urand() and nrand(). It implements
+ * xoshiro256++ (period 2^256 - 1, 64-bit outputs) and is seeded with
+ * splitmix64 so that any seed, including 0, gives a good initial state.
+ *
+ * Independent streams for the same seed are obtained by jump-ahead: stream n
+ * starts 2^192 * n numbers after stream 0, so two streams never overlap in
+ * practice. The bulk function fillUniform() uses four generators of its own,
+ * derived from the current stream with the shorter 2^128 jump, so that they
+ * can be evaluated with SIMD instructions. It does not change the sequence
+ * returned by uniform() and normal(). The scripts are evaluated one row at a
+ * time, so urand() does not use it: until there is a batch evaluation, only
+ * the benchmark suite uses it to generate its data file.
+ *
+ * The generator also provides counter-based numbers (counterUniform() and
+ * counterNormal()) computed with Philox4x32-10. Those are a pure function of
+ * the seed, the stream and the given counter, and do not use or change the
+ * state of the sequential generator.
+ */
+class RandomGenerator {
+public:
+	RandomGenerator(unsigned long long seed = 1);
+
+	void seed(unsigned long long seed, unsigned long long stream = 0);
+	unsigned long long seedValue() const;
+	unsigned long long stream() const;
+
+	unsigned long long next();
+	double uniform();
+	double normal();
+
+	void fillUniform(double *values, int n, double minimum = 0., double maximum = 1.);
+
+	double counterUniform(unsigned long long row, unsigned int site, unsigned int call) const;
+	double counterNormal(unsigned long long row, unsigned int site, unsigned int call) const;
+
+	static void philox(const unsigned int *counter, const unsigned int *key, unsigned int *result);
+
+private:
+	static void jump(unsigned long long *state, const unsigned long long *polynomial);
+	static void jumpStreams(unsigned long long *state, unsigned long long nb_streams);
+	static unsigned long long rotl(unsigned long long x, int k);
+	void initBulkState();
+
+	unsigned long long state_[4];
+	unsigned long long stream_start_[4];
+	unsigned long long seed_;
+	unsigned long long stream_;
+	unsigned int philox_key_[2];
+	double spare_normal_;
+	bool has_spare_normal_;
+	// Four generators for the bulk functions, stored word by word
+	// (bulk_state_[4 * w + j] is the word w of generator j).
+	unsigned long long bulk_state_[16];
+	bool bulk_state_ready_;
+};
+
+inline unsigned long long RandomGenerator::rotl(unsigned long long x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+/*! \fn unsigned long long RandomGenerator::seedValue() const
+ *
+ * Return the seed given to the last call to seed().
+ */
+inline unsigned long long RandomGenerator::seedValue() const {
+	return seed_;
+}
+
+/*! \fn unsigned long long RandomGenerator::stream() const
+ *
+ * Return the stream given to the last call to seed().
+ */
+inline unsigned long long RandomGenerator::stream() const {
+	return stream_;
+}
+
+/*! \fn unsigned long long RandomGenerator::next()
+ *
+ * Return the next 64-bit number of the sequence.
+ */
+inline unsigned long long RandomGenerator::next() {
+	unsigned long long result = rotl(state_[0] + state_[3], 23) + state_[0];
+	unsigned long long t = state_[1] << 17;
+	state_[2] ^= state_[0];
+	state_[3] ^= state_[1];
+	state_[1] ^= state_[2];
+	state_[0] ^= state_[3];
+	state_[2] ^= t;
+	state_[3] = rotl(state_[3], 45);
+	return result;
+}
+
+/*! \fn double RandomGenerator::uniform()
+ *
+ * Return a random number in [0, 1[ with a uniform distribution.
+ * All the 53 bits of the mantissa are random.
+ */
+inline double RandomGenerator::uniform() {
+	return (next() >> 11) * (1. / 9007199254740992.);
+}
+
+/*! \fn double RandomGenerator::normal()
+ *
+ * Return a random number with a normal distribution (mean = 0 and
+ * sigma = 1). The numbers are generated by pairs with the Box-Muller
+ * transform and the second one is kept for the next call.
+ */
+inline double RandomGenerator::normal() {
+	if (has_spare_normal_) {
+		has_spare_normal_ = false;
+		return spare_normal_;
+	}
+	// 1 - uniform() is in ]0, 1] so that the logarithm is finite
+	double r = sqrt(-2. * log(1. - uniform()));
+	double theta = 2. * M_PI * uniform();
+	spare_normal_ = r * cos(theta);
+	has_spare_normal_ = true;
+	return r * sin(theta);
+}
+
+/*! \fn void RandomGenerator::philox(const unsigned int *counter, const unsigned int *key, unsigned int *result)
+ *
+ * Compute the Philox4x32-10 block for the given 4-word counter and 2-word key.
+ */
+inline void RandomGenerator::philox(const unsigned int *counter, const unsigned int *key, unsigned int *result) {
+	unsigned int c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	unsigned int k0 = key[0], k1 = key[1];
+	for (int round = 0 ; round < 10 ; ++round) {
+		unsigned long long p0 = (unsigned long long)0xD2511F53U * c0;
+		unsigned long long p1 = (unsigned long long)0xCD9E8D57U * c2;
+		c0 = (unsigned int)(p1 >> 32) ^ c1 ^ k0;
+		c2 = (unsigned int)(p0 >> 32) ^ c3 ^ k1;
+		c1 = (unsigned int)p1;
+		c3 = (unsigned int)p0;
+		k0 += 0x9E3779B9U;
+		k1 += 0xBB67AE85U;
+	}
+	result[0] = c0;
+	result[1] = c1;
+	result[2] = c2;
+	result[3] = c3;
+}
+
+/*! \fn double RandomGenerator::counterUniform(unsigned long long row, unsigned int site, unsigned int call) const
+ *
+ * Return a random number in [0, 1[ with a uniform distribution that only
+ * depends on the seed, the stream, and the given row, call site and call count.
+ */
+inline double RandomGenerator::counterUniform(unsigned long long row, unsigned int site, unsigned int call) const {
+	unsigned int counter[4] = { (unsigned int)row, (unsigned int)(row >> 32), site, call }, block[4];
+	philox(counter, philox_key_, block);
+	unsigned long long bits = ((unsigned long long)block[0] << 32) | block[1];
+	return (bits >> 11) * (1. / 9007199254740992.);
+}
+
+/*! \fn double RandomGenerator::counterNormal(unsigned long long row, unsigned int site, unsigned int call) const
+ *
+ * Return a random number with a normal distribution (mean = 0 and sigma = 1)
+ * that only depends on the seed, the stream, and the given row, call site and
+ * call count. Both uniform numbers used by the Box-Muller transform come from
+ * the same Philox block, and the second normal number is not used.
+ */
+inline double RandomGenerator::counterNormal(unsigned long long row, unsigned int site, unsigned int call) const {
+	unsigned int counter[4] = { (unsigned int)row, (unsigned int)(row >> 32), site, call }, block[4];
+	philox(counter, philox_key_, block);
+	unsigned long long bits1 = ((unsigned long long)block[0] << 32) | block[1];
+	unsigned long long bits2 = ((unsigned long long)block[2] << 32) | block[3];
+	double r = sqrt(-2. * log(1. - (bits1 >> 11) * (1. / 9007199254740992.)));
+	return r * sin(2. * M_PI * (bits2 >> 11) * (1. / 9007199254740992.));
+}
+
+#endif
@@ -19,15 +19,21 @@
 
 #include "redirect_output.h"
 #include "list.h"
+#include "timer.h"
 
 List<FILE*> streams;
 
+// Output statistics
+static bool output_timing = false;
+static long long output_bytes_count = 0;
+static long long output_ns = 0;
+
 
 bool redirect_output(const String& file) {
-	FILE* f = fopen(file.c_str(), "a");
+	FILE* f = open_output(file);
 	if (f == NULL)
 		return false;
-	streams << f;
+	push_output(f);
 	return true;
 }
 
@@ -36,16 +42,54 @@ void close_redirect_output() {
 		fclose(streams.takeLast());
 }
 
+// Open the given file to append the output to it. Return NULL on failure.
+FILE* open_output(const String& file) {
+	return fopen(file.c_str(), "a");
+}
+
+// Send the output to the given stream, which stays owned by the caller,
+// until pop_output() is called. This is cheap enough to switch between
+// several outputs for each row of a data file.
+void push_output(FILE* f) {
+	streams << f;
+}
+
+void pop_output() {
+	if (!streams.isEmpty())
+		streams.takeLast();
+}
+
 int rprintf(const char *fmt, ...) {
 	FILE* stream = stdout;
 	if (!streams.isEmpty())
 		stream = streams.last();
 
+	long long start = output_timing ? Timer::wallNs() : 0;
 	va_list args;
 	va_start(args, fmt);
     int status = vfprintf(stream, fmt, args);
     va_end(args);
+	if (status > 0)
+		output_bytes_count += status;
+	if (output_timing)
+		output_ns += Timer::wallNs() - start;
 
     return status;
 }
 
+// Reset the number of bytes written by rprintf() and the time spent in it.
+// The time is only measured if timing is true.
+void reset_output_stats(bool timing) {
+	output_timing = timing;
+	output_bytes_count = 0;
+	output_ns = 0;
+}
+
+long long output_bytes() {
+	return output_bytes_count;
+}
+
+long long output_time_ns() {
+	return output_ns;
+}
+
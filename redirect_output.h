@@ -26,6 +26,14 @@
 bool redirect_output(const String& file);
 void close_redirect_output();
 
+FILE* open_output(const String& file);
+void push_output(FILE*);
+void pop_output();
+
 int rprintf(const char *fmt, ...);
 
+void reset_output_stats(bool timing);
+long long output_bytes();
+long long output_time_ns();
+
 #endif
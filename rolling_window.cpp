@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "rolling_window.h"
+
+LagBuffer::LagBuffer(int lag) :
+	values_(new double[lag]), size_(lag), position_(0)
+{
+	for (int i = 0 ; i < size_ ; ++i)
+		values_[i] = NAN;
+}
+
+LagBuffer::~LagBuffer() {
+	delete [] values_;
+}
+
+RollingMean::RollingMean(int size) :
+	values_(new double[size]), size_(size), position_(0), count_(0),
+	nb_positive_infinite_(0), nb_negative_infinite_(0),
+	sum_(0.), compensation_(0.)
+{
+	// The empty places of the window are NaN, which are not counted
+	for (int i = 0 ; i < size_ ; ++i)
+		values_[i] = NAN;
+}
+
+RollingMean::~RollingMean() {
+	delete [] values_;
+}
+
+RollingExtremum::RollingExtremum(int size, bool maximum) :
+	values_(new double[size]), rows_(new long long[size]), size_(size),
+	maximum_(maximum), first_(0), nb_values_(0), row_(0)
+{
+}
+
+RollingExtremum::~RollingExtremum() {
+	delete [] values_;
+	delete [] rows_;
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef rolling_window_h
+#define rolling_window_h
+
+#include <math.h>
+
+/*! \class LagBuffer
+ *
+ * Ring buffer that returns the value that was pushed a fixed number of
+ * pushes earlier, as used by the lag() function of the scripts.
+ */
+class LagBuffer {
+public:
+	LagBuffer(int lag);
+	~LagBuffer();
+
+	double push(double);
+
+private:
+	// Not copyable: the buffer is owned by the object.
+	LagBuffer(const LagBuffer&);
+	LagBuffer &operator=(const LagBuffer&);
+
+	double *values_;
+	int size_;
+	int position_;   // Position of the oldest value
+};
+
+/*! \fn double LagBuffer::push(double value)
+ *
+ * Add a value and return the one that was added \p lag calls earlier, or NaN
+ * if there were not that many calls yet.
+ */
+inline double LagBuffer::push(double value) {
+	double old = values_[position_];
+	values_[position_] = value;
+	if (++position_ == size_)
+		position_ = 0;
+	return old;
+}
+
+/*! \class RollingMean
+ *
+ * Mean of the last values added, up to a fixed window size. The values
+ * leaving the window are subtracted from a compensated sum (see RunningStats),
+ * so that add() does not depend on the window size. NaN values take a place
+ * in the window but are not counted in the mean, and infinite values are
+ * counted separately so that they do not poison the sum once they leave the
+ * window.
+ */
+class RollingMean {
+public:
+	RollingMean(int size);
+	~RollingMean();
+
+	void add(double);
+	double mean() const;
+
+private:
+	// Not copyable: the buffer is owned by the object.
+	RollingMean(const RollingMean&);
+	RollingMean &operator=(const RollingMean&);
+
+	void addToSum(double);
+
+	double *values_;
+	int size_;
+	int position_;   // Position of the oldest value
+	int count_;      // Number of values that are not NaN
+	int nb_positive_infinite_;
+	int nb_negative_infinite_;
+	double sum_;     // Sum of the finite values
+	double compensation_;
+};
+
+/*! \fn void RollingMean::add(double value)
+ *
+ * Add a value to the window, removing the oldest one if the window is full.
+ */
+inline void RollingMean::add(double value) {
+	double old = values_[position_];
+	values_[position_] = value;
+	if (++position_ == size_)
+		position_ = 0;
+	if (old == old) {
+		--count_;
+		if (old > 1.7976931348623157e308)
+			--nb_positive_infinite_;
+		else if (old < -1.7976931348623157e308)
+			--nb_negative_infinite_;
+		else
+			addToSum(-old);
+		// Forget the rounding errors when the window becomes empty
+		if (count_ == 0)
+			sum_ = compensation_ = 0.;
+	}
+	if (value == value) {
+		++count_;
+		if (value > 1.7976931348623157e308)
+			++nb_positive_infinite_;
+		else if (value < -1.7976931348623157e308)
+			++nb_negative_infinite_;
+		else
+			addToSum(value);
+	}
+}
+
+/*! \fn double RollingMean::mean() const
+ *
+ * Return the mean of the values in the window, or NaN if there are none.
+ */
+inline double RollingMean::mean() const {
+	if (count_ == 0 || (nb_positive_infinite_ > 0 && nb_negative_infinite_ > 0))
+		return NAN;
+	if (nb_positive_infinite_ > 0)
+		return INFINITY;
+	if (nb_negative_infinite_ > 0)
+		return -INFINITY;
+	return (sum_ + compensation_) / count_;
+}
+
+// Neumaier summation
+inline void RollingMean::addToSum(double value) {
+	double t = sum_ + value;
+	if (fabs(sum_) >= fabs(value))
+		compensation_ += (sum_ - t) + value;
+	else
+		compensation_ += (value - t) + sum_;
+	sum_ = t;
+}
+
+/*! \class RollingExtremum
+ *
+ * Minimum or maximum of the last values added, up to a fixed window size.
+ * The candidates are kept in a monotonic deque (stored in a ring buffer):
+ * a value is dropped as soon as a newer value is at least as good, so that
+ * the extremum is always the oldest candidate and add() costs O(1) amortized
+ * whatever the window size. NaN values take a place in the window but are
+ * ignored.
+ */
+class RollingExtremum {
+public:
+	RollingExtremum(int size, bool maximum);
+	~RollingExtremum();
+
+	void add(double);
+	double value() const;
+
+private:
+	// Not copyable: the buffers are owned by the object.
+	RollingExtremum(const RollingExtremum&);
+	RollingExtremum &operator=(const RollingExtremum&);
+
+	bool isBetter(double a, double b) const;
+
+	double *values_;
+	long long *rows_;   // Number of the add() call of each value
+	int size_;
+	bool maximum_;
+	int first_;         // Position of the oldest candidate
+	int nb_values_;     // Number of candidates
+	long long row_;     // Number of add() calls
+};
+
+inline bool RollingExtremum::isBetter(double a, double b) const {
+	return maximum_ ? a >= b : a <= b;
+}
+
+/*! \fn void RollingExtremum::add(double value)
+ *
+ * Add a value to the window, removing the oldest one if the window is full.
+ */
+inline void RollingExtremum::add(double value) {
+	++row_;
+	if (nb_values_ > 0 && rows_[first_] <= row_ - size_) {
+		if (++first_ == size_)
+			first_ = 0;
+		--nb_values_;
+	}
+	if (value != value)
+		return;
+	while (nb_values_ > 0) {
+		int last = first_ + nb_values_ - 1;
+		if (last >= size_)
+			last -= size_;
+		if (!isBetter(value, values_[last]))
+			break;
+		--nb_values_;
+	}
+	int position = first_ + nb_values_;
+	if (position >= size_)
+		position -= size_;
+	values_[position] = value;
+	rows_[position] = row_;
+	++nb_values_;
+}
+
+/*! \fn double RollingExtremum::value() const
+ *
+ * Return the minimum or maximum of the values in the window, or NaN if there
+ * are none.
+ */
+inline double RollingExtremum::value() const {
+	return nb_values_ == 0 ? NAN : values_[first_];
+}
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "script_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char cache_magic[8] = { 'S', 'C', 'R', 'I', 'P', 'T', 'C', 'C' };
+
+/***********************************************************************************
+ * CacheWriter
+ ***********************************************************************************/
+
+CacheWriter::CacheWriter() :
+	data_(NULL), size_(0), capacity_(0)
+{
+}
+
+CacheWriter::~CacheWriter() {
+	free(data_);
+}
+
+/*! \fn void CacheWriter::writeBytes(const void *data, int size)
+ *
+ * Append \p size bytes to the buffer.
+ */
+void CacheWriter::writeBytes(const void *data, int size) {
+	if (size_ + size > capacity_) {
+		capacity_ = capacity_ == 0 ? 1024 : capacity_;
+		while (size_ + size > capacity_)
+			capacity_ *= 2;
+		data_ = (char*)realloc(data_, capacity_);
+	}
+	memcpy(data_ + size_, data, size);
+	size_ += size;
+}
+
+void CacheWriter::writeInt(int value) {
+	writeBytes(&value, sizeof(int));
+}
+
+void CacheWriter::writeDouble(double value) {
+	writeBytes(&value, sizeof(double));
+}
+
+void CacheWriter::writeString(const String &str) {
+	writeInt(str.length());
+	writeBytes(str.c_str(), str.length());
+}
+
+void CacheWriter::writeStringList(const StringList &list) {
+	writeInt(list.size());
+	for (int i = 0 ; i < list.size() ; ++i)
+		writeString(list[i]);
+}
+
+/***********************************************************************************
+ * CacheReader
+ ***********************************************************************************/
+
+CacheReader::CacheReader(const char *data, int size) :
+	data_(data), size_(size), pos_(0), valid_(data != NULL)
+{
+}
+
+/*! \fn bool CacheReader::readBytes(void *data, int size)
+ *
+ * Copy the next \p size bytes to \p data. Return false, and mark the reader
+ * as invalid, if there are not enough bytes left.
+ */
+bool CacheReader::readBytes(void *data, int size) {
+	if (!valid_ || size < 0 || size > size_ - pos_) {
+		valid_ = false;
+		return false;
+	}
+	memcpy(data, data_ + pos_, size);
+	pos_ += size;
+	return true;
+}
+
+int CacheReader::readInt() {
+	int value = 0;
+	readBytes(&value, sizeof(int));
+	return value;
+}
+
+double CacheReader::readDouble() {
+	double value = 0.;
+	readBytes(&value, sizeof(double));
+	return value;
+}
+
+String CacheReader::readString() {
+	int length = readInt();
+	if (!valid_ || length < 0 || length > size_ - pos_) {
+		valid_ = false;
+		return String();
+	}
+	String str(data_ + pos_, length);
+	pos_ += length;
+	return str;
+}
+
+StringList CacheReader::readStringList() {
+	StringList list;
+	int size = readInt();
+	for (int i = 0 ; i < size && valid_ ; ++i)
+		list << readString();
+	return list;
+}
+
+/***********************************************************************************
+ * ScriptCache
+ ***********************************************************************************/
+
+bool ScriptCache::enabled_ = true;
+
+ScriptCache::ScriptCache() :
+	map_(NULL), map_size_(0)
+{
+}
+
+ScriptCache::~ScriptCache() {
+	close();
+}
+
+/*! \fn void ScriptCache::setEnabled(bool enable)
+ *
+ * Enable or disable the cache. When it is disabled, open() always fails
+ * and store() does nothing.
+ */
+void ScriptCache::setEnabled(bool enable) {
+	enabled_ = enable;
+}
+
+/*! \fn bool ScriptCache::enabled()
+ *
+ * Return true if the cache is enabled and has a directory.
+ */
+bool ScriptCache::enabled() {
+	return enabled_ && !directory().isEmpty();
+}
+
+/*! \fn String ScriptCache::directory()
+ *
+ * Return the directory in which the compiled scripts are stored, or an empty
+ * string if it cannot be determined.
+ */
+String ScriptCache::directory() {
+	const char *dir = getenv("SCRIPT_CMD_CACHE_DIR");
+	if (dir != NULL && *dir != '\0')
+		return String(dir);
+	dir = getenv("XDG_CACHE_HOME");
+	if (dir != NULL && *dir != '\0')
+		return String::format("%s/script_cmd", dir);
+	dir = getenv("HOME");
+	if (dir != NULL && *dir != '\0')
+		return String::format("%s/.cache/script_cmd", dir);
+	return String();
+}
+
+// Add the given bytes to a 64-bit FNV-1a hash.
+static unsigned long long hashBytes(unsigned long long hash, const void *data, int size) {
+	const unsigned char *c = (const unsigned char*)data;
+	for (int i = 0 ; i < size ; ++i) {
+		hash ^= c[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// The file name is a hash of what is checked in the header of the file:
+// the format version, the size of pointers, the parser flags and the source.
+// Collisions are harmless as the file also contains all of them.
+String ScriptCache::filePath(const String &script, int flags) {
+	int key[3] = { formatVersion, (int)sizeof(void*), flags };
+	unsigned long long hash = hashBytes(0xcbf29ce484222325ULL, key, sizeof(key));
+	hash = hashBytes(hash, script.c_str(), script.length());
+	return String::format("%s/%016llx.scc", directory().c_str(), hash);
+}
+
+/*! \fn bool ScriptCache::open(const String &script, int flags)
+ *
+ * Map the cache file for the given script compiled with the given parser
+ * flags. Return false if the cache is disabled or if there is no valid file
+ * for this script, these flags and this version of the compiled form.
+ * Otherwise the compiled form can be read with reader() until close() is
+ * called or the ScriptCache is destroyed.
+ */
+bool ScriptCache::open(const String &script, int flags) {
+	close();
+	if (!enabled())
+		return false;
+
+	String path = filePath(script, flags);
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+	// The modification time tells which files were used last (see
+	// removeOldFiles()). It is only updated once a day to avoid a write
+	// at each start.
+	if (time(NULL) - st.st_mtime > 24 * 3600)
+		utime(path.c_str(), NULL);
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	map_ = map;
+	map_size_ = st.st_size;
+
+	// Check the header and the source
+	reader_ = CacheReader((const char*)map_, (int)map_size_);
+	char magic[sizeof(cache_magic)];
+	if (
+		!reader_.readBytes(magic, sizeof(magic)) ||
+		memcmp(magic, cache_magic, sizeof(magic)) != 0 ||
+		reader_.readInt() != formatVersion ||
+		reader_.readInt() != (int)sizeof(void*) ||
+		reader_.readInt() != flags ||
+		reader_.readString() != script ||
+		!reader_.isValid()
+	) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+/*! \fn void ScriptCache::close()
+ *
+ * Unmap the file opened with open().
+ */
+void ScriptCache::close() {
+	if (map_ != NULL)
+		munmap(map_, map_size_);
+	map_ = NULL;
+	map_size_ = 0;
+	reader_ = CacheReader();
+}
+
+// Create the directory and its missing parents.
+static bool makeDirectory(const String &path) {
+	char *dir = strdup(path.c_str());
+	for (char *c = dir + 1 ; ; ++c) {
+		if (*c == '/' || *c == '\0') {
+			char end = *c;
+			*c = '\0';
+			if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+				free(dir);
+				return false;
+			}
+			if (end == '\0')
+				break;
+			*c = end;
+		}
+	}
+	free(dir);
+	return true;
+}
+
+// Remove the cache files that were used the longest time ago until the files
+// left and a new file of the given size fit in maxSizeMB.
+void ScriptCache::removeOldFiles(long long new_size) {
+	String dir_path = directory();
+	DIR *dir = opendir(dir_path.c_str());
+	if (dir == NULL)
+		return;
+	StringList paths;
+	List<long long> sizes;
+	List<time_t> times;
+	long long total = new_size;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		String name(entry->d_name);
+		struct stat st;
+		if (!name.endsWith(".scc"))
+			continue;
+		String path = String::format("%s/%s", dir_path.c_str(), entry->d_name);
+		if (stat(path.c_str(), &st) != 0)
+			continue;
+		paths << path;
+		sizes << (long long)st.st_size;
+		times << st.st_mtime;
+		total += st.st_size;
+	}
+	closedir(dir);
+	const long long max_size = (long long)maxSizeMB * 1024 * 1024;
+	while (total > max_size && !paths.isEmpty()) {
+		int oldest = 0;
+		for (int i = 1 ; i < paths.size() ; ++i) {
+			if (times[i] < times[oldest])
+				oldest = i;
+		}
+		remove(paths[oldest].c_str());
+		total -= sizes[oldest];
+		paths.removeAt(oldest);
+		sizes.removeAt(oldest);
+		times.removeAt(oldest);
+	}
+}
+
+/*! \fn bool ScriptCache::store(const String &script, int flags, const CacheWriter &content)
+ *
+ * Write the compiled form of the given script, compiled with the given parser
+ * flags, to the cache. The file is written under a temporary name and then
+ * renamed, so that processes reading the cache at the same time never see a
+ * partial file. The oldest files are removed first if the cache would
+ * otherwise get larger than maxSizeMB.
+ */
+bool ScriptCache::store(const String &script, int flags, const CacheWriter &content) {
+	if (!enabled() || !makeDirectory(directory()))
+		return false;
+
+	CacheWriter header;
+	header.writeBytes(cache_magic, sizeof(cache_magic));
+	header.writeInt(formatVersion);
+	header.writeInt((int)sizeof(void*));
+	header.writeInt(flags);
+	header.writeString(script);
+	removeOldFiles(header.size() + content.size());
+
+	String path = filePath(script, flags);
+	String temp_path = String::format("%s.%d.tmp", path.c_str(), (int)getpid());
+	FILE *file = fopen(temp_path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	bool ok =
+		fwrite(header.data(), 1, header.size(), file) == (size_t)header.size() &&
+		fwrite(content.data(), 1, content.size(), file) == (size_t)content.size();
+	if (fclose(file) != 0)
+		ok = false;
+	if (ok)
+		ok = rename(temp_path.c_str(), path.c_str()) == 0;
+	if (!ok)
+		remove(temp_path.c_str());
+	return ok;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef script_cache_h
+#define script_cache_h
+
+#include <stddef.h>
+#include "str.h"
+#include "strlist.h"
+
+/*! \class CacheWriter
+ *
+ * Growable buffer in which a compiled script is serialized before it is
+ * written to the cache. Numbers are written in the native byte order: the
+ * cache is only meant to be read back on the same machine.
+ */
+class CacheWriter {
+public:
+	CacheWriter();
+	~CacheWriter();
+
+	void writeInt(int);
+	void writeDouble(double);
+	void writeString(const String&);
+	void writeStringList(const StringList&);
+	void writeBytes(const void*, int size);
+
+	const char *data() const;
+	int size() const;
+
+private:
+	char *data_;
+	int size_;
+	int capacity_;
+};
+
+/*! \class CacheReader
+ *
+ * Read back the data written by a CacheWriter. Reading past the end of the
+ * data does not crash but marks the reader as invalid, so that a truncated
+ * or corrupted cache file is simply ignored.
+ */
+class CacheReader {
+public:
+	CacheReader(const char *data = NULL, int size = 0);
+
+	int readInt();
+	double readDouble();
+	String readString();
+	StringList readStringList();
+	bool readBytes(void*, int size);
+
+	bool isValid() const;
+
+private:
+	const char *data_;
+	int size_;
+	int pos_;
+	bool valid_;
+};
+
+/*! \class ScriptCache
+ *
+ * On-disk cache of compiled scripts. A cache file contains the source of the
+ * script and the flags of the parser modes used to compile it, to make sure
+ * it is only used for that exact script and modes, followed by the compiled
+ * form written by ScriptParser. The file name is a hash of the format version,
+ * the flags and the source, so that the same script compiled with different
+ * modes gets different files. Files are memory-mapped when they are read.
+ * The directory is given by the SCRIPT_CMD_CACHE_DIR environment variable,
+ * or is script_cmd in the user cache directory ($XDG_CACHE_HOME or
+ * ~/.cache). ScriptParser only uses the cache when asked to.
+ *
+ * The files that have not been used for the longest time are removed when
+ * a new file would make the cache larger than maxSizeMB.
+ *
+ * Example:
+ * \code
+	ScriptCache cache;
+	if (cache.open(script, flags)) {
+		int value = cache.reader().readInt();
+		[...]
+	}
+ * \endcode
+ */
+class ScriptCache {
+public:
+	// Increase it each time the compiled form changes.
+	static const int formatVersion = 8;
+	// Size of all the cache files above which the oldest ones are removed
+	static const int maxSizeMB = 64;
+
+	ScriptCache();
+	~ScriptCache();
+
+	bool open(const String &script, int flags);
+	void close();
+	CacheReader &reader();
+
+	static bool store(const String &script, int flags, const CacheWriter &content);
+
+	static void setEnabled(bool);
+	static bool enabled();
+	static String directory();
+
+private:
+	static String filePath(const String &script, int flags);
+	static void removeOldFiles(long long new_size);
+
+	void *map_;
+	size_t map_size_;
+	CacheReader reader_;
+
+	static bool enabled_;
+};
+
+/*! \fn const char *CacheWriter::data() const
+ *
+ * Return the data written so far.
+ */
+inline const char *CacheWriter::data() const {
+	return data_;
+}
+
+/*! \fn int CacheWriter::size() const
+ *
+ * Return the number of bytes written so far.
+ */
+inline int CacheWriter::size() const {
+	return size_;
+}
+
+/*! \fn bool CacheReader::isValid() const
+ *
+ * Return false if an attempt was made to read past the end of the data.
+ */
+inline bool CacheReader::isValid() const {
+	return valid_;
+}
+
+/*! \fn CacheReader &ScriptCache::reader()
+ *
+ * Return the reader for the compiled form of the script opened with open().
+ */
+inline CacheReader &ScriptCache::reader() {
+	return reader_;
+}
+
+#endif
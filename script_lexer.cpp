@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "script_lexer.h"
+#include <ctype.h>
+#include <string.h>
+
+/*! \fn ScriptLexer::ScriptLexer(const String &script)
+ *
+ * Create a lexer for the given script and read its first token.
+ */
+ScriptLexer::ScriptLexer(const String &script) :
+	script_(script), source_(script_.c_str()), length_(script_.length()),
+	pos_(0), line_(1), column_(1)
+{
+	scan();
+}
+
+/*! \fn String ScriptLexer::text(const ScriptToken &token) const
+ *
+ * Return the text of the given token.
+ */
+String ScriptLexer::text(const ScriptToken &token) const {
+	return String(source_ + token.start_, token.length_);
+}
+
+/*! \fn bool ScriptLexer::isKeyword(const ScriptToken &token, const char *keyword) const
+ *
+ * Return true if the given token is the given keyword.
+ */
+bool ScriptLexer::isKeyword(const ScriptToken &token, const char *keyword) const {
+	return
+		token.type_ == ScriptToken::WORD &&
+		token.length_ == (int)strlen(keyword) &&
+		strncmp(source_ + token.start_, keyword, token.length_) == 0;
+}
+
+/*! \fn void ScriptLexer::appendText(String &text, const ScriptToken &token) const
+ *
+ * Append the text of the token to \p text, preceded by a single space if the
+ * token was preceded by spaces or comments in the script.
+ */
+void ScriptLexer::appendText(String &text, const ScriptToken &token) const {
+	if (token.space_before_ && !text.isEmpty())
+		text += ' ';
+	text += String(source_ + token.start_, token.length_);
+}
+
+// Read the next token into token_.
+void ScriptLexer::scan() {
+	token_.space_before_ = false;
+	// Skip spaces and comments
+	while (pos_ < length_) {
+		char c = source_[pos_];
+		if (isspace((unsigned char)c))
+			advance();
+		else if (c == '#' || (c == '/' && pos_ + 1 < length_ && source_[pos_ + 1] == '/')) {
+			// Shell and C++ style comments
+			while (pos_ < length_ && source_[pos_] != '\n')
+				advance();
+		} else if (c == '/' && pos_ + 1 < length_ && source_[pos_ + 1] == '*') {
+			// C style comment
+			advance();
+			advance();
+			while (pos_ < length_ && !(source_[pos_] == '*' && pos_ + 1 < length_ && source_[pos_ + 1] == '/'))
+				advance();
+			if (pos_ < length_) {
+				advance();
+				advance();
+			}
+		} else
+			break;
+		token_.space_before_ = true;
+	}
+
+	token_.start_ = pos_;
+	token_.line_ = line_;
+	token_.column_ = column_;
+	if (pos_ == length_) {
+		token_.type_ = ScriptToken::END;
+		token_.length_ = 0;
+		return;
+	}
+
+	switch (source_[pos_]) {
+	case '(':
+		token_.type_ = ScriptToken::LEFT_PAREN;
+		break;
+	case ')':
+		token_.type_ = ScriptToken::RIGHT_PAREN;
+		break;
+	case '{':
+		token_.type_ = ScriptToken::LEFT_BRACE;
+		break;
+	case '}':
+		token_.type_ = ScriptToken::RIGHT_BRACE;
+		break;
+	case ';':
+		token_.type_ = ScriptToken::SEMICOLON;
+		break;
+	default:
+		token_.type_ = ScriptToken::WORD;
+		while (pos_ < length_) {
+			char c = source_[pos_];
+			if (
+				isspace((unsigned char)c) || strchr("(){};#", c) != NULL ||
+				(c == '/' && pos_ + 1 < length_ && (source_[pos_ + 1] == '/' || source_[pos_ + 1] == '*'))
+			)
+				break;
+			advance();
+		}
+		token_.length_ = pos_ - token_.start_;
+		return;
+	}
+	advance();
+	token_.length_ = 1;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef script_lexer_h
+#define script_lexer_h
+
+#include "str.h"
+
+/*! \struct ScriptToken
+ *
+ * Token returned by the ScriptLexer. The position is the one of the first
+ * character of the token in the script source (lines and columns start at 1).
+ */
+struct ScriptToken {
+	enum Type {
+		END,          // End of the script
+		WORD,         // Any other sequence of characters (part of an expression or keyword)
+		LEFT_PAREN,   // (
+		RIGHT_PAREN,  // )
+		LEFT_BRACE,   // {
+		RIGHT_BRACE,  // }
+		SEMICOLON     // ;
+	};
+
+	Type type_;
+	int start_;         // Offset of the token in the script
+	int length_;        // Number of characters
+	int line_;
+	int column_;
+	bool space_before_; // True if the token is preceded by spaces or comments
+};
+
+/*! \class ScriptLexer
+ *
+ * Split a script into tokens for the ScriptParser in a single pass. Comments
+ * (C, C++ and shell style) and spaces are skipped but recorded in the
+ * space_before_ flag of the next token, so that the text of an expression can
+ * be rebuilt from its tokens. A word is any sequence of characters that does
+ * not contain spaces, parentheses, braces, ';' or the start of a comment. The
+ * keywords 'if', 'else' and 'while' are words and are recognized by the
+ * parser with isKeyword().
+ *
+ * Example:
+ * \code
+	ScriptLexer lexer(script);
+	while (lexer.peek().type_ != ScriptToken::END) {
+		ScriptToken token = lexer.next();
+		printf("%d:%d %s\n", token.line_, token.column_, lexer.text(token).c_str());
+	}
+ * \endcode
+ */
+class ScriptLexer {
+public:
+	ScriptLexer(const String &script);
+
+	const ScriptToken &peek() const;
+	ScriptToken next();
+
+	String text(const ScriptToken&) const;
+	bool isKeyword(const ScriptToken&, const char *keyword) const;
+	void appendText(String &text, const ScriptToken&) const;
+
+private:
+	void scan();
+	void advance();
+
+	String script_;
+	const char *source_;
+	int length_;
+	int pos_;
+	int line_;
+	int column_;
+	ScriptToken token_;
+};
+
+/*! \fn const ScriptToken &ScriptLexer::peek() const
+ *
+ * Return the next token without consuming it.
+ */
+inline const ScriptToken &ScriptLexer::peek() const {
+	return token_;
+}
+
+/*! \fn ScriptToken ScriptLexer::next()
+ *
+ * Consume and return the next token.
+ */
+inline ScriptToken ScriptLexer::next() {
+	ScriptToken token = token_;
+	if (token_.type_ != ScriptToken::END)
+		scan();
+	return token;
+}
+
+/*! \fn void ScriptLexer::advance()
+ *
+ * Move to the next character of the source, keeping track of the line and column.
+ */
+inline void ScriptLexer::advance() {
+	if (source_[pos_] == '\n') {
+		++line_;
+		column_ = 1;
+	} else
+		++column_;
+	++pos_;
+}
+
+#endif
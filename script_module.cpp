@@ -18,12 +18,18 @@
  */
 
 #include "script_parser.h"
+#include "data_file_reader.h"
+#include "dataset.h"
+#include "fast_math.h"
+#include "evaluation_context.h"
 #include "redirect_output.h"
+#include "timer.h"
 #include "modules.h"
 #include "map.h"
 #include <math.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <sys/resource.h>
 
 void printScriptModuleHelp(int mode) {
 	switch (mode) {
@@ -61,6 +67,30 @@ void printScriptModuleHelp(int mode) {
 		printf("      if (variable4 < 0) {\n");
 		printf("    }\n");
 		printf("  }\n");
+		printf("At the top level, a 'begin { ... }' and an 'end { ... }' section are run once\n");
+		printf("before the first row and after the last row of the data file given to 'run',\n");
+		printf("while the rest of the script is run for each row.\n");
+		printf("The aggregate functions (count(), mean(), median()... see 'help functions') keep\n");
+		printf("their values from one row to the next, so that the statistics of a column\n");
+		printf("can be computed and printed with:\n");
+		printf("  m = mean(variable1);\n");
+		printf("  s = stddev(variable1);\n");
+		printf("  end {\n");
+		printf("    print(\"mean: \", m, \" stddev: \", s);\n");
+		printf("  }\n");
+		printf("A 'group (key) { ... }' statement at the top level runs its block with separate\n");
+		printf("aggregates and variables for each value of the key, and prints one line per group\n");
+		printf("with the key and the variables assigned in the block at the end of the run:\n");
+		printf("  group (well) {\n");
+		printf("    n = count(porosity);\n");
+		printf("    phi = mean(porosity);\n");
+		printf("  }\n");
+		printf("Functions can be defined at the top level and used by the statements that follow.\n");
+		printf("The body is a single return statement that can only use the parameters:\n");
+		printf("  function hypot(a, b) { return sqrt(a * a + b * b); }\n");
+		printf("  length = hypot(variable1, variable2);\n");
+		printf("A 'memo function' without side effects keeps the results for the last arguments\n");
+		printf("of each call, which is faster when the same arguments are used again.\n");
 		break;
 	default:
 		printf("Evaluates C-like script.\n");
@@ -68,21 +98,53 @@ void printScriptModuleHelp(int mode) {
 		printf("  - 'start [name]'   Start defining a script. Optionaly a name can be given for the script.\n");
 		printf("                     Type 'end' to finish the script definition. The script will consists of\n");
 		printf("                     everything you have typed between 'start' and 'end'.\n");
-		printf("  - 'scripts'        List all the defined scripts.\n");
+		printf("  - 'scripts'        List all the defined scripts and the loaded datasets.\n");
 		printf("  - 'clear [name]'   Clear the script with the given name.\n");
 		printf("  - 'script [name]'  Print the previously defined script with the given name.\n");
 		printf("  - 'script [name] < file' Initialise the script with the given name using the content of the\n");
 		printf("                           given file.\n");
 		printf("  - 'script [name] > file' Save the script with the given name to the given file\n");
-		printf("  - 'variables'      Print the list of variables in the previously defined scripts.\n");
+		printf("  - 'variables'      Print the list of variables in the previously defined scripts and\n");
+		printf("                     the loaded datasets.\n");
 		printf("  - 'run [name]'     Run the previously defined script with the given name.\n");
 		printf("  - 'run [name] > file'    Run the previously defined script with the given name and redirect.\n");
 		printf("                           output to file.\n");
+		printf("  - 'run [name] on dataset' Run the script once for each row of the given dataset.\n");
+		printf("  - 'run a,b,c < file > a.txt,b.txt,c.txt' Run several scripts in a single pass over the\n");
+		printf("                     data: the scripts are run in turn on each row, each with its own\n");
+		printf("                     output file. This also works with 'on dataset' and with 'profile'.\n");
+		printf("  - 'load dataset < file' Read the given data file once and keep its values in memory\n");
+		printf("                     in the dataset with the given name, to run scripts on it.\n");
+		printf("  - 'unload dataset' Free the memory used by the given dataset.\n");
+		printf("  - 'profile [name] < file' Run the script with the given name like 'run' and print for each\n");
+		printf("                     statement the number of executions and the time spent in it, how often\n");
+		printf("                     the 'if' conditions were true and the number of 'while' iterations.\n");
 #ifdef PARSER_TREE_DEBUG
 		printf("  - 'tree [name]'    Display the parser tree for the previously defined script with the given.\n");
 		printf("                     name. This can be useful to debug issues with the parser.\n");
 		printf("  - 'tree [name] > file'  Print the parser tree to the specified file.\n");
 #endif
+#ifdef PARSER_INSTRUMENTATION
+		printf("                     After 'run' or 'profile', the tree of that script shows how many\n");
+		printf("                     times each operator was evaluated and the time spent in it.\n");
+#endif
+		printf("  - 'fastmath [name] [on|off]' Enable or disable the fast approximations of exp(), log(),\n");
+		printf("                     sin() and cos() for the script with the given name, or for all the\n");
+		printf("                     scripts without their own setting if no name is given. Without\n");
+		printf("                     'on' or 'off' it prints the current setting.\n");
+		printf("  - 'mathcheck'      Print the maximum error observed for the fast math approximations.\n");
+		printf("  - 'stats [on|off]' Print the statistics of the last run: time spent parsing the script,\n");
+		printf("                     mapping the data file header, reading the rows, evaluating the script\n");
+		printf("                     and writing the output, rows and bytes processed and peak memory.\n");
+		printf("                     With 'on' they are printed after each run, and the time spent on the\n");
+		printf("                     rows is split between reading, evaluation and output.\n");
+		printf("  - 'rngmode [sequential|counter]' Set how urand() and nrand() generate numbers. In counter\n");
+		printf("                     mode a number only depends on the seed, the row (one run or one line\n");
+		printf("                     of a data file), the call in the script and the number of times that\n");
+		printf("                     call was made in the row. Without argument it prints the current mode.\n");
+		printf("  - 'compare [exact|tolerant]' Set how ==, !=, <= and >= compare values: exactly (the\n");
+		printf("                     default) or ignoring differences of up to 100 ULP (units in the last\n");
+		printf("                     place). Without argument it prints the current mode.\n");
 		printf("  - 'help [topic]'   Print this help or help on a specific topic. Topics are:\n");
 		printf("                     'constants', 'functions', 'operators' and 'script'.\n");
 		printf("  - 'quit' or 'exit' Quit the program.\n");
@@ -93,8 +155,7 @@ void printScriptModuleHelp(int mode) {
 void removeScript(
 	const String& name,
 	Map<String, String>& scripts,
-	StringList& variables,
-	double*& var_values
+	VariableStorage& variables
 ) {
 	// Remove this script
 	if (!scripts.remove(name))
@@ -105,7 +166,7 @@ void removeScript(
 	StringList new_vars;
 	ScriptParser parser;
 	for (int i = 0 ; i < names.size() ; ++i) {
-		StringList script_vars = parser.getVariablesList(scripts[names[i]]);
+		StringList script_vars = parser.getVariablesList(scripts[names[i]], true);
 		for (int v = 0 ; v < script_vars.size() ; ++v) {
 			if (!new_vars.contains(script_vars[v]))
 				new_vars << script_vars[v];
@@ -114,44 +175,29 @@ void removeScript(
 	if (new_vars.size() == variables.size())
 		return; // No variables was removed
 
-	// Update value array
-	double* new_values = NULL;
-	if (!new_vars.isEmpty()) {
-		new_values = new double[new_vars.size()];
-		for (int i = 0 ; i < new_vars.size() ; ++i) {
-			int index = variables.indexOf(new_vars[i]);
-			if (index == -1)
-				new_values[i] = 0.0;
-			else
-				new_values[i] = var_values[index];
-		}
-	}
-
-	delete [] var_values;
-	var_values = new_values;
-	variables = new_vars;
+	// The remaining variables keep their value
+	variables.setNames(new_vars);
 }
 
 void addScript(
 	const String& script,
 	const String& name,
 	Map<String, String>& scripts,
-	StringList& variables,
-	double*& var_values
+	VariableStorage& variables
 ) {
 	if (script.isEmpty()) {
-		removeScript(name, scripts, variables, var_values);
+		removeScript(name, scripts, variables);
 		return;
 	}
 
 	// Check the script is valid
 	ScriptParser parser;
-	StringList new_vars = parser.getVariablesList(script);
+	StringList new_vars = parser.getVariablesList(script, true);
 	if (parser.nbErrors() > 0) {
 		printf("The script contains %d error(s):\n", parser.nbErrors());
 		for (int error = 0 ; error < parser.nbErrors() ; ++error)
 			printf("  %d: %s\n", error+1, parser.getError(error).c_str());
-		removeScript(name, scripts, variables, var_values);
+		removeScript(name, scripts, variables);
 		return;
 	}
 
@@ -159,7 +205,7 @@ void addScript(
 	scripts.remove(name);
 	const StringList& names = scripts.keys();
 	for (int i = 0 ; i < names.size() ; ++i) {
-		StringList script_vars = parser.getVariablesList(scripts[names[i]]);
+		StringList script_vars = parser.getVariablesList(scripts[names[i]], true);
 		for (int v = 0 ; v < script_vars.size() ; ++v) {
 			if (!new_vars.contains(script_vars[v]))
 				new_vars << script_vars[v];
@@ -167,22 +213,8 @@ void addScript(
 	}
 	scripts[name] = script;
 
-	// Update value array
-	double* new_values = NULL;
-	if (!new_vars.isEmpty()) {
-		new_values = new double[new_vars.size()];
-		for (int i = 0 ; i < new_vars.size() ; ++i) {
-			int index = variables.indexOf(new_vars[i]);
-			if (index == -1)
-				new_values[i] = 0.0;
-			else
-				new_values[i] = var_values[index];
-		}
-	}
-
-	delete [] var_values;
-	var_values = new_values;
-	variables = new_vars;
+	// The existing variables keep their value
+	variables.setNames(new_vars);
 }
 
 String breakLine(const String& line, String& argument, String& input_file, String& output_file) {
@@ -222,14 +254,386 @@ String breakLine(const String& line, String& argument, String& input_file, Strin
 	return cmd;
 }
 
+// Remove the last word of the given text and return it.
+String takeLastWord(String& text) {
+	int index = text.length() - 1;
+	while (index >= 0 && !isspace(text[index]))
+		--index;
+	String word = text.right(index + 1);
+	text = index > 0 ? text.left(index - 1).trimmed() : String();
+	return word;
+}
+
+// Split the argument of 'run' and 'profile', '[name] [on dataset]', and
+// return the name of the dataset (empty if there is none).
+String splitDatasetName(String& name) {
+	String rest = name;
+	String dataset = takeLastWord(rest);
+	if (takeLastWord(rest) != "on")
+		return String();
+	name = rest;
+	return dataset;
+}
+
+// Split a comma separated list, such as the 'a,b,c' of 'run a,b,c'.
+StringList splitCommaList(const String& text) {
+	StringList items;
+	const char *start = text.c_str();
+	for (const char *c = start ; ; ++c) {
+		if (*c == ',' || *c == '\0') {
+			items << String(start, c - start).trimmed();
+			if (*c == '\0')
+				break;
+			start = c + 1;
+		}
+	}
+	return items;
+}
+
+// Number of random call site ids given to each script of a run: the i-th
+// script uses the ids from i * CallSitesPerScript (see
+// ScriptParser::setFirstCallSite()).
+static const unsigned int CallSitesPerScript = 1 << 16;
+
+// Evaluate the scripts of a run in turn on the current row, which is a single
+// new row for the EvaluationContext they share. If \p outputs is not empty,
+// the output of each script goes to its own file (or to the standard output
+// if that file could not be opened).
+inline void evaluateScripts(const List<ScriptParser*>& parsers, const List<FILE*>& outputs) {
+	parsers.first()->nextRow();
+	if (outputs.isEmpty()) {
+		for (int i = 0 ; i < parsers.size() ; ++i)
+			parsers[i]->evaluate();
+		return;
+	}
+	for (int i = 0 ; i < parsers.size() ; ++i) {
+		if (outputs[i] != NULL)
+			push_output(outputs[i]);
+		parsers[i]->evaluate();
+		if (outputs[i] != NULL)
+			pop_output();
+	}
+}
+
+// Evaluate the 'begin' sections of the scripts of a run if \p begin is true,
+// or else their 'end' sections, each with its own output as in
+// evaluateScripts().
+void evaluateSections(const List<ScriptParser*>& parsers, const List<FILE*>& outputs, bool begin) {
+	for (int i = 0 ; i < parsers.size() ; ++i) {
+		FILE* output = outputs.isEmpty() ? NULL : outputs[i];
+		if (output != NULL)
+			push_output(output);
+		if (begin)
+			parsers[i]->evaluateBegin();
+		else
+			parsers[i]->evaluateEnd();
+		if (output != NULL)
+			pop_output();
+	}
+}
+
+// Once the 'begin' sections have been run, turn the variables that do not
+// change from one row to the next into constants in the scripts of the run.
+// Those are the variables that are neither columns of the data nor assigned
+// by any of the scripts.
+void foldRunConstants(const List<ScriptParser*>& parsers, const StringList& columns) {
+	bool has_begin = false;
+	for (int i = 0 ; i < parsers.size() ; ++i)
+		has_begin = has_begin || parsers[i]->hasBeginSection();
+	if (!has_begin)
+		return;
+	StringList modified = columns;
+	for (int i = 0 ; i < parsers.size() ; ++i)
+		modified << parsers[i]->assignedVariables();
+	for (int i = 0 ; i < parsers.size() ; ++i)
+		parsers[i]->foldConstants(modified);
+}
+
+/*! \class RowGuardFilter
+ *
+ * Filter given to the DataFileReader of a run whose scripts all have a row
+ * guard (see ScriptParser::hasRowGuard()): a row is skipped as soon as its
+ * guard columns are read if the guards of all the scripts are false.
+ */
+class RowGuardFilter : public RowFilter {
+public:
+	RowGuardFilter(const List<ScriptParser*>& parsers) : parsers_(parsers) {}
+
+	virtual bool accept() {
+		for (int i = 0 ; i < parsers_.size() ; ++i) {
+			if (parsers_[i]->evaluateRowGuard())
+				return true;
+		}
+		parsers_.first()->nextRow();
+		return false;
+	}
+
+private:
+	List<ScriptParser*> parsers_;
+};
+
+// Return false if the row guards of all the scripts of a run are false for
+// all the rows of the given block of the dataset (see Dataset::blockStats()).
+// \p guard_columns are the columns of the dataset used by the guards and
+// \p min_values and \p max_values have one value per variable, NaN for the
+// variables that are not a guard column.
+bool blockMayBeAccepted(
+	const List<ScriptParser*>& parsers, const Dataset* dataset, int block,
+	const List<int>& guard_columns, const List<int>& mapping,
+	double* min_values, double* max_values
+) {
+	int size = dataset->blockSize(block);
+	for (int i = 0 ; i < guard_columns.size() ; ++i) {
+		int c = guard_columns[i];
+		const Dataset::BlockStats& block_stats = dataset->blockStats(c, block);
+		// A missing field leaves the variable unchanged: its value is then unknown
+		bool known = block_stats.count_ == size;
+		min_values[mapping[c]] = known ? block_stats.min_ : NAN;
+		max_values[mapping[c]] = known ? block_stats.max_ : NAN;
+	}
+	for (int i = 0 ; i < parsers.size() ; ++i) {
+		if (parsers[i]->rowGuardMayAccept(min_values, max_values))
+			return true;
+	}
+	return false;
+}
+
+// Set in \p mask the rows of the given block of the dataset that pass the row
+// guard of at least one of the scripts of a run (see
+// ScriptParser::rowGuardMask()). \p columns has one pointer per variable, NULL
+// for the variables that are not a guard column, and \p other can hold a mask
+// of a block. Return false if one of the guards cannot be computed this way,
+// for instance when it uses a column with missing fields.
+bool blockRowMask(
+	const List<ScriptParser*>& parsers, const Dataset* dataset, int block,
+	const List<int>& guard_columns, const List<int>& mapping,
+	const double** columns, unsigned char* mask, unsigned char* other
+) {
+	long long start = (long long)block * Dataset::BlockSize;
+	int size = dataset->blockSize(block);
+	for (int i = 0 ; i < guard_columns.size() ; ++i) {
+		int c = guard_columns[i];
+		// A missing field leaves the variable unchanged
+		columns[mapping[c]] = dataset->hasMissing(c) ? NULL : dataset->column(c) + start;
+	}
+	if (!parsers[0]->rowGuardMask(columns, size, mask))
+		return false;
+	for (int i = 1 ; i < parsers.size() ; ++i) {
+		if (!parsers[i]->rowGuardMask(columns, size, other))
+			return false;
+		for (int row = 0 ; row < size ; ++row)
+			mask[row] |= other[row];
+	}
+	return true;
+}
+
+// Get in \p columns the variables used by the row guards of the scripts of a
+// run. Return false if the rows cannot be filtered while they are read: one
+// of the scripts has no row guard, or a guard uses a variable assigned by one
+// of the scripts.
+bool rowGuardColumns(const List<ScriptParser*>& parsers, StringList& columns) {
+	StringList assigned;
+	for (int i = 0 ; i < parsers.size() ; ++i) {
+		if (!parsers[i]->hasRowGuard())
+			return false;
+		assigned << parsers[i]->assignedVariables();
+	}
+	for (int i = 0 ; i < parsers.size() ; ++i) {
+		StringList variables = parsers[i]->rowGuardVariables();
+		for (int v = 0 ; v < variables.size() ; ++v) {
+			if (assigned.contains(variables[v]))
+				return false;
+			if (!columns.contains(variables[v]))
+				columns << variables[v];
+		}
+	}
+	return true;
+}
+
+void printDatasets(const Map<String, Dataset*>& datasets) {
+	if (datasets.isEmpty())
+		return;
+	const StringList& names = datasets.keys();
+	long long total = 0;
+	printf("There are %d datasets loaded:\n", names.size());
+	for (int i = 0 ; i < names.size() ; ++i) {
+		const Dataset* dataset = datasets[names[i]];
+		printf(
+			"   %s: %lld rows, %d columns, %.1f KB\n", names[i].c_str(),
+			dataset->nbRows(), dataset->nbColumns(), dataset->memoryUsage() / 1024.
+		);
+		total += dataset->memoryUsage();
+	}
+	printf("Memory used by the datasets: %.1f KB\n", total / 1024.);
+}
+
+bool useFastMath(const String& name, const Map<String, bool>& fast_math, bool default_fast_math) {
+	if (fast_math.contains(name))
+		return fast_math[name];
+	return default_fast_math;
+}
+
+void fastMathCommand(const String& argument, Map<String, bool>& fast_math, bool& default_fast_math) {
+	// The argument is '[name] [on|off]'
+	String name = argument, mode;
+	int index = name.length() - 1;
+	while (index >= 0 && !isspace(name[index]))
+		--index;
+	String last_word = name.right(index + 1);
+	if (last_word == "on" || last_word == "off") {
+		mode = last_word;
+		name = name.left(index - 1).trimmed();
+	}
+
+	if (mode.isEmpty()) {
+		if (name.isEmpty()) {
+			printf("Fast math is %s by default.\n", default_fast_math ? "on" : "off");
+			const StringList& names = fast_math.keys();
+			for (int i = 0 ; i < names.size() ; ++i)
+				printf("Fast math is %s for script '%s'.\n", fast_math[names[i]] ? "on" : "off", names[i].c_str());
+		} else
+			printf("Fast math is %s for script '%s'.\n", useFastMath(name, fast_math, default_fast_math) ? "on" : "off", name.c_str());
+		return;
+	}
+
+	if (name.isEmpty())
+		default_fast_math = (mode == "on");
+	else
+		fast_math[name] = (mode == "on");
+}
+
+void printProfile(const String& name, const String& script, const List<ScriptProfileEntry>& entries, long long nb_rows, long long wall_ns) {
+	// Split the script source in lines to show the profiled statements
+	StringList lines;
+	const char *start = script.c_str();
+	for (const char *c = start ; ; ++c) {
+		if (*c == '\n' || *c == '\0') {
+			lines << String(start, c - start);
+			if (*c == '\0')
+				break;
+			start = c + 1;
+		}
+	}
+
+	long long script_ns = 0;
+	for (int i = 0 ; i < entries.size() ; ++i) {
+		if (entries[i].depth_ == 0)
+			script_ns += entries[i].time_ns_;
+	}
+
+	printf("Profile of script '%s': %lld row(s) in %.3f ms (%.3f ms in the statements)\n", name.c_str(), nb_rows, wall_ns * 1e-6, script_ns * 1e-6);
+	printf("  %5s %12s %12s %7s  %-28s %s\n", "Line", "Hits", "Time (ms)", "Time %", "Branch / loop", "Source");
+	for (int i = 0 ; i < entries.size() ; ++i) {
+		const ScriptProfileEntry& entry = entries[i];
+		String detail;
+		if (entry.kind_[0] == 'i')
+			detail = String::format("taken %lld/%lld (%.1f%%)", entry.taken_, entry.hits_, entry.hits_ > 0 ? 100. * entry.taken_ / entry.hits_ : 0.);
+		else if (entry.kind_[0] == 'w')
+			detail = String::format("iterations %lld (%.1f/hit)", entry.iterations_, entry.hits_ > 0 ? (double)entry.iterations_ / entry.hits_ : 0.);
+		String source;
+		if (entry.line_ >= 1 && entry.line_ <= lines.size())
+			source = lines[entry.line_ - 1].trimmed();
+		if (source.length() > 40)
+			source = source.left(36) + " ...";
+		printf(
+			"  %5d %12lld %12.3f %6.1f%%  %-28s %*s%s\n",
+			entry.line_, entry.hits_, entry.time_ns_ * 1e-6,
+			script_ns > 0 ? 100. * entry.time_ns_ / script_ns : 0.,
+			detail.c_str(), 2 * entry.depth_, "", source.c_str()
+		);
+	}
+}
+
+/*! \struct RunStats
+ *
+ * Statistics of a script run, with the time of each phase of the run.
+ * Evaluation time does not include the time spent writing the output.
+ * Reading the rows, evaluating them and writing the output are only timed
+ * separately if timed_ is true ('stats on' or 'profile'), as this reads the
+ * clock for each row and each print. Otherwise eval_ns_ is the time of all
+ * three.
+ */
+struct RunStats {
+	RunStats() : timed_(false), rows_(-1) {}
+
+	String name_;
+	bool timed_;
+	long long rows_;
+	long long skipped_rows_;  // Rows rejected by the row guards without evaluating the scripts
+	long long input_bytes_;
+	long long output_bytes_;
+	long long parse_ns_;
+	long long header_ns_;
+	long long ingest_ns_;
+	long long eval_ns_;
+	long long output_ns_;
+	long long wall_ns_;
+	long long cpu_ns_;
+	long peak_rss_kb_;
+};
+
+void printRunStats(const RunStats& stats) {
+	if (stats.rows_ < 0) {
+		printf("No script has been run yet.\n");
+		return;
+	}
+	double seconds = stats.wall_ns_ * 1e-9;
+	printf("Statistics of the last run of script '%s':\n", stats.name_.c_str());
+	printf("  Rows:      %lld (%.0f rows/s)\n", stats.rows_, seconds > 0. ? stats.rows_ / seconds : 0.);
+	if (stats.skipped_rows_ > 0)
+		printf("  Skipped:   %lld rows rejected by the row guard before evaluation\n", stats.skipped_rows_);
+	printf("  Input:     %lld bytes (%.2f MB/s)\n", stats.input_bytes_, seconds > 0. ? stats.input_bytes_ * 1e-6 / seconds : 0.);
+	printf("  Output:    %lld bytes (%.2f MB/s)\n", stats.output_bytes_, seconds > 0. ? stats.output_bytes_ * 1e-6 / seconds : 0.);
+	printf("  Wall time: %.3f ms\n", stats.wall_ns_ * 1e-6);
+	printf("  CPU time:  %.3f ms (%.0f%% of wall time)\n", stats.cpu_ns_ * 1e-6, stats.wall_ns_ > 0 ? 100. * stats.cpu_ns_ / stats.wall_ns_ : 0.);
+	printf("  Peak RSS:  %ld KB\n", stats.peak_rss_kb_);
+	const char *names[] = { "Parse", "Header mapping", "Row ingest", "Evaluation", "Output" };
+	long long times[] = { stats.parse_ns_, stats.header_ns_, stats.ingest_ns_, stats.eval_ns_, stats.output_ns_ };
+	int nb_phases = 5;
+	if (!stats.timed_) {
+		names[2] = "Rows";
+		times[2] = stats.eval_ns_;
+		nb_phases = 3;
+	}
+	printf("  %-16s %12s %7s\n", "Phase", "Time (ms)", "%");
+	for (int i = 0 ; i < nb_phases ; ++i)
+		printf("  %-16s %12.3f %6.1f%%\n", names[i], times[i] * 1e-6, stats.wall_ns_ > 0 ? 100. * times[i] / stats.wall_ns_ : 0.);
+	if (!stats.timed_)
+		printf("  Use 'stats on' to split the time of the rows between reading, evaluation and output.\n");
+}
+
+long peakRssKb() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	// Reported in bytes on Mac OS X and in kilobytes on Linux
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
 void runScriptModule(const String& s) {
+	// The random number generator and other evaluation state of this session
+	EvaluationContext context;
+	EquationParser::setContext(&context);
 	Map<String, String> scripts;
+	// Data files kept in memory by 'load'
+	Map<String, Dataset*> datasets;
+	// Values of the variables of all the scripts, used in place by the parser
+	VariableStorage variables;
 	ScriptParser parser;
-	StringList variables;
 	String cur_script, cur_name, input_file, output_file;
-	double* var_values = NULL;
+	// Script currently parsed by the parser (empty for one-line scripts)
+	String parsed_script;
+	bool parsed_fast_math = false;
+	RunStats last_run;
+	bool print_stats = false;
+	Map<String, bool> fast_math;
+	bool default_fast_math = EquationParser::fastMath();
 	if (!s.isEmpty())
-		addScript(s, String(), scripts, variables, var_values);
+		addScript(s, String(), scripts, variables);
 	bool script_edition = false;
 	printf("Starting script mode.\nType 'help' to get some help.\n");
 	while (1) {
@@ -238,7 +642,8 @@ void runScriptModule(const String& s) {
 			String line = readLine(NULL, false);
 			if (line == "end\n") {
 				script_edition = false;
-				addScript(cur_script, cur_name, scripts, variables, var_values);
+				addScript(cur_script, cur_name, scripts, variables);
+				parsed_script.clear();
 			} else
 				cur_script += line;
 			continue;
@@ -288,12 +693,63 @@ void runScriptModule(const String& s) {
 				for (int i = 0 ; i < names.size() ; ++i)
 					printf("   %s\n", names[i].c_str());
 			}
+			printDatasets(datasets);
 			continue;
 		}
 
 		// clear
 		if (cmd == "clear") {
-			removeScript(cur_name, scripts, variables, var_values);
+			removeScript(cur_name, scripts, variables);
+			parsed_script.clear();
+			fast_math.remove(cur_name);
+			continue;
+		}
+
+		// fastmath
+		if (cmd == "fastmath") {
+			fastMathCommand(cur_name, fast_math, default_fast_math);
+			continue;
+		}
+
+		// mathcheck
+		if (cmd == "mathcheck") {
+			FastMath::selfCheck();
+			continue;
+		}
+
+		// rngmode
+		if (cmd == "rngmode") {
+			if (cur_name == "sequential")
+				context.setRandomMode(EvaluationContext::RANDOM_SEQUENTIAL);
+			else if (cur_name == "counter")
+				context.setRandomMode(EvaluationContext::RANDOM_COUNTER);
+			else if (!cur_name.isEmpty())
+				printf("Unknown random mode '%s'. Use 'sequential' or 'counter'.\n", cur_name.c_str());
+			else
+				printf("Random numbers are generated in %s mode.\n", context.randomMode() == EvaluationContext::RANDOM_COUNTER ? "counter" : "sequential");
+			continue;
+		}
+
+		// compare
+		if (cmd == "compare") {
+			if (cur_name == "exact" || cur_name == "tolerant") {
+				EquationParser::setTolerantComparisons(cur_name == "tolerant");
+				parsed_script.clear();
+			} else if (!cur_name.isEmpty())
+				printf("Unknown comparison mode '%s'. Use 'exact' or 'tolerant'.\n", cur_name.c_str());
+			else
+				printf("Comparisons are %s.\n", EquationParser::tolerantComparisons() ? "tolerant" : "exact");
+			continue;
+		}
+
+		// stats
+		if (cmd == "stats") {
+			if (cur_name == "on" || cur_name == "off")
+				print_stats = (cur_name == "on");
+			else if (!cur_name.isEmpty())
+				printf("Unknown argument '%s'. Use 'on' or 'off'.\n", cur_name.c_str());
+			else
+				printRunStats(last_run);
 			continue;
 		}
 
@@ -309,7 +765,8 @@ void runScriptModule(const String& s) {
 					while (fgets(buffer, 256, file) != NULL)
 						cur_script += buffer;
 					fclose(file);
-					addScript(cur_script, cur_name, scripts, variables, var_values);
+					addScript(cur_script, cur_name, scripts, variables);
+					parsed_script.clear();
 				}
 			}
 			if (!scripts.contains(cur_name)) {
@@ -337,7 +794,15 @@ void runScriptModule(const String& s) {
 				printf("The script '%s' is not defined.\n", cur_name.c_str());
 				printf("Type 'scripts' to get a list of defined scripts.\n");
 			} else {
-				parser.parse(scripts[cur_name], variables);
+				// Keep the parsed tree of the last run so that its evaluation
+				// counters can be shown in an instrumentation build.
+				bool use_fast_math = useFastMath(cur_name, fast_math, default_fast_math);
+				if (parsed_script != scripts[cur_name] || parsed_fast_math != use_fast_math) {
+					EquationParser::setFastMath(use_fast_math);
+					parser.parse(scripts[cur_name], variables, true);
+					parsed_script = scripts[cur_name];
+					parsed_fast_math = use_fast_math;
+				}
 				bool redirected = false;
 				if (!output_file.isEmpty())
 					redirected = redirect_output(output_file);
@@ -361,7 +826,41 @@ void runScriptModule(const String& s) {
 				printf("Type 'start [name]' to define a script and 'end' when you have finished.\n");
 			} else {
 				for (int i = 0 ; i < variables.size() ; ++i)
-					printf("%s = %.12g\n", variables[i].c_str(), var_values[i]);
+					printf("%s = %.12g\n", variables.names()[i].c_str(), variables[i]);
+			}
+			printDatasets(datasets);
+			continue;
+		}
+
+		// load
+		if (cmd == "load") {
+			if (input_file.isEmpty())
+				printf("Give the data file to load: 'load [name] < file'.\n");
+			else {
+				Dataset* dataset = new Dataset;
+				if (!dataset->load(input_file)) {
+					printf("Cannot open file %s\n", input_file.c_str());
+					delete dataset;
+				} else {
+					if (datasets.contains(cur_name))
+						delete datasets[cur_name];
+					datasets[cur_name] = dataset;
+					printf(
+						"Loaded %lld rows of %d columns in dataset '%s' (%.1f KB).\n",
+						dataset->nbRows(), dataset->nbColumns(), cur_name.c_str(), dataset->memoryUsage() / 1024.
+					);
+				}
+			}
+			continue;
+		}
+
+		// unload
+		if (cmd == "unload") {
+			if (!datasets.contains(cur_name))
+				printf("The dataset '%s' is not loaded.\n", cur_name.c_str());
+			else {
+				delete datasets[cur_name];
+				datasets.remove(cur_name);
 			}
 			continue;
 		}
@@ -372,68 +871,221 @@ void runScriptModule(const String& s) {
 			cur_name = cmd;
 			cmd = "run";
 		}
-		if (cmd == "run") {
-			if (!scripts.contains(cur_name)) {
-				printf("The script '%s' is not defined.\n", cur_name.c_str());
+		if (cmd == "run" || cmd == "profile") {
+			String dataset_name = splitDatasetName(cur_name);
+			bool use_dataset = (dataset_name != String());
+			// 'run a,b,c' runs several scripts in a single pass over the data
+			StringList names;
+			if (scripts.contains(cur_name))
+				names << cur_name;
+			else
+				names = splitCommaList(cur_name);
+			StringList output_files;
+			if (names.size() > 1 && output_file.findChar(',') != -1)
+				output_files = splitCommaList(output_file);
+			int undefined = -1;
+			for (int i = 0 ; i < names.size() && undefined == -1 ; ++i) {
+				if (!scripts.contains(names[i]))
+					undefined = i;
+			}
+			if (undefined != -1) {
+				printf("The script '%s' is not defined.\n", names[undefined].c_str());
 				printf("Type 'scripts' to get a list of defined scripts.\n");
+			} else if (use_dataset && !datasets.contains(dataset_name)) {
+				printf("The dataset '%s' is not loaded.\n", dataset_name.c_str());
+				printf("Type 'load %s < file' to load it.\n", dataset_name.c_str());
+			} else if (use_dataset && !input_file.isEmpty()) {
+				printf("Cannot run a script on both a dataset and a data file.\n");
+			} else if (!output_files.isEmpty() && output_files.size() != names.size()) {
+				printf("Give either one output file or one per script (%d scripts and %d files given).\n", names.size(), output_files.size());
 			} else {
+				bool profile = (cmd == "profile");
+				RunStats stats;
+				stats.name_ = cur_name;
+				stats.timed_ = print_stats || profile;
+				stats.rows_ = stats.skipped_rows_ = stats.input_bytes_ = 0;
+				stats.header_ns_ = stats.ingest_ns_ = stats.eval_ns_ = 0;
+				long long start = Timer::wallNs(), cpu_start = Timer::cpuNs();
+				reset_output_stats(stats.timed_);
 				bool redirected = false;
-				if (!output_file.isEmpty())
+				if (!output_file.isEmpty() && output_files.isEmpty())
 					redirected = redirect_output(output_file);
-				parser.parse(scripts[cur_name], variables);
-				if (!input_file.isEmpty()) {
-					FILE* var_file = fopen(input_file.c_str(), "r");
-					if (var_file == NULL)
-						printf("Cannot open file %s\n", input_file.c_str());
-					else {
-						String line = readLine(true, var_file).trimmed();
-						List<int> column_mapping;
-						while (!line.isEmpty()) {
-							int space_i = line.findSpace();
-							String var;
-							if (space_i == -1) {
-								var = line;
-								line.clear();
-							} else {
-								var = line.left(space_i - 1);
-								line = line.right(space_i + 1).trimmed();
-							}
-							column_mapping << variables.indexOf(var);
-							if (column_mapping.last() == -1)
-								printf("Warning: variable %s ignored as it is not used in any script.\n", var.c_str());
+				List<FILE*> outputs;
+				for (int i = 0 ; i < output_files.size() ; ++i)
+					outputs << open_output(output_files[i]);
+				parsed_fast_math = useFastMath(names[0], fast_math, default_fast_math);
+				EquationParser::setFastMath(parsed_fast_math);
+				parser.parse(scripts[names[0]], variables, true);
+				parsed_script = scripts[names[0]];
+				// The other scripts of a shared scan get their own parser
+				List<ScriptParser*> parsers;
+				parsers << &parser;
+				for (int i = 1 ; i < names.size() ; ++i) {
+					EquationParser::setFastMath(useFastMath(names[i], fast_math, default_fast_math));
+					parsers << new ScriptParser;
+					parsers.last()->setFirstCallSite(i * CallSitesPerScript);
+					parsers.last()->parse(scripts[names[i]], variables, true);
+				}
+				if (profile) {
+					for (int i = 0 ; i < parsers.size() ; ++i)
+						parsers[i]->resetProfile();
+					ScriptParser::setProfiling(true);
+				}
+				long long t0 = Timer::wallNs(), t1;
+				stats.parse_ns_ = t0 - start;
+				evaluateSections(parsers, outputs, true);
+				t1 = Timer::wallNs();
+				stats.eval_ns_ = t1 - t0;
+				t0 = t1;
+				if (use_dataset) {
+					// The rows are only copied, so this is counted in the evaluation
+					const Dataset* dataset = datasets[dataset_name];
+					List<int> mapping = dataset->mapColumns(variables.names());
+					foldRunConstants(parsers, dataset->columnNames());
+					double* values = variables.values();
+					// Skip the blocks of rows rejected by the guards
+					StringList guard_variables;
+					List<int> guard_columns;
+					if (rowGuardColumns(parsers, guard_variables)) {
+						for (int c = 0 ; c < mapping.size() ; ++c) {
+							if (mapping[c] != -1 && guard_variables.contains(variables.names()[mapping[c]]))
+								guard_columns << c;
 						}
-						while (!feof(var_file)) {
-							String line = readLine(true, var_file).trimmed();
-							int var_i = 0;
-							while (!line.isEmpty()) {
-								int space_i = line.findSpace();
-								String value;
-								if (space_i == -1) {
-									value = line;
-									line.clear();
-								} else {
-									value = line.left(space_i - 1);
-									line = line.right(space_i + 1).trimmed();
+					}
+					double* min_values = new double[variables.size()];
+					double* max_values = new double[variables.size()];
+					const double** columns = new const double*[variables.size()];
+					unsigned char* mask = new unsigned char[2 * Dataset::BlockSize];
+					for (int i = 0 ; i < variables.size() ; ++i) {
+						min_values[i] = max_values[i] = NAN;
+						columns[i] = NULL;
+					}
+					t1 = Timer::wallNs();
+					stats.header_ns_ = t1 - t0;
+					long long row = 0;
+					for (int block = 0 ; block < dataset->nbBlocks() ; ++block) {
+						long long end = row + dataset->blockSize(block);
+						if (
+							!guard_columns.isEmpty() &&
+							!blockMayBeAccepted(parsers, dataset, block, guard_columns, mapping, min_values, max_values)
+						) {
+							dataset->copyLastValues(row, end, mapping, values);
+							stats.skipped_rows_ += end - row;
+							for ( ; row < end ; ++row)
+								parsers.first()->nextRow();
+							continue;
+						}
+						// Only evaluate the rows accepted by the guards
+						if (
+							!guard_columns.isEmpty() &&
+							blockRowMask(parsers, dataset, block, guard_columns, mapping, columns, mask, mask + Dataset::BlockSize)
+						) {
+							long long copied = row;
+							for (int i = 0 ; row < end ; ++row, ++i) {
+								if (!mask[i]) {
+									parsers.first()->nextRow();
+									++stats.skipped_rows_;
+									continue;
 								}
-								if (column_mapping[var_i] != -1)
-									sscanf(value.c_str(), "%lf", var_values + column_mapping[var_i]);
-								++var_i;
+								if (copied < row)
+									dataset->copyLastValues(copied, row, mapping, values);
+								dataset->copyRow(row, mapping, values);
+								evaluateScripts(parsers, outputs);
+								copied = row + 1;
 							}
-							parser.evaluate(var_values);
+							if (copied < end)
+								dataset->copyLastValues(copied, end, mapping, values);
+							continue;
+						}
+						for ( ; row < end ; ++row) {
+							dataset->copyRow(row, mapping, values);
+							evaluateScripts(parsers, outputs);
 						}
-						fclose(var_file);
 					}
-				} else
-					parser.evaluate(var_values);
+					delete [] min_values;
+					delete [] max_values;
+					delete [] columns;
+					delete [] mask;
+					stats.eval_ns_ += Timer::wallNs() - t1;
+					stats.rows_ = dataset->nbRows();
+				} else if (!input_file.isEmpty()) {
+					DataFileReader reader;
+					RowGuardFilter filter(parsers);
+					bool opened = reader.open(input_file, variables.names());
+					if (opened) {
+						foldRunConstants(parsers, reader.columnNames());
+						// Skip the rows rejected by the guards while they are read
+						StringList guard_columns;
+						if (rowGuardColumns(parsers, guard_columns))
+							reader.setFilter(&filter, guard_columns);
+					}
+					t1 = Timer::wallNs();
+					stats.header_ns_ = t1 - t0;
+					t0 = t1;
+					if (!opened)
+						printf("Cannot open file %s\n", input_file.c_str());
+					else if (stats.timed_) {
+						// Time reading and evaluation of the rows separately
+						while (reader.readRow(variables.values())) {
+							t1 = Timer::wallNs();
+							stats.ingest_ns_ += t1 - t0;
+							evaluateScripts(parsers, outputs);
+							t0 = Timer::wallNs();
+							stats.eval_ns_ += t0 - t1;
+						}
+						stats.ingest_ns_ += Timer::wallNs() - t0;
+					} else {
+						while (reader.readRow(variables.values()))
+							evaluateScripts(parsers, outputs);
+						stats.eval_ns_ += Timer::wallNs() - t0;
+					}
+					if (opened) {
+						stats.rows_ = reader.nbRows();
+						stats.skipped_rows_ = reader.nbSkippedRows();
+						stats.input_bytes_ = reader.nbBytes();
+					}
+				} else {
+					evaluateScripts(parsers, outputs);
+					stats.eval_ns_ += Timer::wallNs() - t0;
+					stats.rows_ = 1;
+				}
+				t0 = Timer::wallNs();
+				evaluateSections(parsers, outputs, false);
+				stats.eval_ns_ += Timer::wallNs() - t0;
 				if (redirected)
 					close_redirect_output();
+				for (int i = 0 ; i < outputs.size() ; ++i) {
+					if (outputs[i] != NULL)
+						fclose(outputs[i]);
+				}
+				stats.output_bytes_ = output_bytes();
+				stats.output_ns_ = output_time_ns();
+				reset_output_stats(false);
+				stats.eval_ns_ -= stats.output_ns_;
+				stats.wall_ns_ = Timer::wallNs() - start;
+				stats.cpu_ns_ = Timer::cpuNs() - cpu_start;
+				stats.peak_rss_kb_ = peakRssKb();
+				last_run = stats;
+				if (profile) {
+					ScriptParser::setProfiling(false);
+					for (int i = 0 ; i < names.size() ; ++i)
+						printProfile(names[i], scripts[names[i]], parsers[i]->getProfile(), stats.rows_, stats.wall_ns_);
+				}
+				for (int i = 1 ; i < parsers.size() ; ++i)
+					delete parsers[i];
+				if (print_stats)
+					printRunStats(last_run);
 			}
 			continue;
 		}
 
 		// Treat it as a one-line script
-		if (parser.parse(line, variables))
-			parser.evaluate(var_values);
+		EquationParser::setFastMath(default_fast_math);
+		parsed_script.clear();
+		if (parser.parse(line, variables)) {
+			parser.nextRow();
+			parser.evaluate();
+		}
 		else {
 			if (parser.nbErrors() == 0)
 				printf("Syntax error...\n");
@@ -445,5 +1097,8 @@ void runScriptModule(const String& s) {
 		}
 	}
 
-	delete [] var_values;
+	const StringList& dataset_names = datasets.keys();
+	for (int i = 0 ; i < dataset_names.size() ; ++i)
+		delete datasets[dataset_names[i]];
+	EquationParser::setContext(NULL);
 }
@@ -18,15 +18,39 @@
  */
 
 #include "script_parser.h"
-#include "math_utils.h"
+#include "evaluation_context.h"
+#include "eval_kernels.h"
+#include "script_cache.h"
+#include "script_lexer.h"
+#include "parser_operators.h"
+#include "string_index.h"
+#include "timer.h"
+#include "redirect_output.h"
 #include <ctype.h>
+#include <typeinfo>
+
+// Delete the expressions of a block.
+static void deleteExpressions(List<ScriptParserExpression*> &expressions) {
+	for (List<ScriptParserExpression*>::iterator it = expressions.begin() ; it != expressions.end() ; ++it)
+		delete (*it);
+	expressions.clear();
+}
+
+// Parser modes that change the compiled equations
+enum { FAST_MATH_FLAG = 1, TOLERANT_COMPARISONS_FLAG = 2 };
+
+static int compilationFlags() {
+	return
+		(EquationParser::fastMath() ? FAST_MATH_FLAG : 0) |
+		(EquationParser::tolerantComparisons() ? TOLERANT_COMPARISONS_FLAG : 0);
+}
 
 /*! \fn ScriptParser::ScriptParser()
  *
  * Create a ScriptParser object.
  */
 ScriptParser::ScriptParser() :
-	args_double_(NULL)
+	row_guard_(NULL), context_(NULL), first_call_site_(0), variables_(NULL)
 {
 }
 
@@ -38,89 +62,337 @@ void ScriptParser::clear() {
 	for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
 		delete (*it);
 	expressions_.clear();
-	delete [] args_double_;
-	args_double_ = NULL;
+	deleteExpressions(begin_expressions_);
+	deleteExpressions(end_expressions_);
+	row_guard_ = NULL;
+	variables_ = NULL;
 	args_names_.clear();
 	errors_.clear();
 }
 
-/*! \fn bool ScriptParser::parse(const String &script, const StringList &variable_names)
+/*! \fn bool ScriptParser::parse(const String &script, VariableStorage &variables, bool use_cache)
  *
  * Parse the given script.
  * Parsing has to be done before calling evaluate(). If a parsing
  * error occurs this function return false. You can get the errors
  * with nbErrors() and getError(int).
+ *
+ * The compiled script reads and writes the variables directly in
+ * \p variables, which must outlive the parsed script and should not
+ * get new variables until the script is parsed again. Several scripts
+ * can be parsed with the same storage.
+ *
+ * If \p use_cache is true and the ScriptCache is enabled, the compiled
+ * script is loaded from the cache when possible, and otherwise saved to
+ * the cache after it has been parsed.
  */
 bool ScriptParser::parse(
 	const String &script,
-	const StringList &variable_names
+	VariableStorage &variables,
+	bool use_cache
 ) {
 	clear();
 
-	args_names_ = variable_names;
-	if (!args_names_.isEmpty()) {
-		args_double_ = new double[args_names_.size()];
-		memset(args_double_, 0, args_names_.size() * sizeof(double));
+	// Random call sites are numbered from the start of the script
+	context_ = EquationParser::context();
+	context_->resetCallSites(first_call_site_);
+
+	variables_ = &variables;
+	args_names_ = variables.names();
+
+	use_cache = use_cache && ScriptCache::enabled();
+	if (use_cache) {
+		ScriptCache cache;
+		if (cache.open(script, compilationFlags()) && loadCompiled(cache.reader(), args_names_)) {
+			splitSections();
+			optimize();
+			return true;
+		}
+		context_->resetCallSites(first_call_site_);
 	}
 
-	breakBlock(script, expressions_, variable_names, false, errors_, args_double_);
+	EquationParser equation_parser;
+	equation_parser.setVariables(args_names_, false, variables.values());
+	breakBlock(script, expressions_, equation_parser, errors_);
 
 	if (!errors_.isEmpty()) {
 		for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
 			delete (*it);
 		expressions_.clear();
-		delete [] args_double_;
-		args_double_ = NULL;
 		return false;
 	}
 
+	// The cache keeps the expressions as written, so that they can be
+	// saved and loaded. The optimizations are applied after that.
+	if (use_cache)
+		saveCompiled(script);
+	splitSections();
+	optimize();
+	return true;
+}
+
+// Move the statements of the 'begin' and 'end' sections out of the script.
+void ScriptParser::splitSections() {
+	List<ScriptParserExpression*> expressions;
+	for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it) {
+		ScriptParserSectionExpression *section = dynamic_cast<ScriptParserSectionExpression*>(*it);
+		if (section == NULL) {
+			expressions << (*it);
+			continue;
+		}
+		List<ScriptParserExpression*> &target = section->isBegin() ? begin_expressions_ : end_expressions_;
+		List<ScriptParserExpression*> block = section->takeExpressions();
+		for (int i = 0 ; i < block.size() ; ++i)
+			target << block[i];
+		delete section;
+	}
+	expressions_ = expressions;
+}
+
+static ScriptParserConditionalExpression *rowGuard(const List<ScriptParserExpression*>&);
+
+// Rewrite the parsed expressions to make them faster to evaluate without
+// changing their results. This first moves the loop invariant subexpressions
+// of the while loops out of the loops and then replaces the &&, || and if()
+// with cheap operands by their branch-free versions. The row guard is found
+// once the script is in its final form.
+void ScriptParser::optimize() {
+	List<ScriptParserExpression*> *blocks[] = { &begin_expressions_, &expressions_, &end_expressions_ };
+	List<ParserOperator**> equations;
+	for (int b = 0 ; b < 3 ; ++b) {
+		for (List<ScriptParserExpression*>::iterator it = blocks[b]->begin() ; it != blocks[b]->end() ; ++it) {
+			(*it)->optimize();
+			(*it)->getEquations(equations);
+		}
+	}
+	// The root of each equation is kept: it is the assignment or the
+	// 'if' created for the condition.
+	for (int i = 0 ; i < equations.size() ; ++i)
+		selectBranchFree(*equations[i]);
+	ScriptParserConditionalExpression *guard = rowGuard(expressions_);
+	row_guard_ = guard != NULL ? guard->condition() : NULL;
+}
+
+/*! \fn bool ScriptParser::parse(const String &script, const StringList &variable_names, bool use_cache)
+ *
+ * Parse the given script with its own storage for the given variables, all
+ * set to 0. Their values are given by VariablesValue().
+ */
+bool ScriptParser::parse(
+	const String &script,
+	const StringList &variable_names,
+	bool use_cache
+) {
+	own_variables_.clear();
+	own_variables_.setNames(variable_names);
+	return parse(script, own_variables_, use_cache);
+}
+
+// Compiled script format (after the header written by ScriptCache, which
+// includes the flags of the parser modes used to compile the script):
+//   - variables of the script (as returned by getVariablesList())
+//   - variable names given to parse(), used by the compiled equations
+//   - compiled expressions
+bool ScriptParser::loadCompiled(CacheReader &reader, const StringList &variable_names) {
+	reader.readStringList();
+	StringList names = reader.readStringList();
+	if (!reader.isValid())
+		return false;
+	List<int> variable_map;
+	StringIndex index(variable_names);
+	for (int i = 0 ; i < names.size() ; ++i)
+		variable_map << index.indexOf(names[i]);
+	EquationParser equation_parser;
+	equation_parser.setVariables(variable_names, false, variables_->values());
+	if (!ScriptParserExpression::loadList(reader, expressions_, equation_parser, variable_map)) {
+		for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
+			delete (*it);
+		expressions_.clear();
+		return false;
+	}
 	return true;
 }
 
-/*! \fn StringList ScriptParser::getVariablesList(const String &script)
+void ScriptParser::saveCompiled(const String &script) const {
+	CacheWriter writer;
+	ScriptParser variables_parser;
+	writer.writeStringList(variables_parser.getVariablesList(script));
+	writer.writeStringList(args_names_);
+	EquationParser equation_parser;
+	equation_parser.setVariables(args_names_, false, variables_->values());
+	if (ScriptParserExpression::saveList(expressions_, writer, equation_parser))
+		ScriptCache::store(script, compilationFlags(), writer);
+}
+
+/*! \fn StringList ScriptParser::getVariablesList(const String &script, bool use_cache)
  *
  * Get the list of variables from the script. This will
  * also report parsing errors, so in most cases you will
  * want to check that nbErrors() return 0 after calling
  * this function.
+ *
+ * If \p use_cache is true the list is taken from the compiled
+ * script in the ScriptCache if there is one (only scripts
+ * without errors are saved in the cache).
  */
-StringList ScriptParser::getVariablesList(const String &script) {
-	// We parse the script with the breakBlock() function and auto_add_variables
-	// variable set to true. This is not correct because the created EquationParser
-	// will use different list of variables, but at least it can be used to list all
-	// the variables.
+StringList ScriptParser::getVariablesList(const String &script, bool use_cache) {
 	clear();
 
-	List<ScriptParserExpression*> expressions;
-	breakBlock(script, expressions, StringList(), true, errors_);
-	StringList variables;
-	for (int i = 0 ; i < expressions.size() ; ++i) {
-		StringList vars = expressions[i]->variablesName();
-		delete expressions[i];
-		for (int j = 0 ; j < vars.size() ; ++j) {
-			if (!variables.contains(vars[j]))
-				variables.append(vars[j]);
+	if (use_cache && ScriptCache::enabled()) {
+		ScriptCache cache;
+		if (cache.open(script, compilationFlags())) {
+			StringList variables = cache.reader().readStringList();
+			if (cache.reader().isValid())
+				return variables;
 		}
 	}
 
-	return variables;
+	// We parse the script with a single EquationParser in the auto-add mode,
+	// so that it collects the variables in the order in which they appear.
+	EquationParser equation_parser;
+	equation_parser.setVariables(StringList(), true);
+	List<ScriptParserExpression*> expressions;
+	breakBlock(script, expressions, equation_parser, errors_);
+	for (List<ScriptParserExpression*>::iterator it = expressions.begin() ; it != expressions.end() ; ++it)
+		delete (*it);
+
+	return equation_parser.variablesName();
+}
+
+/*! \fn void ScriptParser::setFirstCallSite(unsigned int first)
+ *
+ * Set the id given to the first urand() or nrand() call of the scripts
+ * parsed next (0 by default). The scripts run together on the same rows
+ * use separate ranges of ids, so that in counter mode they do not get the
+ * same random numbers (see EvaluationContext).
+ */
+void ScriptParser::setFirstCallSite(unsigned int first) {
+	first_call_site_ = first;
+}
+
+/*! \fn void ScriptParser::nextRow()
+ *
+ * Start a new row in the EvaluationContext of the last script parsed. This
+ * is called once per row, before evaluate() or instead of it when the row is
+ * skipped. The scripts run together on the same rows share the context, so
+ * it is only called for one of them.
+ */
+void ScriptParser::nextRow() {
+	if (context_ != NULL)
+		context_->nextRow();
 }
 
 /*! \fn void ScriptParser::evaluate(double *var)
  *
- * Evaluate the last script parsed with the given variable values
- * or the variable values set in the VariablesValue() array if
- * no value array is given.
+ * Evaluate the last script parsed on the values of its VariableStorage
+ * (see VariablesValue()). If a value array \p var is given instead, the
+ * values are copied from and back to it, which is only needed when the
+ * script was not parsed with the storage that holds the values. This does
+ * not start a new row for the EvaluationContext (see nextRow()).
  */
 void ScriptParser::evaluate(double *var) {
-	if (var != NULL && args_double_ != NULL)
-		memcpy(args_double_, var, args_names_.size() * sizeof(double));
+	double *values = VariablesValue();
+	bool copy = var != NULL && values != NULL && var != values;
+	if (copy)
+		memcpy(values, var, args_names_.size() * sizeof(double));
 
 	for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
-		(*it)->evaluate();
+		(*it)->execute();
+
+	if (copy)
+		memcpy(var, values, args_names_.size() * sizeof(double));
+}
+
+/*! \fn bool ScriptParser::hasBeginSection() const
+ *
+ * Return true if the last script parsed has a 'begin' section.
+ */
+bool ScriptParser::hasBeginSection() const {
+	return !begin_expressions_.isEmpty();
+}
 
-	if (var != NULL && args_double_ != NULL)
-		memcpy(var, args_double_, args_names_.size() * sizeof(double));
+/*! \fn bool ScriptParser::hasEndSection() const
+ *
+ * Return true if the last script parsed has an 'end' section.
+ */
+bool ScriptParser::hasEndSection() const {
+	return !end_expressions_.isEmpty();
+}
+
+/*! \fn void ScriptParser::evaluateBegin()
+ *
+ * Evaluate the 'begin' section of the last script parsed. It is meant to be
+ * called once before the rows are evaluated with evaluate().
+ */
+void ScriptParser::evaluateBegin() {
+	for (List<ScriptParserExpression*>::iterator it = begin_expressions_.begin() ; it != begin_expressions_.end() ; ++it)
+		(*it)->execute();
+}
+
+/*! \fn void ScriptParser::evaluateEnd()
+ *
+ * Evaluate the 'end' section of the last script parsed, once the last row
+ * has been evaluated. The rows of the 'group' statements are printed first.
+ */
+void ScriptParser::evaluateEnd() {
+	for (int i = 0 ; i < expressions_.size() ; ++i) {
+		ScriptParserGroupExpression *group = dynamic_cast<ScriptParserGroupExpression*>(expressions_[i]);
+		if (group != NULL && variables_ != NULL)
+			group->printGroups(*variables_);
+	}
+	for (List<ScriptParserExpression*>::iterator it = end_expressions_.begin() ; it != end_expressions_.end() ; ++it)
+		(*it)->execute();
+}
+
+/*! \fn void ScriptParser::setProfiling(bool enable)
+ *
+ * Enable or disable the profiling of the statements for all the scripts.
+ * When it is enabled each statement counts its executions and the time
+ * spent in it. Use getProfile() to get the result and resetProfile() to
+ * reset the counters. Profiling is disabled by default and only costs
+ * a test per statement execution in that case.
+ */
+void ScriptParser::setProfiling(bool enable) {
+	ScriptParserExpression::profiling_ = enable;
+}
+
+/*! \fn bool ScriptParser::profiling()
+ *
+ * Return true if the profiling is enabled.
+ */
+bool ScriptParser::profiling() {
+	return ScriptParserExpression::profiling_;
+}
+
+/*! \fn void ScriptParser::resetProfile()
+ *
+ * Reset the profiling counters of all the statements of the script.
+ */
+void ScriptParser::resetProfile() {
+	for (List<ScriptParserExpression*>::iterator it = begin_expressions_.begin() ; it != begin_expressions_.end() ; ++it)
+		(*it)->resetProfile();
+	for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
+		(*it)->resetProfile();
+	for (List<ScriptParserExpression*>::iterator it = end_expressions_.begin() ; it != end_expressions_.end() ; ++it)
+		(*it)->resetProfile();
+}
+
+/*! \fn List<ScriptProfileEntry> ScriptParser::getProfile() const
+ *
+ * Return the profiling counters of the statements of the script, in the
+ * order in which they appear in the script (a statement is followed by
+ * the statements of its blocks). The statements of the 'begin' section
+ * come first and those of the 'end' section last.
+ */
+List<ScriptProfileEntry> ScriptParser::getProfile() const {
+	List<ScriptProfileEntry> entries;
+	for (int i = 0 ; i < begin_expressions_.size() ; ++i)
+		begin_expressions_[i]->getProfile(entries, 0);
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getProfile(entries, 0);
+	for (int i = 0 ; i < end_expressions_.size() ; ++i)
+		end_expressions_[i]->getProfile(entries, 0);
+	return entries;
 }
 
 /*! \fn double *ScriptParser::VariablesValue()
@@ -129,7 +401,7 @@ void ScriptParser::evaluate(double *var) {
  * that is used during the evaluate() call.
  */
 double *ScriptParser::VariablesValue() {
-	return args_double_;
+	return variables_ == NULL ? NULL : variables_->values();
 }
 
 /*! \fn const StringList &ScriptParser::variablesName() const
@@ -167,779 +439,1666 @@ String ScriptParser::getLastError() const {
 	return getError(nbErrors() - 1);
 }
 
-/*! \fn void ScriptParser::breakBlock(const String &script_block, List<ScriptParserExpression*> &expressions, const StringList &variable_names, bool auto_add_variables, StringList &errors, double* variable_array = NULL)
+/*! \class ScriptStatementParser
+ *
+ * Internal recursive descent parser used by ScriptParser::breakBlock(). It
+ * reads the tokens of the script from a ScriptLexer and creates each statement
+ * as soon as it has been read, so that the script is parsed in a single pass
+ * whatever the nesting of its blocks:
+ * \code
+	block      := statement* ('}' | end of script)
+	statement  := ';'
+	            | ('begin' | 'end') '{' block
+	            | 'group' '(' expression ')' '{' block
+	            | function
+	            | 'if' condition body ('else' (if statement | body))?
+	            | 'while' condition body
+	            | expression ';'
+	function   := 'memo'? 'function' name '(' parameters? ')'
+	              '{' 'return' expression ';' '}'
+	condition  := '(' expression ')'
+	body       := '{' block | statement
+ * \endcode
+ * As in C, an 'else' belongs to the closest 'if'. Blocks are not allowed in
+ * the body of an 'if' or 'while' written without braces. The 'begin' and
+ * 'end' sections, the 'group' statements and the function definitions are
+ * only allowed at the top level of the script. 'begin' and 'end' are only
+ * keywords when followed by '{', 'group' when followed by '(', and 'function'
+ * (optionally preceded by 'memo') when followed by a name and '('. A
+ * function is compiled by the EquationParser (see
+ * EquationParser::defineFunction()) and can be used by the statements that
+ * follow it.
+ */
+class ScriptStatementParser {
+public:
+	ScriptStatementParser(const String &script, EquationParser &equation_parser, StringList &errors);
+
+	void parseScript(List<ScriptParserExpression*> &expressions);
+
+private:
+	bool parseBlock(List<ScriptParserExpression*> &expressions);
+	bool parseStatement(List<ScriptParserExpression*> &expressions, bool in_single_statement);
+	bool parseConditional(List<ScriptParserExpression*> &expressions, bool in_single_statement);
+	bool parseWhile(List<ScriptParserExpression*> &expressions, bool in_single_statement);
+	bool isFollowedBy(ScriptToken::Type) const;
+	bool parseSection(List<ScriptParserExpression*> &expressions, bool in_single_statement);
+	bool parseGroup(List<ScriptParserExpression*> &expressions, bool in_single_statement);
+	bool isFunctionDefinition() const;
+	bool parseFunction(bool in_single_statement);
+	bool parseExpression(List<ScriptParserExpression*> &expressions);
+	bool parseParenthesized(const ScriptToken &keyword, String &text, const char *empty_message);
+	bool parseCondition(const ScriptToken &keyword, ParserOperator *&condition);
+	ParserOperator *compile(const String &equation, const ScriptToken&, const char *what);
+	bool parseBody(List<ScriptParserExpression*> &expressions, bool in_single_statement);
+
+	void addExpression(List<ScriptParserExpression*> &expressions, ScriptParserExpression*, const ScriptToken&);
+	bool error(const ScriptToken&, const char *message);
+
+	ScriptLexer lexer_;
+	EquationParser &equation_parser_;
+	StringList &errors_;
+	int depth_;  // Number of enclosing blocks
+};
+
+ScriptStatementParser::ScriptStatementParser(
+	const String &script, EquationParser &equation_parser, StringList &errors
+) :
+	lexer_(script), equation_parser_(equation_parser), errors_(errors), depth_(0)
+{
+}
+
+/*! \fn void ScriptStatementParser::parseScript(List<ScriptParserExpression*> &expressions)
+ *
+ * Parse the whole script and append its statements to \p expressions. Parsing
+ * stops at the first syntax error. Invalid expressions and conditions are
+ * reported but do not stop the parsing.
+ */
+void ScriptStatementParser::parseScript(List<ScriptParserExpression*> &expressions) {
+	if (parseBlock(expressions) && lexer_.peek().type_ == ScriptToken::RIGHT_BRACE)
+		error(lexer_.peek(), "unexpected '}'.");
+}
+
+// Parse statements until the next '}' (not consumed) or the end of the script.
+bool ScriptStatementParser::parseBlock(List<ScriptParserExpression*> &expressions) {
+	while (
+		lexer_.peek().type_ != ScriptToken::END &&
+		lexer_.peek().type_ != ScriptToken::RIGHT_BRACE
+	) {
+		if (!parseStatement(expressions, false))
+			return false;
+	}
+	return true;
+}
+
+bool ScriptStatementParser::parseStatement(List<ScriptParserExpression*> &expressions, bool in_single_statement) {
+	const ScriptToken &token = lexer_.peek();
+	switch (token.type_) {
+	case ScriptToken::SEMICOLON:
+		// Empty statement
+		lexer_.next();
+		return true;
+	case ScriptToken::LEFT_BRACE:
+		return error(token, "unexpected '{'.");
+	case ScriptToken::RIGHT_BRACE:
+		return error(token, "unexpected '}'.");
+	case ScriptToken::END:
+		return error(token, "unexpected end of script.");
+	default:
+		break;
+	}
+	if (lexer_.isKeyword(token, "if"))
+		return parseConditional(expressions, in_single_statement);
+	if (lexer_.isKeyword(token, "while"))
+		return parseWhile(expressions, in_single_statement);
+	if ((lexer_.isKeyword(token, "begin") || lexer_.isKeyword(token, "end")) && isFollowedBy(ScriptToken::LEFT_BRACE))
+		return parseSection(expressions, in_single_statement);
+	if (lexer_.isKeyword(token, "group") && isFollowedBy(ScriptToken::LEFT_PAREN))
+		return parseGroup(expressions, in_single_statement);
+	if ((lexer_.isKeyword(token, "function") || lexer_.isKeyword(token, "memo")) && isFunctionDefinition())
+		return parseFunction(in_single_statement);
+	if (lexer_.isKeyword(token, "else"))
+		return error(token, "unexpected 'else' (not preceded by 'if' or 'else if' statement).");
+	return parseExpression(expressions);
+}
+
+bool ScriptStatementParser::parseConditional(List<ScriptParserExpression*> &expressions, bool in_single_statement) {
+	ScriptToken keyword = lexer_.next();
+	ParserOperator *condition = NULL;
+	if (!parseCondition(keyword, condition))
+		return false;
+	List<ScriptParserExpression*> if_expressions, else_expressions;
+	bool ok = parseBody(if_expressions, in_single_statement);
+	if (ok && lexer_.isKeyword(lexer_.peek(), "else")) {
+		lexer_.next();
+		ok = lexer_.isKeyword(lexer_.peek(), "if") ?
+			parseConditional(else_expressions, in_single_statement) :
+			parseBody(else_expressions, in_single_statement);
+	}
+	if (!ok) {
+		delete condition;
+		deleteExpressions(if_expressions);
+		deleteExpressions(else_expressions);
+		return false;
+	}
+	addExpression(expressions, new ScriptParserConditionalExpression(condition, if_expressions, else_expressions), keyword);
+	return true;
+}
+
+bool ScriptStatementParser::parseWhile(List<ScriptParserExpression*> &expressions, bool in_single_statement) {
+	ScriptToken keyword = lexer_.next();
+	ParserOperator *condition = NULL;
+	if (!parseCondition(keyword, condition))
+		return false;
+	List<ScriptParserExpression*> block;
+	if (!parseBody(block, in_single_statement)) {
+		delete condition;
+		deleteExpressions(block);
+		return false;
+	}
+	addExpression(expressions, new ScriptParserWhileExpression(condition, block), keyword);
+	return true;
+}
+
+// Return true if the token after the next one has the given type. This tells
+// if a 'begin', 'end' or 'group' keyword starts a statement or is part of an
+// expression.
+bool ScriptStatementParser::isFollowedBy(ScriptToken::Type type) const {
+	ScriptLexer lexer = lexer_;
+	lexer.next();
+	return lexer.peek().type_ == type;
+}
+
+bool ScriptStatementParser::parseSection(List<ScriptParserExpression*> &expressions, bool in_single_statement) {
+	ScriptToken keyword = lexer_.next();
+	if (in_single_statement || depth_ > 0)
+		return error(keyword, "'begin' and 'end' sections are only allowed at the top level of the script.");
+	List<ScriptParserExpression*> block;
+	if (!parseBody(block, false)) {
+		deleteExpressions(block);
+		return false;
+	}
+	addExpression(expressions, new ScriptParserSectionExpression(lexer_.isKeyword(keyword, "begin"), block), keyword);
+	return true;
+}
+
+// Return true if the given equation uses a window function (see
+// WindowOperator).
+static bool hasWindowFunction(const ParserOperator *op) {
+	if (op == NULL)
+		return false;
+#ifdef PARSER_INSTRUMENTATION
+	const InstrumentedOperator *instrumented = dynamic_cast<const InstrumentedOperator*>(op);
+	if (instrumented != NULL)
+		op = instrumented->wrappedOperator();
+#endif
+	if (dynamic_cast<const WindowOperator*>(op) != NULL)
+		return true;
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		if (hasWindowFunction(op->child(i)))
+			return true;
+	}
+	return false;
+}
+
+bool ScriptStatementParser::parseGroup(List<ScriptParserExpression*> &expressions, bool in_single_statement) {
+	ScriptToken keyword = lexer_.next();
+	if (in_single_statement || depth_ > 0)
+		return error(keyword, "'group' statements are only allowed at the top level of the script.");
+	String text;
+	if (!parseParenthesized(keyword, text, "empty group key."))
+		return false;
+	ParserOperator *key = compile(text, keyword, "group key");
+	if (lexer_.peek().type_ != ScriptToken::LEFT_BRACE) {
+		delete key;
+		return error(lexer_.peek(), "'{' expected after the group key.");
+	}
+	List<ScriptParserExpression*> block;
+	if (!parseBody(block, false)) {
+		delete key;
+		deleteExpressions(block);
+		return false;
+	}
+	// The groups would all share the same window
+	List<ParserOperator**> equations;
+	for (int i = 0 ; i < block.size() ; ++i)
+		block[i]->getEquations(equations);
+	for (int i = 0 ; i < equations.size() ; ++i) {
+		if (hasWindowFunction(*equations[i])) {
+			delete key;
+			deleteExpressions(block);
+			return error(keyword, "window functions cannot be used in a 'group' block.");
+		}
+	}
+	// The key is the first column of the rows printed for the groups
+	String key_name;
+	for (int i = 0 ; i < text.length() ; ++i) {
+		if (!isspace(text[i]))
+			key_name += text[i];
+	}
+	addExpression(expressions, new ScriptParserGroupExpression(key, key_name, block), keyword);
+	return true;
+}
+
+// Return true if the next tokens are 'function' (optionally preceded by
+// 'memo'), a name and '('.
+bool ScriptStatementParser::isFunctionDefinition() const {
+	ScriptLexer lexer = lexer_;
+	if (lexer.isKeyword(lexer.peek(), "memo"))
+		lexer.next();
+	if (!lexer.isKeyword(lexer.next(), "function"))
+		return false;
+	if (lexer.peek().type_ != ScriptToken::WORD)
+		return false;
+	lexer.next();
+	return lexer.peek().type_ == ScriptToken::LEFT_PAREN;
+}
+
+bool ScriptStatementParser::parseFunction(bool in_single_statement) {
+	ScriptToken keyword = lexer_.next();
+	bool memoized = lexer_.isKeyword(keyword, "memo");
+	if (memoized)
+		lexer_.next();
+	if (in_single_statement || depth_ > 0)
+		return error(keyword, "functions can only be defined at the top level of the script.");
+	String name = lexer_.text(lexer_.next());
+	String text;
+	if (!parseParenthesized(keyword, text, NULL))
+		return false;
+	StringList parameters;
+	String parameter;
+	for (int i = 0 ; i <= text.length() ; ++i) {
+		if (i == text.length() || text[i] == ',') {
+			parameters << parameter.trimmed();
+			parameter.clear();
+		} else
+			parameter += text[i];
+	}
+	if (parameters.size() == 1 && parameters[0].isEmpty())
+		parameters.clear();
+
+	// The body is a single return statement
+	if (lexer_.peek().type_ != ScriptToken::LEFT_BRACE)
+		return error(lexer_.peek(), "'{' expected after the parameters of the function.");
+	ScriptToken open = lexer_.next();
+	if (!lexer_.isKeyword(lexer_.peek(), "return"))
+		return error(lexer_.peek(), "the body of a function must be a single 'return' statement.");
+	lexer_.next();
+	String body;
+	while (lexer_.peek().type_ != ScriptToken::SEMICOLON) {
+		const ScriptToken &token = lexer_.peek();
+		if (token.type_ == ScriptToken::END)
+			return error(open, "unexpected end of script (missing ';').");
+		if (token.type_ == ScriptToken::LEFT_BRACE || token.type_ == ScriptToken::RIGHT_BRACE)
+			return error(token, token.type_ == ScriptToken::LEFT_BRACE ? "missing ';' before '{'." : "missing ';' before '}'.");
+		lexer_.appendText(body, lexer_.next());
+	}
+	lexer_.next();
+	if (lexer_.peek().type_ != ScriptToken::RIGHT_BRACE)
+		return error(lexer_.peek(), "the body of a function must be a single 'return' statement.");
+	lexer_.next();
+
+	if (!equation_parser_.defineFunction(name, parameters, body, memoized)) {
+		errors_ << String::format(
+			"Script parsing error line %d, column %d: invalid function '%s'.",
+			keyword.line_, keyword.column_, name.c_str()
+		);
+		for (int e = 0 ; e < equation_parser_.nbErrors() ; ++e)
+			errors_.append(equation_parser_.getError(e));
+	}
+	return true;
+}
+
+// Read an expression up to the next ';' and create the statement for it.
+bool ScriptStatementParser::parseExpression(List<ScriptParserExpression*> &expressions) {
+	ScriptToken first = lexer_.peek();
+	// Position of the last 'if' or 'while' at the top level of the expression,
+	// used to report a missing ';' before a conditional or loop.
+	ScriptToken keyword = first;
+	bool has_keyword = false;
+	int level = 0;
+	String expression;
+	while (lexer_.peek().type_ != ScriptToken::SEMICOLON) {
+		const ScriptToken &token = lexer_.peek();
+		if (token.type_ == ScriptToken::END)
+			return error(first, "unexpected end of script (missing ';').");
+		if (token.type_ == ScriptToken::LEFT_BRACE || token.type_ == ScriptToken::RIGHT_BRACE) {
+			if (has_keyword)
+				return error(keyword, lexer_.isKeyword(keyword, "if") ? "missing ';' before 'if'." : "missing ';' before 'while'.");
+			return error(token, token.type_ == ScriptToken::LEFT_BRACE ? "missing ';' before '{'." : "missing ';' before '}'.");
+		}
+		if (token.type_ == ScriptToken::LEFT_PAREN)
+			++level;
+		else if (token.type_ == ScriptToken::RIGHT_PAREN)
+			--level;
+		else if (level == 0 && (lexer_.isKeyword(token, "if") || lexer_.isKeyword(token, "while"))) {
+			keyword = token;
+			has_keyword = true;
+		}
+		lexer_.appendText(expression, lexer_.next());
+	}
+	lexer_.next();
+
+	ParserOperator *equation = compile(expression, first, "expression");
+	if (equation != NULL)
+		addExpression(expressions, new ScriptParserEquationExpression(equation), first);
+	return true;
+}
+
+// Compile an equation with the shared EquationParser and report its errors.
+ParserOperator *ScriptStatementParser::compile(const String &equation, const ScriptToken &token, const char *what) {
+	ParserOperator *tree = equation_parser_.compile(equation);
+	if (equation_parser_.nbErrors() > 0) {
+		errors_ << String::format(
+			"Script parsing error line %d, column %d: invalid %s '%s'.",
+			token.line_, token.column_, what, equation.c_str()
+		);
+		for (int e = 0 ; e < equation_parser_.nbErrors() ; ++e)
+			errors_.append(equation_parser_.getError(e));
+	}
+	return tree;
+}
+
+// Read the text between the parentheses that follow a keyword. The text can
+// only be empty if there is no \p empty_message.
+bool ScriptStatementParser::parseParenthesized(const ScriptToken &keyword, String &text, const char *empty_message) {
+	String message = String::format("'(' expected after '%s'.", lexer_.text(keyword).c_str());
+	if (lexer_.peek().type_ != ScriptToken::LEFT_PAREN)
+		return error(lexer_.peek(), message.c_str());
+	ScriptToken open = lexer_.next();
+	int level = 1;
+	while (true) {
+		const ScriptToken &token = lexer_.peek();
+		if (token.type_ == ScriptToken::END)
+			return error(open, "unexpected end of script (unbalanced parenthesis).");
+		if (token.type_ == ScriptToken::LEFT_PAREN)
+			++level;
+		else if (token.type_ == ScriptToken::RIGHT_PAREN && --level == 0)
+			break;
+		lexer_.appendText(text, lexer_.next());
+	}
+	ScriptToken close = lexer_.next();
+	if (text.isEmpty() && empty_message != NULL)
+		return error(close, empty_message);
+	return true;
+}
+
+// Read the parenthesized condition after an 'if' or 'while' keyword.
+bool ScriptStatementParser::parseCondition(const ScriptToken &keyword, ParserOperator *&condition) {
+	String text;
+	if (!parseParenthesized(keyword, text, "empty conditional expression."))
+		return false;
+	// The condition is compiled before the body so that the variables are
+	// found in the order in which they appear in the script.
+	condition = compile("if(" + text + ", 1., 0.)", keyword, "condition");
+	return true;
+}
+
+// Read the body of an 'if', 'else' or 'while': either a block between braces
+// or a single statement.
+bool ScriptStatementParser::parseBody(List<ScriptParserExpression*> &expressions, bool in_single_statement) {
+	if (lexer_.peek().type_ != ScriptToken::LEFT_BRACE)
+		return parseStatement(expressions, true);
+	if (in_single_statement) {
+		// Forbid this. This can get confusing if we allow nested blocks in a single-line block.
+		// The script may not behave as the user expect.
+		return error(lexer_.peek(), "nested blocks inside a single line conditional is forbidden.");
+	}
+	ScriptToken open = lexer_.next();
+	++depth_;
+	if (!parseBlock(expressions))
+		return false;
+	--depth_;
+	if (lexer_.peek().type_ != ScriptToken::RIGHT_BRACE)
+		return error(open, "unexpected end of script (unbalanced '{' and '}').");
+	lexer_.next();
+	return true;
+}
+
+void ScriptStatementParser::addExpression(
+	List<ScriptParserExpression*> &expressions,
+	ScriptParserExpression *exp, const ScriptToken &token
+) {
+	exp->setLine(token.line_);
+	exp->setColumn(token.column_);
+	expressions.append(exp);
+}
+
+bool ScriptStatementParser::error(const ScriptToken &token, const char *message) {
+	errors_ << String::format("Script parsing error line %d, column %d: %s", token.line_, token.column_, message);
+	return false;
+}
+
+/*! \fn void ScriptParser::breakBlock(const String &script_block, List<ScriptParserExpression*> &expressions, EquationParser &equation_parser, StringList &errors)
  *
  * Parse the given script block and fill the given ScriptParserExpression
  * list with expressions found in the script. If error are found during the
- * parsing they will be appended to the errors list.
+ * parsing they will be appended to the errors list. Each expression knows
+ * the line and column at which it starts in the script.
  *
- * If \p auto_add_variables is false, you can pass the value array for the
- * variables. The \p variable_array should therefore be allocated to hold as
- * many value as elements in the \p variable_names list. The values will
- * also be stored in the same order as the list.
+ * All the equations of the script are compiled by \p equation_parser with
+ * the variables given to EquationParser::setVariables(). They use its value
+ * array, so the expressions must not be evaluated after the parser has been
+ * destroyed unless a variable array was passed to setVariables().
  */
 void ScriptParser::breakBlock(
 	const String &script_block, List<ScriptParserExpression*> &expressions,
-	const StringList &variable_names, bool auto_add_variables,
-	StringList &errors,
-	double* variable_array
+	EquationParser &equation_parser, StringList &errors
 ) {
-	String script;
-	bool is_original_script = false;
-	if (!script_block.startsWith("!!")) {
-		is_original_script = true;
-		// Inject line numbers (used for parsing error messages
-		StrReadStream stream(script_block);
-		String s;
-		int line = 1;
-		while (!stream.atEnd()) {
-			if (line > 1)
-				s += '\n';
-			s += String::format("!!%d\n", line) + stream.readLine();
-			++line;
-		}
+	ScriptStatementParser parser(script_block, equation_parser, errors);
+	parser.parseScript(expressions);
+}
 
-		// remove C style comments
-		// remove C++ and Shell (one line) style comments
-		// add new line after ;
-		// add new line after and before } and {
-		// simplify new lines
-		// simplify any space and new line between else and if
-		// This way each line only contains one expression.
-		// This also means that if { ... } else { ... } construct will look like
-		// if
-		// {
-		// ....
-		// }
-		// else if
-		// {
-		// ...
-		// }
-		// else
-		// {
-		// ....
-		// }
-		// whatever the original way if was formatted
-		int i = 0, length = s.length();
-		while (i < length) {
-			char c = s[i];
-			if (i+1 < length && c == '/' && s[i+1] == '*') {
-				// C style comment
-				i += 4;
-				while (i < length && (s[i-2] != '*' || s[i-1] != '/')) {
-					// keep line numbers
-					if (s[i-2] == '!' && s[i-1] == '!') {
-						int j = i;
-						while (j < length && s[j] != '\n') {
-							if (!isdigit(s[j]))
-								j = length;
-						}
-						if (j < length) {
-							script += s.mid(i-2, j);
-							i = j+1;
-						}
-					}
-					// skip character
-					++i;
-				}
-			} else if (i+1 < length && c == '/' && s[i+1] == '/') {
-				// C++ style comment
-				i += 2;
-				while (i < length && s[i] != '\n')
-					++i;
-			} else if (c == '#') {
-				// Shell style comment
-				++i;
-				while (i < length && s[i] != '\n')
-					++i;
-			} else {
-				if (c == '{' || c == '}')
-					script += '\n';
-				script += c;
-				if (c == '{' || c == '}' || c == ';')
-					script += '\n';
-				++i;
-				if (script.endsWith("\nelse") && s.isSpace(i)) {
-					// check if this is followed by a if, and make sure to only keep a single
-					// space between the two.
-					int j = i + 1;
-					while (j < length) {
-						if (s.isSpace(j))
-							++j;
-						else if (
-							j + 2 < length && s[j-1] == '\n' && s[j] == '!' && s[j+1] == '!' &&
-							s[j+2] >= 48 && s[j+2] <= 57
-						) {
-							// This is a line number inserted above. Skip it.
-							j = j + 3;
-							while (j < length && s[j] >= 48 && s[j] <= 57)
-								++j;							
-							if (j == length || s[j] != '\n')
-								break;
-							++j;
-						} else if (
-							j + 2 < length && s[j] == 'i' && s[j+1] == 'f' &&
-							(s.isSpace(j+2) || s[j+2] == '(')
-						) {
-							script += " if";
-							i = j + 2;
-							break;
-						} else
-							break;
-					}
-				}
-			}
-		}
-	} else
-		script = script_block;
-
-	// Simplify new lines and spaces
-	script.simplify('\n');
-	script.replaceChar('\t', ' ');
-	script.simplify(' ');
-
-	// Parsing state
-	// 0: normal
-	// 1: leaving 'if' block (=>check if we have a 'else' or 'else if' block starting)
-	// 2: leaving 'else if' block (=>check if we have a 'else' or 'else if' block starting)
-	// 3: leaving 'else' block
-	int state = 0;
-
-	String if_condition, else_if_condition, if_block, else_block, expression;
-	bool conditional_else_block = false;
-
-	// Use a StrReadStream to read the script line by line
-	int line_number = 1;
-	StrReadStream stream(script);
-	while (!stream.atEnd()) {
-		String line = stream.readLine().trimmed();
-
-		// Check there is something on the line
-		if (line.isEmpty())
-			continue;
+/*! \fn ScriptParserExpression::ScriptParserExpression()
+ *
+ * Cnstructor for the ScriptParserExpression class.
+ */
+ScriptParserExpression::ScriptParserExpression() :
+	line_(0), column_(0), hits_(0), time_ns_(0)
+{
+}
 
-		if (line.startsWith("!!")) {
-			line_number = line.right(2).toInt();
-			continue;
-		}
+ScriptParserExpression::~ScriptParserExpression() {
+}
 
-		// Check if we are leaving a block
-		if (line == "}") {
-			errors << String::format("Script parsing error line %d: unexpected '}'.",line_number);
-			return;
-		}
+bool ScriptParserExpression::profiling_ = false;
 
-		// If we have left a 'if', 'else if' block check if we have something more
-		// and complete the conditional expression if needed.
-		if (state == 1 || state == 2) {
-			if (line.startsWith("else if") && (line.length() == 7 || line.isSpace(7) || line[7] == '(')) {
-				// Look for start of condition
-				line = line.right(7).trimmed();
-				while (line.isEmpty() && !stream.atEnd()) {
-					line = stream.readLine().trimmed();
-					if (line.startsWith("!!")) {
-						line_number = line.right(2).toInt();
-						line.clear();
-					}
-				}
-				if (line[0] != '(') {
-					errors << String::format("Script parsing error line %d: '(' expected after 'else if'.", line_number);
-					return;
-				}
-				// Read condition
-				line = line.right(1);
-				if (!readCondition(else_if_condition, stream, line, line_number, errors))
-					return;
-				// Add condition
-				if (else_block.isEmpty())
-					else_block += String::format("!!%d\nif (", line_number) + else_if_condition + ")\n{\n";
-				else {
-					else_block += "else if (" + else_if_condition + ")\n{\n";
-				}
-				else_if_condition.clear();
-				// Read block
-				if (!readBlock(else_block, stream, line, line_number, errors))
-					return;
-				// Add a '}' to match the added 'if (...) {' at the beginning of the else block
-				else_block += "\n}\n";
-				state = 2;
-				continue;
-			} else if (line.startsWith("else") && (line.length() == 4 || line.isSpace(4))) {
-				line = line.right(4).trimmed();
-				// Read block
-				if (conditional_else_block)
-					else_block += " else\n{\n";
-				if (!readBlock(else_block, stream, line, line_number, errors))
-					return;
-				if (conditional_else_block)
-					else_block += "\n}\n";
-				state = 3;
-				continue;
-			} else
-				state = 3;
+/*! \fn ScriptParserExpression *ScriptParserExpression::load(CacheReader &reader, EquationParser &equation_parser, const List<int> &variable_map)
+ *
+ * Create an expression from its compiled form written by save(). Return NULL
+ * if the data is not valid. The equations are loaded with the variables given
+ * to \p equation_parser (see EquationParser::loadTree()).
+ */
+ScriptParserExpression *ScriptParserExpression::load(
+	CacheReader &reader,
+	EquationParser &equation_parser,
+	const List<int> &variable_map
+) {
+	int kind = reader.readInt();
+	int line = reader.readInt();
+	int column = reader.readInt();
+	if (!reader.isValid())
+		return NULL;
+	// Create empty expressions and then load their content
+	ScriptParserExpression *exp = NULL;
+	if (kind == EQUATION)
+		exp = new ScriptParserEquationExpression(NULL);
+	else if (kind == CONDITIONAL)
+		exp = new ScriptParserConditionalExpression(NULL, List<ScriptParserExpression*>(), List<ScriptParserExpression*>());
+	else if (kind == WHILE)
+		exp = new ScriptParserWhileExpression(NULL, List<ScriptParserExpression*>());
+	else if (kind == BEGIN_SECTION || kind == END_SECTION)
+		exp = new ScriptParserSectionExpression(kind == BEGIN_SECTION, List<ScriptParserExpression*>());
+	else if (kind == GROUP)
+		exp = new ScriptParserGroupExpression(NULL, String(), List<ScriptParserExpression*>());
+	else
+		return NULL;
+	exp->setLine(line);
+	exp->setColumn(column);
+	if (!exp->loadContent(reader, equation_parser, variable_map)) {
+		delete exp;
+		return NULL;
+	}
+	return exp;
+}
 
-		}
-		// If we are at the end of a conditional expression, create it and
-		// start normal reading
-		if (state == 3) {
-			ScriptParserExpression *exp = 0;
-			if (else_block.isEmpty())
-				exp = new ScriptParserConditionalExpression(if_condition, if_block, variable_names, auto_add_variables, variable_array);
-			else
-				exp = new ScriptParserConditionalExpression(if_condition, if_block, else_block, variable_names, auto_add_variables, variable_array);
-			expressions.append(exp);
-			for (int e = 0 ; e < exp->nbErrors() ; ++e)
-				errors.append(exp->getError(e));
-			if_condition.clear();
-			if_block.clear();
-			else_block.clear();
-			conditional_else_block = false;
-			state = 0;
-		}
+/*! \fn bool ScriptParserExpression::saveList(const List<ScriptParserExpression*> &expressions, CacheWriter &writer, const EquationParser &equation_parser)
+ *
+ * Write the compiled form of a block of expressions to \p writer.
+ */
+bool ScriptParserExpression::saveList(
+	const List<ScriptParserExpression*> &expressions,
+	CacheWriter &writer,
+	const EquationParser &equation_parser
+) {
+	writer.writeInt(expressions.size());
+	for (int i = 0 ; i < expressions.size() ; ++i) {
+		if (!expressions[i]->save(writer, equation_parser))
+			return false;
+	}
+	return true;
+}
 
-		// Normal reading
-		if (state == 0) {
-			// Checking if we start a if statement
-			if (line.startsWith("if") && (line.length() == 2 || line.isSpace(2) || line[2] == '(')) {
-				if (!expression.isEmpty()) {
-					errors << String::format("Script parsing error line %d: missing ';' before 'if'.", line_number);
-					return;
-				}
-				line = line.right(2).trimmed();
-				while (line.isEmpty() && !stream.atEnd()) {
-					line = stream.readLine().trimmed();
-					if (line.startsWith("!!")) {
-						line_number = line.right(2).toInt();
-						line.clear();
-					}
-				}
-				if (line[0] != '(') {
-					errors << String::format("Script parsing error line %d: '(' expected after 'if'.", line_number);
-					return;
-				}
-				line = line.right(1);
-				if (!readCondition(if_condition, stream, line, line_number, errors))
-					return;
-				// Read block
-				if (!readBlock(if_block, stream, line, line_number, errors))
-					return;
-				state = 1;
-				continue;
-			}
-			// Checking if we start a while statement
-			else if (line.startsWith("while") && (line.length() == 5 || line.isSpace(5) || line[5] == '(')) {
-				if (!expression.isEmpty()) {
-					errors << String::format("Script parsing error line %d: missing ';' before 'while'.", line_number);
-					return;
-				}
-				line = line.right(5).trimmed();
-				while (line.isEmpty() && !stream.atEnd()) {
-					line = stream.readLine().trimmed();
-					if (line.startsWith("!!")) {
-						line_number = line.right(2).toInt();
-						line.clear();
-					}
-				}
-				if (line[0] != '(') {
-					errors << String::format("Script parsing error line %d: '(' expected after 'while'.", line_number);
-					return;
-				}
-				// Read condition
-				line = line.right(1);
-				String while_condition;
-				if (!readCondition(while_condition, stream, line, line_number, errors))
-					return;
-				// Read block
-				String while_block;
-				if (!readBlock(while_block, stream, line, line_number, errors))
-					return;
-				// Create while parser object
-				ScriptParserExpression *exp = new ScriptParserWhileExpression(while_condition, while_block, variable_names, auto_add_variables, variable_array);
-				expressions.append(exp);
-				for (int e = 0 ; e < exp->nbErrors() ; ++e)
-					errors.append(exp->getError(e));
-				state = 0;
-				continue;
-			}
-			// Check we do not have a else
-			else if (line.startsWith("else") && (line.length() == 4 || line[4] == ' ')) {
-				errors << String::format("Script parsing error line %d: unexpected 'else' (not preceded by 'if' or 'else if' statement).", line_number);
-				return;
-			}
-			// Otherwise read until we reach a ';' (which should be at the end of a line)
-			else if (!line.isEmpty() && line[line.length() - 1] == ';') {
-				expression += line.left(-2);
-				if (!expression.isEmpty()) {
-					ScriptParserExpression *exp = new ScriptParserEquationExpression(expression, variable_names, auto_add_variables, variable_array);
-					expressions.append(exp);
-					if (exp->nbErrors() > 0) {
-						errors << String::format("Script parsing error line %d:invalid expression '%s'.", line_number, expression.c_str());
-						for (int e = 0 ; e < exp->nbErrors() ; ++e)
-							errors.append(exp->getError(e));
-					}
-					expression.clear();
-				}
-			} else {
-				expression += line;
+/*! \fn bool ScriptParserExpression::loadList(CacheReader &reader, List<ScriptParserExpression*> &expressions, EquationParser &equation_parser, const List<int> &variable_map)
+ *
+ * Append to \p expressions the block of expressions written by saveList().
+ */
+bool ScriptParserExpression::loadList(
+	CacheReader &reader,
+	List<ScriptParserExpression*> &expressions,
+	EquationParser &equation_parser,
+	const List<int> &variable_map
+) {
+	int nb_expressions = reader.readInt();
+	if (!reader.isValid())
+		return false;
+	for (int i = 0 ; i < nb_expressions ; ++i) {
+		ScriptParserExpression *exp = load(reader, equation_parser, variable_map);
+		if (exp == NULL)
+			return false;
+		expressions << exp;
+	}
+	return true;
+}
+
+bool ScriptParserExpression::saveEquation(
+	const ParserOperator *equation,
+	CacheWriter &writer,
+	const EquationParser &equation_parser
+) {
+	writer.writeInt(equation != NULL);
+	return equation == NULL || equation_parser.saveTree(equation, writer);
+}
+
+bool ScriptParserExpression::loadEquation(
+	ParserOperator *&equation,
+	CacheReader &reader,
+	EquationParser &equation_parser,
+	const List<int> &variable_map
+) {
+	if (!reader.readInt())
+		return reader.isValid();
+	equation = equation_parser.loadTree(reader, variable_map);
+	return equation != NULL;
+}
+
+// Evaluate a condition. A missing condition is false.
+bool ScriptParserExpression::isTrue(const ParserOperator *condition) {
+	return condition != NULL && condition->evaluateBool();
+}
+
+/*! \fn void ScriptParserExpression::setLine(int line)
+ *
+ * Set the line of the script source on which this expression starts.
+ */
+void ScriptParserExpression::setLine(int line) {
+	line_ = line;
+}
+
+/*! \fn int ScriptParserExpression::line() const
+ *
+ * Return the line of the script source on which this expression starts.
+ */
+int ScriptParserExpression::line() const {
+	return line_;
+}
+
+/*! \fn void ScriptParserExpression::setColumn(int column)
+ *
+ * Set the column of the script source at which this expression starts.
+ */
+void ScriptParserExpression::setColumn(int column) {
+	column_ = column;
+}
+
+/*! \fn int ScriptParserExpression::column() const
+ *
+ * Return the column of the script source at which this expression starts.
+ */
+int ScriptParserExpression::column() const {
+	return column_;
+}
+
+/*! \fn void ScriptParserExpression::profiledEvaluate()
+ *
+ * Evaluate the expression and update its hit count and time.
+ */
+void ScriptParserExpression::profiledEvaluate() {
+	++hits_;
+	long long start = Timer::wallNs();
+	evaluate();
+	time_ns_ += Timer::wallNs() - start;
+}
+
+ScriptProfileEntry ScriptParserExpression::profileEntry(const char *kind, int depth) const {
+	ScriptProfileEntry entry;
+	entry.line_ = line_;
+	entry.depth_ = depth;
+	entry.kind_ = kind;
+	entry.hits_ = hits_;
+	entry.time_ns_ = time_ns_;
+	entry.taken_ = 0;
+	entry.iterations_ = 0;
+	return entry;
+}
+
+/*! \fn void ScriptParserExpression::resetProfile()
+ *
+ * Reset the profiling counters of this expression and of the expressions
+ * in its blocks.
+ */
+void ScriptParserExpression::resetProfile() {
+	hits_ = 0;
+	time_ns_ = 0;
+}
+
+/*! \fn void ScriptParserExpression::getProfile(List<ScriptProfileEntry> &entries, int depth) const
+ *
+ * Append the profiling counters of this expression, followed by those of
+ * the expressions in its blocks, to \p entries.
+ */
+void ScriptParserExpression::getProfile(List<ScriptProfileEntry> &entries, int depth) const {
+	entries << profileEntry("statement", depth);
+}
+
+/*! \fn void ScriptParserExpression::getEquations(List<ParserOperator**> &equations)
+ *
+ * Append to \p equations the address of each compiled equation of the
+ * expression, including the conditions and the equations of its blocks.
+ */
+
+/*! \fn void ScriptParserExpression::optimize()
+ *
+ * Optimize the expression and the expressions of its blocks. The default
+ * implementation does nothing.
+ */
+void ScriptParserExpression::optimize() {
+}
+
+// Append the variables used in the given equation to the list.
+static void getVariables(const ParserOperator *op, List<const double*> &variables) {
+	if (op == NULL)
+		return;
+	const VariableOperator *variable = dynamic_cast<const VariableOperator*>(op);
+	if (variable != NULL) {
+		variables << variable->valuePointer();
+		return;
+	}
+	for (int i = 0 ; i < op->nbChildren() ; ++i)
+		getVariables(op->child(i), variables);
+}
+
+// Append the variables that may be modified by the given equation to the list.
+static void getAssignedVariables(const ParserOperator *op, List<const double*> &variables) {
+	if (op == NULL)
+		return;
+	if (op->isAssignment())
+		getVariables(op->child(0), variables);
+	for (int i = 0 ; i < op->nbChildren() ; ++i)
+		getAssignedVariables(op->child(i), variables);
+}
+
+// Return true if the value of the equation does not change as long as
+// the given variables are not modified.
+static bool isInvariant(const ParserOperator *op, const List<const double*> &assigned_variables) {
+	if (op == NULL || dynamic_cast<const LoopInvariantOperator*>(op) != NULL)
+		return true;
+	// The parameters of an inlined function are set by each call
+	if (op->hasSideEffects() || dynamic_cast<const ParameterOperator*>(op) != NULL)
+		return false;
+	const VariableOperator *variable = dynamic_cast<const VariableOperator*>(op);
+	if (variable != NULL)
+		return !assigned_variables.contains(variable->valuePointer());
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		if (!isInvariant(op->child(i), assigned_variables))
+			return false;
+	}
+	return true;
+}
+
+// Return true if the equation or one of its operands has side effects.
+static bool hasSideEffects(const ParserOperator *op) {
+	if (op == NULL)
+		return false;
+	if (op->hasSideEffects())
+		return true;
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		if (hasSideEffects(op->child(i)))
+			return true;
+	}
+	return false;
+}
+
+// Operands up to this cost (see ParserOperator::cost()) are cheap enough to
+// always be evaluated: a mispredicted branch costs more than computing them.
+static const int BRANCH_FREE_MAX_COST = 8;
+
+// Return true if the operand can be evaluated even when a short circuit
+// would skip it.
+static bool isBranchFreeOperand(const ParserOperator *op) {
+	return op != NULL && op->cost() <= BRANCH_FREE_MAX_COST && !hasSideEffects(op);
+}
+
+/*! \fn void ScriptParser::selectBranchFree(ParserOperator *op)
+ *
+ * Replace the AndOperator and OrOperator below the given operator whose right
+ * operand is cheap and has no side effects by a BranchFreeAndOperator or
+ * BranchFreeOrOperator, and the IfOperator whose both branches are cheap and
+ * have no side effects by a BranchFreeIfOperator. Those evaluate all their
+ * operands, which gives the same result as the short circuit, but do not
+ * branch on the value of the condition. The operands are converted first.
+ *
+ * The instrumented operators are never converted.
+ */
+void ScriptParser::selectBranchFree(ParserOperator *op) {
+	if (op == NULL)
+		return;
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		ParserOperator **slot = op->childSlot(i);
+		ParserOperator *child = *slot;
+		if (child == NULL)
+			continue;
+		selectBranchFree(child);
+		ParserOperator *replacement = NULL;
+		if (typeid(*child) == typeid(AndOperator) || typeid(*child) == typeid(OrOperator)) {
+			if (isBranchFreeOperand(child->child(1))) {
+				ParserOperator *left = child->child(0), *right = child->child(1);
+				if (typeid(*child) == typeid(AndOperator))
+					replacement = new BranchFreeAndOperator(left, right);
+				else
+					replacement = new BranchFreeOrOperator(left, right);
 			}
+		} else if (typeid(*child) == typeid(IfOperator)) {
+			if (isBranchFreeOperand(child->child(1)) && isBranchFreeOperand(child->child(2)))
+				replacement = new BranchFreeIfOperator(child->child(0), child->child(1), child->child(2));
+		}
+		if (replacement != NULL) {
+			// The operands now belong to the replacement
+			for (int c = 0 ; c < child->nbChildren() ; ++c)
+				*child->childSlot(c) = NULL;
+			delete child;
+			*slot = replacement;
 		}
+	}
+}
 
+/*! \fn StringList ScriptParser::assignedVariables() const
+ *
+ * Return the variables that may be modified when a row is evaluated (the
+ * 'begin' and 'end' sections are not included).
+ */
+StringList ScriptParser::assignedVariables() const {
+	StringList names;
+	if (variables_ == NULL)
+		return names;
+	List<ParserOperator**> equations;
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getEquations(equations);
+	List<const double*> assigned_variables;
+	for (int i = 0 ; i < equations.size() ; ++i)
+		getAssignedVariables(*equations[i], assigned_variables);
+	const double *values = variables_->values();
+	for (int i = 0 ; i < assigned_variables.size() ; ++i) {
+		const String &name = variables_->names()[assigned_variables[i] - values];
+		if (!names.contains(name))
+			names << name;
 	}
+	return names;
+}
 
-	if (state == 1 || state == 2 || state == 3) {
-		ScriptParserExpression *exp = 0;
-		if (else_block.isEmpty())
-			exp = new ScriptParserConditionalExpression(if_condition, if_block, variable_names, auto_add_variables, variable_array);
+// Replace the operand in the given slot by a constant with its current value.
+static void replaceByConstant(ParserOperator **slot) {
+	if (dynamic_cast<ConstantOperator*>(*slot) != NULL)
+		return;
+	ParserOperator *constant = new ConstantOperator((*slot)->evaluate());
+	delete *slot;
+	*slot = constant;
+}
+
+// Replace the largest subexpressions below the given operator that only use
+// constant variables (flagged in is_constant) by their value. Return true if
+// the operator itself only uses constant variables, in which case it is left
+// to the caller to replace it.
+static bool foldConstantOperands(ParserOperator *op, const double *values, const bool *is_constant) {
+	const VariableOperator *variable = dynamic_cast<const VariableOperator*>(op);
+	if (variable != NULL)
+		return is_constant[variable->valuePointer() - values];
+	// A loop invariant is updated by its loop, and the parameter of an inlined
+	// function by its call, so their value is not known yet
+	bool constant =
+		!op->hasSideEffects() &&
+		dynamic_cast<LoopInvariantOperator*>(op) == NULL &&
+		dynamic_cast<ParameterOperator*>(op) == NULL;
+	List<int> constant_children;
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		ParserOperator *child = op->child(i);
+		if (child == NULL)
+			continue;
+		if (foldConstantOperands(child, values, is_constant))
+			constant_children << i;
 		else
-			exp = new ScriptParserConditionalExpression(if_condition, if_block, else_block, variable_names, auto_add_variables, variable_array);
-		expressions.append(exp);
-		for (int e = 0 ; e < exp->nbErrors() ; ++e)
-			errors.append(exp->getError(e));
+			constant = false;
 	}
+	if (!constant) {
+		for (int i = 0 ; i < constant_children.size() ; ++i)
+			replaceByConstant(op->childSlot(constant_children[i]));
+	}
+	return constant;
+}
+
+/*! \fn void ScriptParser::foldConstants(const StringList &modified_variables)
+ *
+ * Replace the subexpressions of the statements evaluated for each row that
+ * only depend on variables that do not change from one row to the next by
+ * their current value. A variable is considered constant if it is neither in
+ * \p modified_variables (for example the columns of the data file and the
+ * variables assigned by the other scripts of the run) nor assigned by the
+ * script itself. This is meant to be called after evaluateBegin(), so that
+ * the values computed by the 'begin' section become constants of the rows.
+ *
+ * The script has to be parsed again before it can be used with other values.
+ */
+void ScriptParser::foldConstants(const StringList &modified_variables) {
+	if (variables_ == NULL || variables_->size() == 0)
+		return;
+	List<bool> is_constant;
+	for (int i = 0 ; i < variables_->size() ; ++i)
+		is_constant << true;
+	StringList assigned_variables = assignedVariables();
+	for (int i = 0 ; i < modified_variables.size() ; ++i) {
+		int index = variables_->indexOf(modified_variables[i]);
+		if (index != -1)
+			is_constant[index] = false;
+	}
+	for (int i = 0 ; i < assigned_variables.size() ; ++i)
+		is_constant[variables_->indexOf(assigned_variables[i])] = false;
+
+	List<ParserOperator**> equations;
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getEquations(equations);
+	// The root of each equation is kept: it is the assignment or the
+	// 'if' created for the condition.
+	for (int i = 0 ; i < equations.size() ; ++i) {
+		ParserOperator *root = *equations[i];
+		if (root != NULL && foldConstantOperands(root, variables_->values(), is_constant.begin())) {
+			for (int c = 0 ; c < root->nbChildren() ; ++c) {
+				if (root->child(c) != NULL)
+					replaceByConstant(root->childSlot(c));
+			}
+		}
+	}
+}
+
+// Return the 'if' statement that makes up the whole row part of the script,
+// if there is one without 'else' and its condition has no side effects.
+static ScriptParserConditionalExpression *rowGuard(const List<ScriptParserExpression*> &expressions) {
+	if (expressions.size() != 1)
+		return NULL;
+	ScriptParserConditionalExpression *conditional = dynamic_cast<ScriptParserConditionalExpression*>(expressions.first());
+	if (conditional == NULL || conditional->hasElse() || conditional->condition() == NULL || hasSideEffects(conditional->condition()))
+		return NULL;
+	return conditional;
+}
+
+/*! \fn bool ScriptParser::hasRowGuard() const
+ *
+ * Return true if the statements evaluated for each row are all inside a
+ * single 'if' without 'else' whose condition has no side effects. A row for
+ * which that condition is false does not change anything, so it can be
+ * skipped without being evaluated (see evaluateRowGuard() and nextRow()).
+ */
+bool ScriptParser::hasRowGuard() const {
+	return row_guard_ != NULL;
+}
 
-	else if (state != 0 || !expression.isEmpty()) {
-		if (is_original_script)
-			errors << String("Script parsing error: unexpected end of script.");
-		else
-			// this function was called with a if or else block
-			errors << String::format("Script parsing error line %d: missing ';' before '}'.", line_number);
+/*! \fn StringList ScriptParser::rowGuardVariables() const
+ *
+ * Return the variables used by the condition of the row guard (see
+ * hasRowGuard()).
+ */
+StringList ScriptParser::rowGuardVariables() const {
+	StringList names;
+	if (row_guard_ == NULL || variables_ == NULL)
+		return names;
+	List<const double*> variables;
+	getVariables(row_guard_, variables);
+	for (int i = 0 ; i < variables.size() ; ++i) {
+		const String &name = variables_->names()[variables[i] - variables_->values()];
+		if (!names.contains(name))
+			names << name;
 	}
+	return names;
 }
 
-/*! \fn bool ScriptParser::readCondition(String &condition, StrReadStream &script, String &line, int &line_number, StringList &errors)
+/*! \fn bool ScriptParser::evaluateRowGuard() const
  *
- * Internal function used to read a condition from the stream.
+ * Evaluate the condition of the row guard (see hasRowGuard()) on the current
+ * values of the variables. Return true if there is no row guard.
  */
-bool ScriptParser::readCondition(
-	String &condition, StrReadStream &stream,
-	String &line, int &line_number,
-	StringList &errors
-) {
-	int condition_level = 1;
-	do {
-		while (!line.isEmpty() && condition_level > 0) {
-			int close_parenthesis_index = line.findChar(')');
-			if (close_parenthesis_index == -1) {
-				condition += line;
-				condition_level += line.countChar('(');
-				line.clear();
-			} else {
-				String left = line.left(close_parenthesis_index);
-				condition += left;
-				condition_level += left.countChar('(') - 1;
-				line = line.right(close_parenthesis_index + 1).trimmed();
-			}
-		}
-		if (condition_level == 0)
-			break;
-
-		// read next line
-		line = stream.readLine().trimmed();
-
-		// Check there is something on the line
-		if (line.startsWith("!!")) {
-			line_number = line.right(2).toInt();
-			line.clear();
-		}
-	} while (!stream.atEnd());
+bool ScriptParser::evaluateRowGuard() const {
+	return row_guard_ == NULL || row_guard_->evaluateBool();
+}
 
-	if (condition_level != 0) {
-		errors << String("Script parsing error: unexpected end of script (unbalanced parenthesis).");
-		return false;
+// Get in \p min and \p max the range of the values the given operator can
+// take when each variable is in the range given by \p min_values and
+// \p max_values. Return false if the range is not known.
+static bool valueRange(
+	const ParserOperator *op, const double *variables,
+	const double *min_values, const double *max_values,
+	double &min, double &max
+) {
+#ifdef PARSER_INSTRUMENTATION
+	const InstrumentedOperator *instrumented = dynamic_cast<const InstrumentedOperator*>(op);
+	if (instrumented != NULL)
+		op = instrumented->wrappedOperator();
+#endif
+	const ConstantOperator *constant = dynamic_cast<const ConstantOperator*>(op);
+	if (constant != NULL) {
+		min = max = constant->value();
+		return true;
 	}
-
-	// remove last parenthesis
-	condition = condition.left(-2).trimmed();
-	// check the condition is not empty
-	if (condition.isEmpty()) {
-		errors << String::format("Script parsing error line %d: empty conditional expression.", line_number);
+	const VariableOperator *variable = dynamic_cast<const VariableOperator*>(op);
+	if (variable == NULL)
 		return false;
-	}
+	int index = variable->valuePointer() - variables;
+	min = min_values[index];
+	max = max_values[index];
+	// Also false if the bounds are NaN
+	return min <= max;
+}
 
+// Return false if the given condition is false whenever each variable is in
+// the range given by \p min_values and \p max_values. Only the comparisons
+// of variables and constants combined with '&&', '||' and if() are analyzed:
+// any other condition may be true. The last argument of if() is assumed to
+// be used whatever its condition.
+static bool mayBeTrue(
+	const ParserOperator *op, const double *variables,
+	const double *min_values, const double *max_values
+) {
+#ifdef PARSER_INSTRUMENTATION
+	const InstrumentedOperator *instrumented = dynamic_cast<const InstrumentedOperator*>(op);
+	if (instrumented != NULL)
+		op = instrumented->wrappedOperator();
+#endif
+	// Also matches the branch-free variants
+	if (dynamic_cast<const AndOperator*>(op) != NULL)
+		return
+			mayBeTrue(op->child(0), variables, min_values, max_values) &&
+			mayBeTrue(op->child(1), variables, min_values, max_values);
+	if (dynamic_cast<const OrOperator*>(op) != NULL)
+		return
+			mayBeTrue(op->child(0), variables, min_values, max_values) ||
+			mayBeTrue(op->child(1), variables, min_values, max_values);
+	// The conditions are compiled as 'if(condition, 1., 0.)'
+	if (dynamic_cast<const IfOperator*>(op) != NULL)
+		return
+			(
+				mayBeTrue(op->child(0), variables, min_values, max_values) &&
+				mayBeTrue(op->child(1), variables, min_values, max_values)
+			) ||
+			mayBeTrue(op->child(2), variables, min_values, max_values);
+	const ConstantOperator *constant = dynamic_cast<const ConstantOperator*>(op);
+	if (constant != NULL)
+		return constant->value() != 0.;
+	double lmin, lmax, rmin, rmax;
+	if (
+		op->nbChildren() != 2 ||
+		!valueRange(op->child(0), variables, min_values, max_values, lmin, lmax) ||
+		!valueRange(op->child(1), variables, min_values, max_values, rmin, rmax)
+	)
+		return true;
+	// The comparisons with NaN are false, as when they are evaluated
+	if (dynamic_cast<const SmallerOperator*>(op) != NULL)
+		return lmin < rmax;
+	if (dynamic_cast<const GreaterOperator*>(op) != NULL)
+		return lmax > rmin;
+	if (dynamic_cast<const EqualOrSmallerOperator*>(op) != NULL)
+		return lmin <= rmax;
+	if (dynamic_cast<const EqualOrGreaterOperator*>(op) != NULL)
+		return lmax >= rmin;
+	if (dynamic_cast<const EqualOperator*>(op) != NULL)
+		return lmin <= rmax && rmin <= lmax;
+	if (dynamic_cast<const NotEqualOperator*>(op) != NULL)
+		return !(lmin == lmax && rmin == rmax && lmin == rmin);
+	// The ULP error grows with the distance, so the bounds are enough
+	if (dynamic_cast<const TolerantEqualOrSmallerOperator*>(op) != NULL)
+		return MathUtils::isInfOrEqual(lmin, rmax);
+	if (dynamic_cast<const TolerantEqualOrGreaterOperator*>(op) != NULL)
+		return MathUtils::isSupOrEqual(lmax, rmin);
+	if (dynamic_cast<const TolerantEqualOperator*>(op) != NULL)
+		return MathUtils::isInfOrEqual(lmin, rmax) && MathUtils::isInfOrEqual(rmin, lmax);
 	return true;
 }
 
-/*! \fn bool ScriptParser::readBlock(String &block, StrReadStream &stream, String &line, int &line_number, StringList &errors)
+/*! \fn bool ScriptParser::rowGuardMayAccept(const double *min_values, const double *max_values) const
  *
- * Internal function used to read a block of expressions from the stream.
+ * Return false if the condition of the row guard (see hasRowGuard()) is
+ * false for every row whose variables are in the range given by
+ * \p min_values and \p max_values, which have one value per variable of the
+ * storage. The range of a variable that is not known is given by NaN bounds.
+ * Only the comparisons of variables with constants combined with '&&' and '||'
+ * are analyzed. Return true if there is no row guard.
  */
-bool ScriptParser::readBlock(
-	String &block, StrReadStream &stream,
-	String &line, int &line_number,
-	StringList &errors
- ) {
-	// Look for start of block
-	while (line.isEmpty() && !stream.atEnd()) {
-		line = stream.readLine().trimmed();
-		if (line.startsWith("!!")) {
-			line_number = line.right(2  ).toInt();
-			line.clear();
-		}
-	}
-
-	if (line != "{") {
-		// single line statement (except it may have more than one level)
-		block += line + "\n";
-		if (line.endsWith(";"))
-			return true;
-
-		while (!stream.atEnd()) {
-			line = stream.readLine().trimmed();
-
-			// Check there is something on the line
-			if (line.isEmpty())
-				continue;
-
-			block += line + "\n";
-
-			if (line.startsWith("!!"))
-				line_number = line.right(2).toInt();
-
-			if (line == "{") {
-				// Forbid this. This can get confusing if we allow nested blocks in a single-line block.
-				// The script may not behave as the user expect.
-				errors << String::format("Script parsing error line %d: nested blocks inside a single line conditional is forbidden.", line_number);
-				return false;
-			}
+bool ScriptParser::rowGuardMayAccept(const double *min_values, const double *max_values) const {
+	if (row_guard_ == NULL || variables_ == NULL)
+		return true;
+	return mayBeTrue(row_guard_, variables_->values(), min_values, max_values);
+}
 
-			if (line.endsWith(";"))
-				return true;
+// Get in \p mask the value (0 or 1) of the given condition for \p n rows
+// whose variables are given by \p columns, which have one array of \p n
+// values per variable or NULL for the variables that are not known. Only the
+// comparisons of these variables with constants combined with '&&', '||' and
+// if() are computed. Return false for any other condition.
+static bool conditionMask(
+	const ParserOperator *op, const double *variables,
+	const double *const *columns, int n, unsigned char *mask
+) {
+#ifdef PARSER_INSTRUMENTATION
+	const InstrumentedOperator *instrumented = dynamic_cast<const InstrumentedOperator*>(op);
+	if (instrumented != NULL)
+		op = instrumented->wrappedOperator();
+#endif
+	const ConstantOperator *constant = dynamic_cast<const ConstantOperator*>(op);
+	if (constant != NULL) {
+		memset(mask, constant->value() != 0. ? 1 : 0, n);
+		return true;
+	}
+	// Also matches the branch-free variants
+	bool is_and = dynamic_cast<const AndOperator*>(op) != NULL;
+	bool is_or = dynamic_cast<const OrOperator*>(op) != NULL;
+	bool is_if = dynamic_cast<const IfOperator*>(op) != NULL;
+	if (is_and || is_or || is_if) {
+		if (!conditionMask(op->child(0), variables, columns, n, mask))
+			return false;
+		unsigned char *other = new unsigned char[2 * n];
+		bool ok = conditionMask(op->child(1), variables, columns, n, other);
+		if (is_if) {
+			// The conditions are compiled as 'if(condition, 1., 0.)'
+			ok = ok && conditionMask(op->child(2), variables, columns, n, other + n);
+			for (int i = 0 ; ok && i < n ; ++i)
+				mask[i] = mask[i] ? other[i] : other[n + i];
+		} else {
+			for (int i = 0 ; ok && i < n ; ++i)
+				mask[i] = is_or ? mask[i] | other[i] : mask[i] & other[i];
 		}
-		errors << String::format("Script parsing error line %d: unexpected end of script (unbalanced '{' and '}' or missing ';')", line_number);
+		delete [] other;
+		return ok;
+	}
+	EvalKernels::CompareOp compare;
+	if (dynamic_cast<const SmallerOperator*>(op) != NULL)
+		compare = EvalKernels::COMPARE_SMALLER;
+	else if (dynamic_cast<const GreaterOperator*>(op) != NULL)
+		compare = EvalKernels::COMPARE_GREATER;
+	else if (dynamic_cast<const EqualOrSmallerOperator*>(op) != NULL)
+		compare = EvalKernels::COMPARE_SMALLER_OR_EQUAL;
+	else if (dynamic_cast<const EqualOrGreaterOperator*>(op) != NULL)
+		compare = EvalKernels::COMPARE_GREATER_OR_EQUAL;
+	else
 		return false;
+	const VariableOperator *variable = dynamic_cast<const VariableOperator*>(op->child(0));
+	constant = dynamic_cast<const ConstantOperator*>(op->child(1));
+	if (variable == NULL || constant == NULL) {
+		// Turn 'constant < variable' into 'variable > constant'
+		variable = dynamic_cast<const VariableOperator*>(op->child(1));
+		constant = dynamic_cast<const ConstantOperator*>(op->child(0));
+		if (variable == NULL || constant == NULL)
+			return false;
+		static const EvalKernels::CompareOp swapped[] = {
+			EvalKernels::COMPARE_GREATER, EvalKernels::COMPARE_GREATER_OR_EQUAL,
+			EvalKernels::COMPARE_SMALLER, EvalKernels::COMPARE_SMALLER_OR_EQUAL
+		};
+		compare = swapped[compare];
 	}
+	const double *values = columns[variable->valuePointer() - variables];
+	if (values == NULL)
+		return false;
+	EvalKernels::compare(values, n, compare, constant->value(), mask);
+	return true;
+}
 
-	int block_level = 1;
-	while (!stream.atEnd()) {
-		line = stream.readLine().trimmed();
+/*! \fn bool ScriptParser::rowGuardMask(const double *const *columns, int n, unsigned char *mask) const
+ *
+ * Compute in \p mask the value (0 or 1) of the condition of the row guard
+ * (see hasRowGuard()) for \p n rows at once. \p columns has one pointer per
+ * variable of the storage to the \p n values of that variable, or NULL if
+ * they are not known. As for rowGuardMayAccept(), only the comparisons of
+ * variables with constants combined with '&&' and '||' can be computed this
+ * way: return false for any other condition or if there is no row guard.
+ */
+bool ScriptParser::rowGuardMask(const double *const *columns, int n, unsigned char *mask) const {
+	if (row_guard_ == NULL || variables_ == NULL)
+		return false;
+	return conditionMask(row_guard_, variables_->values(), columns, n, mask);
+}
 
-		// Check there is something on the line
-		if (line.isEmpty())
-			continue;
+/***********************************************************************************
+ * ScriptParserConditionalExpression
+ ***********************************************************************************/
 
-		if (line.startsWith("!!"))
-			line_number = line.right(2).toInt();
+/*! \fn ScriptParserConditionalExpression::ScriptParserConditionalExpression(ParserOperator *condition, const List<ScriptParserExpression*> &if_expressions, const List<ScriptParserExpression*> &else_expressions)
+ *
+ * Create a ScriptParserConditionalExpression from the given compiled
+ * condition and the expressions of the if and else blocks. The new
+ * object takes ownership of the condition and of the expressions.
+ */
+ScriptParserConditionalExpression::ScriptParserConditionalExpression(
+	ParserOperator *condition,
+	const List<ScriptParserExpression*> &if_expressions,
+	const List<ScriptParserExpression*> &else_expressions
+) :
+	ScriptParserExpression(), condition_(condition),
+	if_expressions_(if_expressions), else_expressions_(else_expressions),
+	taken_(0)
+{
+}
 
-		// Check if we are leaving a block
-		if (line == "}") {
-			--block_level;
-			if (block_level == 0)
-				return true;
-		} else if (line == "{")
-			++block_level;
+ScriptParserConditionalExpression::~ScriptParserConditionalExpression() {
+	delete condition_;
+	deleteExpressions(if_expressions_);
+	deleteExpressions(else_expressions_);
+}
 
-		block += line + "\n";
+/*! \fn void ScriptParserConditionalExpression::evaluate()
+ *
+ * Evaluate the condition and depending on the rsult evaluate the expressions
+ * in the if block or in the else block.
+ */
+void ScriptParserConditionalExpression::evaluate() {
+	if (condition_ == NULL)
+		return;
+	if (isTrue(condition_)) {
+		if (profiling_)
+			++taken_;
+		for (List<ScriptParserExpression*>::iterator it = if_expressions_.begin() ; it != if_expressions_.end() ; ++it)
+			(*it)->execute();
+	} else {
+		for (List<ScriptParserExpression*>::iterator it = else_expressions_.begin() ; it != else_expressions_.end() ; ++it)
+			(*it)->execute();
 	}
-
-	errors << String::format("Script parsing error: unexpected end of script (unbalanced '{' and '}').");
-	return false;
 }
 
-/*! \fn ScriptParserExpression::ScriptParserExpression()
+/*! \fn const ParserOperator *ScriptParserConditionalExpression::condition() const
  *
- * Cnstructor for the ScriptParserExpression class.
+ * Return the compiled condition, or NULL if it could not be compiled.
  */
-ScriptParserExpression::ScriptParserExpression() {
+const ParserOperator *ScriptParserConditionalExpression::condition() const {
+	return condition_;
 }
 
-ScriptParserExpression::~ScriptParserExpression() {
+bool ScriptParserConditionalExpression::hasElse() const {
+	return !else_expressions_.isEmpty();
 }
 
-/*! \fn int ScriptParserExpression::nbErrors() const
+/*! \fn void ScriptParserConditionalExpression::resetProfile()
  *
- * Return the number of errors of this ScriptParserExpression.
+ * Reset the profiling counters of the condition and of both blocks.
  */
-int ScriptParserExpression::nbErrors() const {
-	return 0;
+void ScriptParserConditionalExpression::resetProfile() {
+	ScriptParserExpression::resetProfile();
+	taken_ = 0;
+	for (List<ScriptParserExpression*>::iterator it = if_expressions_.begin() ; it != if_expressions_.end() ; ++it)
+		(*it)->resetProfile();
+	for (List<ScriptParserExpression*>::iterator it = else_expressions_.begin() ; it != else_expressions_.end() ; ++it)
+		(*it)->resetProfile();
 }
 
-/*! \fn String ScriptParserExpression::getError(int) const
+/*! \fn void ScriptParserConditionalExpression::getProfile(List<ScriptProfileEntry> &entries, int depth) const
  *
- * Return the error at the given index or an empty
- * String if the index is out of bound.s
+ * Append the profiling counters of the condition, followed by those of the
+ * expressions in the if block and in the else block, to \p entries.
  */
-String ScriptParserExpression::getError(int) const {
-	return String();
+void ScriptParserConditionalExpression::getProfile(List<ScriptProfileEntry> &entries, int depth) const {
+	ScriptProfileEntry entry = profileEntry("if", depth);
+	entry.taken_ = taken_;
+	entries << entry;
+	for (int i = 0 ; i < if_expressions_.size() ; ++i)
+		if_expressions_[i]->getProfile(entries, depth + 1);
+	for (int i = 0 ; i < else_expressions_.size() ; ++i)
+		else_expressions_[i]->getProfile(entries, depth + 1);
 }
 
-/***********************************************************************************
- * ScriptParserConditionalExpression
- ***********************************************************************************/
+void ScriptParserConditionalExpression::getEquations(List<ParserOperator**> &equations) {
+	equations << &condition_;
+	for (int i = 0 ; i < if_expressions_.size() ; ++i)
+		if_expressions_[i]->getEquations(equations);
+	for (int i = 0 ; i < else_expressions_.size() ; ++i)
+		else_expressions_[i]->getEquations(equations);
+}
+
+void ScriptParserConditionalExpression::optimize() {
+	for (int i = 0 ; i < if_expressions_.size() ; ++i)
+		if_expressions_[i]->optimize();
+	for (int i = 0 ; i < else_expressions_.size() ; ++i)
+		else_expressions_[i]->optimize();
+}
 
-/*! \fn ScriptParserConditionalExpression::ScriptParserConditionalExpression(const String &condition, const String &if_block, const String &else_block, const StringList &variable_names, bool auto_add_variables, double* variable_array = NULL)
+/*! \fn bool ScriptParserConditionalExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const
  *
- * Create a ScriptParserConditionalExpression from the given condition
- * expression and the expressions blocks in the if and else block.
+ * Write the compiled condition and blocks to \p writer.
  */
-ScriptParserConditionalExpression::ScriptParserConditionalExpression(
-	const String &condition,
-	const String &if_block,
-	const String &else_block,
-	const StringList &variable_names,
-	bool auto_add_variables,
-	double* variable_array
-) :
-	ScriptParserExpression(), condition_(NULL)
-{
-	if (!condition.isEmpty()) {
-		// Create condition
-		String equation = "if(" + condition + ", 1., 0.)";
-		condition_ = new EquationParser();
-		condition_->parse(equation, variable_names, auto_add_variables, variable_array);
-		for (int e = 0 ; e < condition_->nbErrors() ; ++e)
-			errors_.append(condition_->getError(e));
-		// Parse if block
-		ScriptParser::breakBlock(if_block, if_expressions_, variable_names, auto_add_variables, errors_, variable_array);
-		// Parse else block
-		ScriptParser::breakBlock(else_block, else_expressions_, variable_names, auto_add_variables, errors_, variable_array);
-	}
+bool ScriptParserConditionalExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const {
+	writer.writeInt(CONDITIONAL);
+	writer.writeInt(line_);
+	writer.writeInt(column_);
+	return
+		saveEquation(condition_, writer, equation_parser) &&
+		saveList(if_expressions_, writer, equation_parser) &&
+		saveList(else_expressions_, writer, equation_parser);
+}
+
+bool ScriptParserConditionalExpression::loadContent(
+	CacheReader &reader,
+	EquationParser &equation_parser,
+	const List<int> &variable_map
+) {
+	return
+		loadEquation(condition_, reader, equation_parser, variable_map) &&
+		loadList(reader, if_expressions_, equation_parser, variable_map) &&
+		loadList(reader, else_expressions_, equation_parser, variable_map);
 }
 
-/*! \fn ScriptParserConditionalExpression::ScriptParserConditionalExpression(const String &condition, const String &if_block, const StringList &variable_names, bool auto_add_variables, double* variable_array = NULL)
+/***********************************************************************************
+ * ScriptParserWhileExpression
+ ***********************************************************************************/
+
+/*! \fn ScriptParserWhileExpression::ScriptParserWhileExpression(ParserOperator *condition, const List<ScriptParserExpression*> &expressions)
  *
- * Create a ScriptParserConditionalExpression from the given condition
- * expression and the expressions block in the if block.
+ * Create a ScriptParserWhileExpression from the given compiled condition
+ * and the expressions of the loop block. The new object takes ownership
+ * of the condition and of the expressions.
  */
-ScriptParserConditionalExpression::ScriptParserConditionalExpression(
-	const String &condition,
-	const String &if_block,
-	const StringList &variable_names,
-	bool auto_add_variables,
-	double* variable_array
+ScriptParserWhileExpression::ScriptParserWhileExpression(
+	ParserOperator *condition,
+	const List<ScriptParserExpression*> &expressions
 ) :
-	ScriptParserExpression(), condition_(NULL)
+	ScriptParserExpression(), condition_(condition), expressions_(expressions), iterations_(0)
 {
-	if (!condition.isEmpty()) {
-		// Create condition
-		String equation = "if(" + condition + ", 1., 0.)";
-		condition_ = new EquationParser();
-		condition_->parse(equation, variable_names, auto_add_variables, variable_array);
-		for (int e = 0 ; e < condition_->nbErrors() ; ++e)
-			errors_.append(condition_->getError(e));
-		// Parse if block
-		ScriptParser::breakBlock(if_block, if_expressions_, variable_names, auto_add_variables, errors_, variable_array);
-	}
 }
 
-ScriptParserConditionalExpression::~ScriptParserConditionalExpression() {
+ScriptParserWhileExpression::~ScriptParserWhileExpression() {
 	delete condition_;
-	for (List<ScriptParserExpression*>::iterator it = if_expressions_.begin() ; it != if_expressions_.end() ; ++it)
-		delete (*it);
-	for (List<ScriptParserExpression*>::iterator it = else_expressions_.begin() ; it != else_expressions_.end() ; ++it)
-		delete (*it);
+	deleteExpressions(expressions_);
 }
 
-/*! \fn int ScriptParserConditionalExpression::nbErrors() const
+/*! \fn void ScriptParserWhileExpression::evaluate()
  *
- * Return the number of errors.
+ * Evaluate the condition and while it is true execute the expressions
+ * in the while loop. The loop invariants are computed first.
  */
-int ScriptParserConditionalExpression::nbErrors() const {
-	return errors_.size();
+void ScriptParserWhileExpression::evaluate() {
+	if (condition_ == NULL)
+		return;
+	for (int i = 0 ; i < invariants_.size() ; ++i)
+		invariants_[i]->update();
+	while (isTrue(condition_)) {
+		if (profiling_)
+			++iterations_;
+		for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
+			(*it)->execute();
+	}
 }
 
-/*! \fn String ScriptParserConditionalExpression::getError(int index) const
+/*! \fn void ScriptParserWhileExpression::resetProfile()
  *
- * Return the error at the given index.
+ * Reset the profiling counters of the loop and of its block.
  */
-String ScriptParserConditionalExpression::getError(int index) const {
-	if (index < 0 || index >= errors_.size())
-		return String();
-	return errors_[index];
+void ScriptParserWhileExpression::resetProfile() {
+	ScriptParserExpression::resetProfile();
+	iterations_ = 0;
+	for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
+		(*it)->resetProfile();
 }
 
-/*! \fn void ScriptParserConditionalExpression::evaluate()
+/*! \fn void ScriptParserWhileExpression::getProfile(List<ScriptProfileEntry> &entries, int depth) const
  *
- * Evaluate the condition and depending on the rsult evaluate the expressions
- * in the if block or in the else block.
+ * Append the profiling counters of the loop, followed by those of the
+ * expressions in its block, to \p entries.
  */
-void ScriptParserConditionalExpression::evaluate() {
-	if (condition_ == NULL)
+void ScriptParserWhileExpression::getProfile(List<ScriptProfileEntry> &entries, int depth) const {
+	ScriptProfileEntry entry = profileEntry("while", depth);
+	entry.iterations_ = iterations_;
+	entries << entry;
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getProfile(entries, depth + 1);
+}
+
+void ScriptParserWhileExpression::getEquations(List<ParserOperator**> &equations) {
+	equations << &condition_;
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getEquations(equations);
+}
+
+/*! \fn void ScriptParserWhileExpression::optimize()
+ *
+ * Replace the subexpressions of the condition and of the block that only
+ * depend on variables not modified in the loop (and have no side effects)
+ * by LoopInvariantOperator objects. Those are computed once by evaluate()
+ * before the first iteration. The enclosing loops are optimized first, so
+ * that a subexpression is moved out of as many loops as possible.
+ */
+void ScriptParserWhileExpression::optimize() {
+	List<ParserOperator**> equations;
+	getEquations(equations);
+	List<const double*> assigned_variables;
+	for (int i = 0 ; i < equations.size() ; ++i)
+		getAssignedVariables(*equations[i], assigned_variables);
+	// The root of each equation is kept: it is the assignment or the
+	// 'if' created for the condition.
+	for (int i = 0 ; i < equations.size() ; ++i)
+		hoistInvariants(*equations[i], assigned_variables);
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->optimize();
+}
+
+// Replace the largest invariant subexpressions below the given operator.
+void ScriptParserWhileExpression::hoistInvariants(ParserOperator *op, const List<const double*> &assigned_variables) {
+	if (op == NULL)
 		return;
-	if (!MathUtils::isEqual(condition_->evaluate(), 0.)) {
-		for (List<ScriptParserExpression*>::iterator it = if_expressions_.begin() ; it != if_expressions_.end() ; ++it)
-			(*it)->evaluate();
-	} else {
-		for (List<ScriptParserExpression*>::iterator it = else_expressions_.begin() ; it != else_expressions_.end() ; ++it)
-			(*it)->evaluate();
+	for (int i = 0 ; i < op->nbChildren() ; ++i) {
+		ParserOperator **slot = op->childSlot(i);
+		ParserOperator *child = *slot;
+		// Variables, constants and other loop invariants are already cheap
+		if (child == NULL || child->nbChildren() == 0 || dynamic_cast<LoopInvariantOperator*>(child) != NULL)
+			continue;
+		if (isInvariant(child, assigned_variables)) {
+			LoopInvariantOperator *invariant = new LoopInvariantOperator(child);
+			*slot = invariant;
+			invariants_ << invariant;
+		} else
+			hoistInvariants(child, assigned_variables);
 	}
 }
 
-/*! \fn StringList ScriptParserConditionalExpression::variablesName() const
+/*! \fn bool ScriptParserWhileExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const
  *
- * Returns the list of variables used in this expression.
+ * Write the compiled condition and block to \p writer.
  */
-StringList ScriptParserConditionalExpression::variablesName() const {
-	StringList vars;
-	if (condition_ != NULL)
-		vars = condition_->variablesName();
-	for (int i = 0 ; i < if_expressions_.size() ; ++i) {
-		StringList list = if_expressions_[i]->variablesName();
-		for (int j = 0 ; j < list.size() ; ++j) {
-			if (!vars.contains(list[j]))
-				vars.append(list[j]);
-		}
-	}
-	for (int i = 0 ; i < else_expressions_.size() ; ++i) {
-		StringList list = else_expressions_[i]->variablesName();
-		for (int j = 0 ; j < list.size() ; ++j) {
-			if (!vars.contains(list[j]))
-				vars.append(list[j]);
-		}
-	}
-	return vars;
+bool ScriptParserWhileExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const {
+	writer.writeInt(WHILE);
+	writer.writeInt(line_);
+	writer.writeInt(column_);
+	return saveEquation(condition_, writer, equation_parser) && saveList(expressions_, writer, equation_parser);
+}
+
+bool ScriptParserWhileExpression::loadContent(
+	CacheReader &reader,
+	EquationParser &equation_parser,
+	const List<int> &variable_map
+) {
+	return
+		loadEquation(condition_, reader, equation_parser, variable_map) &&
+		loadList(reader, expressions_, equation_parser, variable_map);
 }
 
 /***********************************************************************************
- * ScriptParserWhileExpression
+ * ScriptParserEquationExpression
  ***********************************************************************************/
 
-/*! \fn ScriptParserWhileExpression::ScriptParserWhileExpression(const String &condition, const String &block, const StringList &variable_names, bool auto_add_variables, double* variable_array = NULL)
+/*! \fn ScriptParserEquationExpression::ScriptParserEquationExpression(ParserOperator *equation)
  *
- * Create a ScriptParserWhileExpression from the given condition
- * expression and the expressions block in the loop block.
+ * Build a ScriptParserEquationExpression for the given compiled equation.
+ * The new object takes ownership of the equation.
  */
-ScriptParserWhileExpression::ScriptParserWhileExpression(
-	const String &condition,
-	const String &block,
-	const StringList &variable_names,
-	bool auto_add_variables,
-	double* variable_array
-) :
-	ScriptParserExpression(), condition_(NULL)
+ScriptParserEquationExpression::ScriptParserEquationExpression(ParserOperator *equation) :
+	ScriptParserExpression(), equation_(equation)
 {
-	if (!condition.isEmpty()) {
-		// Create condition
-		String equation = "if(" + condition + ", 1., 0.)";
-		condition_ = new EquationParser();
-		condition_->parse(equation, variable_names, auto_add_variables, variable_array);
-		for (int e = 0 ; e < condition_->nbErrors() ; ++e)
-			errors_.append(condition_->getError(e));
-		// Parse if block
-		ScriptParser::breakBlock(block, expressions_, variable_names, auto_add_variables, errors_, variable_array);
-	}
 }
 
-ScriptParserWhileExpression::~ScriptParserWhileExpression() {
-	delete condition_;
-	for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
-		delete (*it);
+ScriptParserEquationExpression::~ScriptParserEquationExpression() {
+	delete equation_;
 }
 
-/*! \fn int ScriptParserWhileExpression::nbErrors() const
+/*! \fn void ScriptParserEquationExpression::evaluate()
  *
- * Return the number of errors.
+ * Evaluate the result of this equation.
  */
-int ScriptParserWhileExpression::nbErrors() const {
-	return errors_.size();
+void ScriptParserEquationExpression::evaluate() {
+	if (equation_ != NULL)
+		equation_->evaluate();
+}
+
+void ScriptParserEquationExpression::getEquations(List<ParserOperator**> &equations) {
+	equations << &equation_;
 }
 
-/*! \fn String ScriptParserWhileExpression::getError(int) const
+/*! \fn bool ScriptParserEquationExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const
  *
- * Return the error at the given index.
+ * Write the compiled equation to \p writer.
  */
-String ScriptParserWhileExpression::getError(int index) const {
-	if (index < 0 || index >= errors_.size())
-		return String();
-	return errors_[index];
+bool ScriptParserEquationExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const {
+	writer.writeInt(EQUATION);
+	writer.writeInt(line_);
+	writer.writeInt(column_);
+	return saveEquation(equation_, writer, equation_parser);
 }
 
-/*! \fn void ScriptParserWhileExpression::evaluate()
+bool ScriptParserEquationExpression::loadContent(
+	CacheReader &reader,
+	EquationParser &equation_parser,
+	const List<int> &variable_map
+) {
+	return loadEquation(equation_, reader, equation_parser, variable_map);
+}
+
+/***********************************************************************************
+ * ScriptParserSectionExpression
+ ***********************************************************************************/
+
+/*! \fn ScriptParserSectionExpression::ScriptParserSectionExpression(bool begin, const List<ScriptParserExpression*> &expressions)
  *
- * Evaluate the condition and while it is true execute the expressions
- * in the while loop.
+ * Build a 'begin' section if \p begin is true or an 'end' section otherwise.
+ * The new object takes ownership of the expressions.
  */
-void ScriptParserWhileExpression::evaluate() {
-	if (condition_ == NULL)
-		return;
-	while (!MathUtils::isEqual(condition_->evaluate(), 0.)) {
-		for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
-			(*it)->evaluate();
-	}
+ScriptParserSectionExpression::ScriptParserSectionExpression(bool begin, const List<ScriptParserExpression*> &expressions) :
+	ScriptParserExpression(), begin_(begin), expressions_(expressions)
+{
+}
+
+ScriptParserSectionExpression::~ScriptParserSectionExpression() {
+	deleteExpressions(expressions_);
+}
+
+bool ScriptParserSectionExpression::isBegin() const {
+	return begin_;
 }
 
-/*! \fn StringList ScriptParserWhileExpression::variablesName() const
+/*! \fn List<ScriptParserExpression*> ScriptParserSectionExpression::takeExpressions()
  *
- * Returns the list of variables used in this expression.
+ * Return the expressions of the section, which is left empty. The caller
+ * takes ownership of the expressions.
  */
-StringList ScriptParserWhileExpression::variablesName() const {
-	StringList vars;
-	if (condition_ != NULL)
-		vars = condition_->variablesName();
-	for (int i = 0 ; i < expressions_.size() ; ++i) {
-		StringList list = expressions_[i]->variablesName();
-		for (int j = 0 ; j < list.size() ; ++j) {
-			if (!vars.contains(list[j]))
-				vars.append(list[j]);
-		}
-	}
-	return vars;
+List<ScriptParserExpression*> ScriptParserSectionExpression::takeExpressions() {
+	List<ScriptParserExpression*> expressions = expressions_;
+	expressions_.clear();
+	return expressions;
+}
+
+/*! \fn void ScriptParserSectionExpression::evaluate()
+ *
+ * Do nothing: the statements of the section are run by the ScriptParser.
+ */
+void ScriptParserSectionExpression::evaluate() {
+}
+
+void ScriptParserSectionExpression::getEquations(List<ParserOperator**> &equations) {
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getEquations(equations);
+}
+
+/*! \fn bool ScriptParserSectionExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const
+ *
+ * Write the compiled statements of the section to \p writer.
+ */
+bool ScriptParserSectionExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const {
+	writer.writeInt(begin_ ? BEGIN_SECTION : END_SECTION);
+	writer.writeInt(line_);
+	writer.writeInt(column_);
+	return saveList(expressions_, writer, equation_parser);
+}
+
+bool ScriptParserSectionExpression::loadContent(
+	CacheReader &reader,
+	EquationParser &equation_parser,
+	const List<int> &variable_map
+) {
+	return loadList(reader, expressions_, equation_parser, variable_map);
 }
 
 /***********************************************************************************
- * ScriptParserEquationExpression
+ * ScriptParserGroupExpression
  ***********************************************************************************/
 
-/*! \fn ScriptParserEquationExpression::ScriptParserEquationExpression(const String &equation, const StringList &variable_names, bool auto_add_variables, double* variable_array = NULL)
+/*! \fn ScriptParserGroupExpression::ScriptParserGroupExpression(ParserOperator *key, const String &key_name, const List<ScriptParserExpression*> &expressions)
  *
- * Build a ScriptParserEquationExpression for the given equation
- * using the given parameters.
+ * Build a 'group' statement from the compiled key, the name of its column in
+ * the rows printed by printGroups() and the expressions of its block. The new
+ * object takes ownership of the key and of the expressions.
  */
-ScriptParserEquationExpression::ScriptParserEquationExpression(
-	const String &equation,
-	const StringList &variable_names,
-	bool auto_add_variables,
-	double* variable_array
+ScriptParserGroupExpression::ScriptParserGroupExpression(
+	ParserOperator *key, const String &key_name,
+	const List<ScriptParserExpression*> &expressions
 ) :
-	ScriptParserExpression(), equation_(NULL)
+	ScriptParserExpression(), key_(key), key_name_(key_name), expressions_(expressions), table_(NULL)
 {
-	if (!equation.isEmpty()) {
-		equation_ = new EquationParser();
-		equation_->parse(equation, variable_names, auto_add_variables, variable_array);
+}
+
+ScriptParserGroupExpression::~ScriptParserGroupExpression() {
+	delete table_;
+	delete key_;
+	deleteExpressions(expressions_);
+}
+
+// Append the aggregate functions used in the given equation to the lists.
+static void getAggregates(
+	ParserOperator *op,
+	List<AggregateOperator*> &aggregates,
+	List<QuantileAggregateOperator*> &quantiles
+) {
+	if (op == NULL)
+		return;
+#ifdef PARSER_INSTRUMENTATION
+	InstrumentedOperator *instrumented = dynamic_cast<InstrumentedOperator*>(op);
+	if (instrumented != NULL)
+		op = const_cast<ParserOperator*>(instrumented->wrappedOperator());
+#endif
+	AggregateOperator *aggregate = dynamic_cast<AggregateOperator*>(op);
+	if (aggregate != NULL)
+		aggregates << aggregate;
+	QuantileAggregateOperator *quantile = dynamic_cast<QuantileAggregateOperator*>(op);
+	if (quantile != NULL)
+		quantiles << quantile;
+	for (int i = 0 ; i < op->nbChildren() ; ++i)
+		getAggregates(op->child(i), aggregates, quantiles);
+}
+
+// Find the variables and aggregates of the block and create the table of the
+// groups. This is done on the first evaluation, as the optimizations of the
+// script may replace some operators.
+void ScriptParserGroupExpression::prepare() {
+	List<ParserOperator**> equations;
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getEquations(equations);
+	List<const double*> assigned_variables;
+	for (int i = 0 ; i < equations.size() ; ++i) {
+		getAssignedVariables(*equations[i], assigned_variables);
+		getAggregates(*equations[i], aggregates_, quantiles_);
+	}
+	for (int i = 0 ; i < assigned_variables.size() ; ++i) {
+		double *variable = const_cast<double*>(assigned_variables[i]);
+		if (!variables_.contains(variable))
+			variables_ << variable;
 	}
+	table_ = new GroupTable(variables_.size(), aggregates_.size(), quantiles_.size());
 }
 
-ScriptParserEquationExpression::~ScriptParserEquationExpression() {
-	delete equation_;
+/*! \fn void ScriptParserGroupExpression::evaluate()
+ *
+ * Find the group of the current key and run the block with its state.
+ */
+void ScriptParserGroupExpression::evaluate() {
+	if (key_ == NULL)
+		return;
+	if (table_ == NULL)
+		prepare();
+	int group = table_->find(key_->evaluate());
+	double *values = table_->values(group);
+	RunningStats *stats = table_->stats(group);
+	QuantileSketch *sketches = table_->sketches(group);
+	for (int i = 0 ; i < variables_.size() ; ++i)
+		*variables_[i] = values[i];
+	for (int i = 0 ; i < aggregates_.size() ; ++i)
+		aggregates_[i]->bind(stats + i);
+	for (int i = 0 ; i < quantiles_.size() ; ++i)
+		quantiles_[i]->bind(sketches + i);
+	for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
+		(*it)->execute();
+	for (int i = 0 ; i < variables_.size() ; ++i)
+		values[i] = *variables_[i];
+}
+
+/*! \fn void ScriptParserGroupExpression::printGroups(const VariableStorage &variables)
+ *
+ * Print a line with the name of the key and of the variables assigned in the
+ * block, followed by one line per group with the key and the values of those
+ * variables for the group. \p variables is the storage the script was parsed
+ * with.
+ */
+void ScriptParserGroupExpression::printGroups(const VariableStorage &variables) {
+	if (key_ == NULL)
+		return;
+	if (table_ == NULL)
+		prepare();
+	rprintf("%s", key_name_.c_str());
+	for (int i = 0 ; i < variables_.size() ; ++i)
+		rprintf(" %s", variables.names()[variables_[i] - variables.values()].c_str());
+	rprintf("\n");
+	for (int group = 0 ; group < table_->size() ; ++group) {
+		rprintf("%.12g", table_->key(group));
+		const double *values = table_->values(group);
+		for (int i = 0 ; i < variables_.size() ; ++i)
+			rprintf(" %.12g", values[i]);
+		rprintf("\n");
+	}
 }
 
-/*! \fn int ScriptParserEquationExpression::nbErrors() const
+/*! \fn void ScriptParserGroupExpression::resetProfile()
  *
- * Return the number of errors when parsing this equation.
+ * Reset the profiling counters of the statement and of its block.
  */
-int ScriptParserEquationExpression::nbErrors() const {
-	if (equation_ == NULL)
-		return 0;
-	return equation_->nbErrors();
+void ScriptParserGroupExpression::resetProfile() {
+	ScriptParserExpression::resetProfile();
+	for (List<ScriptParserExpression*>::iterator it = expressions_.begin() ; it != expressions_.end() ; ++it)
+		(*it)->resetProfile();
 }
 
-/*! \fn String ScriptParserEquationExpression::getError(int) const
+/*! \fn void ScriptParserGroupExpression::getProfile(List<ScriptProfileEntry> &entries, int depth) const
  *
- * get the equation parsing errors.
+ * Append the profiling counters of the statement, followed by those of the
+ * expressions in its block, to \p entries.
  */
-String ScriptParserEquationExpression::getError(int index) const {
-	if (equation_ == NULL)
-		return String();
-	return equation_->getError(index);
+void ScriptParserGroupExpression::getProfile(List<ScriptProfileEntry> &entries, int depth) const {
+	entries << profileEntry("group", depth);
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getProfile(entries, depth + 1);
 }
 
-/*! \fn void ScriptParserEquationExpression::evaluate()
+void ScriptParserGroupExpression::getEquations(List<ParserOperator**> &equations) {
+	equations << &key_;
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->getEquations(equations);
+}
+
+/*! \fn void ScriptParserGroupExpression::optimize()
  *
- * Evaluate the result of this equation.
+ * Optimize the expressions of the block.
  */
-void ScriptParserEquationExpression::evaluate() {
-	if (equation_ != NULL)
-		equation_->evaluate();
+void ScriptParserGroupExpression::optimize() {
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		expressions_[i]->optimize();
 }
 
-/*! \fn StringList ScriptParserEquationExpression::variablesName() const
+/*! \fn bool ScriptParserGroupExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const
  *
- * Returns the list of variables used in this expression.
+ * Write the compiled key and block to \p writer.
  */
-StringList ScriptParserEquationExpression::variablesName() const {
-	StringList vars;
-	if (equation_ != NULL)
-		vars = equation_->variablesName();
-	return vars;
+bool ScriptParserGroupExpression::save(CacheWriter &writer, const EquationParser &equation_parser) const {
+	writer.writeInt(GROUP);
+	writer.writeInt(line_);
+	writer.writeInt(column_);
+	writer.writeString(key_name_);
+	return saveEquation(key_, writer, equation_parser) && saveList(expressions_, writer, equation_parser);
+}
+
+bool ScriptParserGroupExpression::loadContent(
+	CacheReader &reader,
+	EquationParser &equation_parser,
+	const List<int> &variable_map
+) {
+	key_name_ = reader.readString();
+	return
+		loadEquation(key_, reader, equation_parser, variable_map) &&
+		loadList(reader, expressions_, equation_parser, variable_map);
 }
 
 /***********************************************************************************
@@ -951,11 +2110,52 @@ StringList ScriptParserEquationExpression::variablesName() const {
 EquationParser::ParserTreeNode ScriptParser::getParserTreeDescription() const {
 	EquationParser::ParserTreeNode root;
 	root.description_ = "Script";
+	if (!begin_expressions_.isEmpty()) {
+		EquationParser::ParserTreeNode begin_node;
+		begin_node.description_ = "Begin";
+		for (int i = 0 ; i < begin_expressions_.size() ; ++i)
+			begin_node.children_ << begin_expressions_[i]->getParserTreeDescription();
+		root.children_ << begin_node;
+	}
 	for (int i = 0 ; i < expressions_.size() ; ++i)
 		root.children_ << expressions_[i]->getParserTreeDescription();
+	if (!end_expressions_.isEmpty()) {
+		EquationParser::ParserTreeNode end_node;
+		end_node.description_ = "End";
+		for (int i = 0 ; i < end_expressions_.size() ; ++i)
+			end_node.children_ << end_expressions_[i]->getParserTreeDescription();
+		root.children_ << end_node;
+	}
 	return root;
 }
 
+EquationParser::ParserTreeNode ScriptParserSectionExpression::getParserTreeDescription() const {
+	EquationParser::ParserTreeNode node;
+	node.description_ = begin_ ? "Begin" : "End";
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		node.children_ << expressions_[i]->getParserTreeDescription();
+	return node;
+}
+
+EquationParser::ParserTreeNode ScriptParserGroupExpression::getParserTreeDescription() const {
+	EquationParser::ParserTreeNode group_node;
+	group_node.description_ = "Group";
+
+	EquationParser::ParserTreeNode key_node;
+	key_node.description_ = "Key";
+	if (key_ != NULL)
+		key_node.children_ << EquationParser::buildNode(key_);
+	group_node.children_ << key_node;
+
+	EquationParser::ParserTreeNode block_node;
+	block_node.description_ = "Block";
+	for (int i = 0 ; i < expressions_.size() ; ++i)
+		block_node.children_ << expressions_[i]->getParserTreeDescription();
+	group_node.children_ << block_node;
+
+	return group_node;
+}
+
 EquationParser::ParserTreeNode ScriptParserConditionalExpression::getParserTreeDescription() const {
 	EquationParser::ParserTreeNode if_node;
 	if_node.description_ = "If";
@@ -963,7 +2163,7 @@ EquationParser::ParserTreeNode ScriptParserConditionalExpression::getParserTreeD
 	EquationParser::ParserTreeNode cond_node;
 	cond_node.description_ = "Condition";
 	if (condition_ != NULL) {
-		EquationParser::ParserTreeNode if_cond_node = condition_->getParserTreeDescription();
+		EquationParser::ParserTreeNode if_cond_node = EquationParser::buildNode(condition_);
 		// What we get above has three children for Condition/Then/Else.
 		// We only keep the Condition children part (the Then Else are constant 0 or 1).
 		if (!if_cond_node.children_.isEmpty())
@@ -995,7 +2195,7 @@ EquationParser::ParserTreeNode ScriptParserWhileExpression::getParserTreeDescrip
 	EquationParser::ParserTreeNode cond_node;
 	cond_node.description_ = "Condition";
 	if (condition_ != NULL)
-		cond_node.children_ << condition_->getParserTreeDescription();
+		cond_node.children_ << EquationParser::buildNode(condition_);
 	while_node.children_ << cond_node;
 
 	EquationParser::ParserTreeNode then_node;
@@ -1008,12 +2208,7 @@ EquationParser::ParserTreeNode ScriptParserWhileExpression::getParserTreeDescrip
 }
 
 EquationParser::ParserTreeNode ScriptParserEquationExpression::getParserTreeDescription() const {
-	if (equation_ == NULL) {
-		EquationParser::ParserTreeNode node;
-		node.description_ = "(Empty)";
-		return node;
-	}
-	return equation_->getParserTreeDescription();
+	return EquationParser::buildNode(equation_);
 }
 
 #endif
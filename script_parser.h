@@ -24,12 +24,18 @@
 #include "list.h"
 #include "str.h"
 #include "strlist.h"
-#include "strstream.h"
+#include "variable_storage.h"
 
 // The next include is only needed for debugging. Otherwise we could use a forward declaration
 #include "equation_parser.h"
 
 class ScriptParserExpression;
+class LoopInvariantOperator;
+class AggregateOperator;
+class QuantileAggregateOperator;
+class GroupTable;
+class CacheWriter;
+class CacheReader;
 
 /*! \class ScriptParser
  *
@@ -70,6 +76,24 @@ class ScriptParserExpression;
     }
  * \endcode
  *
+ * At the top level, a script can also have 'begin' and 'end' sections, that
+ * are run once before and after the rows of a data file (see evaluateBegin()
+ * and evaluateEnd()), while the rest of the script is run for each row:
+ * \code
+    begin { n = 0; total = 0; }
+    n = n + 1;
+    total = total + value;
+    end { print(total / n); }
+ * \endcode
+ *
+ * A 'group' statement at the top level runs its block with a separate set of
+ * aggregates (see AggregateOperator) and of assigned variables for each value
+ * of its key, and prints one row per group before the 'end' section (see
+ * ScriptParserGroupExpression):
+ * \code
+    group (well) { n = count(porosity); phi = mean(porosity); }
+ * \endcode
+ *
  * Example:
  *
  * Consider the following script.
@@ -112,16 +136,53 @@ class ScriptParserExpression;
 
 #define ScriptParserMaxNbErrors 50
 
+/*! \struct ScriptProfileEntry
+ *
+ * Profiling counters of one statement of a script (see ScriptParser::getProfile()).
+ * The time is inclusive: the time of an 'if' or 'while' statement includes the
+ * time of the statements in its blocks.
+ */
+struct ScriptProfileEntry {
+	int line_;              // Line in the script source (1 for the first line)
+	int depth_;             // Nesting level (0 for top-level statements)
+	const char *kind_;      // "statement", "if" or "while"
+	long long hits_;        // Number of executions
+	long long time_ns_;     // Cumulative time
+	long long taken_;       // 'if': number of times the condition was true
+	long long iterations_;  // 'while': number of iterations
+};
+
 class ScriptParser {
 public:
 	ScriptParser();
 	~ScriptParser();
 
-	bool parse(const String &script, const StringList &variable_names);
+	bool parse(const String &script, VariableStorage &variables, bool use_cache = false);
+	bool parse(const String &script, const StringList &variable_names, bool use_cache = false);
 
-	StringList getVariablesList(const String &script);
+	StringList getVariablesList(const String &script, bool use_cache = false);
 
+	void setFirstCallSite(unsigned int);
+	void nextRow();
 	void evaluate(double *var = 0);
+	bool hasBeginSection() const;
+	bool hasEndSection() const;
+	void evaluateBegin();
+	void evaluateEnd();
+
+	StringList assignedVariables() const;
+	void foldConstants(const StringList &modified_variables);
+
+	bool hasRowGuard() const;
+	StringList rowGuardVariables() const;
+	bool evaluateRowGuard() const;
+	bool rowGuardMayAccept(const double *min_values, const double *max_values) const;
+	bool rowGuardMask(const double *const *columns, int n, unsigned char *mask) const;
+
+	static void setProfiling(bool);
+	static bool profiling();
+	void resetProfile();
+	List<ScriptProfileEntry> getProfile() const;
 
 	double *VariablesValue();
 	const StringList &variablesName() const;
@@ -132,9 +193,7 @@ public:
 
 	static void breakBlock(
 		const String &script_block, List<ScriptParserExpression*> &expressions,
-		const StringList &variable_names, bool auto_add_variables,
-		StringList &errors,
-		double* variable_array = NULL
+		EquationParser &equation_parser, StringList &errors
 	);
 	
 #ifdef PARSER_TREE_DEBUG
@@ -143,21 +202,24 @@ public:
 
 protected:
 	void clear();
-	static bool readCondition(
-		String &condition, StrReadStream &stream,
-		String &line, int &line_number,
-		StringList &errors
-	);
-	static bool readBlock(
-		String &block, StrReadStream &stream,
-		String &line, int &line_number,
-		StringList &errors
-	);
+	void splitSections();
+	void optimize();
+	static void selectBranchFree(ParserOperator*);
+	bool loadCompiled(CacheReader&, const StringList &variable_names);
+	void saveCompiled(const String &script) const;
 
 private:
 	List<ScriptParserExpression*> expressions_;
+	// Statements of the 'begin' and 'end' sections
+	List<ScriptParserExpression*> begin_expressions_;
+	List<ScriptParserExpression*> end_expressions_;
+	// Condition of the 'if' around all the row statements (see hasRowGuard())
+	const ParserOperator *row_guard_;
 	// Equation evaluation
-	double *args_double_;
+	EvaluationContext *context_;
+	unsigned int first_call_site_;
+	VariableStorage own_variables_;
+	VariableStorage *variables_;
 	StringList args_names_;
 	// Errors
 	StringList errors_;
@@ -166,24 +228,72 @@ private:
 /*! \class ScriptParserExpression
  *
  * Internal class used by ScriptParser to store an expression block.
+ * The equations of the expressions are stored as operator trees compiled
+ * by the EquationParser shared by the whole script.
  */
 class ScriptParserExpression {
 public:
 	ScriptParserExpression();
 	virtual ~ScriptParserExpression();
 
-	virtual int nbErrors() const;
-	virtual String getError(int) const;
-
+	void execute();
 	virtual void evaluate() = 0;
 
-	virtual StringList variablesName() const = 0;
+	void setLine(int);
+	int line() const;
+	void setColumn(int);
+	int column() const;
+
+	virtual void resetProfile();
+	virtual void getProfile(List<ScriptProfileEntry>&, int depth) const;
+
+	virtual void getEquations(List<ParserOperator**>&) = 0;
+	virtual void optimize();
+
+	virtual bool save(CacheWriter&, const EquationParser&) const = 0;
+	static ScriptParserExpression *load(CacheReader&, EquationParser&, const List<int> &variable_map);
+	static bool saveList(const List<ScriptParserExpression*>&, CacheWriter&, const EquationParser&);
+	static bool loadList(
+		CacheReader&, List<ScriptParserExpression*>&,
+		EquationParser&, const List<int> &variable_map
+	);
 
 #ifdef PARSER_TREE_DEBUG
 	virtual EquationParser::ParserTreeNode getParserTreeDescription() const = 0;
 #endif
+
+	static bool profiling_;
+
+protected:
+	// Kind of expression in a compiled script
+	enum Kind { EQUATION, CONDITIONAL, WHILE, BEGIN_SECTION, END_SECTION, GROUP };
+
+	virtual bool loadContent(CacheReader&, EquationParser&, const List<int> &variable_map) = 0;
+	static bool saveEquation(const ParserOperator*, CacheWriter&, const EquationParser&);
+	static bool loadEquation(ParserOperator*&, CacheReader&, EquationParser&, const List<int> &variable_map);
+	static bool isTrue(const ParserOperator*);
+
+	void profiledEvaluate();
+	ScriptProfileEntry profileEntry(const char *kind, int depth) const;
+
+	int line_;
+	int column_;
+	long long hits_;
+	long long time_ns_;
 };
 
+/*! \fn void ScriptParserExpression::execute()
+ *
+ * Evaluate the expression, recording the number of executions and the time
+ * spent if profiling is enabled (see ScriptParser::setProfiling()).
+ */
+inline void ScriptParserExpression::execute() {
+	if (profiling_)
+		profiledEvaluate();
+	else
+		evaluate();
+}
+
 /*! \class ScriptParserConditionalExpression
  *
  * Internal class used by ScriptParser to store an expression block.
@@ -191,34 +301,37 @@ public:
 class ScriptParserConditionalExpression : public ScriptParserExpression {
 public:
 	ScriptParserConditionalExpression(
-			const String &condition, const String &if_block, const String &else_block,
-			const StringList &variable_names, bool auto_add_variables = false,
-			double* variable_array = NULL
-		);
-	ScriptParserConditionalExpression(
-			const String &condition, const String &if_block,
-			const StringList &variable_names, bool auto_add_variables = false,
-			double* variable_array = NULL
+			ParserOperator *condition,
+			const List<ScriptParserExpression*> &if_expressions,
+			const List<ScriptParserExpression*> &else_expressions
 		);
 	virtual ~ScriptParserConditionalExpression();
 
-	virtual int nbErrors() const;
-	virtual String getError(int) const;
-
 	virtual void evaluate();
 
-	virtual StringList variablesName() const;
+	const ParserOperator *condition() const;
+	bool hasElse() const;
+
+	virtual void resetProfile();
+	virtual void getProfile(List<ScriptProfileEntry>&, int depth) const;
+
+	virtual void getEquations(List<ParserOperator**>&);
+	virtual void optimize();
+
+	virtual bool save(CacheWriter&, const EquationParser&) const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual EquationParser::ParserTreeNode getParserTreeDescription() const;
 #endif
 
+protected:
+	virtual bool loadContent(CacheReader&, EquationParser&, const List<int> &variable_map);
+
 private:
-	EquationParser *condition_;
+	ParserOperator *condition_;
 	List<ScriptParserExpression*> if_expressions_;
 	List<ScriptParserExpression*> else_expressions_;
-	// Errors
-	StringList errors_;
+	long long taken_;
 };
 
 /*! \class ScriptParserWhileExpression
@@ -228,30 +341,36 @@ private:
 class ScriptParserWhileExpression : public ScriptParserExpression {
 public:
 	ScriptParserWhileExpression(
-		const String &condition,
-		const String &block,
-		const StringList &variable_names,
-		bool auto_add_variables = false,
-		double* variable_array = NULL
+		ParserOperator *condition,
+		const List<ScriptParserExpression*> &expressions
 	);
 	virtual ~ScriptParserWhileExpression();
 
-	virtual int nbErrors() const;
-	virtual String getError(int) const;
-
 	virtual void evaluate();
 
-	virtual StringList variablesName() const;
+	virtual void resetProfile();
+	virtual void getProfile(List<ScriptProfileEntry>&, int depth) const;
+
+	virtual void getEquations(List<ParserOperator**>&);
+	virtual void optimize();
+
+	virtual bool save(CacheWriter&, const EquationParser&) const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual EquationParser::ParserTreeNode getParserTreeDescription() const;
 #endif
 
+protected:
+	virtual bool loadContent(CacheReader&, EquationParser&, const List<int> &variable_map);
+
 private:
-	EquationParser *condition_;
+	void hoistInvariants(ParserOperator*, const List<const double*> &assigned_variables);
+
+	ParserOperator *condition_;
 	List<ScriptParserExpression*> expressions_;
-	// Errors
-	StringList errors_;
+	// Subexpressions computed once before the loop (owned by the equations)
+	List<LoopInvariantOperator*> invariants_;
+	long long iterations_;
 };
 
 /*! \class ScriptParserEquationExpression
@@ -260,27 +379,108 @@ private:
  */
 class ScriptParserEquationExpression : public ScriptParserExpression {
 public:
-	ScriptParserEquationExpression(
-		const String &equation,
-		const StringList &variable_names,
-		bool auto_add_variables = false,
-		double* variable_array = NULL
-	);
+	ScriptParserEquationExpression(ParserOperator *equation);
 	virtual ~ScriptParserEquationExpression();
 
-	virtual int nbErrors() const;
-	virtual String getError(int) const;
+	virtual void evaluate();
+
+	virtual void getEquations(List<ParserOperator**>&);
+
+	virtual bool save(CacheWriter&, const EquationParser&) const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual EquationParser::ParserTreeNode getParserTreeDescription() const;
+#endif
+
+protected:
+	virtual bool loadContent(CacheReader&, EquationParser&, const List<int> &variable_map);
+
+private:
+	ParserOperator *equation_;
+};
+
+/*! \class ScriptParserSectionExpression
+ *
+ * Internal class used by ScriptParser to store a 'begin' or 'end' section.
+ * The section itself does nothing when evaluated: the ScriptParser takes its
+ * statements out of the script after parsing to run them before the first
+ * row or after the last one (see ScriptParser::evaluateBegin()).
+ */
+class ScriptParserSectionExpression : public ScriptParserExpression {
+public:
+	ScriptParserSectionExpression(bool begin, const List<ScriptParserExpression*> &expressions);
+	virtual ~ScriptParserSectionExpression();
+
+	bool isBegin() const;
+	List<ScriptParserExpression*> takeExpressions();
 
 	virtual void evaluate();
 
-	virtual StringList variablesName() const;
+	virtual void getEquations(List<ParserOperator**>&);
+
+	virtual bool save(CacheWriter&, const EquationParser&) const;
 
 #ifdef PARSER_TREE_DEBUG
 	virtual EquationParser::ParserTreeNode getParserTreeDescription() const;
 #endif
 
+protected:
+	virtual bool loadContent(CacheReader&, EquationParser&, const List<int> &variable_map);
+
 private:
-	EquationParser *equation_;
+	bool begin_;
+	List<ScriptParserExpression*> expressions_;
+};
+
+
+/*! \class ScriptParserGroupExpression
+ *
+ * Internal class used by ScriptParser to store a 'group (key) { ... }'
+ * statement. Each evaluation computes the key and runs the block with the
+ * state of the group of that key, kept in a GroupTable: the aggregate
+ * functions of the block are bound to the statistics of the group, and the
+ * variables assigned in the block are set to their values for the group
+ * before the block is run (0 for a new group) and saved after it. Once all the
+ * rows have been evaluated, printGroups() prints the key and the variables of
+ * each group, one group per line, in the order in which the keys were found.
+ */
+class ScriptParserGroupExpression : public ScriptParserExpression {
+public:
+	ScriptParserGroupExpression(
+		ParserOperator *key, const String &key_name,
+		const List<ScriptParserExpression*> &expressions
+	);
+	virtual ~ScriptParserGroupExpression();
+
+	virtual void evaluate();
+	void printGroups(const VariableStorage&);
+
+	virtual void resetProfile();
+	virtual void getProfile(List<ScriptProfileEntry>&, int depth) const;
+
+	virtual void getEquations(List<ParserOperator**>&);
+	virtual void optimize();
+
+	virtual bool save(CacheWriter&, const EquationParser&) const;
+
+#ifdef PARSER_TREE_DEBUG
+	virtual EquationParser::ParserTreeNode getParserTreeDescription() const;
+#endif
+
+protected:
+	virtual bool loadContent(CacheReader&, EquationParser&, const List<int> &variable_map);
+
+private:
+	void prepare();
+
+	ParserOperator *key_;
+	String key_name_;
+	List<ScriptParserExpression*> expressions_;
+	// Created on the first evaluation, once the script has been optimized
+	GroupTable *table_;
+	List<double*> variables_;
+	List<AggregateOperator*> aggregates_;
+	List<QuantileAggregateOperator*> quantiles_;
 };
 
 #endif
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef string_index_h
+#define string_index_h
+
+#include <string.h>
+#include "str.h"
+#include "strlist.h"
+
+/*! \class StringIndex
+ *
+ * Hash table giving the index of a string in a StringList in constant time,
+ * to replace StringList::indexOf() when the list is long. It uses open
+ * addressing with linear probing and keeps a copy of the strings, so it stays
+ * valid if the list is modified, but strings appended to the list must also
+ * be added to the index.
+ *
+ * Example:
+ * \code
+	StringIndex index(names);
+	int i = index.indexOf("x");
+	if (i == -1)
+		index.insert("x", names.size());
+ * \endcode
+ */
+class StringIndex {
+public:
+	StringIndex();
+	StringIndex(const StringList&);
+	StringIndex(const StringIndex&);
+	~StringIndex();
+
+	StringIndex& operator=(const StringIndex&);
+
+	void build(const StringList&);
+	void insert(const String&, int index);
+	int indexOf(const String&) const;
+	bool contains(const String&) const;
+	int size() const;
+	void clear();
+
+private:
+	struct Entry {
+		String key_;
+		unsigned int hash_;
+		int index_;    // -1 for an empty slot
+	};
+
+	static unsigned int hash(const char*, int length);
+	int findSlot(const char*, int length, unsigned int hash) const;
+	void grow();
+
+	Entry *entries_;
+	int capacity_;  // Always a power of two (or 0)
+	int size_;
+};
+
+inline StringIndex::StringIndex() :
+	entries_(NULL), capacity_(0), size_(0)
+{
+}
+
+inline StringIndex::StringIndex(const StringList &list) :
+	entries_(NULL), capacity_(0), size_(0)
+{
+	build(list);
+}
+
+inline StringIndex::StringIndex(const StringIndex &other) :
+	entries_(NULL), capacity_(0), size_(0)
+{
+	*this = other;
+}
+
+inline StringIndex::~StringIndex() {
+	delete [] entries_;
+}
+
+inline StringIndex& StringIndex::operator=(const StringIndex &other) {
+	if (&other == this)
+		return *this;
+	delete [] entries_;
+	entries_ = NULL;
+	capacity_ = other.capacity_;
+	size_ = other.size_;
+	if (capacity_ > 0) {
+		entries_ = new Entry[capacity_];
+		for (int i = 0 ; i < capacity_ ; ++i)
+			entries_[i] = other.entries_[i];
+	}
+	return *this;
+}
+
+/*! \fn void StringIndex::build(const StringList &list)
+ *
+ * Replace the content of the index by the strings of \p list. If a string is
+ * in the list several times, its first index is kept, as for indexOf().
+ */
+inline void StringIndex::build(const StringList &list) {
+	clear();
+	for (int i = 0 ; i < list.size() ; ++i) {
+		if (!contains(list[i]))
+			insert(list[i], i);
+	}
+}
+
+/*! \fn void StringIndex::insert(const String &key, int index)
+ *
+ * Associate \p index with \p key, replacing the previous index if the key
+ * is already in the table.
+ */
+inline void StringIndex::insert(const String &key, int index) {
+	if (2 * (size_ + 1) > capacity_)
+		grow();
+	unsigned int h = hash(key.c_str(), key.length());
+	int slot = findSlot(key.c_str(), key.length(), h);
+	if (entries_[slot].index_ == -1) {
+		entries_[slot].key_ = key;
+		entries_[slot].hash_ = h;
+		++size_;
+	}
+	entries_[slot].index_ = index;
+}
+
+/*! \fn int StringIndex::indexOf(const String &key) const
+ *
+ * Return the index associated with \p key, or -1 if it is not in the table.
+ */
+inline int StringIndex::indexOf(const String &key) const {
+	if (size_ == 0)
+		return -1;
+	return entries_[findSlot(key.c_str(), key.length(), hash(key.c_str(), key.length()))].index_;
+}
+
+inline bool StringIndex::contains(const String &key) const {
+	return indexOf(key) != -1;
+}
+
+inline int StringIndex::size() const {
+	return size_;
+}
+
+inline void StringIndex::clear() {
+	delete [] entries_;
+	entries_ = NULL;
+	capacity_ = 0;
+	size_ = 0;
+}
+
+// FNV-1a
+inline unsigned int StringIndex::hash(const char *str, int length) {
+	unsigned int h = 2166136261U;
+	for (int i = 0 ; i < length ; ++i) {
+		h ^= (unsigned char)str[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+// Return the slot of the key, or the empty slot where it would be inserted.
+inline int StringIndex::findSlot(const char *str, int length, unsigned int h) const {
+	int mask = capacity_ - 1;
+	int slot = h & mask;
+	while (entries_[slot].index_ != -1) {
+		const Entry &entry = entries_[slot];
+		if (entry.hash_ == h && entry.key_.length() == length && memcmp(entry.key_.c_str(), str, length) == 0)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+inline void StringIndex::grow() {
+	Entry *old_entries = entries_;
+	int old_capacity = capacity_;
+	capacity_ = capacity_ == 0 ? 16 : 2 * capacity_;
+	entries_ = new Entry[capacity_];
+	for (int i = 0 ; i < capacity_ ; ++i)
+		entries_[i].index_ = -1;
+	for (int i = 0 ; i < old_capacity ; ++i) {
+		if (old_entries[i].index_ != -1) {
+			const Entry &entry = old_entries[i];
+			entries_[findSlot(entry.key_.c_str(), entry.key_.length(), entry.hash_)] = entry;
+		}
+	}
+	delete [] old_entries;
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2000, 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef timer_h
+#define timer_h
+
+#include <time.h>
+
+/*! \namespace Timer
+ *
+ * Cheap clocks used to time the benchmarks and the script runs.
+ * Both return nanoseconds from an arbitrary origin, so only differences
+ * between two calls are meaningful.
+ */
+namespace Timer {
+
+/*! \fn long long Timer::wallNs()
+ *
+ * Return the time of a monotonic clock (not affected by changes of the
+ * system time) in nanoseconds.
+ */
+inline long long wallNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*! \fn long long Timer::cpuNs()
+ *
+ * Return the CPU time used by the process in nanoseconds.
+ */
+inline long long cpuNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+} // namespace Timer
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#include "variable_storage.h"
+#include <string.h>
+
+VariableStorage::VariableStorage() :
+	buffer_(NULL), values_(NULL), capacity_(0)
+{
+}
+
+VariableStorage::~VariableStorage() {
+	delete [] buffer_;
+}
+
+/*! \fn void VariableStorage::setNames(const StringList &names)
+ *
+ * Replace the variables by the given list. The variables that were already
+ * in the storage keep their value and the new ones are set to 0. Nothing
+ * changes if the list is the same as the current one.
+ */
+void VariableStorage::setNames(const StringList &names) {
+	if (names == names_)
+		return;
+	char *buffer = NULL;
+	double *values = NULL;
+	int capacity = 0;
+	if (!names.isEmpty()) {
+		capacity = allocate(names.size(), buffer, values);
+		for (int i = 0 ; i < names.size() ; ++i) {
+			int index = index_.indexOf(names[i]);
+			if (index != -1)
+				values[i] = values_[index];
+		}
+	}
+	delete [] buffer_;
+	buffer_ = buffer;
+	values_ = values;
+	capacity_ = capacity;
+	names_ = names;
+	index_.build(names);
+}
+
+/*! \fn int VariableStorage::add(const String &name)
+ *
+ * Add a variable set to 0 if it is not already in the storage and return
+ * its index.
+ */
+int VariableStorage::add(const String &name) {
+	int index = index_.indexOf(name);
+	if (index != -1)
+		return index;
+	index = names_.size();
+	if (index == capacity_) {
+		char *buffer;
+		double *values;
+		int capacity = allocate(capacity_ == 0 ? 1 : 2 * capacity_, buffer, values);
+		if (values_ != NULL)
+			memcpy(values, values_, index * sizeof(double));
+		delete [] buffer_;
+		buffer_ = buffer;
+		values_ = values;
+		capacity_ = capacity;
+	}
+	values_[index] = 0.;
+	names_ << name;
+	index_.insert(name, index);
+	return index;
+}
+
+/*! \fn void VariableStorage::clear()
+ *
+ * Remove all the variables.
+ */
+void VariableStorage::clear() {
+	delete [] buffer_;
+	buffer_ = NULL;
+	values_ = NULL;
+	capacity_ = 0;
+	names_.clear();
+	index_.clear();
+}
+
+/*! \fn void VariableStorage::reset()
+ *
+ * Set all the variables to 0.
+ */
+void VariableStorage::reset() {
+	if (values_ != NULL)
+		memset(values_, 0, capacity_ * sizeof(double));
+}
+
+// Allocate a zeroed array of at least the given number of values starting on
+// a cache line boundary. Return its capacity (a whole number of cache lines).
+int VariableStorage::allocate(int capacity, char *&buffer, double *&values) {
+	const int per_line = CacheLineSize / sizeof(double);
+	capacity = (capacity + per_line - 1) & ~(per_line - 1);
+	buffer = new char[capacity * sizeof(double) + CacheLineSize];
+	values = (double*)(((size_t)buffer + CacheLineSize - 1) & ~(size_t)(CacheLineSize - 1));
+	memset(values, 0, capacity * sizeof(double));
+	return capacity;
+}
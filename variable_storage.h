@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2013 Thierry Crozat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: criezy01@gmail.com
+ */
+
+#ifndef variable_storage_h
+#define variable_storage_h
+
+#include "str.h"
+#include "strlist.h"
+#include "string_index.h"
+
+/*! \class VariableStorage
+ *
+ * Values of a set of named variables, stored in a single contiguous array
+ * aligned on a cache line. The variables are stored in the order in which
+ * they were added, so that the variables used by the same statements are
+ * next to each other.
+ *
+ * A ScriptParser can compile its script directly against a storage (see
+ * ScriptParser::parse()): its operators then read and write the values in
+ * place and nothing is copied when the script is evaluated. Several scripts
+ * can share the same storage. Adding variables may move the array, so the
+ * scripts using the storage need to be parsed again after add() or
+ * setNames().
+ *
+ * Example:
+ * \code
+	VariableStorage variables;
+	variables.setNames(parser.getVariablesList(script));
+	if (parser.parse(script, variables)) {
+		variables[variables.indexOf("x")] = 2.;
+		parser.evaluate();
+	}
+ * \endcode
+ */
+class VariableStorage {
+public:
+	VariableStorage();
+	~VariableStorage();
+
+	void setNames(const StringList&);
+	int add(const String&);
+	void clear();
+	void reset();
+
+	int size() const;
+	int indexOf(const String&) const;
+	const StringList &names() const;
+
+	double *values();
+	const double *values() const;
+	double &operator[](int);
+	double operator[](int) const;
+
+	enum { CacheLineSize = 64 };
+
+private:
+	// Not copyable: the compiled scripts keep pointers to the values.
+	VariableStorage(const VariableStorage&);
+	VariableStorage &operator=(const VariableStorage&);
+
+	static int allocate(int capacity, char *&buffer, double *&values);
+
+	StringList names_;
+	StringIndex index_;
+	char *buffer_;     // Allocated memory
+	double *values_;   // First cache line boundary in buffer_
+	int capacity_;     // Always a multiple of the number of values in a cache line
+};
+
+inline int VariableStorage::size() const {
+	return names_.size();
+}
+
+/*! \fn int VariableStorage::indexOf(const String &name) const
+ *
+ * Return the index of the given variable in the value array, or -1 if
+ * there is no such variable.
+ */
+inline int VariableStorage::indexOf(const String &name) const {
+	return index_.indexOf(name);
+}
+
+inline const StringList &VariableStorage::names() const {
+	return names_;
+}
+
+/*! \fn double *VariableStorage::values()
+ *
+ * Return the value array. It is NULL if there are no variables.
+ */
+inline double *VariableStorage::values() {
+	return values_;
+}
+
+inline const double *VariableStorage::values() const {
+	return values_;
+}
+
+inline double &VariableStorage::operator[](int index) {
+	return values_[index];
+}
+
+inline double VariableStorage::operator[](int index) const {
+	return values_[index];
+}
+
+#endif